@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Arguments of a subcommand, split into "--name value" options, "--flag" switches and
+/// positional values. Options are looked up by name without the leading dashes.
+class CommandLine
+{
+public:
+    CommandLine(int argc, char** argv);
+
+    bool HasFlag(const std::string& name) const;
+    std::string GetOption(const std::string& name, const std::string& defaultValue = "") const;
+    uint32_t GetOption(const std::string& name, uint32_t defaultValue) const;
+    float GetOption(const std::string& name, float defaultValue) const;
+
+    const std::vector<std::string>& GetPositional() const { return m_positional; }
+
+private:
+    std::vector<std::pair<std::string, std::string>> m_options;
+    std::vector<std::string> m_positional;
+};
+
+/// Entry point of a subcommand. Returns the process exit code; errors are reported by
+/// throwing, Main prints them.
+using CommandFunction = int (*)(const CommandLine& commandLine);
+
+struct Command
+{
+    const char* name;
+    const char* usage;
+    CommandFunction function;
+};
+
+// Texture commands
+int PackTexturesCommand(const CommandLine& commandLine);
+int PlanUploadCommand(const CommandLine& commandLine);
+int DedupTexturesCommand(const CommandLine& commandLine);
+int CompressTexturesCommand(const CommandLine& commandLine);
+int BenchDecodeCommand(const CommandLine& commandLine);
+int PrefilterEnvironmentCommand(const CommandLine& commandLine);
+int BenchPrefilterCommand(const CommandLine& commandLine);
+int ProjectSHCommand(const CommandLine& commandLine);
+int BenchSHCommand(const CommandLine& commandLine);
+int EnvironmentSampleCommand(const CommandLine& commandLine);
+int BenchSamplerCommand(const CommandLine& commandLine);
+int BenchSwizzleCommand(const CommandLine& commandLine);
+
+// BVH commands
+int BenchBvhCommand(const CommandLine& commandLine);
+int BenchSbvhCommand(const CommandLine& commandLine);
+int BenchLbvhCommand(const CommandLine& commandLine);
+int BenchBvh8Command(const CommandLine& commandLine);
+int BenchQbvhCommand(const CommandLine& commandLine);
+int BenchSceneCommand(const CommandLine& commandLine);
+int BenchTlasCommand(const CommandLine& commandLine);
+int BenchRefitCommand(const CommandLine& commandLine);
+int AnalyzeBvhCommand(const CommandLine& commandLine);
+int PlanASMemoryCommand(const CommandLine& commandLine);
+int PlanScratchCommand(const CommandLine& commandLine);
+int CheckASPoolCommand(const CommandLine& commandLine);
+int BenchInstancesCommand(const CommandLine& commandLine);
+int BenchDirtyInstancesCommand(const CommandLine& commandLine);
+int BenchBvhCacheCommand(const CommandLine& commandLine);
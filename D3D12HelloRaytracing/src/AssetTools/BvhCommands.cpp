@@ -0,0 +1,2894 @@
+#include "AssetTools.h"
+
+#include "ASMemoryEstimator.h"
+#include "ASMemoryPool.h"
+#include "Bvh.h"
+#include "Bvh8.h"
+#include "BvhCache.h"
+#include "BvhAnalyzer.h"
+#include "BvhBuilder.h"
+#include "BvhRefitter.h"
+#include "DirtyInstanceSet.h"
+#include "InstanceDescPacker.h"
+#include "LbvhBuilder.h"
+#include "Model.h"
+#include "QuantizedBvh8.h"
+#include "SceneBvh.h"
+#include "ScratchPlanner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    // Triangles of a benchmark scene: generated positions, or a model loaded the way the
+    // sample loads it
+    struct BenchMesh
+    {
+        std::string name;
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+        DXModel model;
+
+        BvhGeometry GetGeometry() const
+        {
+            BvhGeometry geometry;
+
+            if (!positions.empty())
+            {
+                geometry.positions = positions.data();
+                geometry.vertexCount = static_cast<uint32_t>(positions.size() / 3);
+                geometry.indices = indices.data();
+                geometry.indexCount = static_cast<uint32_t>(indices.size());
+            }
+            else
+            {
+                // Same buffers and stride AddBottomLevelGeometry hands to AddVertexBuffer
+                geometry.positions = &model.mesh.vertices[0].position.x;
+                geometry.vertexStride = sizeof(DXVertex);
+                geometry.vertexCount = static_cast<uint32_t>(model.mesh.vertices.size());
+                geometry.indices = model.mesh.indices.empty() ? nullptr : model.mesh.indices.data();
+                geometry.indexCount = static_cast<uint32_t>(model.mesh.indices.size());
+            }
+
+            return geometry;
+        }
+    };
+
+    bool IsInMengerSponge(uint32_t x, uint32_t y, uint32_t z)
+    {
+        for (; x > 0 || y > 0 || z > 0; x /= 3, y /= 3, z /= 3)
+        {
+            // Removed where two coordinates hit the middle third at the same scale
+            if ((x % 3 == 1) + (y % 3 == 1) + (z % 3 == 1) >= 2)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Menger sponge in [-1, 1]^3: the visible faces of the 20^level cubes, with vertices
+    // shared along the lattice. Level 5 has millions of small triangles in a very uneven
+    // distribution, a standard stress test for BVH builders.
+    void BuildMengerSponge(uint32_t level, BenchMesh& mesh)
+    {
+        if (level > 5)
+        {
+            throw std::runtime_error("Menger sponge levels above 5 do not fit in memory");
+        }
+
+        uint32_t cells = 1;
+
+        for (uint32_t i = 0; i < level; i++)
+        {
+            cells *= 3;
+        }
+
+        const size_t lattice = cells + 1;
+        std::vector<uint8_t> filled(static_cast<size_t>(cells) * cells * cells);
+        std::vector<uint32_t> vertexIndices(lattice * lattice * lattice, UINT32_MAX);
+
+        for (uint32_t z = 0; z < cells; z++)
+        {
+            for (uint32_t y = 0; y < cells; y++)
+            {
+                for (uint32_t x = 0; x < cells; x++)
+                {
+                    filled[(static_cast<size_t>(z) * cells + y) * cells + x] = IsInMengerSponge(x, y, z);
+                }
+            }
+        }
+
+        auto isFilled = [&](int64_t x, int64_t y, int64_t z)
+        {
+            return x >= 0 && y >= 0 && z >= 0 && x < cells && y < cells && z < cells &&
+                   filled[(static_cast<size_t>(z) * cells + y) * cells + x] != 0;
+        };
+
+        auto getVertex = [&](uint32_t x, uint32_t y, uint32_t z)
+        {
+            uint32_t& index = vertexIndices[(z * lattice + y) * lattice + x];
+
+            if (index == UINT32_MAX)
+            {
+                index = static_cast<uint32_t>(mesh.positions.size() / 3);
+                mesh.positions.push_back(2.0f * x / cells - 1.0f);
+                mesh.positions.push_back(2.0f * y / cells - 1.0f);
+                mesh.positions.push_back(2.0f * z / cells - 1.0f);
+            }
+
+            return index;
+        };
+
+        mesh.name = "menger-" + std::to_string(level);
+
+        for (uint32_t z = 0; z < cells; z++)
+        {
+            for (uint32_t y = 0; y < cells; y++)
+            {
+                for (uint32_t x = 0; x < cells; x++)
+                {
+                    if (!isFilled(x, y, z))
+                    {
+                        continue;
+                    }
+
+                    for (uint32_t axis = 0; axis < 3; axis++)
+                    {
+                        for (int32_t side = 0; side < 2; side++)
+                        {
+                            int64_t neighbor[3] = { x, y, z };
+                            neighbor[axis] += side ? 1 : -1;
+
+                            if (isFilled(neighbor[0], neighbor[1], neighbor[2]))
+                            {
+                                continue;
+                            }
+
+                            // Quad on the face plane, wound outwards
+                            const uint32_t u = (axis + 1) % 3;
+                            const uint32_t v = (axis + 2) % 3;
+                            const uint32_t corners[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+                            uint32_t quad[4];
+
+                            for (uint32_t corner = 0; corner < 4; corner++)
+                            {
+                                uint32_t position[3] = { x, y, z };
+                                position[axis] += side;
+                                position[u] += corners[side ? corner : 3 - corner][0];
+                                position[v] += corners[side ? corner : 3 - corner][1];
+                                quad[corner] = getVertex(position[0], position[1], position[2]);
+                            }
+
+                            mesh.indices.insert(mesh.indices.end(), { quad[0], quad[1], quad[2], quad[0], quad[2], quad[3] });
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void LoadModel(const std::string& path, BenchMesh& mesh)
+    {
+        mesh.name = path;
+        mesh.model.load(path);
+
+        if (mesh.model.mesh.vertices.empty())
+        {
+            throw std::runtime_error("Cannot load model " + path);
+        }
+    }
+
+    // Mesh building for the generated scenes, with an optional rotation about Y
+    struct MeshWriter
+    {
+        BenchMesh& mesh;
+        float cosine = 1.0f;
+        float sine = 0.0f;
+
+        uint32_t AddVertex(float x, float y, float z)
+        {
+            mesh.positions.insert(mesh.positions.end(), { cosine * x + sine * z, y, cosine * z - sine * x });
+            return static_cast<uint32_t>(mesh.positions.size() / 3 - 1);
+        }
+
+        // Rectangle spanned by two edges from a corner
+        void AddQuad(const float corner[3], const float edge1[3], const float edge2[3])
+        {
+            const uint32_t a = AddVertex(corner[0], corner[1], corner[2]);
+            const uint32_t b = AddVertex(corner[0] + edge1[0], corner[1] + edge1[1], corner[2] + edge1[2]);
+            const uint32_t c = AddVertex(corner[0] + edge1[0] + edge2[0], corner[1] + edge1[1] + edge2[1], corner[2] + edge1[2] + edge2[2]);
+            const uint32_t d = AddVertex(corner[0] + edge2[0], corner[1] + edge2[1], corner[2] + edge2[2]);
+
+            mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+        }
+
+        void AddBox(float x0, float y0, float z0, float x1, float y1, float z1)
+        {
+            const float dx[3] = { x1 - x0, 0.0f, 0.0f };
+            const float dy[3] = { 0.0f, y1 - y0, 0.0f };
+            const float dz[3] = { 0.0f, 0.0f, z1 - z0 };
+            const float low[3] = { x0, y0, z0 };
+            const float high[3] = { x1, y1, z1 };
+            const float minusX[3] = { -dx[0], 0.0f, 0.0f };
+            const float minusY[3] = { 0.0f, -dy[1], 0.0f };
+            const float minusZ[3] = { 0.0f, 0.0f, -dz[2] };
+
+            AddQuad(low, dy, dx);
+            AddQuad(low, dz, dy);
+            AddQuad(low, dx, dz);
+            AddQuad(high, minusX, minusY);
+            AddQuad(high, minusY, minusZ);
+            AddQuad(high, minusZ, minusX);
+        }
+    };
+
+    // What CreateAccelerationStructures instances, flattened into world space: the three
+    // triangles of CreateTriangleVB at a 16:9 aspect ratio, the plane of CreatePlaneVB and,
+    // when a path is given, the model scaled by 0.25 and moved by (0, -0.5, -0.3)
+    void BuildSampleScene(const std::string& modelPath, BenchMesh& mesh)
+    {
+        const float aspectRatio = 1280.0f / 720.0f;
+        const float triangle[3][3] = {
+            { -0.25f, -0.25f * aspectRatio, 0.0f }, { 0.25f, -0.25f * aspectRatio, 0.0f }, { 0.0f, 0.25f * aspectRatio, 0.0f } };
+        const float offsets[3] = { 0.0f, -0.6f, 0.6f };
+
+        mesh.name = "sample scene";
+
+        for (float offset : offsets)
+        {
+            for (const auto& vertex : triangle)
+            {
+                mesh.indices.push_back(static_cast<uint32_t>(mesh.positions.size() / 3));
+                mesh.positions.insert(mesh.positions.end(), { vertex[0] + offset, vertex[1], vertex[2] });
+            }
+        }
+
+        const float plane[6][3] = { { -1.5f, -0.8f, 1.5f }, { -1.5f, -0.8f, -1.5f }, { 1.5f, -0.8f, 1.5f },
+                                    { 1.5f, -0.8f, 1.5f },  { -1.5f, -0.8f, -1.5f }, { 1.5f, -0.8f, -1.5f } };
+
+        for (const auto& vertex : plane)
+        {
+            mesh.indices.push_back(static_cast<uint32_t>(mesh.positions.size() / 3));
+            mesh.positions.insert(mesh.positions.end(), vertex, vertex + 3);
+        }
+
+        if (!modelPath.empty())
+        {
+            BenchMesh model;
+            LoadModel(modelPath, model);
+
+            const uint32_t base = static_cast<uint32_t>(mesh.positions.size() / 3);
+
+            for (const auto& vertex : model.model.mesh.vertices)
+            {
+                mesh.positions.insert(mesh.positions.end(),
+                                      { vertex.position.x * 0.25f, vertex.position.y * 0.25f - 0.5f, vertex.position.z * 0.25f - 0.3f });
+            }
+
+            for (uint32_t index : model.model.mesh.indices)
+            {
+                mesh.indices.push_back(base + index);
+            }
+        }
+    }
+
+    // An office block turned 30 degrees about Y: floor slabs, full-length walls and
+    // ceiling pipes (long thin triangles across the whole building) around columns and
+    // furniture (many small boxes). The rotation puts the long triangles diagonally in
+    // their bounding boxes, the worst case for object splits.
+    void BuildArchitecturalScene(uint32_t floors, BenchMesh& mesh)
+    {
+        const float size = 60.0f;
+        const float room = 6.0f;
+        const float height = 3.0f;
+        const uint32_t rooms = static_cast<uint32_t>(size / room);
+
+        MeshWriter writer = { mesh, std::cos(0.5236f), std::sin(0.5236f) };
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        mesh.name = "architecture-" + std::to_string(floors);
+
+        for (uint32_t floor = 0; floor <= floors; floor++)
+        {
+            const float y = floor * height;
+            const float slab[3] = { 0.0f, y, 0.0f };
+            const float alongX[3] = { size, 0.0f, 0.0f };
+            const float alongZ[3] = { 0.0f, 0.0f, size };
+
+            writer.AddQuad(slab, alongZ, alongX);
+
+            if (floor == floors)
+            {
+                break;
+            }
+
+            const float up[3] = { 0.0f, height, 0.0f };
+
+            for (uint32_t wall = 0; wall <= rooms; wall++)
+            {
+                const float alongXStart[3] = { 0.0f, y, wall * room };
+                const float alongZStart[3] = { wall * room, y, 0.0f };
+
+                writer.AddQuad(alongXStart, alongX, up);
+                writer.AddQuad(alongZStart, alongZ, up);
+
+                for (uint32_t column = 0; column <= rooms; column++)
+                {
+                    writer.AddBox(wall * room - 0.2f, y, column * room - 0.2f, wall * room + 0.2f, y + height, column * room + 0.2f);
+                }
+
+                writer.AddBox(0.0f, y + height - 0.3f, wall * room + 0.5f, size, y + height - 0.2f, wall * room + 0.6f);
+            }
+
+            for (uint32_t roomZ = 0; roomZ < rooms; roomZ++)
+            {
+                for (uint32_t roomX = 0; roomX < rooms; roomX++)
+                {
+                    for (uint32_t item = 0; item < 8; item++)
+                    {
+                        const float width = 0.3f + 1.2f * uniform(generator);
+                        const float depth = 0.3f + 1.2f * uniform(generator);
+                        const float x = roomX * room + 0.3f + (room - 0.6f - width) * uniform(generator);
+                        const float z = roomZ * room + 0.3f + (room - 0.6f - depth) * uniform(generator);
+
+                        writer.AddBox(x, y, z, x + width, y + 0.4f + 1.2f * uniform(generator), z + depth);
+                    }
+                }
+            }
+        }
+    }
+
+    // Generated scene first, then the models on the command line
+    // A mesh with a viewpoint for camera rays and a point light for shadow rays
+    struct BenchScene
+    {
+        BenchMesh mesh;
+        float eye[3];
+        float target[3];
+        float light[3];
+    };
+
+    // The sample's scene (with a model if one is given) from the sample's camera, lit by
+    // the light Hit.hlsl uses, and the office block from its second floor
+    std::vector<std::unique_ptr<BenchScene>> LoadBenchScenes(const CommandLine& commandLine, uint32_t defaultFloors)
+    {
+        const auto& positional = commandLine.GetPositional();
+        std::vector<std::unique_ptr<BenchScene>> scenes;
+
+        scenes.emplace_back(new BenchScene{ BenchMesh(), { 0.0f, 0.25f, -3.0f }, { 0.0f, 0.25f, 0.0f }, { 2.0f, 2.0f, -2.0f } });
+        BuildSampleScene(positional.empty() ? std::string() : positional[0], scenes.back()->mesh);
+
+        // Looking along the building's diagonal, with a ceiling light a few rooms ahead
+        const float cosine = std::cos(0.5236f);
+        const float sine = std::sin(0.5236f);
+        scenes.emplace_back(new BenchScene{ BenchMesh(),
+                                            { cosine * 2.0f + sine * 2.0f, 4.6f, cosine * 2.0f - sine * 2.0f },
+                                            { cosine * 58.0f + sine * 58.0f, 4.0f, cosine * 58.0f - sine * 58.0f },
+                                            { cosine * 8.0f + sine * 9.0f, 5.7f, cosine * 9.0f - sine * 8.0f } });
+        BuildArchitecturalScene(commandLine.GetOption("floors", defaultFloors), scenes.back()->mesh);
+
+        return scenes;
+    }
+
+    std::vector<std::unique_ptr<BenchMesh>> LoadBenchMeshes(const CommandLine& commandLine)
+    {
+        std::vector<std::unique_ptr<BenchMesh>> meshes;
+
+        meshes.emplace_back(new BenchMesh());
+        BuildMengerSponge(commandLine.GetOption("level", 5u), *meshes.back());
+
+        for (const auto& path : commandLine.GetPositional())
+        {
+            meshes.emplace_back(new BenchMesh());
+            LoadModel(path, *meshes.back());
+        }
+
+        return meshes;
+    }
+
+    // Throw unless every triangle is in exactly one leaf and every node bounds what is
+    // below it. With spatial splits a triangle may be in several leaves, each holding
+    // only part of it.
+    void CheckBvh(const Bvh& bvh, const BvhGeometry& geometry, bool spatialSplits = false)
+    {
+        const auto& nodes = bvh.GetNodes();
+        const auto& primitives = bvh.GetPrimitiveIndices();
+        std::vector<uint32_t> references(geometry.GetTriangleCount());
+        std::vector<uint32_t> stack(nodes.empty() ? 0 : 1, 0);
+
+        auto contains = [](const BvhNode& node, const float* point)
+        {
+            return point[0] >= node.boundsMin[0] && point[1] >= node.boundsMin[1] && point[2] >= node.boundsMin[2] &&
+                   point[0] <= node.boundsMax[0] && point[1] <= node.boundsMax[1] && point[2] <= node.boundsMax[2];
+        };
+
+        while (!stack.empty())
+        {
+            const BvhNode& node = nodes[stack.back()];
+            stack.pop_back();
+
+            if (!node.IsLeaf())
+            {
+                for (uint32_t child = node.offset; child < node.offset + 2; child++)
+                {
+                    if (child >= nodes.size() || !contains(node, nodes[child].boundsMin) || !contains(node, nodes[child].boundsMax))
+                    {
+                        throw std::runtime_error("BVH node " + std::to_string(child) + " is out of its parent");
+                    }
+
+                    stack.push_back(child);
+                }
+
+                continue;
+            }
+
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+            {
+                const float* corners[3];
+                geometry.GetTriangle(primitives[i], corners);
+
+                BvhBounds bounds;
+                bounds.Grow(corners[0]);
+                bounds.Grow(corners[1]);
+                bounds.Grow(corners[2]);
+
+                const bool inside = spatialSplits ? bounds.min[0] <= node.boundsMax[0] && bounds.min[1] <= node.boundsMax[1] &&
+                                                        bounds.min[2] <= node.boundsMax[2] && bounds.max[0] >= node.boundsMin[0] &&
+                                                        bounds.max[1] >= node.boundsMin[1] && bounds.max[2] >= node.boundsMin[2]
+                                                  : contains(node, bounds.min) && contains(node, bounds.max);
+
+                if (!inside)
+                {
+                    throw std::runtime_error("Triangle " + std::to_string(primitives[i]) + " is out of its leaf");
+                }
+
+                references[primitives[i]]++;
+            }
+        }
+
+        for (uint32_t triangle = 0; triangle < references.size(); triangle++)
+        {
+            if (references[triangle] == 0 || (references[triangle] > 1 && !spatialSplits))
+            {
+                throw std::runtime_error("Triangle " + std::to_string(triangle) + " is in " + std::to_string(references[triangle]) + " leaves");
+            }
+        }
+    }
+
+    // Pinhole camera rays through the pixel centers, left-handed like the sample's view
+    void GetCameraRays(const float eye[3], const float target[3], uint32_t width, uint32_t height, std::vector<BvhRay>& rays)
+    {
+        float forward[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+        const float forwardLength = std::sqrt(forward[0] * forward[0] + forward[1] * forward[1] + forward[2] * forward[2]);
+
+        for (float& value : forward)
+        {
+            value /= forwardLength;
+        }
+
+        // right = up x forward with up = +Y, then the true up
+        float right[3] = { forward[2], 0.0f, -forward[0] };
+        const float rightLength = std::sqrt(right[0] * right[0] + right[2] * right[2]);
+        right[0] /= rightLength;
+        right[2] /= rightLength;
+
+        const float up[3] = { forward[1] * right[2] - forward[2] * right[1], forward[2] * right[0] - forward[0] * right[2],
+                              forward[0] * right[1] - forward[1] * right[0] };
+
+        // 45 degrees vertically, as in the sample's projection
+        const float tanHalfFov = std::tan(0.5f * 45.0f * 3.14159265f / 180.0f);
+        const float aspectRatio = static_cast<float>(width) / height;
+
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                const float u = (2.0f * (x + 0.5f) / width - 1.0f) * tanHalfFov * aspectRatio;
+                const float v = (1.0f - 2.0f * (y + 0.5f) / height) * tanHalfFov;
+
+                BvhRay ray;
+                std::copy(eye, eye + 3, ray.origin);
+
+                for (uint32_t axis = 0; axis < 3; axis++)
+                {
+                    ray.direction[axis] = forward[axis] + u * right[axis] + v * up[axis];
+                }
+
+                ray.tMin = 0.0f;
+                ray.tMax = 100000.0f;
+                rays.push_back(ray);
+            }
+        }
+    }
+
+    // Incoherent rays, like ambient occlusion or diffuse bounces: uniform origins in the
+    // scene bounds and uniform directions
+    void GetRandomRays(const BvhBounds& bounds, uint32_t count, std::vector<BvhRay>& rays)
+    {
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            BvhRay ray;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                ray.origin[axis] = bounds.min[axis] + (bounds.max[axis] - bounds.min[axis]) * uniform(generator);
+            }
+
+            const float z = 2.0f * uniform(generator) - 1.0f;
+            const float phi = 2.0f * 3.14159265f * uniform(generator);
+            const float radius = std::sqrt((std::max)(0.0f, 1.0f - z * z));
+
+            ray.direction[0] = radius * std::cos(phi);
+            ray.direction[1] = radius * std::sin(phi);
+            ray.direction[2] = z;
+            ray.tMin = 0.0f;
+            ray.tMax = 100000.0f;
+            rays.push_back(ray);
+        }
+    }
+
+    // Closest hits of every ray through a Bvh or Bvh8, single-threaded, returning the
+    // seconds taken
+    template <typename Hierarchy>
+    double TraceRays(const Hierarchy& bvh, const BvhGeometry& geometry, const std::vector<BvhRay>& rays, std::vector<BvhHit>& hits,
+                     BvhTraversalStats& stats)
+    {
+        hits.resize(rays.size());
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            bvh.Intersect(geometry, rays[i], hits[i], &stats);
+        }
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // An ASMemoryPool with the allocations it should hold, to check it against after
+    // every operation
+    struct PoolModel
+    {
+        ASMemoryPool pool;
+        std::map<uint32_t, ASAllocation> allocations;
+        std::vector<ASRelocation> pending;
+
+        void Check() const
+        {
+            pool.Validate();
+
+            std::vector<std::vector<std::pair<uint64_t, uint64_t>>> ranges(pool.GetHeapCount());
+
+            for (const auto& entry : allocations)
+            {
+                const ASAllocation allocation = pool.GetAllocation(entry.first);
+                const ASAllocation& expected = entry.second;
+
+                if (allocation.id != expected.id || allocation.heap != expected.heap || allocation.offset != expected.offset ||
+                    allocation.size != expected.size)
+                {
+                    throw std::logic_error("AS allocation " + std::to_string(entry.first) + " moved or changed");
+                }
+
+                if (allocation.offset % ASMemoryPool::Alignment != 0 || allocation.offset + allocation.size > pool.GetHeapSize(allocation.heap))
+                {
+                    throw std::logic_error("AS allocation " + std::to_string(entry.first) + " is misaligned or outside its heap");
+                }
+
+                ranges[allocation.heap].emplace_back(allocation.offset, allocation.offset + allocation.size);
+            }
+
+            // Ranges reserved for pending moves must not overlap anything either
+            for (const ASRelocation& relocation : pending)
+            {
+                ranges[relocation.destinationHeap].emplace_back(relocation.destinationOffset, relocation.destinationOffset + relocation.size);
+            }
+
+            for (auto& heapRanges : ranges)
+            {
+                std::sort(heapRanges.begin(), heapRanges.end());
+
+                for (size_t i = 1; i < heapRanges.size(); i++)
+                {
+                    if (heapRanges[i].first < heapRanges[i - 1].second)
+                    {
+                        throw std::logic_error("AS allocations overlap");
+                    }
+                }
+            }
+        }
+
+        void Allocate(uint64_t size)
+        {
+            const ASPoolStats before = pool.GetStats();
+            const ASAllocation allocation = pool.Allocate(size);
+            const uint64_t aligned = (std::max)(ASMemoryPool::Alignment, (size + ASMemoryPool::Alignment - 1) & ~(ASMemoryPool::Alignment - 1));
+
+            if (!allocation.IsValid() || allocation.size != aligned || allocations.count(allocation.id) > 0)
+            {
+                throw std::logic_error("Bad AS allocation of " + std::to_string(size) + " bytes");
+            }
+
+            // Good fit: rounding a request up to its class adds less than a sixteenth, so a
+            // free block that much larger is always found. Free blocks of a heap being
+            // emptied do not count.
+            if (pending.empty() && pool.GetStats().heaps > before.heaps && before.largestFreeBlock >= aligned + aligned / 16)
+            {
+                throw std::logic_error("New heap for " + std::to_string(aligned) + " bytes with a free block of " +
+                                       std::to_string(before.largestFreeBlock));
+            }
+
+            allocations[allocation.id] = allocation;
+        }
+
+        void Free(uint32_t id)
+        {
+            pool.Free(id);
+            allocations.erase(id);
+            pending = pool.GetPendingRelocations();
+        }
+
+        void PlanDefragmentation(uint64_t maxBytes = 0)
+        {
+            pending = pool.PlanDefragmentation(maxBytes);
+
+            for (const ASRelocation& relocation : pending)
+            {
+                const ASAllocation& source = allocations.at(relocation.id);
+
+                if (relocation.sourceHeap != source.heap || relocation.sourceOffset != source.offset || relocation.size != source.size ||
+                    relocation.destinationHeap == source.heap)
+                {
+                    throw std::logic_error("AS relocation of " + std::to_string(relocation.id) + " does not match its allocation");
+                }
+            }
+        }
+
+        // Returns the bytes moved
+        uint64_t CompleteDefragmentation()
+        {
+            pool.CompleteDefragmentation();
+            uint64_t moved = 0;
+
+            for (const ASRelocation& relocation : pending)
+            {
+                ASAllocation& allocation = allocations.at(relocation.id);
+                allocation.heap = relocation.destinationHeap;
+                allocation.offset = relocation.destinationOffset;
+                moved += relocation.size;
+            }
+
+            pending.clear();
+
+            for (uint32_t heap : pool.ReleaseEmptyHeaps())
+            {
+                for (const auto& entry : allocations)
+                {
+                    if (entry.second.heap == heap)
+                    {
+                        throw std::logic_error("Released an AS heap still holding allocations");
+                    }
+                }
+            }
+
+            return moved;
+        }
+    };
+
+    // Every sequence of up to depth operations on a pool of tiny heaps: allocations of a
+    // few sizes, including one larger than a heap, freeing each live allocation, and
+    // planning or completing a defragmentation. Returns the number of sequences.
+    uint64_t CheckPoolSequences(const PoolModel& model, uint32_t depth)
+    {
+        static const uint64_t sizes[] = { 1, 256, 300, 700, 1300, 2100 };
+
+        uint64_t sequences = 1;
+
+        if (depth == 0)
+        {
+            return sequences;
+        }
+
+        auto run = [&](const std::function<void(PoolModel&)>& operation)
+        {
+            PoolModel next = model;
+            operation(next);
+            next.Check();
+            sequences += CheckPoolSequences(next, depth - 1);
+        };
+
+        for (uint64_t size : sizes)
+        {
+            run([size](PoolModel& next) { next.Allocate(size); });
+        }
+
+        for (const auto& entry : model.allocations)
+        {
+            const uint32_t id = entry.first;
+            run([id](PoolModel& next) { next.Free(id); });
+        }
+
+        if (model.pending.empty())
+        {
+            run([](PoolModel& next) { next.PlanDefragmentation(); });
+        }
+        else
+        {
+            run([](PoolModel& next) { next.CompleteDefragmentation(); });
+        }
+
+        return sequences;
+    }
+
+    // D3D12_RAYTRACING_INSTANCE_DESC with its bit fields, for the loop
+    // TopLevelASGenerator::Generate used before InstanceDescPacker
+    struct ReferenceInstanceDesc
+    {
+        float Transform[3][4];
+        uint32_t InstanceID : 24;
+        uint32_t InstanceMask : 8;
+        uint32_t InstanceContributionToHitGroupIndex : 24;
+        uint32_t Flags : 8;
+        uint64_t AccelerationStructure;
+    };
+
+    void PackInstancesReference(const InstanceDescSource& source, uint32_t count, ReferenceInstanceDesc* descs)
+    {
+        memset(descs, 0, sizeof(ReferenceInstanceDesc) * count);
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            descs[i].InstanceID = source.instanceIds[i];
+            descs[i].InstanceContributionToHitGroupIndex = source.hitGroupOffsets[i];
+            descs[i].Flags = source.flags[i];
+
+            // XMMatrixTranspose into a temporary, then the first three rows
+            const float* matrix = source.transforms + static_cast<size_t>(i) * 16;
+            float transposed[4][4];
+
+            for (uint32_t row = 0; row < 4; row++)
+            {
+                for (uint32_t column = 0; column < 4; column++)
+                {
+                    transposed[row][column] = matrix[column * 4 + row];
+                }
+            }
+
+            memcpy(descs[i].Transform, transposed, sizeof(descs[i].Transform));
+            descs[i].AccelerationStructure = source.accelerationStructures[i];
+            descs[i].InstanceMask = source.masks[i];
+        }
+    }
+
+    BvhBuilder::Settings GetBvhSettings(const CommandLine& commandLine)
+    {
+        BvhBuilder::Settings settings;
+        settings.binCount = commandLine.GetOption("bins", settings.binCount);
+        settings.maxLeafSize = commandLine.GetOption("leaf-size", settings.maxLeafSize);
+        settings.threads = commandLine.GetOption("threads", settings.threads);
+        settings.spatialSplitOverlap = commandLine.GetOption("alpha", settings.spatialSplitOverlap);
+        settings.duplicationBudget = commandLine.GetOption("budget", settings.duplicationBudget);
+        return settings;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-bvh [--level N] [--bins N] [--leaf-size N] [--threads N] [--iterations N] [<model.obj>...]
+//
+// Without --bins, every mesh is built with 16 and with 32 bins
+//
+int BenchBvhCommand(const CommandLine& commandLine)
+{
+    const uint32_t iterations = (std::max)(1u, commandLine.GetOption("iterations", 3u));
+    const auto meshes = LoadBenchMeshes(commandLine);
+
+    std::vector<uint32_t> binCounts = { 16, 32 };
+
+    if (!commandLine.GetOption("bins").empty())
+    {
+        binCounts = { GetBvhSettings(commandLine).binCount };
+    }
+
+    for (const auto& mesh : meshes)
+    {
+        const BvhGeometry geometry = mesh->GetGeometry();
+
+        printf("%s: %u triangles, %u vertices\n", mesh->name.c_str(), geometry.GetTriangleCount(), geometry.vertexCount);
+
+        for (uint32_t binCount : binCounts)
+        {
+            BvhBuilder::Settings settings = GetBvhSettings(commandLine);
+            settings.binCount = binCount;
+
+            BvhBuilder builder(settings);
+            Bvh bvh;
+            double bestSeconds = 1e30;
+
+            for (uint32_t i = 0; i < iterations; i++)
+            {
+                builder.Build(geometry, bvh);
+                bestSeconds = (std::min)(bestSeconds, builder.GetStats().seconds);
+            }
+
+            CheckBvh(bvh, geometry);
+
+            const BvhBuilder::Stats& stats = builder.GetStats();
+
+            printf("  %2u bins: %8.1f ms  %6.2f Mtris/s  SAH %7.2f  %u nodes, %u leaves, depth %u, %u tasks, %.1f MB\n",
+                   binCount, bestSeconds * 1000.0, stats.triangles / bestSeconds * 1e-6, bvh.GetSahCost(settings.traversalCost, settings.intersectionCost),
+                   stats.nodes, stats.leaves, stats.maxDepth, stats.tasks, bvh.GetMemorySize() / (1024.0 * 1024.0));
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-sbvh [--floors N] [--budget F] [--alpha F] [--bins N] [--leaf-size N] [--threads N]
+//            [--width N] [--height N] [--rays N] [<model.obj>]
+//
+// Builds the sample's scene (with the model if given) and a generated office block with
+// object splits only and with spatial splits, then traces camera and random rays through
+// both and checks that they find the same hits
+//
+int BenchSbvhCommand(const CommandLine& commandLine)
+{
+    const uint32_t width = commandLine.GetOption("width", 640u);
+    const uint32_t height = commandLine.GetOption("height", 360u);
+    const uint32_t randomRayCount = commandLine.GetOption("rays", 200000u);
+    const auto scenes = LoadBenchScenes(commandLine, 20);
+
+    for (const auto& scene : scenes)
+    {
+        const BvhGeometry geometry = scene->mesh.GetGeometry();
+
+        printf("%s: %u triangles\n", scene->mesh.name.c_str(), geometry.GetTriangleCount());
+
+        std::vector<BvhRay> cameraRays;
+        GetCameraRays(scene->eye, scene->target, width, height, cameraRays);
+
+        std::vector<BvhHit> referenceHits[2];
+
+        for (uint32_t spatial = 0; spatial < 2; spatial++)
+        {
+            BvhBuilder::Settings settings = GetBvhSettings(commandLine);
+            settings.spatialSplits = spatial != 0;
+
+            BvhBuilder builder(settings);
+            Bvh bvh;
+            builder.Build(geometry, bvh);
+            CheckBvh(bvh, geometry, settings.spatialSplits);
+
+            const BvhBuilder::Stats& stats = builder.GetStats();
+
+            std::vector<BvhRay> randomRays;
+            GetRandomRays(bvh.GetBounds(), randomRayCount, randomRays);
+
+            printf("  %-7s  build %7.1f ms  %u references (+%.1f%%, %u spatial splits)  SAH %6.2f  %.2f MB\n", spatial ? "spatial" : "object",
+                   stats.seconds * 1000.0, stats.references, 100.0 * (stats.references - stats.triangles) / stats.triangles, stats.spatialSplits,
+                   bvh.GetSahCost(settings.traversalCost, settings.intersectionCost), bvh.GetMemorySize() / (1024.0 * 1024.0));
+
+            const std::vector<BvhRay>* rayLists[2] = { &cameraRays, &randomRays };
+            const char* rayNames[2] = { "camera", "random" };
+
+            for (uint32_t list = 0; list < 2; list++)
+            {
+                const auto& rays = *rayLists[list];
+                BvhTraversalStats traversal;
+                std::vector<BvhHit> hits;
+                const double seconds = TraceRays(bvh, geometry, rays, hits, traversal);
+                uint32_t mismatches = 0;
+
+                if (spatial == 0)
+                {
+                    referenceHits[list] = hits;
+                }
+                else
+                {
+                    // Ties between triangles at the same distance may resolve differently,
+                    // so compare distances rather than primitives
+                    for (size_t i = 0; i < hits.size(); i++)
+                    {
+                        const BvhHit& reference = referenceHits[list][i];
+
+                        if (hits[i].IsHit() != reference.IsHit() || std::fabs(hits[i].t - reference.t) > 1e-4f * (std::max)(1.0f, reference.t))
+                        {
+                            mismatches++;
+                        }
+                    }
+                }
+
+                printf("    %s: %8.3f Mrays/s  %6.1f nodes  %6.1f triangles per ray", rayNames[list], rays.size() / seconds * 1e-6,
+                       static_cast<double>(traversal.nodes) / rays.size(), static_cast<double>(traversal.triangles) / rays.size());
+                printf(spatial ? "  %u of %zu hits differ from object splits\n" : "\n", mismatches, rays.size());
+            }
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-lbvh [--level N] [--leaf-size N] [--treelet-passes N] [--threads N] [--iterations N]
+//            [--rays N] [--wide] [<model.obj>...]
+//
+// Builds every mesh with the linear builder, without and with treelet restructuring,
+// and with the binned SAH builder for reference. Build times are the best of the
+// iterations, which reuse the builder as a per-frame rebuild would.
+//
+int BenchLbvhCommand(const CommandLine& commandLine)
+{
+    const uint32_t iterations = (std::max)(1u, commandLine.GetOption("iterations", 3u));
+    const uint32_t rayCount = commandLine.GetOption("rays", 100000u);
+    const auto meshes = LoadBenchMeshes(commandLine);
+
+    LbvhBuilder::Settings lbvhSettings;
+    lbvhSettings.wideMortonCodes = commandLine.HasFlag("wide");
+    lbvhSettings.maxLeafSize = commandLine.GetOption("leaf-size", lbvhSettings.maxLeafSize);
+    lbvhSettings.threads = commandLine.GetOption("threads", lbvhSettings.threads);
+
+    const uint32_t treeletPasses[2] = { 0, commandLine.GetOption("treelet-passes", 3u) };
+
+    for (const auto& mesh : meshes)
+    {
+        const BvhGeometry geometry = mesh->GetGeometry();
+
+        printf("%s: %u triangles, %u vertices\n", mesh->name.c_str(), geometry.GetTriangleCount(), geometry.vertexCount);
+
+        std::vector<BvhRay> rays;
+
+        for (uint32_t builderIndex = 0; builderIndex < 3; builderIndex++)
+        {
+            Bvh bvh;
+            double bestSeconds = 1e30;
+            char name[32];
+
+            if (builderIndex < 2)
+            {
+                lbvhSettings.treeletPasses = treeletPasses[builderIndex];
+                LbvhBuilder builder(lbvhSettings);
+                LbvhBuilder::Stats bestStats;
+
+                for (uint32_t i = 0; i < iterations; i++)
+                {
+                    builder.Build(geometry, bvh);
+
+                    if (builder.GetStats().seconds < bestSeconds)
+                    {
+                        bestSeconds = builder.GetStats().seconds;
+                        bestStats = builder.GetStats();
+                    }
+                }
+
+                snprintf(name, sizeof(name), "lbvh, %u treelet passes", lbvhSettings.treeletPasses);
+                printf("  %-24s %8.1f ms  %7.2f Mtris/s  (codes %.1f, sort %.1f, hierarchy %.1f, bounds %.1f, treelets %.1f, output %.1f ms; %u threads)\n",
+                       name, bestSeconds * 1000.0, bestStats.triangles / bestSeconds * 1e-6, bestStats.mortonSeconds * 1000.0,
+                       bestStats.sortSeconds * 1000.0, bestStats.hierarchySeconds * 1000.0, bestStats.boundsSeconds * 1000.0,
+                       bestStats.treeletSeconds * 1000.0, bestStats.outputSeconds * 1000.0, bestStats.threads);
+                printf("  %-24s %u nodes, %u leaves, depth %u, %u treelets restructured\n", "", bestStats.nodes, bestStats.leaves,
+                       bestStats.maxDepth, bestStats.treeletsRestructured);
+            }
+            else
+            {
+                BvhBuilder::Settings settings;
+                settings.maxLeafSize = lbvhSettings.maxLeafSize;
+                settings.threads = lbvhSettings.threads;
+                BvhBuilder builder(settings);
+
+                for (uint32_t i = 0; i < iterations; i++)
+                {
+                    builder.Build(geometry, bvh);
+                    bestSeconds = (std::min)(bestSeconds, builder.GetStats().seconds);
+                }
+
+                snprintf(name, sizeof(name), "binned SAH, %u bins", settings.binCount);
+                printf("  %-24s %8.1f ms  %7.2f Mtris/s\n", name, bestSeconds * 1000.0, geometry.GetTriangleCount() / bestSeconds * 1e-6);
+            }
+
+            CheckBvh(bvh, geometry);
+
+            if (rays.empty())
+            {
+                GetRandomRays(bvh.GetBounds(), rayCount, rays);
+            }
+
+            BvhTraversalStats traversal;
+            std::vector<BvhHit> hits;
+            const double seconds = TraceRays(bvh, geometry, rays, hits, traversal);
+
+            printf("  %-24s SAH %7.2f  random rays %6.3f Mrays/s, %6.1f nodes, %5.1f triangles per ray\n", "",
+                   bvh.GetSahCost(lbvhSettings.traversalCost, lbvhSettings.intersectionCost), rays.size() / seconds * 1e-6,
+                   static_cast<double>(traversal.nodes) / rays.size(), static_cast<double>(traversal.triangles) / rays.size());
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-bvh8 [--floors N] [--level N] [--leaf-size N] [--width N] [--height N] [<model.obj>]
+//
+// Collapses binned SAH BVHs of the bench-sbvh scenes and of a Menger sponge to eight-wide
+// ones and traces the rays Hit.hlsl traces through both: primary rays from the camera,
+// then from every primary hit a shadow ray to the light and a mirror reflection. The
+// normal is the triangle's, as BvhGeometry has no vertex normals.
+//
+int BenchBvh8Command(const CommandLine& commandLine)
+{
+    const uint32_t width = commandLine.GetOption("width", 640u);
+    const uint32_t height = commandLine.GetOption("height", 360u);
+
+    auto scenes = LoadBenchScenes(commandLine, 10);
+
+    // Seen from the front, above and to the side, so that rays pass through the holes
+    scenes.emplace_back(new BenchScene());
+    BenchScene& sponge = *scenes.back();
+    BuildMengerSponge(commandLine.GetOption("level", 4u), sponge.mesh);
+
+    BvhBounds spongeBounds;
+
+    for (size_t i = 0; i < sponge.mesh.positions.size(); i += 3)
+    {
+        spongeBounds.Grow(&sponge.mesh.positions[i]);
+    }
+
+    const float spongeSize = spongeBounds.max[0] - spongeBounds.min[0];
+    const float eyeOffset[3] = { 0.35f, 0.45f, -1.6f };
+    const float lightOffset[3] = { 1.0f, 1.2f, -0.8f };
+
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        sponge.target[axis] = spongeBounds.GetCenter(axis);
+        sponge.eye[axis] = sponge.target[axis] + eyeOffset[axis] * spongeSize;
+        sponge.light[axis] = sponge.target[axis] + lightOffset[axis] * spongeSize;
+    }
+
+    for (const auto& scene : scenes)
+    {
+        const BvhGeometry geometry = scene->mesh.GetGeometry();
+
+        BvhBuilder::Settings settings = GetBvhSettings(commandLine);
+        BvhBuilder builder(settings);
+        Bvh bvh;
+        builder.Build(geometry, bvh);
+        CheckBvh(bvh, geometry);
+
+        Bvh8 wideBvh;
+        wideBvh.Collapse(bvh);
+
+        uint32_t usedLanes = 0;
+
+        for (const Bvh8Node& node : wideBvh.GetNodes())
+        {
+            for (uint32_t lane = 0; lane < Bvh8Node::Width; lane++)
+            {
+                usedLanes += node.boundsMin[0][lane] <= node.boundsMax[0][lane] ? 1 : 0;
+            }
+        }
+
+        printf("%s: %u triangles, %zu binary nodes (%.1f MB), %zu wide nodes (%.1f MB, %.1f children each)\n", scene->mesh.name.c_str(),
+               geometry.GetTriangleCount(), bvh.GetNodes().size(), bvh.GetMemorySize() / (1024.0 * 1024.0), wideBvh.GetNodes().size(),
+               wideBvh.GetMemorySize() / (1024.0 * 1024.0), static_cast<double>(usedLanes) / wideBvh.GetNodes().size());
+
+        std::vector<BvhRay> primaryRays;
+        GetCameraRays(scene->eye, scene->target, width, height, primaryRays);
+
+        std::vector<BvhHit> primaryHits;
+        BvhTraversalStats unused;
+        TraceRays(bvh, geometry, primaryRays, primaryHits, unused);
+
+        // TMin 0.01 as in Hit.hlsl, for scenes the size of the sample's
+        const BvhBounds bounds = bvh.GetBounds();
+        const float extent[3] = { bounds.max[0] - bounds.min[0], bounds.max[1] - bounds.min[1], bounds.max[2] - bounds.min[2] };
+        const float tMin = 0.01f * (std::max)(1.0f, std::sqrt(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]) / 4.0f);
+
+        std::vector<BvhRay> shadowRays;
+        std::vector<BvhRay> reflectionRays;
+
+        for (size_t i = 0; i < primaryRays.size(); i++)
+        {
+            if (!primaryHits[i].IsHit())
+            {
+                continue;
+            }
+
+            const BvhRay& ray = primaryRays[i];
+            const float* corners[3];
+            geometry.GetTriangle(primaryHits[i].primitiveIndex, corners);
+
+            const float edge1[3] = { corners[1][0] - corners[0][0], corners[1][1] - corners[0][1], corners[1][2] - corners[0][2] };
+            const float edge2[3] = { corners[2][0] - corners[0][0], corners[2][1] - corners[0][1], corners[2][2] - corners[0][2] };
+            float normal[3] = { edge1[1] * edge2[2] - edge1[2] * edge2[1], edge1[2] * edge2[0] - edge1[0] * edge2[2],
+                                edge1[0] * edge2[1] - edge1[1] * edge2[0] };
+            const float normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+            const float directionDotNormal = (ray.direction[0] * normal[0] + ray.direction[1] * normal[1] + ray.direction[2] * normal[2]) /
+                                             (normalLength * normalLength);
+
+            BvhRay shadow;
+            BvhRay reflection;
+            float lightDistance = 0.0f;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                shadow.origin[axis] = ray.origin[axis] + primaryHits[i].t * ray.direction[axis];
+                shadow.direction[axis] = scene->light[axis] - shadow.origin[axis];
+                lightDistance += shadow.direction[axis] * shadow.direction[axis];
+
+                // reflect(d, n) = d - 2 dot(d, n) n
+                reflection.origin[axis] = shadow.origin[axis];
+                reflection.direction[axis] = ray.direction[axis] - 2.0f * directionDotNormal * normal[axis];
+            }
+
+            for (float& component : shadow.direction)
+            {
+                component /= std::sqrt(lightDistance);
+            }
+
+            shadow.tMin = tMin;
+            shadow.tMax = 100000.0f;
+            reflection.tMin = tMin;
+            reflection.tMax = 100000.0f;
+            shadowRays.push_back(shadow);
+            reflectionRays.push_back(reflection);
+        }
+
+        const std::vector<BvhRay>* rayLists[3] = { &primaryRays, &shadowRays, &reflectionRays };
+        const char* rayNames[3] = { "primary", "shadow", "reflection" };
+
+        for (uint32_t list = 0; list < 3; list++)
+        {
+            const auto& rays = *rayLists[list];
+
+            if (rays.empty())
+            {
+                continue;
+            }
+
+            std::vector<BvhHit> hits[2];
+            BvhTraversalStats traversal[2];
+            double seconds[2];
+
+            if (list == 1)
+            {
+                // Any hit, as ShadowRay traces them
+                for (uint32_t wide = 0; wide < 2; wide++)
+                {
+                    hits[wide].resize(rays.size());
+                    const auto start = std::chrono::steady_clock::now();
+
+                    for (size_t i = 0; i < rays.size(); i++)
+                    {
+                        const bool occluded = wide ? wideBvh.IsOccluded(geometry, rays[i], &traversal[wide])
+                                                   : bvh.IsOccluded(geometry, rays[i], &traversal[wide]);
+                        hits[wide][i].primitiveIndex = occluded ? 0 : BvhHit::NoHit;
+                    }
+
+                    seconds[wide] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                }
+            }
+            else
+            {
+                seconds[0] = TraceRays(bvh, geometry, rays, hits[0], traversal[0]);
+                seconds[1] = TraceRays(wideBvh, geometry, rays, hits[1], traversal[1]);
+            }
+
+            // Ties between triangles at the same distance may resolve differently, so
+            // compare distances rather than primitives
+            uint32_t mismatches = 0;
+
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                if (hits[0][i].IsHit() != hits[1][i].IsHit() || (list != 1 && std::fabs(hits[0][i].t - hits[1][i].t) > 1e-4f * (std::max)(1.0f, hits[0][i].t)))
+                {
+                    mismatches++;
+                }
+            }
+
+            printf("  %-10s %7zu rays  binary %7.3f Mrays/s %6.1f nodes %5.1f tris  wide %7.3f Mrays/s %6.1f nodes %5.1f tris  %.2fx  %u differ\n",
+                   rayNames[list], rays.size(), rays.size() / seconds[0] * 1e-6, static_cast<double>(traversal[0].nodes) / rays.size(),
+                   static_cast<double>(traversal[0].triangles) / rays.size(), rays.size() / seconds[1] * 1e-6,
+                   static_cast<double>(traversal[1].nodes) / rays.size(), static_cast<double>(traversal[1].triangles) / rays.size(),
+                   seconds[0] / seconds[1], mismatches);
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-qbvh [--level N] [--leaf-size N] [--width N] [--height N] [--rays N] [<model.obj>...]
+//
+// Collapses binned SAH BVHs of a Menger sponge (level 5 by default, 10M triangles) and of
+// the models to eight-wide ones, compresses those to quantized nodes, and compares the
+// two on node memory and on camera and random rays, closest hit and any hit
+//
+int BenchQbvhCommand(const CommandLine& commandLine)
+{
+    const uint32_t width = commandLine.GetOption("width", 640u);
+    const uint32_t height = commandLine.GetOption("height", 360u);
+    const uint32_t randomRayCount = commandLine.GetOption("rays", 200000u);
+    const auto meshes = LoadBenchMeshes(commandLine);
+
+    for (const auto& mesh : meshes)
+    {
+        const BvhGeometry geometry = mesh->GetGeometry();
+
+        BvhBuilder builder(GetBvhSettings(commandLine));
+        Bvh bvh;
+        builder.Build(geometry, bvh);
+        CheckBvh(bvh, geometry);
+
+        Bvh8 wideBvh;
+        wideBvh.Collapse(bvh);
+
+        // The binary tree is not traced, so let its memory go before compressing
+        const size_t binaryNodeBytes = bvh.GetNodes().size() * sizeof(BvhNode);
+        const BvhBounds bounds = bvh.GetBounds();
+        bvh = Bvh();
+
+        const auto start = std::chrono::steady_clock::now();
+        QuantizedBvh8 quantizedBvh;
+        quantizedBvh.Compress(wideBvh);
+        const double compressSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const size_t wideNodeBytes = wideBvh.GetNodes().size() * sizeof(Bvh8Node);
+        const size_t quantizedNodeBytes = quantizedBvh.GetNodes().size() * sizeof(QuantizedBvh8Node);
+
+        printf("%s: %u triangles, compressed in %.0f ms\n", mesh->name.c_str(), geometry.GetTriangleCount(), compressSeconds * 1000.0);
+        printf("  nodes: binary %.1f MB, wide %zu (%.1f MB), quantized %zu (%.1f MB), %.2fx smaller than wide, %.2fx than binary\n",
+               binaryNodeBytes / (1024.0 * 1024.0), wideBvh.GetNodes().size(), wideNodeBytes / (1024.0 * 1024.0),
+               quantizedBvh.GetNodes().size(), quantizedNodeBytes / (1024.0 * 1024.0), static_cast<double>(wideNodeBytes) / quantizedNodeBytes,
+               static_cast<double>(binaryNodeBytes) / quantizedNodeBytes);
+
+        // From the front, above and to the side, as bench-bvh8 views the sponge
+        const float size = (std::max)(bounds.max[0] - bounds.min[0], (std::max)(bounds.max[1] - bounds.min[1], bounds.max[2] - bounds.min[2]));
+        const float eyeOffset[3] = { 0.35f, 0.45f, -1.6f };
+        float eye[3];
+        float target[3];
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            target[axis] = bounds.GetCenter(axis);
+            eye[axis] = target[axis] + eyeOffset[axis] * size;
+        }
+
+        std::vector<BvhRay> rayLists[2];
+        GetCameraRays(eye, target, width, height, rayLists[0]);
+        GetRandomRays(bounds, randomRayCount, rayLists[1]);
+        const char* rayNames[2] = { "camera", "random" };
+
+        for (uint32_t list = 0; list < 2; list++)
+        {
+            const auto& rays = rayLists[list];
+
+            for (uint32_t anyHit = 0; anyHit < 2; anyHit++)
+            {
+                std::vector<BvhHit> hits[2];
+                BvhTraversalStats traversal[2];
+                double seconds[2];
+
+                if (anyHit)
+                {
+                    for (uint32_t quantized = 0; quantized < 2; quantized++)
+                    {
+                        hits[quantized].resize(rays.size());
+                        const auto traceStart = std::chrono::steady_clock::now();
+
+                        for (size_t i = 0; i < rays.size(); i++)
+                        {
+                            const bool occluded = quantized ? quantizedBvh.IsOccluded(geometry, rays[i], &traversal[quantized])
+                                                            : wideBvh.IsOccluded(geometry, rays[i], &traversal[quantized]);
+                            hits[quantized][i].primitiveIndex = occluded ? 0 : BvhHit::NoHit;
+                        }
+
+                        seconds[quantized] = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceStart).count();
+                    }
+                }
+                else
+                {
+                    seconds[0] = TraceRays(wideBvh, geometry, rays, hits[0], traversal[0]);
+                    seconds[1] = TraceRays(quantizedBvh, geometry, rays, hits[1], traversal[1]);
+                }
+
+                // Looser boxes change the order leaves are visited in, which can only
+                // change which of several triangles at the same distance is reported
+                uint32_t mismatches = 0;
+
+                for (size_t i = 0; i < rays.size(); i++)
+                {
+                    if (hits[0][i].IsHit() != hits[1][i].IsHit() || (!anyHit && hits[0][i].t != hits[1][i].t))
+                    {
+                        mismatches++;
+                    }
+                }
+
+                printf("  %-6s %-7s %7zu rays  wide %7.3f Mrays/s %6.1f nodes %5.1f tris  quantized %7.3f Mrays/s %6.1f nodes %5.1f tris  "
+                       "%+.1f%% time  %u differ\n",
+                       rayNames[list], anyHit ? "any" : "closest", rays.size(), rays.size() / seconds[0] * 1e-6,
+                       static_cast<double>(traversal[0].nodes) / rays.size(), static_cast<double>(traversal[0].triangles) / rays.size(),
+                       rays.size() / seconds[1] * 1e-6, static_cast<double>(traversal[1].nodes) / rays.size(),
+                       static_cast<double>(traversal[1].triangles) / rays.size(), (seconds[1] / seconds[0] - 1.0) * 100.0, mismatches);
+            }
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-scene [--copies N] [--level N] [--width N] [--height N] [<model.obj>]
+//
+// Builds the sample's scene as CreateTopLevelAS instances it (bottom levels for the
+// triangle, the plane and the model, with the same transforms, instance IDs and hit group
+// offsets) and traces it through SceneBvh and through a BVH over the same triangles
+// flattened into world space, checking that every ray hits the same triangle of the same
+// instance. Then does the same for copies x copies turned Menger sponges of the given
+// level sharing one bottom level, with the odd copies masked out of the primary rays.
+//
+int BenchSceneCommand(const CommandLine& commandLine)
+{
+    const uint32_t width = commandLine.GetOption("width", 640u);
+    const uint32_t height = commandLine.GetOption("height", 360u);
+    const uint32_t copies = (std::max)(1u, commandLine.GetOption("copies", 8u));
+    const auto& positional = commandLine.GetPositional();
+
+    // Bottom levels of the sample: one triangle of CreateTriangleVB, the plane of
+    // CreatePlaneVB and the model, taken from the flattened scene and the model file
+    BenchMesh sampleScene;
+    BuildSampleScene(std::string(), sampleScene);
+
+    BenchMesh triangle;
+    triangle.positions.assign(sampleScene.positions.begin(), sampleScene.positions.begin() + 9);
+    triangle.indices = { 0, 1, 2 };
+
+    BenchMesh plane;
+    plane.positions.assign(sampleScene.positions.begin() + 27, sampleScene.positions.begin() + 45);
+    plane.indices = { 0, 1, 2, 3, 4, 5 };
+
+    BenchMesh model;
+
+    if (!positional.empty())
+    {
+        LoadModel(positional[0], model);
+    }
+
+    BenchMesh sponge;
+    BuildMengerSponge(commandLine.GetOption("level", 3u), sponge);
+
+    struct BottomLevel
+    {
+        const BenchMesh* mesh;
+        BvhGeometry geometry;
+        Bvh bvh;
+    };
+
+    BottomLevel bottomLevels[4] = { { &triangle, {}, {} }, { &plane, {}, {} }, { &model, {}, {} }, { &sponge, {}, {} } };
+    BvhBuilder builder(GetBvhSettings(commandLine));
+
+    for (BottomLevel& bottomLevel : bottomLevels)
+    {
+        bottomLevel.geometry = bottomLevel.mesh->GetGeometry();
+
+        if (bottomLevel.geometry.GetTriangleCount() > 0)
+        {
+            builder.Build(bottomLevel.geometry, bottomLevel.bvh);
+            CheckBvh(bottomLevel.bvh, bottomLevel.geometry);
+        }
+    }
+
+    auto makeInstance = [&](uint32_t bottomLevel, uint32_t instanceID, uint32_t hitGroupIndex)
+    {
+        SceneInstance instance;
+        instance.bottomLevel = bottomLevels[bottomLevel].bvh.GetView();
+        instance.geometry = bottomLevels[bottomLevel].geometry;
+        instance.instanceID = instanceID;
+        instance.hitGroupIndex = hitGroupIndex;
+        return instance;
+    };
+
+    struct Scene
+    {
+        std::string name;
+        std::vector<SceneInstance> instances;
+        float eye[3];
+        float target[3];
+        float light[3];
+        /// Mask of the primary rays
+        uint32_t primaryMask;
+    };
+
+    std::vector<Scene> scenes(2);
+
+    // CreateTopLevelAS: triangles with hit group 0, the plane with 2 and the model with 4.
+    // The triangle instances use transforms[0..2], which are the identity and moves of
+    // -0.6 and 0.6 along X; the plane uses transforms[3], no move.
+    Scene& sample = scenes[0];
+    sample.name = "sample scene";
+    sample.primaryMask = 0xFF;
+
+    // The sample's camera and Hit.hlsl's light, as in LoadBenchScenes
+    const float sampleEye[3] = { 0.0f, 0.25f, -3.0f };
+    const float sampleTarget[3] = { 0.0f, 0.25f, 0.0f };
+    const float sampleLight[3] = { 2.0f, 2.0f, -2.0f };
+    std::copy(sampleEye, sampleEye + 3, sample.eye);
+    std::copy(sampleTarget, sampleTarget + 3, sample.target);
+    std::copy(sampleLight, sampleLight + 3, sample.light);
+
+    const float triangleOffsets[3] = { 0.0f, -0.6f, 0.6f };
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        sample.instances.push_back(makeInstance(0, i, 0));
+        sample.instances.back().transform[0][3] = triangleOffsets[i];
+    }
+
+    sample.instances.push_back(makeInstance(1, 3, 2));
+
+    // scale(0.25) * translation(0, -0.5, -0.3), transposed
+    sample.instances.push_back(makeInstance(2, 4, 4));
+    const float modelTransform[3][4] = { { 0.25f, 0.0f, 0.0f, 0.0f }, { 0.0f, 0.25f, 0.0f, -0.5f }, { 0.0f, 0.0f, 0.25f, -0.3f } };
+    std::copy(&modelTransform[0][0], &modelTransform[0][0] + 12, &sample.instances.back().transform[0][0]);
+
+    if (model.model.mesh.vertices.empty())
+    {
+        sample.instances.back().bottomLevel = BvhView();
+    }
+
+    // A grid of sponges turned about Y by random angles, seen from above one corner
+    Scene& grid = scenes[1];
+    grid.name = sponge.name + " x " + std::to_string(copies * copies);
+    grid.primaryMask = 0x01;
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    for (uint32_t z = 0; z < copies; z++)
+    {
+        for (uint32_t x = 0; x < copies; x++)
+        {
+            const uint32_t index = z * copies + x;
+            const float angle = 6.2831853f * uniform(generator);
+            const float scale = 0.6f + 0.4f * uniform(generator);
+
+            SceneInstance instance = makeInstance(3, index, index % 4);
+            const float transform[3][4] = { { scale * std::cos(angle), 0.0f, scale * std::sin(angle), 3.0f * x },
+                                            { 0.0f, scale, 0.0f, 0.0f },
+                                            { -scale * std::sin(angle), 0.0f, scale * std::cos(angle), 3.0f * z } };
+            std::copy(&transform[0][0], &transform[0][0] + 12, &instance.transform[0][0]);
+            instance.mask = index % 2 ? 0x02 : 0x01;
+            grid.instances.push_back(instance);
+        }
+    }
+
+    const float gridSize = 3.0f * (copies - 1);
+    const float gridEye[3] = { -0.25f * gridSize - 3.0f, 0.35f * gridSize + 2.0f, -0.25f * gridSize - 3.0f };
+    const float gridTarget[3] = { 0.5f * gridSize, 0.0f, 0.5f * gridSize };
+    const float gridLight[3] = { 0.3f * gridSize, 2.0f * gridSize + 4.0f, 0.1f * gridSize };
+    std::copy(gridEye, gridEye + 3, grid.eye);
+    std::copy(gridTarget, gridTarget + 3, grid.target);
+    std::copy(gridLight, gridLight + 3, grid.light);
+
+    for (const Scene& scene : scenes)
+    {
+        SceneBvh sceneBvh;
+        const auto start = std::chrono::steady_clock::now();
+        sceneBvh.Build(scene.instances);
+        const double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // The same triangles in world space, with the instance and primitive of each, over
+        // the instances the primary rays see
+        BenchMesh flattened;
+        std::vector<uint32_t> triangleInstances;
+        std::vector<uint32_t> trianglePrimitives;
+
+        for (uint32_t i = 0; i < scene.instances.size(); i++)
+        {
+            const SceneInstance& instance = scene.instances[i];
+
+            if (instance.bottomLevel.IsEmpty() || (instance.mask & scene.primaryMask) == 0)
+            {
+                continue;
+            }
+
+            for (uint32_t triangleIndex = 0; triangleIndex < instance.geometry.GetTriangleCount(); triangleIndex++)
+            {
+                const float* corners[3];
+                instance.geometry.GetTriangle(triangleIndex, corners);
+
+                for (const float* corner : corners)
+                {
+                    flattened.indices.push_back(static_cast<uint32_t>(flattened.positions.size() / 3));
+
+                    for (uint32_t row = 0; row < 3; row++)
+                    {
+                        flattened.positions.push_back(instance.transform[row][0] * corner[0] + instance.transform[row][1] * corner[1] +
+                                                      instance.transform[row][2] * corner[2] + instance.transform[row][3]);
+                    }
+                }
+
+                triangleInstances.push_back(i);
+                trianglePrimitives.push_back(triangleIndex);
+            }
+        }
+
+        const BvhGeometry flattenedGeometry = flattened.GetGeometry();
+        Bvh flattenedBvh;
+        builder.Build(flattenedGeometry, flattenedBvh);
+
+        printf("%s: %zu instances, %zu top-level nodes built in %.2f ms, %u triangles flattened\n", scene.name.c_str(),
+               scene.instances.size(), sceneBvh.GetNodes().size(), buildSeconds * 1000.0, flattenedGeometry.GetTriangleCount());
+
+        std::vector<BvhRay> rays;
+        GetCameraRays(scene.eye, scene.target, width, height, rays);
+
+        SceneRayParameters primary;
+        primary.instanceInclusionMask = scene.primaryMask;
+
+        std::vector<SceneHit> hits(rays.size());
+        std::vector<BvhHit> flattenedHits;
+        BvhTraversalStats sceneStats;
+        BvhTraversalStats flattenedStats;
+
+        const auto traceStart = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            sceneBvh.Intersect(rays[i], primary, hits[i], &sceneStats);
+        }
+
+        const double sceneSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceStart).count();
+        const double flattenedSeconds = TraceRays(flattenedBvh, flattenedGeometry, rays, flattenedHits, flattenedStats);
+
+        // Same instance at the same distance, up to the rounding of moving the ray instead
+        // of the triangles; on an edge between two triangles either may be reported. Count
+        // the hit groups the shader table would call.
+        uint32_t mismatches = 0;
+        uint32_t hitCount = 0;
+        std::vector<uint32_t> hitGroupCounts;
+
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            const SceneHit& hit = hits[i];
+            const BvhHit& flattenedHit = flattenedHits[i];
+
+            if (hit.IsHit() != flattenedHit.IsHit())
+            {
+                mismatches++;
+                continue;
+            }
+
+            if (!hit.IsHit())
+            {
+                continue;
+            }
+
+            const uint32_t instance = triangleInstances[flattenedHit.primitiveIndex];
+
+            if (instance != hit.instanceIndex || hit.instanceID != scene.instances[instance].instanceID ||
+                std::fabs(hit.t - flattenedHit.t) > 1e-4f * (std::max)(1.0f, hit.t))
+            {
+                mismatches++;
+            }
+
+            hitCount++;
+            hitGroupCounts.resize((std::max)(hitGroupCounts.size(), static_cast<size_t>(hit.hitGroupIndex) + 1));
+            hitGroupCounts[hit.hitGroupIndex]++;
+        }
+
+        printf("  primary %zu rays: scene %.3f Mrays/s %.1f nodes %.1f tris, flattened %.3f Mrays/s %.1f nodes %.1f tris, %u hits, %u differ\n",
+               rays.size(), rays.size() / sceneSeconds * 1e-6, static_cast<double>(sceneStats.nodes) / rays.size(),
+               static_cast<double>(sceneStats.triangles) / rays.size(), rays.size() / flattenedSeconds * 1e-6,
+               static_cast<double>(flattenedStats.nodes) / rays.size(), static_cast<double>(flattenedStats.triangles) / rays.size(), hitCount,
+               mismatches);
+        printf("  hit groups:");
+
+        for (size_t group = 0; group < hitGroupCounts.size(); group++)
+        {
+            if (hitGroupCounts[group] > 0)
+            {
+                printf(" %zu: %u", group, hitGroupCounts[group]);
+            }
+        }
+
+        printf("\n");
+
+        // Shadow rays as ShadowRay traces them, with ray contribution 1 and against every
+        // instance. Any hit has no hit group to check, so compare it with a closest hit.
+        SceneRayParameters shadow;
+        shadow.rayContributionToHitGroupIndex = 1;
+
+        uint32_t shadowRays = 0;
+        uint32_t occluded = 0;
+        uint32_t shadowMismatches = 0;
+
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            if (!hits[i].IsHit())
+            {
+                continue;
+            }
+
+            BvhRay ray;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                ray.origin[axis] = rays[i].origin[axis] + hits[i].t * rays[i].direction[axis];
+                ray.direction[axis] = scene.light[axis] - ray.origin[axis];
+            }
+
+            ray.tMin = 1e-3f;
+            ray.tMax = 1.0f;
+
+            SceneHit closest;
+            const bool isOccluded = sceneBvh.IsOccluded(ray, shadow);
+            sceneBvh.Intersect(ray, shadow, closest);
+
+            shadowRays++;
+            occluded += isOccluded ? 1 : 0;
+
+            if (isOccluded != closest.IsHit() || (closest.IsHit() && closest.hitGroupIndex != 1 + scene.instances[closest.instanceIndex].hitGroupIndex))
+            {
+                shadowMismatches++;
+            }
+        }
+
+        printf("  shadow %u rays: %u occluded, %u differ from closest hit\n", shadowRays, occluded, shadowMismatches);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-tlas [--instances N] [--frames N] [--moving F] [--threshold F] [--level N] [--rays N]
+//
+// Animates instances of a small Menger sponge drifting and spinning through a box, and
+// brings the top level up to date every frame by refitting only, by rebuilding, and by
+// refitting until the SAH cost passes threshold times the built cost. Reports the time
+// per frame and how the cost drifts, then traces random rays through the final frame of
+// each, checking that all three find the same hits. Without --instances, runs 10k, 100k
+// and 1M instances.
+//
+int BenchTlasCommand(const CommandLine& commandLine)
+{
+    const uint32_t frameCount = (std::max)(1u, commandLine.GetOption("frames", 60u));
+    const float movingFraction = (std::min)(1.0f, (std::max)(0.0f, commandLine.GetOption("moving", 1.0f)));
+    const float threshold = commandLine.GetOption("threshold", 1.3f);
+    const uint32_t randomRayCount = commandLine.GetOption("rays", 100000u);
+
+    std::vector<uint32_t> instanceCounts = { 10000, 100000, 1000000 };
+
+    if (!commandLine.GetOption("instances").empty())
+    {
+        instanceCounts = { (std::max)(1u, commandLine.GetOption("instances", 0u)) };
+    }
+
+    BenchMesh sponge;
+    BuildMengerSponge(commandLine.GetOption("level", 1u), sponge);
+
+    const BvhGeometry geometry = sponge.GetGeometry();
+    BvhBuilder builder(GetBvhSettings(commandLine));
+    Bvh bottomLevel;
+    builder.Build(geometry, bottomLevel);
+
+    printf("%s: %u triangles per instance, %u frames, %.0f%% of the instances moving\n", sponge.name.c_str(), geometry.GetTriangleCount(),
+           frameCount, movingFraction * 100.0f);
+
+    for (uint32_t instanceCount : instanceCounts)
+    {
+        // Start on a grid with a cell of 4 around each unit-radius sponge, then move up to
+        // a sixteenth of a cell per frame with a random heading, bouncing off the sides of
+        // the box, and spin about Y
+        const uint32_t side = static_cast<uint32_t>(std::ceil(std::cbrt(static_cast<double>(instanceCount))));
+        const float extent = 4.0f * side;
+
+        struct Motion
+        {
+            float start[3];
+            float velocity[3];
+            float angularVelocity;
+        };
+
+        std::vector<Motion> motions(instanceCount);
+        std::vector<SceneInstance> instances(instanceCount);
+        std::vector<uint32_t> moving;
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        for (uint32_t i = 0; i < instanceCount; i++)
+        {
+            Motion& motion = motions[i];
+            const uint32_t cell[3] = { i % side, i / side % side, i / (side * side) };
+            const float z = 2.0f * uniform(generator) - 1.0f;
+            const float phi = 2.0f * 3.14159265f * uniform(generator);
+            const float radius = std::sqrt((std::max)(0.0f, 1.0f - z * z));
+            const float speed = 0.05f + 0.2f * uniform(generator);
+            const float heading[3] = { radius * std::cos(phi), radius * std::sin(phi), z };
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                motion.start[axis] = 4.0f * cell[axis] + 2.0f;
+                motion.velocity[axis] = speed * heading[axis];
+            }
+
+            motion.angularVelocity = 0.05f * (2.0f * uniform(generator) - 1.0f);
+
+            instances[i].bottomLevel = bottomLevel.GetView();
+            instances[i].geometry = geometry;
+            instances[i].instanceID = i;
+
+            if (uniform(generator) < movingFraction)
+            {
+                moving.push_back(i);
+            }
+        }
+
+        auto getTransform = [&](uint32_t instance, uint32_t frame, float transform[3][4])
+        {
+            const Motion& motion = motions[instance];
+            const float angle = motion.angularVelocity * frame;
+            const float cosine = std::cos(angle);
+            const float sine = std::sin(angle);
+            const float rows[3][3] = { { cosine, 0.0f, sine }, { 0.0f, 1.0f, 0.0f }, { -sine, 0.0f, cosine } };
+
+            for (uint32_t row = 0; row < 3; row++)
+            {
+                // Fold the straight path back into [1, extent - 1]
+                const float range = extent - 2.0f;
+                float position = std::fmod(motion.start[row] - 1.0f + motion.velocity[row] * frame, 2.0f * range);
+                position = position < 0.0f ? position + 2.0f * range : position;
+                position = position > range ? 2.0f * range - position : position;
+
+                std::copy(rows[row], rows[row] + 3, transform[row]);
+                transform[row][3] = position + 1.0f;
+            }
+        };
+
+        for (uint32_t i = 0; i < instanceCount; i++)
+        {
+            getTransform(i, 0, instances[i].transform);
+        }
+
+        printf("%u instances, %zu moving:\n", instanceCount, moving.size());
+
+        struct Mode
+        {
+            const char* name;
+            float threshold;
+        };
+
+        const Mode modes[3] = { { "refit", std::numeric_limits<float>::infinity() }, { "rebuild", 0.0f }, { "adaptive", threshold } };
+
+        SceneBvh sceneBvh;
+        std::vector<BvhRay> randomRays;
+        std::vector<SceneHit> referenceHits;
+
+        for (const Mode& mode : modes)
+        {
+            auto start = std::chrono::steady_clock::now();
+            sceneBvh.Build(instances);
+            const double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            double transformSeconds = 0.0;
+            double updateSeconds = 0.0;
+            uint32_t rebuilds = 0;
+            float highestRatio = 1.0f;
+
+            for (uint32_t frame = 1; frame <= frameCount; frame++)
+            {
+                start = std::chrono::steady_clock::now();
+
+                for (uint32_t instance : moving)
+                {
+                    float transform[3][4];
+                    getTransform(instance, frame, transform);
+                    sceneBvh.SetTransform(instance, transform);
+                }
+
+                const auto updateStart = std::chrono::steady_clock::now();
+                const SceneBvh::UpdateKind kind = sceneBvh.Update(mode.threshold);
+                const auto end = std::chrono::steady_clock::now();
+
+                transformSeconds += std::chrono::duration<double>(updateStart - start).count();
+                updateSeconds += std::chrono::duration<double>(end - updateStart).count();
+                rebuilds += kind == SceneBvh::UpdateKind::Rebuild ? 1 : 0;
+                highestRatio = (std::max)(highestRatio, sceneBvh.GetSahCost() / sceneBvh.GetBuiltSahCost());
+            }
+
+            // The same rays for every mode, in the box the instances stay in
+            if (randomRays.empty())
+            {
+                GetRandomRays(sceneBvh.GetBounds(), randomRayCount, randomRays);
+            }
+
+            std::vector<SceneHit> hits(randomRays.size());
+            BvhTraversalStats stats;
+            const SceneRayParameters parameters;
+            const auto traceStart = std::chrono::steady_clock::now();
+
+            for (size_t i = 0; i < randomRays.size(); i++)
+            {
+                sceneBvh.Intersect(randomRays[i], parameters, hits[i], &stats);
+            }
+
+            const double traceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - traceStart).count();
+
+            if (referenceHits.empty())
+            {
+                referenceHits = hits;
+            }
+
+            // Every mode traces the same instances, so only ties between them at the same
+            // distance may differ
+            uint32_t mismatches = 0;
+
+            for (size_t i = 0; i < hits.size(); i++)
+            {
+                if (hits[i].IsHit() != referenceHits[i].IsHit() ||
+                    (hits[i].IsHit() && std::fabs(hits[i].t - referenceHits[i].t) > 1e-4f * (std::max)(1.0f, hits[i].t)))
+                {
+                    mismatches++;
+                }
+            }
+
+            printf("  %-8s  build %7.1f ms  update %7.2f ms/frame (+%6.2f ms transforms)  %2u rebuilds  SAH %7.2f (%.2fx built, peak %.2fx)\n"
+                   "            %zu random rays: %.3f Mrays/s %.1f nodes %.1f tris, %u differ\n",
+                   mode.name, buildSeconds * 1000.0, updateSeconds * 1000.0 / frameCount, transformSeconds * 1000.0 / frameCount, rebuilds,
+                   sceneBvh.GetSahCost(), sceneBvh.GetSahCost() / sceneBvh.GetBuiltSahCost(), highestRatio, randomRays.size(),
+                   randomRays.size() / traceSeconds * 1e-6, static_cast<double>(stats.nodes) / randomRays.size(),
+                   static_cast<double>(stats.triangles) / randomRays.size(), mismatches);
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-refit [--size N] [--frames N] [--threshold F] [--threads N] [--leaf-size N] [--rays N]
+//
+// A size x size quad cloth (708 by default, 1M triangles) is built flat and then waves
+// like a flag whose waves grow over the frames. Its BVH is brought up to date every frame
+// by refitting only, by rebuilding, and by refitting until the SAH cost passes threshold
+// times the built cost. Reports refit throughput and how quality drifts, checks that the
+// final tree bounds every triangle, and traces random rays through it and through a tree
+// built from scratch for the last frame.
+//
+int BenchRefitCommand(const CommandLine& commandLine)
+{
+    const uint32_t size = (std::max)(1u, commandLine.GetOption("size", 708u));
+    const uint32_t frameCount = (std::max)(1u, commandLine.GetOption("frames", 60u));
+    const float threshold = commandLine.GetOption("threshold", 1.5f);
+    const uint32_t randomRayCount = commandLine.GetOption("rays", 100000u);
+
+    BenchMesh cloth;
+    cloth.name = "cloth-" + std::to_string(size);
+    cloth.positions.resize(static_cast<size_t>(size + 1) * (size + 1) * 3);
+
+    for (uint32_t y = 0; y < size; y++)
+    {
+        for (uint32_t x = 0; x < size; x++)
+        {
+            const uint32_t corner = y * (size + 1) + x;
+            const uint32_t quad[6] = { corner, corner + 1, corner + size + 1, corner + size + 1, corner + 1, corner + size + 2 };
+            cloth.indices.insert(cloth.indices.end(), quad, quad + 6);
+        }
+    }
+
+    // A 2 x 1.4 flag hung from x = 0. Its waves travel away from the pole and grow to
+    // full height over the first half of the frames, pulling the free end in.
+    auto setFrame = [&](uint32_t frame)
+    {
+        const float time = frame / 30.0f;
+        const float amplitude = 0.4f * (std::min)(1.0f, 2.0f * frame / frameCount);
+
+        for (uint32_t y = 0; y <= size; y++)
+        {
+            for (uint32_t x = 0; x <= size; x++)
+            {
+                const float u = static_cast<float>(x) / size;
+                const float v = static_cast<float>(y) / size;
+                float* position = &cloth.positions[(static_cast<size_t>(y) * (size + 1) + x) * 3];
+
+                position[0] = 2.0f * u * (1.0f - 0.2f * amplitude);
+                position[1] = 1.4f * v - 0.1f * amplitude * u * u;
+                position[2] = amplitude * u * std::sin(12.0f * u - 6.0f * time + 2.0f * v);
+            }
+        }
+    };
+
+    const BvhGeometry geometry = cloth.GetGeometry();
+    const BvhBuilder::Settings buildSettings = GetBvhSettings(commandLine);
+
+    printf("%s: %u triangles, %u frames\n", cloth.name.c_str(), geometry.GetTriangleCount(), frameCount);
+
+    struct Mode
+    {
+        const char* name;
+        float threshold;
+    };
+
+    const Mode modes[3] = { { "refit", std::numeric_limits<float>::infinity() }, { "rebuild", 0.0f }, { "adaptive", threshold } };
+
+    // The last frame built from scratch, for the rays
+    setFrame(frameCount);
+
+    BvhBuilder builder(buildSettings);
+    Bvh referenceBvh;
+    builder.Build(geometry, referenceBvh);
+
+    std::vector<BvhRay> randomRays;
+    GetRandomRays(referenceBvh.GetBounds(), randomRayCount, randomRays);
+
+    std::vector<BvhHit> referenceHits;
+    BvhTraversalStats referenceStats;
+    const double referenceSeconds = TraceRays(referenceBvh, geometry, randomRays, referenceHits, referenceStats);
+
+    printf("  built for the last frame in %.1f ms: SAH %.2f, %zu random rays %.3f Mrays/s %.1f nodes %.1f tris\n", builder.GetStats().seconds * 1000.0,
+           referenceBvh.GetSahCost(buildSettings.traversalCost, buildSettings.intersectionCost), randomRays.size(),
+           randomRays.size() / referenceSeconds * 1e-6, static_cast<double>(referenceStats.nodes) / randomRays.size(),
+           static_cast<double>(referenceStats.triangles) / randomRays.size());
+
+    for (const Mode& mode : modes)
+    {
+        BvhRefitter::Settings settings;
+        settings.rebuildThreshold = mode.threshold;
+        settings.threads = buildSettings.threads;
+
+        BvhRefitter refitter(settings, buildSettings);
+        Bvh bvh;
+
+        setFrame(0);
+        refitter.Build(geometry, bvh);
+
+        double refitSeconds = 0.0;
+        double rebuildSeconds = 0.0;
+        float worstQuality = 1.0f;
+
+        for (uint32_t frame = 1; frame <= frameCount; frame++)
+        {
+            setFrame(frame);
+            refitter.Update(geometry, bvh);
+
+            const BvhRefitter::Stats& stats = refitter.GetStats();
+            refitSeconds += stats.refitSeconds;
+            rebuildSeconds += stats.rebuildSeconds;
+            worstQuality = (std::max)(worstQuality, refitter.GetQuality());
+        }
+
+        CheckBvh(bvh, geometry, buildSettings.spatialSplits);
+
+        // Every tree is over the same triangles, so only ties between them may differ
+        std::vector<BvhHit> hits;
+        BvhTraversalStats traversal;
+        const double seconds = TraceRays(bvh, geometry, randomRays, hits, traversal);
+        uint32_t mismatches = 0;
+
+        for (size_t i = 0; i < hits.size(); i++)
+        {
+            if (hits[i].IsHit() != referenceHits[i].IsHit() ||
+                (hits[i].IsHit() && std::fabs(hits[i].t - referenceHits[i].t) > 1e-4f * (std::max)(1.0f, hits[i].t)))
+            {
+                mismatches++;
+            }
+        }
+
+        const BvhRefitter::Stats& stats = refitter.GetStats();
+        const uint32_t refits = stats.refits;
+
+        // Runs that never refit have no refit tasks or threads to report
+        char refitRate[64] = "";
+
+        if (refits)
+        {
+            snprintf(refitRate, sizeof(refitRate), " (%6.1f Mtris/s, %u tasks on %u threads)",
+                     geometry.GetTriangleCount() * refits / refitSeconds * 1e-6, stats.tasks, stats.threads);
+        }
+
+        printf("  %-8s  refit %7.2f ms%s x %2u  rebuild %7.1f ms x %2u  %7.2f ms/frame\n"
+               "            SAH %.2f (%.2fx built, worst %.2fx), %zu random rays %.3f Mrays/s %.1f nodes %.1f tris, %u differ\n",
+               mode.name, refits ? refitSeconds * 1000.0 / refits : 0.0, refitRate, refits, stats.rebuilds ? rebuildSeconds * 1000.0 / stats.rebuilds : 0.0, stats.rebuilds,
+               (refitSeconds + rebuildSeconds) * 1000.0 / frameCount, refitter.GetSahCost(), refitter.GetQuality(), worstQuality,
+               randomRays.size(), randomRays.size() / seconds * 1e-6, static_cast<double>(traversal.nodes) / randomRays.size(),
+               static_cast<double>(traversal.triangles) / randomRays.size(), mismatches);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// analyze-bvh [--builder binned|sbvh|lbvh|treelet] [--floors N] [--leaf-size N] [--width N] [--height N]
+//             [--json report.json] [--heatmap prefix] [--no-epo] [<model.obj>]
+//
+// Builds the bench-sbvh scenes (the sample's, with the model if given, and an office
+// block) with every builder, or just the one named, and reports the quality of each:
+// SAH cost, EPO, leaf sizes and depths, child overlap by level, and the node visits and
+// triangle tests of the camera's rays. --json writes all reports as one array; --heatmap
+// writes <prefix>-<scene>-<builder>.bmp of the node visits per pixel.
+//
+int AnalyzeBvhCommand(const CommandLine& commandLine)
+{
+    const uint32_t width = commandLine.GetOption("width", 640u);
+    const uint32_t height = commandLine.GetOption("height", 360u);
+    const std::string builderName = commandLine.GetOption("builder");
+    const std::string jsonPath = commandLine.GetOption("json");
+    const std::string heatmapPrefix = commandLine.GetOption("heatmap");
+    const char* const builderNames[4] = { "binned", "sbvh", "lbvh", "treelet" };
+
+    if (!builderName.empty() && std::find(builderNames, builderNames + 4, builderName) == builderNames + 4)
+    {
+        throw std::runtime_error("Unknown BVH builder " + builderName + ", expected binned, sbvh, lbvh or treelet");
+    }
+
+    BvhAnalyzer::Settings analyzerSettings;
+    analyzerSettings.computeEpo = !commandLine.HasFlag("no-epo");
+
+    const auto scenes = LoadBenchScenes(commandLine, 4);
+    std::vector<std::string> reports;
+
+    for (size_t sceneIndex = 0; sceneIndex < scenes.size(); sceneIndex++)
+    {
+        const BenchScene& scene = *scenes[sceneIndex];
+        const BvhGeometry geometry = scene.mesh.GetGeometry();
+
+        printf("%s: %u triangles\n", scene.mesh.name.c_str(), geometry.GetTriangleCount());
+
+        std::vector<BvhRay> rays;
+        GetCameraRays(scene.eye, scene.target, width, height, rays);
+
+        for (const char* name : builderNames)
+        {
+            if (!builderName.empty() && builderName != name)
+            {
+                continue;
+            }
+
+            const std::string builder = name;
+            Bvh bvh;
+
+            if (builder == "binned" || builder == "sbvh")
+            {
+                BvhBuilder::Settings settings = GetBvhSettings(commandLine);
+                settings.spatialSplits = builder == "sbvh";
+                BvhBuilder(settings).Build(geometry, bvh);
+            }
+            else
+            {
+                LbvhBuilder::Settings settings;
+                settings.maxLeafSize = commandLine.GetOption("leaf-size", settings.maxLeafSize);
+                settings.threads = commandLine.GetOption("threads", settings.threads);
+                settings.treeletPasses = builder == "treelet" ? commandLine.GetOption("treelet-passes", 3u) : 0;
+                LbvhBuilder(settings).Build(geometry, bvh);
+            }
+
+            BvhAnalyzer analyzer(analyzerSettings);
+            analyzer.Analyze(bvh, geometry);
+            analyzer.TraceRays(bvh, geometry, rays, width, height);
+
+            const BvhAnalyzer::Report& report = analyzer.GetReport();
+            std::string leafSizes;
+
+            for (size_t size = 1; size < report.leafSizes.size(); size++)
+            {
+                leafSizes += (size > 1 ? " " : "") + std::to_string(report.leafSizes[size]);
+            }
+
+            printf("  %-8s SAH %7.2f  EPO %7.3f  %u nodes, %u leaves (%u references), leaf depth %u/%.1f/%u, analyzed in %.2f s\n", name,
+                   report.sahCost, report.epo, report.nodes, report.leaves, report.references, report.minLeafDepth, report.averageLeafDepth,
+                   report.maxLeafDepth, report.seconds);
+            printf("           leaves by size: %s\n", leafSizes.c_str());
+            printf("           child overlap by level:");
+
+            for (size_t level = 0; level < report.levels.size(); level += 4)
+            {
+                printf(" %zu: %.3f", level, report.levels[level].childOverlap);
+            }
+
+            printf("\n           per camera ray: nodes %.1f mean, %u median, %u p99, %u max; triangles %.1f mean, %u p99, %u max\n",
+                   report.nodeVisits.mean, report.nodeVisits.median, report.nodeVisits.percentile99, report.nodeVisits.max,
+                   report.triangleTests.mean, report.triangleTests.percentile99, report.triangleTests.max);
+
+            std::string reportName = scene.mesh.name + "-" + builder;
+            std::replace(reportName.begin(), reportName.end(), ' ', '-');
+            reports.push_back(analyzer.ToJson(reportName));
+
+            if (!heatmapPrefix.empty())
+            {
+                analyzer.SaveHeatmap(heatmapPrefix + "-" + reportName + ".bmp");
+            }
+        }
+    }
+
+    if (!jsonPath.empty())
+    {
+        std::ofstream file(jsonPath);
+
+        if (!file.good())
+        {
+            throw std::runtime_error("Cannot create BVH report " + jsonPath);
+        }
+
+        file << "[\n";
+
+        for (size_t i = 0; i < reports.size(); i++)
+        {
+            file << reports[i] << (i + 1 < reports.size() ? ",\n" : "\n");
+        }
+
+        file << "]\n";
+
+        if (!file.good())
+        {
+            throw std::runtime_error("Cannot write BVH report " + jsonPath);
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// plan-as-memory --table <file> [--build none|fast-trace|fast-build] [--allow-update] [--compaction] [<model.obj>...]
+//
+int PlanASMemoryCommand(const CommandLine& commandLine)
+{
+    const std::string tablePath = commandLine.GetOption("table");
+
+    if (tablePath.empty())
+    {
+        throw std::runtime_error("Expected --table with the sizes recorded by the sample");
+    }
+
+    ASMemoryEstimator estimator;
+    estimator.Load(tablePath);
+
+    // The options describe the bottom-level builds. The sample refits its top level in
+    // place, so that one is always built with ALLOW_UPDATE
+    const std::string build = commandLine.GetOption("build", "none");
+    uint32_t flags = 0;
+
+    if (build == "fast-trace")
+    {
+        flags |= ASMemoryEstimator::PreferFastTrace;
+    }
+    else if (build == "fast-build")
+    {
+        flags |= ASMemoryEstimator::PreferFastBuild;
+    }
+    else if (build != "none")
+    {
+        throw std::runtime_error("Unknown build preference " + build);
+    }
+
+    if (commandLine.HasFlag("allow-update"))
+    {
+        flags |= ASMemoryEstimator::AllowUpdate;
+    }
+
+    if (commandLine.HasFlag("compaction"))
+    {
+        flags |= ASMemoryEstimator::AllowCompaction;
+    }
+
+    // The structures CreateAccelerationStructures builds: three instances of the triangle,
+    // the plane and each model
+    std::vector<ASBudgetRequest> requests;
+    requests.push_back({ "triangle", ASKind::BottomLevel, flags, 1, 1, false });
+    requests.push_back({ "plane", ASKind::BottomLevel, flags, 1, 2, false });
+
+    for (const auto& path : commandLine.GetPositional())
+    {
+        BenchMesh model;
+        LoadModel(path, model);
+
+        const auto& mesh = model.model.mesh;
+        const size_t corners = mesh.indices.empty() ? mesh.vertices.size() : mesh.indices.size();
+        requests.push_back({ path, ASKind::BottomLevel, flags, 1, static_cast<uint32_t>(corners / 3), !mesh.indices.empty() });
+    }
+
+    requests.push_back({ "top level", ASKind::TopLevel, ASMemoryEstimator::AllowUpdate, 1,
+                         static_cast<uint32_t>(4 + commandLine.GetPositional().size()), false });
+
+    const ASBudget budget = estimator.PlanBudget(requests);
+    auto toKB = [](uint64_t bytes) { return bytes / 1024.0; };
+
+    printf("%s\n", estimator.GetDeviceName().c_str());
+
+    for (const ASBudgetEntry& entry : budget.entries)
+    {
+        printf("%-32s %-14s flags 0x%02x %9u prims  result %10.1f KB  scratch %10.1f KB  update %10.1f KB",
+               entry.request.name.c_str(), entry.request.kind == ASKind::TopLevel ? "top" : entry.request.indexed ? "bottom-indexed" : "bottom", entry.request.flags,
+               entry.request.primitives,
+               toKB(entry.sizes.result), toKB(entry.sizes.scratch), toKB(entry.sizes.updateScratch));
+
+        if (entry.instanceDescs > 0)
+        {
+            printf("  descs %8.1f KB", toKB(entry.instanceDescs));
+        }
+
+        printf("\n");
+    }
+
+    printf("resident %.1f KB, scratch %.1f KB if every build keeps its own buffer, %.1f KB shared, %.1f KB of alignment padding\n",
+           toKB(budget.resident), toKB(budget.scratchAllAtOnce), toKB(budget.scratchLargest), toKB(budget.padding));
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// plan-scratch [--builds N] [--budget MB] [--max-size MB] [--trials N]
+//
+int PlanScratchCommand(const CommandLine& commandLine)
+{
+    const uint32_t buildCount = commandLine.GetOption("builds", 4000u);
+    const uint64_t budget = static_cast<uint64_t>(commandLine.GetOption("budget", 64.0f) * 1024.0f * 1024.0f);
+    const float maxSize = (std::min)(commandLine.GetOption("max-size", 32.0f) * 1024.0f * 1024.0f, static_cast<float>(budget));
+    const uint32_t trials = commandLine.GetOption("trials", 200u);
+
+    // Scratch sizes spread evenly in log scale, like a scene of many small props and a
+    // few large meshes
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> logSize(std::log(256.0f), std::log((std::max)(256.0f, maxSize)));
+
+    ScratchPlanner planner;
+    uint64_t largest = 0;
+
+    for (uint32_t i = 0; i < buildCount; i++)
+    {
+        const uint64_t size = static_cast<uint64_t>(std::exp(logSize(generator)));
+        planner.AddBuild(size);
+        largest = (std::max)(largest, size);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    planner.Plan(budget);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    planner.Validate();
+
+    const auto& batches = planner.GetBatches();
+    const uint64_t unaliased = planner.GetUnaliasedSize();
+    const uint64_t minimumBatches = budget > 0 ? (unaliased + budget - 1) / budget : 1;
+
+    printf("%u builds, %.1f MB of scratch with one buffer each, largest %.1f MB\n",
+           buildCount, unaliased / (1024.0 * 1024.0), largest / (1024.0 * 1024.0));
+    printf("budget %.1f MB: %zu batches (at least %llu), arena %.1f MB, %.1f%% of the budget used on average, planned in %.2f ms\n",
+           budget / (1024.0 * 1024.0), batches.size(), static_cast<unsigned long long>(minimumBatches),
+           planner.GetArenaSize() / (1024.0 * 1024.0), 100.0 * unaliased / (static_cast<double>(batches.size()) * planner.GetArenaSize()),
+           seconds * 1000.0);
+
+    // Random build sets and budgets, checked independently of Validate: sorted by offset,
+    // the ranges of a batch must not overlap, and every build must appear once
+    uint32_t failures = 0;
+
+    for (uint32_t trial = 0; trial < trials; trial++)
+    {
+        ScratchPlanner randomPlanner;
+        const uint32_t count = std::uniform_int_distribution<uint32_t>(0, 300)(generator);
+        uint64_t trialLargest = 0;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // Include empty and unaligned sizes
+            const uint64_t size = std::uniform_int_distribution<uint64_t>(0, 1 << 20)(generator) >> std::uniform_int_distribution<uint32_t>(0, 12)(generator);
+            randomPlanner.AddBuild(size);
+            trialLargest = (std::max)(trialLargest, size);
+        }
+
+        const uint64_t trialBudget = trial % 10 == 0 ? 0 : ScratchPlanner::Alignment * ((trialLargest + ScratchPlanner::Alignment - 1) / ScratchPlanner::Alignment + std::uniform_int_distribution<uint32_t>(0, 8192)(generator));
+
+        bool failed = false;
+
+        try
+        {
+            randomPlanner.Plan(trialBudget);
+            randomPlanner.Validate();
+        }
+        catch (const std::exception& exception)
+        {
+            printf("trial %u: %s\n", trial, exception.what());
+            failures++;
+            continue;
+        }
+
+        std::vector<uint32_t> scheduled(count, 0);
+
+        for (const auto& batch : randomPlanner.GetBatches())
+        {
+            std::vector<std::pair<uint64_t, uint64_t>> ranges;
+
+            for (uint32_t build : batch.builds)
+            {
+                const ScratchPlacement& placement = randomPlanner.GetPlacement(build);
+                ranges.emplace_back(placement.offset, placement.offset + placement.size);
+                scheduled[build]++;
+                failed |= placement.offset % ScratchPlanner::Alignment != 0 || placement.offset + placement.size > randomPlanner.GetArenaSize();
+            }
+
+            std::sort(ranges.begin(), ranges.end());
+
+            for (size_t i = 1; i < ranges.size(); i++)
+            {
+                failed |= ranges[i].first < ranges[i - 1].second;
+            }
+        }
+
+        failed |= trialBudget > 0 && randomPlanner.GetArenaSize() > trialBudget;
+        failed |= trialBudget == 0 && randomPlanner.GetBatches().size() > 1;
+        failed |= std::count(scheduled.begin(), scheduled.end(), 1u) != static_cast<std::ptrdiff_t>(count);
+
+        if (failed)
+        {
+            printf("trial %u: %u builds under a budget of %llu bytes planned wrongly\n", trial, count, static_cast<unsigned long long>(trialBudget));
+            failures++;
+        }
+    }
+
+    printf("%u of %u random plans checked, %u failed\n", trials - failures, trials, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// check-as-pool [--depth N] [--operations N] [--heap-size MB] [--live N] [--threshold F]
+//
+// Runs every short operation sequence on a pool of 2 KB heaps, checking it against a
+// model after each, then a long random sequence of bottom-level sized allocations with
+// defragmentation whenever the pool asks for it, and compares the memory to one
+// committed resource per structure.
+//
+int CheckASPoolCommand(const CommandLine& commandLine)
+{
+    const uint32_t depth = commandLine.GetOption("depth", 6u);
+    const uint32_t operations = commandLine.GetOption("operations", 200000u);
+    const uint32_t targetLive = commandLine.GetOption("live", 4000u);
+
+    ASMemoryPool::Settings tinySettings;
+    tinySettings.heapSize = 8 * ASMemoryPool::Alignment;
+    tinySettings.defragmentationThreshold = 0.0f;
+
+    const auto exhaustiveStart = std::chrono::steady_clock::now();
+    const uint64_t sequences = CheckPoolSequences(PoolModel{ ASMemoryPool(tinySettings), {}, {} }, depth);
+    printf("%llu operation sequences of up to %u steps checked in %.2f s\n", static_cast<unsigned long long>(sequences), depth,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - exhaustiveStart).count());
+
+    ASMemoryPool::Settings settings;
+    settings.heapSize = static_cast<uint64_t>(commandLine.GetOption("heap-size", 64.0f) * 1024.0f * 1024.0f);
+    settings.defragmentationThreshold = commandLine.GetOption("threshold", settings.defragmentationThreshold);
+
+    PoolModel model{ ASMemoryPool(settings), {}, {} };
+    std::mt19937 generator(1);
+
+    // Bottom levels from a few hundred bytes to 16 MB, most of them small
+    std::uniform_real_distribution<float> logSize(std::log(200.0f), std::log(16.0f * 1024.0f * 1024.0f));
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    uint32_t defragmentations = 0;
+    uint32_t heapsReleased = 0;
+    uint32_t peakHeaps = 0;
+    uint64_t movedBytes = 0;
+    double poolSeconds = 0.0;
+    std::vector<uint32_t> live;
+
+    for (uint32_t operation = 0; operation < operations; operation++)
+    {
+        // Grow to the target, then churn around it
+        const bool allocate = live.empty() || (live.size() < targetLive ? uniform(generator) < 0.7f : uniform(generator) < 0.5f);
+        const auto start = std::chrono::steady_clock::now();
+
+        if (allocate)
+        {
+            const ASAllocation allocation = model.pool.Allocate(static_cast<uint64_t>(std::exp(logSize(generator))));
+            model.allocations[allocation.id] = allocation;
+            live.push_back(allocation.id);
+        }
+        else
+        {
+            const size_t index = std::uniform_int_distribution<size_t>(0, live.size() - 1)(generator);
+            model.pool.Free(live[index]);
+            model.allocations.erase(live[index]);
+            live[index] = live.back();
+            live.pop_back();
+        }
+
+        poolSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        peakHeaps = (std::max)(peakHeaps, model.pool.GetStats().heaps);
+
+        if (operation % 1000 == 999 && model.pool.NeedsDefragmentation())
+        {
+            const uint32_t heapsBefore = model.pool.GetStats().heaps;
+            model.PlanDefragmentation();
+
+            if (!model.pending.empty())
+            {
+                movedBytes += model.CompleteDefragmentation();
+                defragmentations++;
+                heapsReleased += heapsBefore - model.pool.GetStats().heaps;
+            }
+        }
+
+        if (operation % 10000 == 9999)
+        {
+            model.Check();
+        }
+    }
+
+    model.Check();
+
+    const ASPoolStats stats = model.pool.GetStats();
+    uint64_t committedBytes = 0;
+
+    for (const auto& entry : model.allocations)
+    {
+        // D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT, the granularity of committed buffers
+        committedBytes += (entry.second.size + 65535) & ~65535ull;
+    }
+
+    printf("%u operations, %.3f us each, %u live structures of %.1f MB\n", operations, poolSeconds * 1e6 / (std::max)(1u, operations),
+           stats.allocations, stats.allocatedBytes / (1024.0 * 1024.0));
+    printf("%u heaps of %.1f MB (peak %u), fragmentation %.2f, largest free block %.1f MB\n", stats.heaps,
+           stats.reservedBytes / (1024.0 * 1024.0), peakHeaps, stats.fragmentation, stats.largestFreeBlock / (1024.0 * 1024.0));
+    printf("%u defragmentations moved %.1f MB and released %u heaps\n", defragmentations, movedBytes / (1024.0 * 1024.0), heapsReleased);
+    printf("committed resources would take %.1f MB, %.1f MB of it rounding to 64 KB\n", committedBytes / (1024.0 * 1024.0),
+           (committedBytes - stats.allocatedBytes) / (1024.0 * 1024.0));
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-instances [--instances N] [--iterations N] [--threads N]
+//
+// Times writing top-level instance descriptors the way TopLevelASGenerator::Generate
+// used to, clearing the buffer and filling fields one at a time, against
+// InstanceDescPacker on one thread and on all of them, and checks that every byte
+// matches.
+//
+int BenchInstancesCommand(const CommandLine& commandLine)
+{
+    const uint32_t count = commandLine.GetOption("instances", 1000000u);
+    const uint32_t iterations = (std::max)(1u, commandLine.GetOption("iterations", 5u));
+    const uint32_t threads = commandLine.GetOption("threads", 0u);
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> uniform(-100.0f, 100.0f);
+
+    // Affine XMMATRIXes: row vectors, translation in the last row
+    struct alignas(16) Matrix
+    {
+        float m[16];
+    };
+
+    std::vector<Matrix> transforms(count);
+    std::vector<uint32_t> instanceIds(count);
+    std::vector<uint8_t> masks(count);
+    std::vector<uint32_t> hitGroupOffsets(count);
+    std::vector<uint8_t> flags(count);
+    std::vector<uint64_t> accelerationStructures(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        for (uint32_t row = 0; row < 4; row++)
+        {
+            for (uint32_t column = 0; column < 3; column++)
+            {
+                transforms[i].m[row * 4 + column] = uniform(generator);
+            }
+
+            transforms[i].m[row * 4 + 3] = row == 3 ? 1.0f : 0.0f;
+        }
+
+        instanceIds[i] = static_cast<uint32_t>(generator()) & 0xFFFFFF;
+        masks[i] = static_cast<uint8_t>(generator());
+        hitGroupOffsets[i] = static_cast<uint32_t>(generator()) & 0xFFFFFF;
+        flags[i] = static_cast<uint8_t>(generator() & 0xF);
+        accelerationStructures[i] = (static_cast<uint64_t>(generator()) << 32 | generator()) & ~0xFFull;
+    }
+
+    InstanceDescSource source;
+    source.transforms = transforms[0].m;
+    source.instanceIds = instanceIds.data();
+    source.masks = masks.data();
+    source.hitGroupOffsets = hitGroupOffsets.data();
+    source.flags = flags.data();
+    source.accelerationStructures = accelerationStructures.data();
+
+    std::vector<ReferenceInstanceDesc> referenceDescs(count);
+    std::vector<PackedInstanceDesc> packedDescs(count);
+
+    auto time = [&](const std::function<void()>& pack)
+    {
+        double best = 1e30;
+
+        for (uint32_t iteration = 0; iteration < iterations; iteration++)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            pack();
+            best = (std::min)(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        return best;
+    };
+
+    const double referenceSeconds = time([&]() { PackInstancesReference(source, count, referenceDescs.data()); });
+
+    const double singleSeconds = time([&]() { InstanceDescPacker::Pack(source, count, packedDescs.data(), 1); });
+    const bool singleMatches = memcmp(referenceDescs.data(), packedDescs.data(), sizeof(PackedInstanceDesc) * count) == 0;
+
+    memset(packedDescs.data(), 0xCD, sizeof(PackedInstanceDesc) * count);
+    const double parallelSeconds = time([&]() { InstanceDescPacker::Pack(source, count, packedDescs.data(), threads); });
+    const bool parallelMatches = memcmp(referenceDescs.data(), packedDescs.data(), sizeof(PackedInstanceDesc) * count) == 0;
+
+    const double megabytes = sizeof(PackedInstanceDesc) * static_cast<double>(count) / (1024.0 * 1024.0);
+    printf("%u instances, %.1f MB of descriptors\n", count, megabytes);
+    printf("field by field   %8.2f ms  %7.1f MB/s\n", referenceSeconds * 1000.0, megabytes / referenceSeconds);
+    printf("packed, 1 thread %8.2f ms  %7.1f MB/s  %.2fx  %s\n", singleSeconds * 1000.0, megabytes / singleSeconds,
+           referenceSeconds / singleSeconds, singleMatches ? "identical" : "MISMATCH");
+    printf("packed, threads  %8.2f ms  %7.1f MB/s  %.2fx  %s\n", parallelSeconds * 1000.0, megabytes / parallelSeconds,
+           referenceSeconds / parallelSeconds, parallelMatches ? "identical" : "MISMATCH");
+
+    return singleMatches && parallelMatches ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-dirty-instances [--instances N] [--moving N] [--frames N]
+//
+// Checks DirtyInstanceSet against a plain array of flags over random marks and resizes,
+// then times a frame of top-level descriptor writes with a few instances moving: every
+// descriptor packed, as before, against only the ranges the set collects.
+//
+int BenchDirtyInstancesCommand(const CommandLine& commandLine)
+{
+    const uint32_t count = commandLine.GetOption("instances", 1000000u);
+    const uint32_t moving = (std::min)(count, commandLine.GetOption("moving", 1000u));
+    const uint32_t frames = (std::max)(1u, commandLine.GetOption("frames", 20u));
+
+    std::mt19937 generator(1);
+
+    // Random marks, whole-set marks and resizes, collected now and then
+    DirtyInstanceSet set;
+    std::vector<bool> expected;
+    uint32_t checks = 0;
+
+    for (uint32_t step = 0; step < 200000; step++)
+    {
+        const uint32_t action = generator() % 100;
+
+        if (action < 2)
+        {
+            const uint32_t size = generator() % 300;
+            set.Resize(size);
+            expected.resize(size, true);
+        }
+        else if (action < 3)
+        {
+            set.MarkAll();
+            expected.assign(expected.size(), true);
+        }
+        else if (action < 90)
+        {
+            if (!expected.empty())
+            {
+                const uint32_t index = generator() % expected.size();
+                set.Mark(index);
+                expected[index] = true;
+            }
+        }
+        else
+        {
+            const uint32_t dirtyCount = static_cast<uint32_t>(std::count(expected.begin(), expected.end(), true));
+
+            if (set.GetDirtyCount() != dirtyCount)
+            {
+                printf("step %u: %u dirty instances, expected %u\n", step, set.GetDirtyCount(), dirtyCount);
+                return 1;
+            }
+
+            std::vector<bool> collected(expected.size(), false);
+            uint32_t previousEnd = 0;
+            bool first = true;
+
+            for (const DirtyRange& range : set.CollectRanges())
+            {
+                if (range.begin >= range.end || range.end > expected.size() || (!first && range.begin <= previousEnd))
+                {
+                    printf("step %u: range [%u, %u) is empty, out of bounds, unordered or adjacent to the previous\n", step,
+                           range.begin, range.end);
+                    return 1;
+                }
+
+                for (uint32_t i = range.begin; i < range.end; i++)
+                {
+                    collected[i] = true;
+                }
+
+                previousEnd = range.end;
+                first = false;
+            }
+
+            if (collected != expected)
+            {
+                printf("step %u: collected ranges do not match the marked instances\n", step);
+                return 1;
+            }
+
+            expected.assign(expected.size(), false);
+            checks++;
+        }
+
+        try
+        {
+            set.Validate();
+        }
+        catch (const std::logic_error& error)
+        {
+            printf("step %u: %s\n", step, error.what());
+            return 1;
+        }
+    }
+
+    printf("%u collections checked against the reference\n", checks);
+
+    // A scene of count instances, moving of which change every frame
+    struct alignas(16) Matrix
+    {
+        float m[16];
+    };
+
+    std::uniform_real_distribution<float> uniform(-100.0f, 100.0f);
+    std::vector<Matrix> transforms(count);
+
+    for (Matrix& transform : transforms)
+    {
+        for (float& value : transform.m)
+        {
+            value = uniform(generator);
+        }
+    }
+
+    InstanceDescSource source;
+    source.transforms = transforms[0].m;
+
+    std::vector<PackedInstanceDesc> fullDescs(count);
+    std::vector<PackedInstanceDesc> dirtyDescs(count);
+    InstanceDescPacker::Pack(source, count, dirtyDescs.data(), 1);
+
+    DirtyInstanceSet dirty;
+    dirty.Resize(count);
+    dirty.CollectRanges();
+
+    double fullSeconds = 0.0;
+    double dirtySeconds = 0.0;
+    uint32_t rangeCount = 0;
+
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        for (uint32_t i = 0; i < moving; i++)
+        {
+            const uint32_t index = generator() % count;
+            transforms[index].m[12] += 1.0f;
+            dirty.Mark(index);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        InstanceDescPacker::Pack(source, count, fullDescs.data(), 1);
+        fullSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        const std::vector<DirtyRange>& ranges = dirty.CollectRanges();
+
+        for (const DirtyRange& range : ranges)
+        {
+            for (uint32_t i = range.begin; i < range.end; i++)
+            {
+                InstanceDescPacker::PackInstance(transforms[i].m, 0, 0xFF, 0, 0, 0, dirtyDescs.data() + i);
+            }
+        }
+
+        InstanceDescPacker::Flush();
+        dirtySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rangeCount += static_cast<uint32_t>(ranges.size());
+    }
+
+    const bool matches = memcmp(fullDescs.data(), dirtyDescs.data(), sizeof(PackedInstanceDesc) * count) == 0;
+
+    printf("%u instances, %u moving per frame, %.1f dirty ranges per frame\n", count, moving,
+           rangeCount / static_cast<double>(frames));
+    printf("every descriptor   %8.3f ms per frame\n", fullSeconds * 1000.0 / frames);
+    printf("dirty ranges only  %8.3f ms per frame  %.1fx  %s\n", dirtySeconds * 1000.0 / frames, fullSeconds / dirtySeconds,
+           matches ? "identical" : "MISMATCH");
+
+    return matches ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-bvh-cache [--directory D] [--level N] [--bins N] [--leaf-size N] [--threads N] [--rays N] [<model.obj>...]
+//
+// Loads every mesh through a BvhCache twice, building and saving it the first time and
+// mapping the file the second, with and without verifying the payload. The mapped
+// hierarchy must trace like a fresh build, and damaged, truncated or stale files must be
+// rejected and rebuilt.
+//
+int BenchBvhCacheCommand(const CommandLine& commandLine)
+{
+    std::string directory = commandLine.GetOption("directory");
+
+    if (directory.empty())
+    {
+        directory = (std::filesystem::temp_directory_path() / "BvhCacheBench").string();
+    }
+
+    const uint32_t rayCount = commandLine.GetOption("rays", 100000u);
+    const BvhBuilder::Settings settings = GetBvhSettings(commandLine);
+    const auto meshes = LoadBenchMeshes(commandLine);
+    bool passed = true;
+
+    auto expect = [&](bool condition, const char* what)
+    {
+        if (!condition)
+        {
+            printf("  FAILED: %s\n", what);
+            passed = false;
+        }
+    };
+
+    // Whether opening path throws
+    auto isRejected = [](const std::string& path, bool verifyPayload)
+    {
+        BvhCacheFile file;
+
+        try
+        {
+            file.Open(path, verifyPayload);
+            return false;
+        }
+        catch (const std::runtime_error&)
+        {
+            return true;
+        }
+    };
+
+    for (const auto& mesh : meshes)
+    {
+        const BvhGeometry geometry = mesh->GetGeometry();
+        printf("%s: %u triangles\n", mesh->name.c_str(), geometry.GetTriangleCount());
+
+        BvhCache cold(directory);
+        const std::string path = cold.GetPath(BvhCache::HashGeometry(geometry), settings);
+        std::error_code error;
+        std::filesystem::remove(path, error);
+
+        auto start = std::chrono::steady_clock::now();
+        const BvhView built = cold.Load(geometry, settings);
+        const double coldSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        expect(cold.GetStats().builds == 1 && cold.GetStats().unsaved == 0, "the first load builds and saves");
+
+        BvhCache verified(directory);
+        start = std::chrono::steady_clock::now();
+        const BvhView mapped = verified.Load(geometry, settings);
+        const double verifiedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        expect(verified.GetStats().hits == 1, "the second load is a hit");
+
+        BvhCache unverified(directory, false);
+        start = std::chrono::steady_clock::now();
+        const BvhView headerOnly = unverified.Load(geometry, settings);
+        const double unverifiedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        expect(unverified.GetStats().hits == 1 && headerOnly.nodeCount == built.nodeCount, "a load without verification is a hit");
+
+        printf("  build and save %8.2f ms (hash %.2f ms)\n", coldSeconds * 1000.0, cold.GetStats().hashSeconds * 1000.0);
+        printf("  verified load  %8.2f ms (hash %.2f ms)  %.1fx\n", verifiedSeconds * 1000.0, verified.GetStats().hashSeconds * 1000.0,
+               coldSeconds / verifiedSeconds);
+        printf("  mapped load    %8.2f ms (hash %.2f ms)  %.1fx, %.1f MB file\n", unverifiedSeconds * 1000.0,
+               unverified.GetStats().hashSeconds * 1000.0, coldSeconds / unverifiedSeconds,
+               std::filesystem::file_size(path, error) / (1024.0 * 1024.0));
+
+        // The mapped hierarchy against a fresh build of the same triangles
+        Bvh reference;
+        BvhBuilder(settings).Build(geometry, reference);
+
+        std::vector<BvhRay> rays;
+        GetRandomRays(reference.GetBounds(), rayCount, rays);
+        uint32_t mismatches = 0;
+
+        for (const BvhRay& ray : rays)
+        {
+            BvhHit expected, hit;
+            reference.Intersect(geometry, ray, expected);
+            mapped.Intersect(geometry, ray, hit);
+
+            if (expected.IsHit() != hit.IsHit() || (hit.IsHit() && expected.t != hit.t) ||
+                reference.IsOccluded(geometry, ray) != mapped.IsOccluded(geometry, ray))
+            {
+                mismatches++;
+            }
+        }
+
+        printf("  %u rays, %u mismatches against a fresh build\n", rayCount, mismatches);
+        expect(mismatches == 0, "the mapped hierarchy traces like a fresh build");
+
+        // Damaged copies of the file
+        std::vector<char> bytes;
+        {
+            std::ifstream file(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+
+        const std::string damagedPath = path + ".damaged";
+
+        auto writeDamaged = [&](const std::vector<char>& damaged)
+        {
+            std::ofstream file(damagedPath, std::ios::binary);
+            file.write(damaged.data(), static_cast<std::streamsize>(damaged.size()));
+        };
+
+        std::vector<char> damaged = bytes;
+        damaged[8] ^= 1;
+        writeDamaged(damaged);
+        expect(isRejected(damagedPath, false), "a damaged header is rejected without verification");
+
+        damaged = bytes;
+        damaged[damaged.size() / 2 + 64] ^= 1;
+        writeDamaged(damaged);
+        expect(isRejected(damagedPath, true), "a damaged payload is rejected with verification");
+
+        damaged.assign(bytes.begin(), bytes.end() - 4);
+        writeDamaged(damaged);
+        expect(isRejected(damagedPath, false), "a truncated file is rejected");
+
+        std::filesystem::remove(damagedPath, error);
+
+        BvhCacheFile file;
+        file.Open(path);
+        BvhBuilder::Settings otherSettings = settings;
+        otherSettings.maxLeafSize++;
+        expect(!file.Matches(BvhCache::HashGeometry(geometry), otherSettings), "other settings do not match");
+        otherSettings = settings;
+        otherSettings.threads = settings.threads + 1;
+        expect(file.Matches(BvhCache::HashGeometry(geometry), otherSettings), "thread counts do not change the key");
+        file.Close();
+
+        // A damaged file in the cache is rebuilt
+        damaged = bytes;
+        damaged[damaged.size() - 1] ^= 1;
+        {
+            std::ofstream damagedFile(path, std::ios::binary);
+            damagedFile.write(damaged.data(), static_cast<std::streamsize>(damaged.size()));
+        }
+
+        BvhCache repaired(directory);
+        repaired.Load(geometry, settings);
+        expect(repaired.GetStats().rejected == 1 && repaired.GetStats().builds == 1, "a damaged cache file is rebuilt");
+        expect(!isRejected(path, true), "the rebuilt file is valid");
+    }
+
+    printf("%s\n", passed ? "all checks passed" : "CHECKS FAILED");
+    return passed ? 0 : 1;
+}
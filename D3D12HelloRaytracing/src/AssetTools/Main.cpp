@@ -0,0 +1,217 @@
+#include "AssetTools.h"
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <string>
+
+namespace
+{
+    const Command kCommands[] = {
+        { "pack", "pack [--resample WxH] <outputPrefix> <texture.dds>...\n"
+                  "    Pack same-format textures into Texture2DArray DDS files and write a remap table",
+          PackTexturesCommand },
+        { "plan-upload", "plan-upload <texture.dds>...\n"
+                         "    Lay out the textures in one staging arena and check the D3D12 alignment rules",
+          PlanUploadCommand },
+        { "dedup", "dedup [--index <file>] <texture.dds>...\n"
+                   "    Group textures with identical content and report the memory sharing them saves",
+          DedupTexturesCommand },
+        { "compress", "compress [--whole] [--no-split] <texture.dds>...\n"
+                      "    Write a .ctex supercompressed copy next to each texture and report the ratios",
+          CompressTexturesCommand },
+        { "bench-decode", "bench-decode [--iterations N] <texture.ctex>...\n"
+                          "    Measure the decode speed of compressed textures, from memory",
+          BenchDecodeCommand },
+        { "prefilter", "prefilter [--samples N] [--mips N] [--threads N] <input.dds> <output.dds>\n"
+                       "    Write the GGX-prefiltered specular mip chain of a cube map, roughness = mip / (mips - 1)",
+          PrefilterEnvironmentCommand },
+        { "bench-prefilter", "bench-prefilter [--size N] [--samples N] [--mips N] [--threads N]\n"
+                             "    Time the prefiltering of a procedural sky, 1024x1024 per face by default",
+          BenchPrefilterCommand },
+        { "sh-project", "sh-project [--max-size N] [--threads N] <cube.dds>\n"
+                        "    Print the L2 spherical harmonics irradiance constants of a cube map",
+          ProjectSHCommand },
+        { "bench-sh", "bench-sh [--size N] [--max-size N] [--threads N] [--iterations N]\n"
+                      "    Time the spherical harmonics projection of a procedural sky and check it",
+          BenchSHCommand },
+        { "env-sample", "env-sample [--size N] [--max-size N] [--threads N] [--samples N] [--verify] [<cube.dds>]\n"
+                        "    Build and time the importance sampling tables of a cube map, --verify checks the PDF",
+          EnvironmentSampleCommand },
+        { "bench-sampler", "bench-sampler [--size N] [--format NAME] [--filter point|bilinear|trilinear] [--address wrap|clamp]\n"
+                           "              [--samples N] [--cube]\n"
+                           "    Time the software texture sampler, one lookup and eight lookups per call",
+          BenchSamplerCommand },
+        { "bench-swizzle", "bench-swizzle [--size N] [--format NAME] [--filter point|bilinear|trilinear] [--lod L] [--samples N]\n"
+                           "    Compare linear and Morton texel storage on random and camera-ordered cube lookups",
+          BenchSwizzleCommand },
+        { "bench-bvh", "bench-bvh [--level N] [--bins N] [--leaf-size N] [--threads N] [--iterations N] [<model.obj>...]\n"
+                       "    Time the binned SAH BVH builder on a Menger sponge of the given level and on models",
+          BenchBvhCommand },
+        { "bench-sbvh", "bench-sbvh [--floors N] [--budget F] [--alpha F] [--bins N] [--leaf-size N] [--threads N]\n"
+                        "           [--width N] [--height N] [--rays N] [<model.obj>]\n"
+                        "    Compare object-split and spatial-split BVHs on the sample scene and an office block",
+          BenchSbvhCommand },
+        { "bench-lbvh", "bench-lbvh [--level N] [--leaf-size N] [--treelet-passes N] [--threads N] [--iterations N]\n"
+                        "           [--rays N] [--wide] [<model.obj>...]\n"
+                        "    Compare linear BVH builds, with and without treelet restructuring, to binned SAH",
+          BenchLbvhCommand },
+        { "bench-bvh8", "bench-bvh8 [--floors N] [--level N] [--leaf-size N] [--width N] [--height N] [<model.obj>]\n"
+                        "    Compare binary and eight-wide BVH traversal on primary, shadow and reflection rays",
+          BenchBvh8Command },
+        { "bench-qbvh", "bench-qbvh [--level N] [--leaf-size N] [--width N] [--height N] [--rays N] [<model.obj>...]\n"
+                        "    Compare eight-wide BVHs with full-precision and quantized nodes on memory and traversal speed",
+          BenchQbvhCommand },
+        { "bench-scene", "bench-scene [--copies N] [--level N] [--width N] [--height N] [<model.obj>]\n"
+                         "    Trace the sample's instanced scene and a grid of instances through the CPU two-level BVH",
+          BenchSceneCommand },
+        { "bench-tlas", "bench-tlas [--instances N] [--frames N] [--moving F] [--threshold F] [--level N] [--rays N]\n"
+                        "    Compare refitting and rebuilding the CPU top level over animated instances",
+          BenchTlasCommand },
+        { "bench-refit", "bench-refit [--size N] [--frames N] [--threshold F] [--threads N] [--leaf-size N] [--rays N]\n"
+                         "    Compare refitting and rebuilding the BVH of a waving cloth",
+          BenchRefitCommand },
+        { "analyze-bvh", "analyze-bvh [--builder binned|sbvh|lbvh|treelet] [--floors N] [--leaf-size N] [--width N] [--height N]\n"
+                         "            [--json report.json] [--heatmap prefix] [--no-epo] [<model.obj>]\n"
+                         "    Report SAH cost, EPO, leaf and depth statistics and per-ray costs of each BVH builder",
+          AnalyzeBvhCommand },
+        { "plan-as-memory", "plan-as-memory --table <file> [--build none|fast-trace|fast-build] [--allow-update] [--compaction]\n"
+                            "               [<model.obj>...]\n"
+                            "    Estimate the acceleration structure memory of the sample scene from a size table recorded\n"
+                            "    by running the sample with -recordASSizes <file>; the flags apply to the bottom levels",
+          PlanASMemoryCommand },
+        { "plan-scratch", "plan-scratch [--builds N] [--budget MB] [--max-size MB] [--trials N]\n"
+                          "    Batch bottom-level builds into a shared scratch arena under a budget and check random plans",
+          PlanScratchCommand },
+        { "check-as-pool", "check-as-pool [--depth N] [--operations N] [--heap-size MB] [--live N] [--threshold F]\n"
+                           "    Check the acceleration structure pool exhaustively on short sequences and at random on long ones",
+          CheckASPoolCommand },
+        { "bench-instances", "bench-instances [--instances N] [--iterations N] [--threads N]\n"
+                             "    Compare writing top-level instance descriptors field by field and with the SIMD packer",
+          BenchInstancesCommand },
+        { "bench-dirty-instances", "bench-dirty-instances [--instances N] [--moving N] [--frames N]\n"
+                                   "    Check the dirty instance set and time descriptor updates proportional to motion",
+          BenchDirtyInstancesCommand },
+        { "bench-bvh-cache", "bench-bvh-cache [--directory D] [--level N] [--bins N] [--leaf-size N] [--threads N] [--rays N] [<model.obj>...]\n"
+                             "    Time building and saving BVHs against mapping them from the cache, and check damaged files are rebuilt",
+          BenchBvhCacheCommand },
+    };
+
+    void PrintUsage()
+    {
+        printf("Usage: AssetTools <command> [options]\n\nCommands:\n");
+
+        for (const auto& command : kCommands)
+        {
+            printf("  %s\n", command.usage);
+        }
+    }
+
+    // Options whose name is in this list are switches and never consume the next argument
+    bool IsFlag(const std::string& name)
+    {
+        static const char* const kFlags[] = { "verify", "whole", "no-split", "cube", "wide", "no-epo", "allow-update", "compaction" };
+
+        for (const char* flag : kFlags)
+        {
+            if (name == flag)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
+
+CommandLine::CommandLine(int argc, char** argv)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        const std::string argument = argv[i];
+
+        if (argument.size() > 2 && argument.compare(0, 2, "--") == 0)
+        {
+            const std::string name = argument.substr(2);
+
+            if (IsFlag(name) || i + 1 == argc)
+            {
+                m_options.emplace_back(name, "");
+            }
+            else
+            {
+                m_options.emplace_back(name, argv[++i]);
+            }
+        }
+        else
+        {
+            m_positional.push_back(argument);
+        }
+    }
+}
+
+bool CommandLine::HasFlag(const std::string& name) const
+{
+    for (const auto& option : m_options)
+    {
+        if (option.first == name)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::string CommandLine::GetOption(const std::string& name, const std::string& defaultValue) const
+{
+    for (const auto& option : m_options)
+    {
+        if (option.first == name)
+        {
+            return option.second;
+        }
+    }
+
+    return defaultValue;
+}
+
+uint32_t CommandLine::GetOption(const std::string& name, uint32_t defaultValue) const
+{
+    const std::string value = GetOption(name, std::string());
+    return value.empty() ? defaultValue : static_cast<uint32_t>(std::stoul(value));
+}
+
+float CommandLine::GetOption(const std::string& name, float defaultValue) const
+{
+    const std::string value = GetOption(name, std::string());
+    return value.empty() ? defaultValue : std::stof(value);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    for (const auto& command : kCommands)
+    {
+        if (strcmp(argv[1], command.name) == 0)
+        {
+            try
+            {
+                return command.function(CommandLine(argc - 2, argv + 2));
+            }
+            catch (const std::exception& e)
+            {
+                fprintf(stderr, "%s: %s\n", command.name, e.what());
+                return 1;
+            }
+        }
+    }
+
+    PrintUsage();
+    return 1;
+}
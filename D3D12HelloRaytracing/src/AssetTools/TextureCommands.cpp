@@ -0,0 +1,1166 @@
+#include "AssetTools.h"
+
+#include "CompressedTexture.h"
+#include "EnvironmentImportanceSampler.h"
+#include "EnvironmentPrefilter.h"
+#include "SphericalHarmonics.h"
+#include "TextureSampler.h"
+#include "TextureArrayPacker.h"
+#include "TextureCache.h"
+#include "TextureUploadPlanner.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+    void ParseSize(const std::string& text, uint32_t& width, uint32_t& height)
+    {
+        const auto separator = text.find('x');
+
+        if (separator == std::string::npos)
+        {
+            throw std::runtime_error("Expected a size like 512x512, got " + text);
+        }
+
+        width = static_cast<uint32_t>(std::stoul(text.substr(0, separator)));
+        height = static_cast<uint32_t>(std::stoul(text.substr(separator + 1)));
+    }
+
+    EnvironmentPrefilter::Settings GetPrefilterSettings(const CommandLine& commandLine)
+    {
+        EnvironmentPrefilter::Settings settings;
+        settings.sampleCount = commandLine.GetOption("samples", settings.sampleCount);
+        settings.mipLevels = commandLine.GetOption("mips", settings.mipLevels);
+        settings.threads = commandLine.GetOption("threads", settings.threads);
+        return settings;
+    }
+
+    // Blue gradient above the horizon, dark ground and a small bright sun, so the
+    // benchmarks do not depend on a particular asset
+    void BuildProceduralSky(uint32_t size, CubeMapImage& sky)
+    {
+        sky.Initialize(size);
+
+        const float sun[3] = { 0.48f, 0.6f, 0.64f };
+
+        for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+        {
+            Texel* texels = sky.GetFace(face);
+
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    float direction[3];
+                    CubeMapImage::GetTexelDirection(face, x, y, size, direction);
+
+                    const float height = direction[1];
+                    const float sunDot = direction[0] * sun[0] + direction[1] * sun[1] + direction[2] * sun[2];
+                    const float sunIntensity = sunDot > 0.999f ? 50.0f : 0.0f;
+
+                    Texel& texel = texels[y * size + x];
+                    texel.r = (height > 0.0f ? 0.3f + 0.2f * (1.0f - height) : 0.1f) + sunIntensity;
+                    texel.g = (height > 0.0f ? 0.5f + 0.2f * (1.0f - height) : 0.08f) + sunIntensity;
+                    texel.b = (height > 0.0f ? 0.9f : 0.05f) + sunIntensity;
+                    texel.a = 1.0f;
+                }
+            }
+        }
+    }
+
+    // Gradients over an 8x8 checker, on every mip of a 2D texture
+    void BuildProceduralTexture(TextureFormat format, uint32_t size, DDSFile& texture)
+    {
+        texture.Initialize(format, size, size, 1, CountMips(size, size), false);
+
+        std::vector<Texel> texels;
+
+        for (uint32_t mip = 0; mip < texture.mipLevels; mip++)
+        {
+            const DDSSubresource& subresource = texture.GetSubresource(mip);
+            const uint32_t width = subresource.width;
+
+            texels.resize(static_cast<size_t>(width) * width);
+
+            for (uint32_t y = 0; y < width; y++)
+            {
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    Texel& texel = texels[static_cast<size_t>(y) * width + x];
+                    texel.r = static_cast<float>(x) / width;
+                    texel.g = static_cast<float>(y) / width;
+                    texel.b = ((x * 8 / width + y * 8 / width) & 1) ? 0.9f : 0.1f;
+                    texel.a = 1.0f / (mip + 1);
+                }
+            }
+
+            EncodeSurface(format, texels.data(), width, width, texture.GetSubresourceData(mip), subresource.rowPitch);
+        }
+    }
+
+    // The procedural sky with its mip chain, as a cube DDS
+    void BuildProceduralCubeTexture(TextureFormat format, uint32_t size, DDSFile& texture)
+    {
+        CubeMapImage sky;
+        BuildProceduralSky(size, sky);
+        sky.BuildMipChain();
+
+        texture.Initialize(format, size, size, CubeMapImage::FaceCount, sky.GetMipCount(), true);
+
+        for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+        {
+            for (uint32_t mip = 0; mip < sky.GetMipCount(); mip++)
+            {
+                const uint32_t index = texture.GetSubresourceIndex(mip, face);
+
+                EncodeSurface(format, sky.GetFace(face, mip), sky.GetSize(mip), sky.GetSize(mip),
+                              texture.GetSubresourceData(index), texture.GetSubresource(index).rowPitch);
+            }
+        }
+    }
+
+    TextureFormat ParseSampledFormat(const std::string& name)
+    {
+        const TextureFormat formats[] = {
+            TextureFormat::R8G8B8A8_UNorm, TextureFormat::R8G8B8A8_UNorm_sRGB, TextureFormat::R16G16B16A16_Float,
+            TextureFormat::R32G32B32A32_Float,
+        };
+
+        for (TextureFormat format : formats)
+        {
+            if (name == GetTextureFormatName(format))
+            {
+                return format;
+            }
+        }
+
+        throw std::runtime_error("Unknown format " + name + ", expected an 8-bit RGBA, RGBA16F or RGBA32F format name");
+    }
+
+    SamplerDesc GetSamplerDesc(const CommandLine& commandLine)
+    {
+        SamplerDesc desc;
+
+        const std::string filter = commandLine.GetOption("filter", "trilinear");
+        const std::string address = commandLine.GetOption("address", "wrap");
+
+        if (filter == "point")
+        {
+            desc.filter = SamplerFilter::Point;
+        }
+        else if (filter == "bilinear")
+        {
+            desc.filter = SamplerFilter::Bilinear;
+        }
+        else if (filter != "trilinear")
+        {
+            throw std::runtime_error("Unknown filter " + filter);
+        }
+
+        if (address == "clamp")
+        {
+            desc.addressMode = SamplerAddressMode::Clamp;
+        }
+        else if (address != "wrap")
+        {
+            throw std::runtime_error("Unknown address mode " + address);
+        }
+
+        return desc;
+    }
+
+    // Set-associative LRU cache with 64-byte lines, to count misses the same way on every
+    // machine
+    class CacheModel
+    {
+    public:
+        CacheModel(size_t size, uint32_t ways)
+            : m_setCount(static_cast<uint32_t>(size / 64 / ways)), m_ways(ways),
+              m_lines(static_cast<size_t>(m_setCount) * ways, ~0ull), m_lastUse(m_lines.size(), 0)
+        {
+        }
+
+        /// Returns true on a hit
+        bool Access(uint64_t address)
+        {
+            const uint64_t line = address >> 6;
+            const size_t set = static_cast<size_t>(line % m_setCount) * m_ways;
+            size_t victim = set;
+
+            m_clock++;
+
+            for (size_t way = set; way < set + m_ways; way++)
+            {
+                if (m_lines[way] == line)
+                {
+                    m_lastUse[way] = m_clock;
+                    return true;
+                }
+
+                if (m_lastUse[way] < m_lastUse[victim])
+                {
+                    victim = way;
+                }
+            }
+
+            m_lines[victim] = line;
+            m_lastUse[victim] = m_clock;
+            return false;
+        }
+
+    private:
+        uint32_t m_setCount;
+        uint32_t m_ways;
+        std::vector<uint64_t> m_lines;
+        std::vector<uint64_t> m_lastUse;
+        uint64_t m_clock = 0;
+    };
+
+    EnvironmentSHProjector::Settings GetSHSettings(const CommandLine& commandLine)
+    {
+        EnvironmentSHProjector::Settings settings;
+        settings.maxSize = commandLine.GetOption("max-size", settings.maxSize);
+        settings.threads = commandLine.GetOption("threads", settings.threads);
+        return settings;
+    }
+
+    void PrintLightingConstants(const EnvironmentLightingConstants& constants)
+    {
+        for (uint32_t i = 0; i < SHCoefficients::Count; i++)
+        {
+            printf("  c%u  %9.5f %9.5f %9.5f\n", i, constants.coefficients[i][0], constants.coefficients[i][1],
+                   constants.coefficients[i][2]);
+        }
+    }
+
+    void PrintPrefilterStats(const EnvironmentPrefilter& prefilter, uint32_t size, uint32_t mipLevels)
+    {
+        const auto& stats = prefilter.GetStats();
+
+        printf("%ux%u per face, %u mips: %.2f s, %.1f M samples/s\n", size, size, mipLevels,
+               stats.seconds, stats.samples / stats.seconds / 1e6);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//
+// pack [--resample WxH] <outputPrefix> <texture.dds>...
+//
+int PackTexturesCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.size() < 2)
+    {
+        throw std::runtime_error("Expected an output prefix and at least one texture");
+    }
+
+    TextureArrayPacker::Settings settings;
+    const std::string resample = commandLine.GetOption("resample");
+
+    if (!resample.empty())
+    {
+        ParseSize(resample, settings.resampleWidth, settings.resampleHeight);
+    }
+
+    TextureArrayPacker packer(settings);
+
+    for (size_t i = 1; i < positional.size(); i++)
+    {
+        packer.AddTexture(positional[i]);
+    }
+
+    packer.Pack(positional[0]);
+
+    for (const auto& warning : packer.GetWarnings())
+    {
+        printf("warning: %s\n", warning.c_str());
+    }
+
+    const auto& remapTable = packer.GetRemapTable();
+
+    for (size_t i = 0; i < remapTable.arrays.size(); i++)
+    {
+        printf("%s:\n", remapTable.arrays[i].c_str());
+
+        for (const auto& entry : remapTable.textures)
+        {
+            if (entry.arrayIndex == i)
+            {
+                printf("  [%u] %s\n", entry.slice, entry.name.c_str());
+            }
+        }
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// plan-upload <texture.dds>...
+//
+int PlanUploadCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.empty())
+    {
+        throw std::runtime_error("Expected at least one texture");
+    }
+
+    TextureUploadPlanner planner;
+    uint64_t payloadBytes = 0;
+
+    for (const auto& path : positional)
+    {
+        DDSFile file;
+        file.Load(path);
+
+        TextureUploadDesc desc;
+        desc.format = file.format;
+        desc.width = file.width;
+        desc.height = file.height;
+        desc.arraySize = file.arraySize;
+        desc.mipLevels = file.mipLevels;
+
+        planner.AddTexture(desc);
+        payloadBytes += file.data.size();
+    }
+
+    planner.Validate();
+
+    for (const auto& copy : planner.GetCopies())
+    {
+        printf("%-32s sub %3u  offset %10llu  pitch %6u  %4ux%-4u rows %4u\n",
+               positional[copy.texture].c_str(), copy.subresource,
+               static_cast<unsigned long long>(copy.offset), copy.rowPitch, copy.width, copy.height, copy.numRows);
+    }
+
+    printf("%zu copies, arena %llu bytes for %llu bytes of texel data (%.1f%% padding)\n",
+           planner.GetCopies().size(), static_cast<unsigned long long>(planner.GetArenaSize()),
+           static_cast<unsigned long long>(payloadBytes),
+           100.0 * (planner.GetArenaSize() - payloadBytes) / planner.GetArenaSize());
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// dedup [--index <file>] <texture.dds>...
+//
+int DedupTexturesCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.empty())
+    {
+        throw std::runtime_error("Expected at least one texture");
+    }
+
+    const std::string indexPath = commandLine.GetOption("index");
+
+    TextureCache cache;
+
+    if (!indexPath.empty())
+    {
+        cache.LoadIndex(indexPath);
+    }
+
+    std::vector<std::vector<std::string>> groups;
+
+    for (const auto& path : positional)
+    {
+        bool created = false;
+        const uint32_t handle = cache.Acquire(path, created);
+
+        if (handle >= groups.size())
+        {
+            groups.resize(handle + 1);
+        }
+
+        groups[handle].push_back(path);
+    }
+
+    for (uint32_t handle = 0; handle < groups.size(); handle++)
+    {
+        printf("%016llx  %s\n", static_cast<unsigned long long>(cache.GetHash(handle)), groups[handle][0].c_str());
+
+        for (size_t i = 1; i < groups[handle].size(); i++)
+        {
+            printf("                  = %s\n", groups[handle][i].c_str());
+        }
+    }
+
+    if (!indexPath.empty())
+    {
+        cache.SaveIndex(indexPath);
+    }
+
+    const TextureCacheStats stats = cache.GetStats();
+
+    printf("%u textures, %u unique, %u duplicates: %llu bytes saved of %llu\n",
+           stats.requests, stats.uniqueTextures, stats.duplicates,
+           static_cast<unsigned long long>(stats.savedBytes),
+           static_cast<unsigned long long>(stats.uniqueBytes + stats.savedBytes));
+    printf("%u hashes from the index, %u files hashed (%llu bytes)\n",
+           stats.indexHits, stats.filesHashed, static_cast<unsigned long long>(stats.bytesHashed));
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// compress [--whole] [--no-split] <texture.dds>...
+//
+int CompressTexturesCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.empty())
+    {
+        throw std::runtime_error("Expected at least one texture");
+    }
+
+    CompressedTextureFile::Settings settings;
+    settings.chunkPerSubresource = !commandLine.HasFlag("whole");
+    settings.splitBlocks = !commandLine.HasFlag("no-split");
+
+    uint64_t totalPayload = 0;
+    uint64_t totalCompressed = 0;
+
+    for (const auto& path : positional)
+    {
+        DDSFile texture;
+        texture.Load(path);
+
+        const std::string outputPath = path.substr(0, path.find_last_of('.')) + ".ctex";
+        CompressedTextureFile::Save(texture, outputPath, settings);
+
+        // Read the result back, so a broken file never goes unnoticed
+        CompressedTextureFile compressed;
+        compressed.Open(outputPath);
+
+        DDSFile decoded;
+        compressed.Load(decoded);
+
+        if (decoded.data != texture.data)
+        {
+            throw std::runtime_error("Round trip mismatch for " + outputPath);
+        }
+
+        uint64_t compressedSize = 0;
+
+        for (const auto& chunk : compressed.GetChunks())
+        {
+            compressedSize += chunk.compressedSize;
+        }
+
+        printf("%-32s %-10s %10zu -> %10llu bytes (%5.1f%%), %zu chunks\n",
+               outputPath.c_str(), GetTextureFormatName(texture.format), texture.data.size(),
+               static_cast<unsigned long long>(compressedSize), 100.0 * compressedSize / texture.data.size(),
+               compressed.GetChunks().size());
+
+        totalPayload += texture.data.size();
+        totalCompressed += compressedSize;
+    }
+
+    printf("total %llu -> %llu bytes (%.1f%%)\n", static_cast<unsigned long long>(totalPayload),
+           static_cast<unsigned long long>(totalCompressed), 100.0 * totalCompressed / totalPayload);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-decode [--iterations N] <texture.ctex>...
+//
+int BenchDecodeCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.empty())
+    {
+        throw std::runtime_error("Expected at least one compressed texture");
+    }
+
+    const uint32_t iterations = commandLine.GetOption("iterations", 20u);
+
+    for (const auto& path : positional)
+    {
+        CompressedTextureFile compressed;
+        compressed.Open(path);
+
+        // Decode from memory, so the numbers measure the decoder and not the disk
+        std::ifstream file(path, std::ios::binary);
+        const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        const DDSFile& info = compressed.GetInfo();
+        std::vector<uint8_t> payload(info.GetPayloadSize());
+        std::vector<uint8_t> scratch;
+
+        const auto start = std::chrono::steady_clock::now();
+
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            for (const auto& chunk : compressed.GetChunks())
+            {
+                compressed.DecodeChunk(chunk, bytes.data() + chunk.offset,
+                                       payload.data() + info.GetSubresource(chunk.firstSubresource).offset, scratch);
+            }
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%-32s %10zu -> %10zu bytes (%5.1f%%), decode %8.1f MB/s (%.3f ms per texture)\n",
+               path.c_str(), payload.size(), bytes.size(), 100.0 * bytes.size() / payload.size(),
+               static_cast<double>(payload.size()) * iterations / seconds / (1024.0 * 1024.0),
+               seconds * 1000.0 / iterations);
+    }
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// prefilter [--samples N] [--mips N] [--threads N] <input.dds> <output.dds>
+//
+int PrefilterEnvironmentCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.size() != 2)
+    {
+        throw std::runtime_error("Expected an input and an output cube map");
+    }
+
+    DDSFile source;
+    source.Load(positional[0]);
+
+    EnvironmentPrefilter prefilter(GetPrefilterSettings(commandLine));
+
+    DDSFile output;
+    prefilter.Prefilter(source, output);
+    output.Save(positional[1]);
+
+    for (uint32_t mip = 0; mip < output.mipLevels; mip++)
+    {
+        printf("  mip %2u  %4ux%-4u roughness %.3f\n", mip, output.GetSubresource(mip).width,
+               output.GetSubresource(mip).height, EnvironmentPrefilter::GetMipRoughness(mip, output.mipLevels));
+    }
+
+    PrintPrefilterStats(prefilter, output.width, output.mipLevels);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-prefilter [--size N] [--samples N] [--mips N] [--threads N]
+//
+int BenchPrefilterCommand(const CommandLine& commandLine)
+{
+    const uint32_t size = commandLine.GetOption("size", 1024u);
+
+    CubeMapImage sky;
+    BuildProceduralSky(size, sky);
+
+    EnvironmentPrefilter prefilter(GetPrefilterSettings(commandLine));
+
+    DDSFile output;
+    prefilter.Prefilter(sky, output);
+
+    PrintPrefilterStats(prefilter, size, output.mipLevels);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// sh-project [--max-size N] [--threads N] <cube.dds>
+//
+int ProjectSHCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+
+    if (positional.size() != 1)
+    {
+        throw std::runtime_error("Expected one cube map");
+    }
+
+    DDSFile texture;
+    texture.Load(positional[0]);
+
+    CubeMapImage environment;
+    environment.Load(texture);
+    environment.BuildMipChain();
+
+    EnvironmentSHProjector projector(GetSHSettings(commandLine));
+
+    SHCoefficients radiance;
+    projector.Project(environment, radiance);
+
+    EnvironmentLightingConstants constants;
+    EnvironmentSHProjector::GetLightingConstants(radiance, constants);
+
+    printf("EnvironmentLighting constants (irradiance / pi):\n");
+    PrintLightingConstants(constants);
+    printf("%ux%u per face: %.3f ms\n", projector.GetStats().size, projector.GetStats().size, projector.GetStats().seconds * 1000.0);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-sh [--size N] [--max-size N] [--threads N] [--iterations N]
+//
+// Also checks the L2 irradiance against a brute-force cosine integral along the axes
+//
+int BenchSHCommand(const CommandLine& commandLine)
+{
+    const uint32_t size = commandLine.GetOption("size", 1024u);
+    const uint32_t iterations = (std::max)(1u, commandLine.GetOption("iterations", 20u));
+
+    CubeMapImage sky;
+    BuildProceduralSky(size, sky);
+
+    auto start = std::chrono::steady_clock::now();
+    sky.BuildMipChain();
+    const double mipSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    EnvironmentSHProjector projector(GetSHSettings(commandLine));
+    SHCoefficients radiance;
+    double bestSeconds = 1e30;
+
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+        projector.Project(sky, radiance);
+        bestSeconds = (std::min)(bestSeconds, projector.GetStats().seconds);
+    }
+
+    EnvironmentLightingConstants constants;
+    EnvironmentSHProjector::GetLightingConstants(radiance, constants);
+
+    PrintLightingConstants(constants);
+
+    // Reference irradiance / pi from the same mip
+    const uint32_t projectedSize = projector.GetStats().size;
+    uint32_t mip = 0;
+
+    while (sky.GetSize(mip) != projectedSize)
+    {
+        mip++;
+    }
+
+    const float axes[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+
+    for (const auto& axis : axes)
+    {
+        double reference[3] = {};
+
+        for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+        {
+            const Texel* texels = sky.GetFace(face, mip);
+
+            for (uint32_t y = 0; y < projectedSize; y++)
+            {
+                for (uint32_t x = 0; x < projectedSize; x++)
+                {
+                    float direction[3];
+                    CubeMapImage::GetTexelDirection(face, x, y, projectedSize, direction);
+
+                    const float cosine = direction[0] * axis[0] + direction[1] * axis[1] + direction[2] * axis[2];
+
+                    if (cosine > 0.0f)
+                    {
+                        const double weight = cosine * CubeMapImage::GetTexelSolidAngle(x, y, projectedSize) / 3.14159265358979;
+                        const Texel& texel = texels[y * projectedSize + x];
+
+                        reference[0] += texel.r * weight;
+                        reference[1] += texel.g * weight;
+                        reference[2] += texel.b * weight;
+                    }
+                }
+            }
+        }
+
+        float color[3];
+        EnvironmentSHProjector::EvaluateLighting(constants, axis, color);
+
+        printf("  (%2.0f %2.0f %2.0f)  SH %.4f %.4f %.4f  reference %.4f %.4f %.4f\n", axis[0], axis[1], axis[2],
+               color[0], color[1], color[2], reference[0], reference[1], reference[2]);
+    }
+
+    printf("%ux%u per face, projected at %ux%u: %.3f ms (mip chain %.1f ms, done once per environment)\n",
+           size, size, projectedSize, projectedSize, bestSeconds * 1000.0, mipSeconds * 1000.0);
+
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// env-sample [--size N] [--max-size N] [--threads N] [--samples N] [--verify] [<cube.dds>]
+//
+// Builds the importance sampling tables of a cube map, or of a procedural sky of
+// --size texels per face, and times sampling. --verify checks the PDF against a
+// brute-force integration and the histogram of drawn directions.
+//
+int EnvironmentSampleCommand(const CommandLine& commandLine)
+{
+    const auto& positional = commandLine.GetPositional();
+    const uint32_t sampleCount = commandLine.GetOption("samples", 4000000u);
+
+    CubeMapImage environment;
+
+    if (positional.empty())
+    {
+        BuildProceduralSky(commandLine.GetOption("size", 1024u), environment);
+    }
+    else
+    {
+        DDSFile texture;
+        texture.Load(positional[0]);
+        environment.Load(texture);
+    }
+
+    environment.BuildMipChain();
+
+    EnvironmentImportanceSampler::Settings settings;
+    settings.maxSize = commandLine.GetOption("max-size", settings.maxSize);
+    settings.threads = commandLine.GetOption("threads", settings.threads);
+
+    EnvironmentImportanceSampler sampler(settings);
+    sampler.Build(environment);
+
+    const uint32_t size = sampler.GetSize();
+
+    printf("%ux%u per face: built in %.2f ms, %.2f MB\n", size, size, sampler.GetStats().seconds * 1000.0,
+           sampler.GetMemorySize() / (1024.0 * 1024.0));
+
+    // The same mip the tables were built from
+    uint32_t mip = 0;
+
+    while (environment.GetSize(mip) != size)
+    {
+        mip++;
+    }
+
+    auto getLuminance = [&](const float direction[3])
+    {
+        const Texel texel = environment.Sample(direction, static_cast<float>(mip));
+        return 0.2126f * texel.r + 0.7152f * texel.g + 0.0722f * texel.b;
+    };
+
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    std::vector<float> randoms(static_cast<size_t>(sampleCount) * 2);
+
+    for (float& random : randoms)
+    {
+        random = (std::min)(uniform(generator), 0.99999994f);
+    }
+
+    // Importance sampled and uniform estimates of the integral of luminance over the sphere
+    double sum = 0.0, sumSquares = 0.0;
+    double uniformSum = 0.0, uniformSumSquares = 0.0;
+    double pdfSum = 0.0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        float direction[3];
+        pdfSum += sampler.Sample(randoms[i * 2], randoms[i * 2 + 1], direction);
+    }
+
+    const double sampleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%u samples in %.1f ms: %.1f M samples/s (pdf sum %g)\n", sampleCount, sampleSeconds * 1000.0,
+           sampleCount / sampleSeconds / 1e6, pdfSum);
+
+    const uint32_t estimateCount = (std::min)(sampleCount, 1000000u);
+
+    for (uint32_t i = 0; i < estimateCount; i++)
+    {
+        float direction[3];
+        const float pdf = sampler.Sample(randoms[i * 2], randoms[i * 2 + 1], direction);
+        const double value = pdf > 0.0f ? getLuminance(direction) / pdf : 0.0;
+
+        sum += value;
+        sumSquares += value * value;
+
+        // Uniform on the sphere from the same numbers
+        const float z = 1.0f - 2.0f * randoms[i * 2];
+        const float radius = std::sqrt((std::max)(0.0f, 1.0f - z * z));
+        const float phi = 2.0f * 3.14159265f * randoms[i * 2 + 1];
+        const float uniformDirection[3] = { radius * std::cos(phi), radius * std::sin(phi), z };
+        const double uniformValue = getLuminance(uniformDirection) * 4.0 * 3.14159265358979;
+
+        uniformSum += uniformValue;
+        uniformSumSquares += uniformValue * uniformValue;
+    }
+
+    const double mean = sum / estimateCount;
+    const double variance = sumSquares / estimateCount - mean * mean;
+    const double uniformMean = uniformSum / estimateCount;
+    const double uniformVariance = uniformSumSquares / estimateCount - uniformMean * uniformMean;
+
+    printf("Luminance integral: importance %.4f (variance %.4g), uniform %.4f (variance %.4g), %.1fx less variance\n",
+           mean, variance, uniformMean, uniformVariance, uniformVariance / (std::max)(variance, 1e-30));
+
+    if (!commandLine.HasFlag("verify"))
+    {
+        return 0;
+    }
+
+    bool passed = true;
+
+    // 1. The PDF integrates to 1, on a grid four times finer than the tables
+    const uint32_t fineSize = size * 4;
+    const uint32_t binSize = (std::min)(size, 8u);
+    const uint32_t binsPerRow = size / binSize;
+    std::vector<double> binExpected(static_cast<size_t>(binsPerRow) * binsPerRow * CubeMapImage::FaceCount);
+    double integral = 0.0;
+
+    for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+    {
+        for (uint32_t y = 0; y < fineSize; y++)
+        {
+            for (uint32_t x = 0; x < fineSize; x++)
+            {
+                float direction[3];
+                CubeMapImage::GetTexelDirection(face, x, y, fineSize, direction);
+
+                const double probability = sampler.GetPdf(direction) * static_cast<double>(CubeMapImage::GetTexelSolidAngle(x, y, fineSize));
+
+                integral += probability;
+                binExpected[(face * binsPerRow + y / 4 / binSize) * binsPerRow + x / 4 / binSize] += probability;
+            }
+        }
+    }
+
+    const bool normalized = std::fabs(integral - 1.0) < 1e-3;
+    passed = passed && normalized;
+
+    printf("PDF integral over the sphere: %.6f %s\n", integral, normalized ? "ok" : "FAILED");
+
+    // 2. Sample() returns the density GetPdf() reports for the same direction. Points
+    //    exactly on a texel edge may round to the neighbour, allow a few.
+    std::vector<uint32_t> binCounts(binExpected.size());
+    uint32_t mismatches = 0;
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        float direction[3];
+        const float pdf = sampler.Sample(randoms[i * 2], randoms[i * 2 + 1], direction);
+
+        if (std::fabs(pdf - sampler.GetPdf(direction)) > 1e-3f * pdf)
+        {
+            mismatches++;
+        }
+
+        uint32_t face;
+        float u, v;
+        CubeMapImage::GetFaceCoordinates(direction, face, u, v);
+
+        const uint32_t x = (std::min)(static_cast<uint32_t>(u * size), size - 1);
+        const uint32_t y = (std::min)(static_cast<uint32_t>(v * size), size - 1);
+
+        binCounts[(face * binsPerRow + y / binSize) * binsPerRow + x / binSize]++;
+    }
+
+    const bool consistent = mismatches <= sampleCount / 1000;
+    passed = passed && consistent;
+
+    printf("Sample() and GetPdf() disagree on %u of %u directions %s\n", mismatches, sampleCount, consistent ? "ok" : "FAILED");
+
+    // 3. Drawn directions follow the integrated PDF, over blocks of texels
+    double worstDeviation = 0.0;
+
+    for (size_t bin = 0; bin < binExpected.size(); bin++)
+    {
+        const double expected = binExpected[bin] * sampleCount;
+
+        if (expected >= 20.0)
+        {
+            worstDeviation = (std::max)(worstDeviation, std::fabs(binCounts[bin] - expected) / std::sqrt(expected));
+        }
+    }
+
+    const bool distributed = worstDeviation < 5.0;
+    passed = passed && distributed;
+
+    printf("Worst histogram deviation over %zu blocks: %.2f sigma %s\n", binExpected.size(), worstDeviation, distributed ? "ok" : "FAILED");
+
+    return passed ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-sampler [--size N] [--format NAME] [--filter point|bilinear|trilinear]
+//               [--address wrap|clamp] [--samples N] [--cube]
+//
+// Samples a procedural texture at random coordinates and mips, one lookup at a time
+// and eight at a time, and checks that both agree
+//
+int BenchSamplerCommand(const CommandLine& commandLine)
+{
+    const uint32_t size = commandLine.GetOption("size", 1024u);
+    const uint32_t sampleCount = commandLine.GetOption("samples", 4000000u) / TextureSampler::BatchSize * TextureSampler::BatchSize;
+    const TextureFormat format = ParseSampledFormat(commandLine.GetOption("format", "R8G8B8A8_UNORM_SRGB"));
+    const bool cube = commandLine.HasFlag("cube");
+
+    DDSFile texture;
+
+    if (cube)
+    {
+        BuildProceduralCubeTexture(format, size, texture);
+    }
+    else
+    {
+        BuildProceduralTexture(format, size, texture);
+    }
+
+    TextureSampler sampler(texture, GetSamplerDesc(commandLine));
+
+    // Coordinates outside [0, 1] exercise the address modes, lods outside the chain the clamping
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<float> coordinate(-1.5f, 2.5f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> lod(-0.5f, texture.mipLevels + 0.5f);
+
+    std::vector<float> x(sampleCount), y(sampleCount), z(sampleCount), lods(sampleCount);
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        x[i] = cube ? direction(generator) : coordinate(generator);
+        y[i] = cube ? direction(generator) : coordinate(generator);
+        z[i] = direction(generator);
+        lods[i] = lod(generator);
+    }
+
+    std::vector<Texel> scalarResults(sampleCount);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        const float vector[3] = { x[i], y[i], z[i] };
+        scalarResults[i] = cube ? sampler.SampleCube(vector, lods[i]) : sampler.Sample(x[i], y[i], lods[i]);
+    }
+
+    const double scalarSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<TexelBlock8> batchResults(sampleCount / TextureSampler::BatchSize);
+
+    start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < sampleCount; i += TextureSampler::BatchSize)
+    {
+        TexelBlock8& result = batchResults[i / TextureSampler::BatchSize];
+
+        if (cube)
+        {
+            sampler.SampleCube(&x[i], &y[i], &z[i], &lods[i], result);
+        }
+        else
+        {
+            sampler.Sample(&x[i], &y[i], &lods[i], result);
+        }
+    }
+
+    const double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    float maxDifference = 0.0f;
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        const TexelBlock8& block = batchResults[i / TextureSampler::BatchSize];
+        const uint32_t lane = i % TextureSampler::BatchSize;
+        const Texel& expected = scalarResults[i];
+
+        maxDifference = (std::max)(maxDifference, std::fabs(block.r[lane] - expected.r));
+        maxDifference = (std::max)(maxDifference, std::fabs(block.g[lane] - expected.g));
+        maxDifference = (std::max)(maxDifference, std::fabs(block.b[lane] - expected.b));
+        maxDifference = (std::max)(maxDifference, std::fabs(block.a[lane] - expected.a));
+    }
+
+    printf("%s %s %ux%u, %u mips: %u samples\n", cube ? "Cube" : "2D", GetTextureFormatName(format), size, size,
+           texture.mipLevels, sampleCount);
+    printf("  scalar   %7.1f M samples/s\n", sampleCount / scalarSeconds / 1e6);
+    printf("  batched  %7.1f M samples/s (%.1fx), max difference %g\n", sampleCount / batchSeconds / 1e6,
+           scalarSeconds / batchSeconds, maxDifference);
+
+    return maxDifference < 1e-4f ? 0 : 1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// bench-swizzle [--size N] [--format NAME] [--filter point|bilinear|trilinear] [--lod L] [--samples N]
+//
+// Samples a procedural cube map from linear and Morton storage, with random directions
+// and with the scanline-ordered directions of a camera. Reports batched throughput and
+// the misses of a modelled 32 KB L1 and 1 MB L2 on the mip 0 bilinear footprints.
+//
+int BenchSwizzleCommand(const CommandLine& commandLine)
+{
+    const uint32_t size = commandLine.GetOption("size", 1024u);
+    const uint32_t sampleCount = commandLine.GetOption("samples", 4194304u) / TextureSampler::BatchSize * TextureSampler::BatchSize;
+    const TextureFormat format = ParseSampledFormat(commandLine.GetOption("format", "R8G8B8A8_UNORM_SRGB"));
+    const float lod = commandLine.GetOption("lod", 0.0f);
+
+    DDSFile texture;
+    BuildProceduralCubeTexture(format, size, texture);
+
+    // Conversion round trip
+    {
+        const DDSSubresource& subresource = texture.GetSubresource(0);
+        const uint32_t bytesPerTexel = GetBytesPerBlock(format);
+
+        std::vector<uint8_t> swizzled(GetMortonSurfaceTexels(subresource.width, subresource.height) * bytesPerTexel);
+        std::vector<uint8_t> linear(subresource.slicePitch);
+
+        SwizzleSurface(texture.GetSubresourceData(0), subresource.rowPitch, subresource.width, subresource.height, bytesPerTexel, swizzled.data());
+        UnswizzleSurface(swizzled.data(), subresource.width, subresource.height, bytesPerTexel, linear.data(), subresource.rowPitch);
+
+        if (memcmp(linear.data(), texture.GetSubresourceData(0), linear.size()) != 0)
+        {
+            throw std::runtime_error("Morton round trip changed the texels");
+        }
+    }
+
+    SamplerDesc desc = GetSamplerDesc(commandLine);
+    TextureSampler linearSampler(texture, desc);
+    desc.layout = TexelLayout::Morton;
+    TextureSampler mortonSampler(texture, desc);
+
+    // Random directions, then a 90 degree camera looking at a random direction, one
+    // image row after another
+    std::mt19937 generator(1);
+    std::normal_distribution<float> gaussian;
+
+    std::vector<float> random[3], camera[3];
+    const std::vector<float> lods(sampleCount, lod);
+
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        random[axis].resize(sampleCount);
+        camera[axis].resize(sampleCount);
+    }
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        random[0][i] = gaussian(generator);
+        random[1][i] = gaussian(generator);
+        random[2][i] = gaussian(generator);
+    }
+
+    const uint32_t imageSize = static_cast<uint32_t>(std::sqrt(static_cast<double>(sampleCount)));
+    const float forward[3] = { 0.3f, 0.2f, 0.93f };
+    const float right[3] = { 0.95f, 0.0f, -0.31f };
+    const float up[3] = { -0.06f, 0.98f, -0.19f };
+
+    for (uint32_t i = 0; i < sampleCount; i++)
+    {
+        const float px = 2.0f * ((i % imageSize) + 0.5f) / imageSize - 1.0f;
+        const float py = 1.0f - 2.0f * ((i / imageSize % imageSize) + 0.5f) / imageSize;
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            camera[axis][i] = forward[axis] + px * right[axis] + py * up[axis];
+        }
+    }
+
+    printf("Cube %s %ux%u, %u lookups per pattern at lod %.1f\n", GetTextureFormatName(format), size, size, sampleCount, lod);
+
+    const std::vector<float>* patterns[2] = { random, camera };
+    const char* patternNames[2] = { "random", "camera" };
+    float maxDifference = 0.0f;
+
+    for (uint32_t pattern = 0; pattern < 2; pattern++)
+    {
+        const std::vector<float>* directions = patterns[pattern];
+        std::vector<TexelBlock8> results[2];
+
+        for (uint32_t layout = 0; layout < 2; layout++)
+        {
+            const TextureSampler& sampler = layout == 0 ? linearSampler : mortonSampler;
+
+            results[layout].resize(sampleCount / TextureSampler::BatchSize);
+
+            const auto start = std::chrono::steady_clock::now();
+
+            for (uint32_t i = 0; i < sampleCount; i += TextureSampler::BatchSize)
+            {
+                sampler.SampleCube(&directions[0][i], &directions[1][i], &directions[2][i], &lods[i],
+                                   results[layout][i / TextureSampler::BatchSize]);
+            }
+
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            // Modelled misses of the mip 0 bilinear footprints, in lookup order
+            CacheModel level1(32 * 1024, 8);
+            CacheModel level2(1024 * 1024, 16);
+            uint64_t level1Misses = 0, level2Misses = 0;
+
+            for (uint32_t i = 0; i < sampleCount; i++)
+            {
+                const float direction[3] = { directions[0][i], directions[1][i], directions[2][i] };
+
+                uint32_t face;
+                float u, v;
+                CubeMapImage::GetFaceCoordinates(direction, face, u, v);
+
+                const float x = (std::max)(u * size - 0.5f, 0.0f);
+                const float y = (std::max)(v * size - 0.5f, 0.0f);
+                const uint32_t x0 = (std::min)(static_cast<uint32_t>(x), size - 1);
+                const uint32_t y0 = (std::min)(static_cast<uint32_t>(y), size - 1);
+                const uint32_t x1 = (std::min)(x0 + 1, size - 1);
+                const uint32_t y1 = (std::min)(y0 + 1, size - 1);
+                const uint32_t subresource = texture.GetSubresourceIndex(0, face);
+
+                const size_t footprint[4] = {
+                    sampler.GetTexelOffset(subresource, x0, y0), sampler.GetTexelOffset(subresource, x1, y0),
+                    sampler.GetTexelOffset(subresource, x0, y1), sampler.GetTexelOffset(subresource, x1, y1),
+                };
+
+                for (size_t offset : footprint)
+                {
+                    if (!level1.Access(offset))
+                    {
+                        level1Misses++;
+
+                        if (!level2.Access(offset))
+                        {
+                            level2Misses++;
+                        }
+                    }
+                }
+            }
+
+            printf("  %-6s %-6s  %7.1f M samples/s   L1 misses %.3f, L2 misses %.3f per lookup\n", patternNames[pattern],
+                   layout == 0 ? "linear" : "morton", sampleCount / seconds / 1e6,
+                   static_cast<double>(level1Misses) / sampleCount, static_cast<double>(level2Misses) / sampleCount);
+        }
+
+        for (size_t block = 0; block < results[0].size(); block++)
+        {
+            for (uint32_t lane = 0; lane < TextureSampler::BatchSize; lane++)
+            {
+                maxDifference = (std::max)(maxDifference, std::fabs(results[0][block].r[lane] - results[1][block].r[lane]));
+                maxDifference = (std::max)(maxDifference, std::fabs(results[0][block].a[lane] - results[1][block].a[lane]));
+            }
+        }
+    }
+
+    printf("Max difference between the layouts: %g\n", maxDifference);
+
+    return maxDifference == 0.0f ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "ASBufferPool.h"
+
+#include "DXRHelper.h"
+
+ASAllocation ASBufferPool::Allocate(ID3D12Device* device, uint64_t size)
+{
+    const ASAllocation allocation = m_pool.Allocate(size);
+
+    m_buffers.resize(m_pool.GetHeapCount());
+
+    if (!m_buffers[allocation.heap])
+    {
+        m_buffers[allocation.heap] = nv_helpers_dx12::CreateBuffer(device,
+            m_pool.GetHeapSize(allocation.heap),
+            D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+            D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
+            nv_helpers_dx12::kDefaultHeapProps);
+    }
+
+    return allocation;
+}
+
+D3D12_GPU_VIRTUAL_ADDRESS ASBufferPool::GetAddress(uint32_t id) const
+{
+    const ASAllocation allocation = m_pool.GetAllocation(id);
+    return allocation.IsValid() ? m_buffers[allocation.heap]->GetGPUVirtualAddress() + allocation.offset : 0;
+}
+
+bool ASBufferPool::RecordDefragmentation(ID3D12GraphicsCommandList4* commandList, uint64_t maxBytes)
+{
+    if (!m_pool.NeedsDefragmentation())
+    {
+        return false;
+    }
+
+    const auto& relocations = m_pool.PlanDefragmentation(maxBytes);
+
+    if (relocations.empty())
+    {
+        return false;
+    }
+
+    // Builds writing the sources have to be done, and the clones before anything reads them
+    const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+    commandList->ResourceBarrier(1, &barrier);
+
+    for (const ASRelocation& relocation : relocations)
+    {
+        commandList->CopyRaytracingAccelerationStructure(
+            m_buffers[relocation.destinationHeap]->GetGPUVirtualAddress() + relocation.destinationOffset,
+            m_buffers[relocation.sourceHeap]->GetGPUVirtualAddress() + relocation.sourceOffset,
+            D3D12_RAYTRACING_ACCELERATION_STRUCTURE_COPY_MODE_CLONE);
+    }
+
+    commandList->ResourceBarrier(1, &barrier);
+    return true;
+}
+
+void ASBufferPool::CompleteDefragmentation()
+{
+    m_pool.CompleteDefragmentation();
+
+    for (uint32_t heap : m_pool.ReleaseEmptyHeaps())
+    {
+        m_buffers[heap].Reset();
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "ASMemoryPool.h"
+
+#include <d3d12.h>
+#include <vector>
+#include <wrl.h>
+
+/// Backs the heaps of an ASMemoryPool with one buffer each, in the acceleration
+/// structure state, so that bottom levels are built at offsets into a few large buffers
+/// (BottomLevelASGenerator::Generate takes the offset) rather than into a committed
+/// resource each.
+///
+/// Defragmentation clones the moved structures into their new ranges. Whoever refers to
+/// a structure by address, such as the instance descriptors of a top level, has to be
+/// updated with GetAddress once CompleteDefragmentation has run.
+class ASBufferPool
+{
+public:
+    explicit ASBufferPool(const ASMemoryPool::Settings& settings) : m_pool(settings) {}
+
+    /// A range for a structure of size bytes, creating a buffer when the pool grows
+    ASAllocation Allocate(ID3D12Device* device, uint64_t size);
+    void Free(uint32_t id) { m_pool.Free(id); }
+
+    ID3D12Resource* GetBuffer(uint32_t heap) const { return m_buffers[heap].Get(); }
+    D3D12_GPU_VIRTUAL_ADDRESS GetAddress(uint32_t id) const;
+
+    /// If the pool needs it, plan a defragmentation and record the copies on commandList.
+    /// Returns whether anything was recorded; then CompleteDefragmentation must be called
+    /// once the command list has executed.
+    bool RecordDefragmentation(ID3D12GraphicsCommandList4* commandList, uint64_t maxBytes = 0);
+    /// Switch the moved ids to their new ranges and release the emptied buffers
+    void CompleteDefragmentation();
+
+    const ASMemoryPool& GetPool() const { return m_pool; }
+
+private:
+    ASMemoryPool m_pool;
+    std::vector<Microsoft::WRL::ComPtr<ID3D12Resource>> m_buffers;
+};
@@ -0,0 +1,239 @@
+#include "ASMemoryEstimator.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    // v2 added indexed bottom levels, v1 tables still load
+    const char* const TableHeader = "# AS prebuild sizes v2";
+    const char* const TableHeaderV1 = "# AS prebuild sizes v1";
+
+    const char* GetKindName(ASKind kind, bool indexed)
+    {
+        return kind == ASKind::TopLevel ? "top" : indexed ? "bottom-indexed" : "bottom";
+    }
+
+    uint64_t GetSize(const ASSizes& sizes, uint32_t field)
+    {
+        return field == 0 ? sizes.result : field == 1 ? sizes.scratch : sizes.updateScratch;
+    }
+
+    void SetSize(ASSizes& sizes, uint32_t field, uint64_t value)
+    {
+        (field == 0 ? sizes.result : field == 1 ? sizes.scratch : sizes.updateScratch) = value;
+    }
+
+    // One size of a single geometry, interpolated between the samples around the count.
+    // Samples are sorted by primitive count, without repeated counts.
+    uint64_t Interpolate(const std::vector<const ASSizeSample*>& samples, uint32_t field, uint32_t primitives)
+    {
+        auto upper = std::lower_bound(samples.begin(), samples.end(), primitives,
+                                      [](const ASSizeSample* sample, uint32_t count) { return sample->primitives < count; });
+
+        if (upper == samples.begin())
+        {
+            // Below the smallest count, sizes do not shrink further in any driver seen
+            return GetSize((*upper)->sizes, field);
+        }
+
+        if (upper != samples.end() && (*upper)->primitives == primitives)
+        {
+            return GetSize((*upper)->sizes, field);
+        }
+
+        // Past the largest count, continue along the last two samples
+        if (upper == samples.end())
+        {
+            if (samples.size() == 1)
+            {
+                const ASSizeSample& only = *samples.back();
+                return GetSize(only.sizes, field) * primitives / (std::max)(1u, only.primitives);
+            }
+
+            upper = samples.end() - 1;
+        }
+
+        const ASSizeSample& a = **(upper - 1);
+        const ASSizeSample& b = **upper;
+        const double t = (static_cast<double>(primitives) - a.primitives) / (static_cast<double>(b.primitives) - a.primitives);
+        const double size = GetSize(a.sizes, field) + t * (static_cast<double>(GetSize(b.sizes, field)) - GetSize(a.sizes, field));
+        return static_cast<uint64_t>((std::max)(0.0, size) + 0.999);
+    }
+}
+
+void ASMemoryEstimator::AddSample(const ASSizeSample& sample)
+{
+    m_samples.push_back(sample);
+}
+
+void ASMemoryEstimator::Load(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+
+    if (!file.good() || !std::getline(file, line) || (line != TableHeader && line != TableHeaderV1))
+    {
+        throw std::runtime_error("Cannot read AS size table " + path);
+    }
+
+    m_deviceName.clear();
+    m_samples.clear();
+
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword.empty() || keyword[0] == '#')
+        {
+            continue;
+        }
+
+        if (keyword == "device")
+        {
+            stream.get();
+            std::getline(stream, m_deviceName);
+            continue;
+        }
+
+        ASSizeSample sample;
+        sample.kind = keyword == "top" ? ASKind::TopLevel : ASKind::BottomLevel;
+        sample.indexed = keyword == "bottom-indexed";
+        stream >> sample.flags >> sample.geometries >> sample.primitives >> sample.sizes.result >> sample.sizes.scratch >> sample.sizes.updateScratch;
+
+        if (stream.fail() || (keyword != "top" && keyword != "bottom" && keyword != "bottom-indexed"))
+        {
+            throw std::runtime_error("Malformed line in AS size table " + path + ": " + line);
+        }
+
+        m_samples.push_back(sample);
+    }
+}
+
+void ASMemoryEstimator::Save(const std::string& path) const
+{
+    std::ofstream file(path);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create AS size table " + path);
+    }
+
+    file << TableHeader << "\n";
+    file << "device " << m_deviceName << "\n";
+    file << "# kind flags geometries primitives result scratch updateScratch\n";
+
+    for (const ASSizeSample& sample : m_samples)
+    {
+        file << GetKindName(sample.kind, sample.indexed) << " " << sample.flags << " " << sample.geometries << " " << sample.primitives << " "
+             << sample.sizes.result << " " << sample.sizes.scratch << " " << sample.sizes.updateScratch << "\n";
+    }
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot write AS size table " + path);
+    }
+}
+
+ASSizes ASMemoryEstimator::Estimate(ASKind kind, uint32_t flags, uint32_t geometries, uint32_t primitives, bool indexed) const
+{
+    // Instances are never indexed
+    indexed = indexed && kind == ASKind::BottomLevel;
+
+    auto inGroup = [&](const ASSizeSample& sample) { return sample.kind == kind && sample.flags == flags && sample.indexed == indexed; };
+
+    // Single-geometry samples by count, the largest sizes where a count was recorded twice
+    std::vector<const ASSizeSample*> samples;
+
+    for (const ASSizeSample& sample : m_samples)
+    {
+        if (inGroup(sample) && sample.geometries <= 1)
+        {
+            samples.push_back(&sample);
+        }
+    }
+
+    if (samples.empty())
+    {
+        throw std::runtime_error(std::string("No recorded sizes for ") + (indexed ? "indexed bottom" : GetKindName(kind, false)) + "-level builds with flags " + std::to_string(flags));
+    }
+
+    std::sort(samples.begin(), samples.end(),
+              [](const ASSizeSample* a, const ASSizeSample* b)
+              { return a->primitives != b->primitives ? a->primitives < b->primitives : a->sizes.result > b->sizes.result; });
+    samples.erase(std::unique(samples.begin(), samples.end(),
+                              [](const ASSizeSample* a, const ASSizeSample* b) { return a->primitives == b->primitives; }),
+                  samples.end());
+
+    ASSizes sizes;
+
+    for (uint32_t field = 0; field < 3; field++)
+    {
+        uint64_t size = Interpolate(samples, field, primitives);
+
+        if (kind == ASKind::BottomLevel && geometries > 1)
+        {
+            // The most any recorded multi-geometry build needed per extra geometry
+            uint64_t perGeometry = 0;
+
+            for (const ASSizeSample& sample : m_samples)
+            {
+                if (inGroup(sample) && sample.geometries > 1)
+                {
+                    const uint64_t single = Interpolate(samples, field, sample.primitives);
+                    const uint64_t actual = GetSize(sample.sizes, field);
+
+                    if (actual > single)
+                    {
+                        perGeometry = (std::max)(perGeometry, (actual - single + sample.geometries - 2) / (sample.geometries - 1));
+                    }
+                }
+            }
+
+            size += perGeometry * (geometries - 1);
+        }
+
+        SetSize(sizes, field, size);
+    }
+
+    return sizes;
+}
+
+ASBudget ASMemoryEstimator::PlanBudget(const std::vector<ASBudgetRequest>& requests) const
+{
+    ASBudget budget;
+
+    for (const ASBudgetRequest& request : requests)
+    {
+        const ASSizes estimate = Estimate(request.kind, request.flags, request.geometries, request.primitives, request.indexed);
+
+        ASBudgetEntry entry;
+        entry.request = request;
+        entry.sizes.result = Align(estimate.result);
+        entry.sizes.scratch = Align(estimate.scratch);
+        entry.sizes.updateScratch = Align(estimate.updateScratch);
+        entry.padding = entry.sizes.result - estimate.result + entry.sizes.scratch - estimate.scratch;
+
+        if (request.kind == ASKind::TopLevel)
+        {
+            entry.instanceDescs = Align(InstanceDescSize * request.primitives);
+            entry.padding += entry.instanceDescs - InstanceDescSize * request.primitives;
+        }
+
+        // The generators allocate one scratch buffer for the build and reuse it for
+        // updates, so it has to fit both
+        const uint64_t scratch = (request.flags & AllowUpdate) ? (std::max)(entry.sizes.scratch, entry.sizes.updateScratch) : entry.sizes.scratch;
+
+        budget.resident += entry.sizes.result + entry.instanceDescs;
+        budget.scratchAllAtOnce += scratch;
+        budget.scratchLargest = (std::max)(budget.scratchLargest, scratch);
+        budget.padding += entry.padding;
+        budget.entries.push_back(entry);
+    }
+
+    return budget;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class ASKind : uint32_t
+{
+    /// Triangle geometries, BottomLevelASGenerator
+    BottomLevel,
+    /// Instances, TopLevelASGenerator
+    TopLevel,
+};
+
+/// What GetRaytracingAccelerationStructurePrebuildInfo returns, before the rounding
+/// ComputeASBufferSizes applies
+struct ASSizes
+{
+    uint64_t result = 0;
+    uint64_t scratch = 0;
+    uint64_t updateScratch = 0;
+};
+
+/// One prebuild query and its answer, as recorded on a device
+struct ASSizeSample
+{
+    ASKind kind = ASKind::BottomLevel;
+    /// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS
+    uint32_t flags = 0;
+    /// Geometry descs of a bottom level, 1 for a top level
+    uint32_t geometries = 1;
+    /// Triangles over all geometries, or instances
+    uint32_t primitives = 0;
+    /// Bottom levels whose triangles come from an R32_UINT index buffer
+    bool indexed = false;
+    ASSizes sizes;
+};
+
+/// One acceleration structure of a scene to budget for
+struct ASBudgetRequest
+{
+    std::string name;
+    ASKind kind = ASKind::BottomLevel;
+    /// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS of this build
+    uint32_t flags = 0;
+    uint32_t geometries = 1;
+    uint32_t primitives = 0;
+    bool indexed = false;
+};
+
+struct ASBudgetEntry
+{
+    ASBudgetRequest request;
+    /// Buffer sizes as ComputeASBufferSizes would return them
+    ASSizes sizes;
+    /// Bytes the rounding added to result and scratch
+    uint64_t padding = 0;
+    /// Upload buffer of D3D12_RAYTRACING_INSTANCE_DESC, top levels only
+    uint64_t instanceDescs = 0;
+};
+
+struct ASBudget
+{
+    std::vector<ASBudgetEntry> entries;
+    /// Stays resident: results and instance descriptors
+    uint64_t resident = 0;
+    /// Scratch when every build has its own buffer until the command list is flushed, as
+    /// CreateAccelerationStructures does, and when builds share one buffer one at a time
+    uint64_t scratchAllAtOnce = 0;
+    uint64_t scratchLargest = 0;
+    uint64_t padding = 0;
+};
+
+/// Predicts acceleration structure buffer sizes without a device, from prebuild sizes a
+/// device reported for a sweep of primitive counts. Sizes depend on the driver, so the
+/// estimator knows nothing until it is given samples, normally by Load of a table the
+/// application recorded when started with -recordASSizes (see
+/// D3D12HelloRaytracing::RecordASSizes); a build farm keeps one table per GPU it needs to
+/// budget for.
+///
+/// Samples are grouped by kind, indexing and build flags. Within a group, single-geometry samples
+/// are interpolated linearly in the primitive count, and past the largest one extrapolated
+/// along the last two; each extra geometry of a bottom level costs the most any recorded
+/// multi-geometry sample needed above that. An estimate is therefore exact at recorded
+/// counts and otherwise only as good as the sweep is dense.
+///
+/// Like TextureUploadPlanner, it does not depend on D3D12 so that it runs anywhere.
+class ASMemoryEstimator
+{
+public:
+    /// D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, the ROUND_UP of ComputeASBufferSizes
+    static const uint64_t PlacementAlignment = 256;
+    /// sizeof(D3D12_RAYTRACING_INSTANCE_DESC)
+    static const uint64_t InstanceDescSize = 64;
+
+    /// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_*
+    static const uint32_t AllowUpdate = 0x1;
+    static const uint32_t AllowCompaction = 0x2;
+    static const uint32_t PreferFastTrace = 0x4;
+    static const uint32_t PreferFastBuild = 0x8;
+    static const uint32_t MinimizeMemory = 0x10;
+
+    static uint64_t Align(uint64_t size) { return (size + PlacementAlignment - 1) & ~(PlacementAlignment - 1); }
+
+    void SetDeviceName(const std::string& name) { m_deviceName = name; }
+    const std::string& GetDeviceName() const { return m_deviceName; }
+
+    void AddSample(const ASSizeSample& sample);
+    const std::vector<ASSizeSample>& GetSamples() const { return m_samples; }
+
+    /// Replace the samples with a table written by Save. Throws std::runtime_error if the
+    /// file cannot be read or is not such a table.
+    void Load(const std::string& path);
+    /// Throws std::runtime_error if the file cannot be written
+    void Save(const std::string& path) const;
+
+    /// Prebuild sizes, unrounded. Throws std::runtime_error if no sample has this kind,
+    /// indexing and flags.
+    ASSizes Estimate(ASKind kind, uint32_t flags, uint32_t geometries, uint32_t primitives, bool indexed = false) const;
+
+    /// Buffer sizes of every structure, each with its own build flags, rounded as
+    /// ComputeASBufferSizes rounds them, and the totals
+    ASBudget PlanBudget(const std::vector<ASBudgetRequest>& requests) const;
+
+private:
+    std::string m_deviceName;
+    std::vector<ASSizeSample> m_samples;
+};
@@ -0,0 +1,727 @@
+#include "ASMemoryPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // Index of the highest set bit, value > 0
+    uint32_t GetHighestBit(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return index;
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    uint32_t CountTrailingZeros(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return index;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+}
+
+ASMemoryPool::ASMemoryPool(const Settings& settings) :
+    m_settings(settings)
+{
+    if (settings.heapSize < Alignment)
+    {
+        throw std::runtime_error("AS pool heaps must hold at least one 256-byte block");
+    }
+
+    m_settings.heapSize = (settings.heapSize + Alignment - 1) & ~(Alignment - 1);
+
+    for (auto& lists : m_freeLists)
+    {
+        std::fill(lists, lists + SecondLevelCount, InvalidBlock);
+    }
+}
+
+// Small sizes map linearly to the first level; from 16 units on, each power of two is
+// split into 16 classes
+void ASMemoryPool::GetMapping(uint64_t units, uint32_t& firstLevel, uint32_t& secondLevel)
+{
+    if (units < SecondLevelCount)
+    {
+        firstLevel = 0;
+        secondLevel = static_cast<uint32_t>(units);
+        return;
+    }
+
+    const uint32_t highestBit = GetHighestBit(units);
+    firstLevel = highestBit - SecondLevelBits + 1;
+    secondLevel = static_cast<uint32_t>(units >> (highestBit - SecondLevelBits)) - SecondLevelCount;
+}
+
+uint32_t ASMemoryPool::NewBlock()
+{
+    if (!m_unusedBlocks.empty())
+    {
+        const uint32_t block = m_unusedBlocks.back();
+        m_unusedBlocks.pop_back();
+        m_blocks[block] = Block();
+        return block;
+    }
+
+    m_blocks.emplace_back();
+    return static_cast<uint32_t>(m_blocks.size() - 1);
+}
+
+void ASMemoryPool::DeleteBlock(uint32_t block)
+{
+    m_blocks[block] = Block();
+    m_unusedBlocks.push_back(block);
+}
+
+void ASMemoryPool::InsertFree(uint32_t block)
+{
+    uint32_t firstLevel, secondLevel;
+    GetMapping(m_blocks[block].size, firstLevel, secondLevel);
+
+    const uint32_t head = m_freeLists[firstLevel][secondLevel];
+    m_blocks[block].previousFree = InvalidBlock;
+    m_blocks[block].nextFree = head;
+
+    if (head != InvalidBlock)
+    {
+        m_blocks[head].previousFree = block;
+    }
+
+    m_freeLists[firstLevel][secondLevel] = block;
+    m_secondLevelBitmaps[firstLevel] |= 1u << secondLevel;
+    m_firstLevelBitmap |= 1ull << firstLevel;
+}
+
+void ASMemoryPool::RemoveFree(uint32_t block)
+{
+    uint32_t firstLevel, secondLevel;
+    GetMapping(m_blocks[block].size, firstLevel, secondLevel);
+
+    const uint32_t previous = m_blocks[block].previousFree;
+    const uint32_t next = m_blocks[block].nextFree;
+
+    if (previous != InvalidBlock)
+    {
+        m_blocks[previous].nextFree = next;
+    }
+    else
+    {
+        m_freeLists[firstLevel][secondLevel] = next;
+    }
+
+    if (next != InvalidBlock)
+    {
+        m_blocks[next].previousFree = previous;
+    }
+
+    m_blocks[block].previousFree = InvalidBlock;
+    m_blocks[block].nextFree = InvalidBlock;
+
+    if (m_freeLists[firstLevel][secondLevel] == InvalidBlock)
+    {
+        m_secondLevelBitmaps[firstLevel] &= ~(1u << secondLevel);
+
+        if (m_secondLevelBitmaps[firstLevel] == 0)
+        {
+            m_firstLevelBitmap &= ~(1ull << firstLevel);
+        }
+    }
+}
+
+// The head of the first non-empty list whose blocks are all at least units large
+uint32_t ASMemoryPool::FindFree(uint64_t units) const
+{
+    if (units >= SecondLevelCount)
+    {
+        units += (1ull << (GetHighestBit(units) - SecondLevelBits)) - 1;
+    }
+
+    uint32_t firstLevel, secondLevel;
+    GetMapping(units, firstLevel, secondLevel);
+
+    if (firstLevel >= FirstLevelCount)
+    {
+        return InvalidBlock;
+    }
+
+    uint32_t secondLevelMap = m_secondLevelBitmaps[firstLevel] & (~0u << secondLevel);
+
+    if (secondLevelMap == 0)
+    {
+        const uint64_t firstLevelMap = firstLevel + 1 < 64 ? m_firstLevelBitmap & (~0ull << (firstLevel + 1)) : 0;
+
+        if (firstLevelMap == 0)
+        {
+            return InvalidBlock;
+        }
+
+        firstLevel = CountTrailingZeros(firstLevelMap);
+        secondLevelMap = m_secondLevelBitmaps[firstLevel];
+    }
+
+    return m_freeLists[firstLevel][CountTrailingZeros(secondLevelMap)];
+}
+
+uint32_t ASMemoryPool::CreateHeap(uint64_t units)
+{
+    uint32_t heap = 0;
+
+    while (heap < m_heaps.size() && m_heaps[heap].size > 0)
+    {
+        heap++;
+    }
+
+    if (heap == m_heaps.size())
+    {
+        m_heaps.emplace_back();
+    }
+
+    const uint32_t block = NewBlock();
+    m_blocks[block].heap = heap;
+    m_blocks[block].size = units;
+    m_blocks[block].isFree = true;
+    InsertFree(block);
+
+    m_heaps[heap] = Heap();
+    m_heaps[heap].size = units * Alignment;
+    m_heaps[heap].firstBlock = block;
+    return heap;
+}
+
+uint32_t ASMemoryPool::AllocateBlock(uint64_t units, uint32_t id, bool canGrow)
+{
+    uint32_t block = FindFree(units);
+
+    if (block == InvalidBlock)
+    {
+        if (!canGrow)
+        {
+            return InvalidBlock;
+        }
+
+        const uint32_t heap = CreateHeap((std::max)(units, m_settings.heapSize / Alignment));
+        block = m_heaps[heap].firstBlock;
+    }
+
+    RemoveFree(block);
+
+    // Return the tail to the free lists
+    if (m_blocks[block].size > units)
+    {
+        const uint32_t rest = NewBlock();
+        Block& allocated = m_blocks[block];
+        Block& tail = m_blocks[rest];
+
+        tail.heap = allocated.heap;
+        tail.offset = allocated.offset + units;
+        tail.size = allocated.size - units;
+        tail.previousPhysical = block;
+        tail.nextPhysical = allocated.nextPhysical;
+        tail.isFree = true;
+
+        if (allocated.nextPhysical != InvalidBlock)
+        {
+            m_blocks[allocated.nextPhysical].previousPhysical = rest;
+        }
+
+        allocated.nextPhysical = rest;
+        allocated.size = units;
+        InsertFree(rest);
+    }
+
+    Block& allocated = m_blocks[block];
+    allocated.isFree = false;
+    allocated.id = id;
+
+    Heap& heap = m_heaps[allocated.heap];
+    heap.allocated += units * Alignment;
+    heap.allocations++;
+    return block;
+}
+
+void ASMemoryPool::FreeBlock(uint32_t block)
+{
+    Heap& heap = m_heaps[m_blocks[block].heap];
+    heap.allocated -= m_blocks[block].size * Alignment;
+    heap.allocations--;
+
+    m_blocks[block].isFree = true;
+    m_blocks[block].isLocked = heap.isLocked;
+    m_blocks[block].id = ASAllocation::InvalidId;
+
+    // Merge with free neighbours, which are locked exactly when the heap is
+    const uint32_t next = m_blocks[block].nextPhysical;
+
+    if (next != InvalidBlock && m_blocks[next].isFree)
+    {
+        if (!heap.isLocked)
+        {
+            RemoveFree(next);
+        }
+
+        m_blocks[block].size += m_blocks[next].size;
+        m_blocks[block].nextPhysical = m_blocks[next].nextPhysical;
+
+        if (m_blocks[next].nextPhysical != InvalidBlock)
+        {
+            m_blocks[m_blocks[next].nextPhysical].previousPhysical = block;
+        }
+
+        DeleteBlock(next);
+    }
+
+    const uint32_t previous = m_blocks[block].previousPhysical;
+
+    if (previous != InvalidBlock && m_blocks[previous].isFree)
+    {
+        if (!heap.isLocked)
+        {
+            RemoveFree(previous);
+        }
+
+        m_blocks[previous].size += m_blocks[block].size;
+        m_blocks[previous].nextPhysical = m_blocks[block].nextPhysical;
+
+        if (m_blocks[block].nextPhysical != InvalidBlock)
+        {
+            m_blocks[m_blocks[block].nextPhysical].previousPhysical = previous;
+        }
+
+        DeleteBlock(block);
+        block = previous;
+    }
+
+    if (!heap.isLocked)
+    {
+        InsertFree(block);
+    }
+}
+
+void ASMemoryPool::SetHeapLocked(uint32_t heap, bool locked)
+{
+    if (m_heaps[heap].isLocked == locked)
+    {
+        return;
+    }
+
+    m_heaps[heap].isLocked = locked;
+
+    for (uint32_t block = m_heaps[heap].firstBlock; block != InvalidBlock; block = m_blocks[block].nextPhysical)
+    {
+        if (m_blocks[block].isFree)
+        {
+            m_blocks[block].isLocked = locked;
+
+            if (locked)
+            {
+                RemoveFree(block);
+            }
+            else
+            {
+                InsertFree(block);
+            }
+        }
+    }
+}
+
+ASAllocation ASMemoryPool::GetBlockAllocation(uint32_t block) const
+{
+    ASAllocation allocation;
+    allocation.id = m_blocks[block].id;
+    allocation.heap = m_blocks[block].heap;
+    allocation.offset = m_blocks[block].offset * Alignment;
+    allocation.size = m_blocks[block].size * Alignment;
+    return allocation;
+}
+
+ASAllocation ASMemoryPool::Allocate(uint64_t size)
+{
+    const uint64_t units = (std::max)(1ull, static_cast<unsigned long long>((size + Alignment - 1) / Alignment));
+
+    uint32_t id;
+
+    if (!m_unusedIds.empty())
+    {
+        id = m_unusedIds.back();
+        m_unusedIds.pop_back();
+    }
+    else
+    {
+        id = static_cast<uint32_t>(m_allocations.size());
+        m_allocations.emplace_back();
+    }
+
+    m_allocations[id] = AllocateBlock(units, id, true);
+    return GetBlockAllocation(m_allocations[id]);
+}
+
+void ASMemoryPool::Free(uint32_t id)
+{
+    if (id >= m_allocations.size() || m_allocations[id] == InvalidBlock)
+    {
+        throw std::logic_error("Freeing AS allocation " + std::to_string(id) + ", which is not allocated");
+    }
+
+    // Drop a pending move of it, and the range reserved for it
+    for (size_t i = 0; i < m_relocations.size(); i++)
+    {
+        if (m_relocations[i].id == id)
+        {
+            FreeBlock(m_relocationBlocks[i]);
+            m_relocations.erase(m_relocations.begin() + i);
+            m_relocationBlocks.erase(m_relocationBlocks.begin() + i);
+            break;
+        }
+    }
+
+    FreeBlock(m_allocations[id]);
+    m_allocations[id] = InvalidBlock;
+    m_unusedIds.push_back(id);
+
+    // Nothing left to move: the plan is over
+    if (m_relocations.empty())
+    {
+        for (uint32_t heap = 0; heap < m_heaps.size(); heap++)
+        {
+            SetHeapLocked(heap, false);
+        }
+    }
+}
+
+ASAllocation ASMemoryPool::GetAllocation(uint32_t id) const
+{
+    if (id >= m_allocations.size() || m_allocations[id] == InvalidBlock)
+    {
+        return ASAllocation();
+    }
+
+    return GetBlockAllocation(m_allocations[id]);
+}
+
+ASPoolStats ASMemoryPool::GetStats() const
+{
+    ASPoolStats stats;
+    stats.allocations = static_cast<uint32_t>(m_allocations.size() - m_unusedIds.size());
+
+    for (const Heap& heap : m_heaps)
+    {
+        if (heap.size == 0)
+        {
+            continue;
+        }
+
+        stats.heaps++;
+        stats.reservedBytes += heap.size;
+        stats.allocatedBytes += heap.allocated;
+
+        for (uint32_t block = heap.firstBlock; block != InvalidBlock; block = m_blocks[block].nextPhysical)
+        {
+            if (m_blocks[block].isFree)
+            {
+                stats.largestFreeBlock = (std::max)(stats.largestFreeBlock, m_blocks[block].size * Alignment);
+            }
+        }
+    }
+
+    stats.freeBytes = stats.reservedBytes - stats.allocatedBytes;
+    stats.fragmentation = stats.freeBytes > 0 ? 1.0f - static_cast<float>(stats.largestFreeBlock) / stats.freeBytes : 0.0f;
+    return stats;
+}
+
+bool ASMemoryPool::NeedsDefragmentation() const
+{
+    const ASPoolStats stats = GetStats();
+
+    if (stats.heaps < 2 || stats.fragmentation < m_settings.defragmentationThreshold)
+    {
+        return false;
+    }
+
+    // Worth planning only if the free space of the other heaps could hold the emptiest
+    for (const Heap& heap : m_heaps)
+    {
+        if (heap.size > 0 && heap.allocated <= stats.freeBytes - (heap.size - heap.allocated))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const std::vector<ASRelocation>& ASMemoryPool::PlanDefragmentation(uint64_t maxBytes)
+{
+    if (!m_relocations.empty())
+    {
+        throw std::logic_error("An AS pool defragmentation is already pending");
+    }
+
+    std::vector<uint32_t> candidates;
+
+    for (uint32_t heap = 0; heap < m_heaps.size(); heap++)
+    {
+        if (m_heaps[heap].size > 0 && m_heaps[heap].allocations > 0)
+        {
+            candidates.push_back(heap);
+        }
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(),
+                     [this](uint32_t a, uint32_t b) { return m_heaps[a].allocated < m_heaps[b].allocated; });
+
+    // Heaps holding new ranges must stay
+    std::vector<bool> isDestination(m_heaps.size(), false);
+    uint64_t movedBytes = 0;
+
+    for (uint32_t heap : candidates)
+    {
+        if (isDestination[heap])
+        {
+            continue;
+        }
+
+        if (maxBytes > 0 && movedBytes + m_heaps[heap].allocated > maxBytes)
+        {
+            break;
+        }
+
+        // Nothing may land in the heap being emptied
+        SetHeapLocked(heap, true);
+
+        std::vector<uint32_t> sources;
+
+        for (uint32_t block = m_heaps[heap].firstBlock; block != InvalidBlock; block = m_blocks[block].nextPhysical)
+        {
+            if (!m_blocks[block].isFree)
+            {
+                sources.push_back(block);
+            }
+        }
+
+        // Largest first packs the free space best
+        std::stable_sort(sources.begin(), sources.end(),
+                         [this](uint32_t a, uint32_t b) { return m_blocks[a].size > m_blocks[b].size; });
+
+        std::vector<uint32_t> destinations;
+
+        for (uint32_t source : sources)
+        {
+            const uint32_t destination = AllocateBlock(m_blocks[source].size, ASAllocation::InvalidId, false);
+
+            if (destination == InvalidBlock)
+            {
+                break;
+            }
+
+            destinations.push_back(destination);
+        }
+
+        if (destinations.size() < sources.size())
+        {
+            // The rest of the heaps cannot take this one, nor any fuller one
+            for (uint32_t destination : destinations)
+            {
+                FreeBlock(destination);
+            }
+
+            SetHeapLocked(heap, false);
+            break;
+        }
+
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            const Block& source = m_blocks[sources[i]];
+            const Block& destination = m_blocks[destinations[i]];
+
+            ASRelocation relocation;
+            relocation.id = source.id;
+            relocation.sourceHeap = source.heap;
+            relocation.sourceOffset = source.offset * Alignment;
+            relocation.destinationHeap = destination.heap;
+            relocation.destinationOffset = destination.offset * Alignment;
+            relocation.size = source.size * Alignment;
+
+            m_relocations.push_back(relocation);
+            m_relocationBlocks.push_back(destinations[i]);
+            isDestination[destination.heap] = true;
+        }
+
+        movedBytes += m_heaps[heap].allocated;
+    }
+
+    return m_relocations;
+}
+
+void ASMemoryPool::CompleteDefragmentation()
+{
+    for (uint32_t heap = 0; heap < m_heaps.size(); heap++)
+    {
+        SetHeapLocked(heap, false);
+    }
+
+    for (size_t i = 0; i < m_relocations.size(); i++)
+    {
+        const uint32_t id = m_relocations[i].id;
+        const uint32_t source = m_allocations[id];
+
+        m_blocks[m_relocationBlocks[i]].id = id;
+        m_allocations[id] = m_relocationBlocks[i];
+        FreeBlock(source);
+    }
+
+    m_relocations.clear();
+    m_relocationBlocks.clear();
+}
+
+std::vector<uint32_t> ASMemoryPool::ReleaseEmptyHeaps()
+{
+    std::vector<uint32_t> released;
+
+    for (uint32_t heap = 0; heap < m_heaps.size(); heap++)
+    {
+        if (m_heaps[heap].size > 0 && m_heaps[heap].allocations == 0 && !m_heaps[heap].isLocked)
+        {
+            RemoveFree(m_heaps[heap].firstBlock);
+            DeleteBlock(m_heaps[heap].firstBlock);
+            m_heaps[heap] = Heap();
+            released.push_back(heap);
+        }
+    }
+
+    return released;
+}
+
+void ASMemoryPool::Validate() const
+{
+    uint32_t listedBlocks = 0;
+
+    for (uint32_t heap = 0; heap < m_heaps.size(); heap++)
+    {
+        const Heap& heapInfo = m_heaps[heap];
+        const std::string name = "heap " + std::to_string(heap);
+
+        if (heapInfo.size == 0)
+        {
+            if (heapInfo.firstBlock != InvalidBlock || heapInfo.allocations > 0)
+            {
+                throw std::logic_error(name + ": released but has blocks");
+            }
+
+            continue;
+        }
+
+        uint64_t offset = 0;
+        uint64_t allocated = 0;
+        uint32_t allocations = 0;
+        uint32_t previous = InvalidBlock;
+
+        for (uint32_t block = heapInfo.firstBlock; block != InvalidBlock; block = m_blocks[block].nextPhysical)
+        {
+            const Block& info = m_blocks[block];
+            const std::string blockName = name + " block at " + std::to_string(info.offset * Alignment);
+
+            if (info.heap != heap || info.offset != offset || info.previousPhysical != previous || info.size == 0)
+            {
+                throw std::logic_error(blockName + ": broken block list");
+            }
+
+            if (info.isFree)
+            {
+                if (previous != InvalidBlock && m_blocks[previous].isFree)
+                {
+                    throw std::logic_error(blockName + ": free neighbours not merged");
+                }
+
+                if (info.isLocked != heapInfo.isLocked || info.id != ASAllocation::InvalidId)
+                {
+                    throw std::logic_error(blockName + ": free block in the wrong state");
+                }
+
+                listedBlocks += info.isLocked ? 0 : 1;
+            }
+            else
+            {
+                allocated += info.size * Alignment;
+                allocations++;
+
+                const bool isPending = std::find(m_relocationBlocks.begin(), m_relocationBlocks.end(), block) != m_relocationBlocks.end();
+
+                if (isPending ? info.id != ASAllocation::InvalidId : (info.id >= m_allocations.size() || m_allocations[info.id] != block))
+                {
+                    throw std::logic_error(blockName + ": allocation id does not match");
+                }
+            }
+
+            offset += info.size;
+            previous = block;
+        }
+
+        if (offset * Alignment != heapInfo.size || allocated != heapInfo.allocated || allocations != heapInfo.allocations)
+        {
+            throw std::logic_error(name + ": blocks do not add up to the heap");
+        }
+    }
+
+    for (uint32_t firstLevel = 0; firstLevel < FirstLevelCount; firstLevel++)
+    {
+        if (((m_firstLevelBitmap >> firstLevel) & 1) != (m_secondLevelBitmaps[firstLevel] != 0 ? 1u : 0u))
+        {
+            throw std::logic_error("First-level bitmap out of date at " + std::to_string(firstLevel));
+        }
+
+        for (uint32_t secondLevel = 0; secondLevel < SecondLevelCount; secondLevel++)
+        {
+            const uint32_t head = m_freeLists[firstLevel][secondLevel];
+
+            if (((m_secondLevelBitmaps[firstLevel] >> secondLevel) & 1) != (head != InvalidBlock ? 1u : 0u))
+            {
+                throw std::logic_error("Second-level bitmap out of date at " + std::to_string(firstLevel) + "," + std::to_string(secondLevel));
+            }
+
+            uint32_t previous = InvalidBlock;
+
+            for (uint32_t block = head; block != InvalidBlock; block = m_blocks[block].nextFree)
+            {
+                uint32_t blockFirstLevel, blockSecondLevel;
+                GetMapping(m_blocks[block].size, blockFirstLevel, blockSecondLevel);
+
+                if (!m_blocks[block].isFree || m_blocks[block].isLocked || m_blocks[block].previousFree != previous ||
+                    blockFirstLevel != firstLevel || blockSecondLevel != secondLevel)
+                {
+                    throw std::logic_error("Free list " + std::to_string(firstLevel) + "," + std::to_string(secondLevel) + " is broken");
+                }
+
+                previous = block;
+                listedBlocks--;
+            }
+        }
+    }
+
+    if (listedBlocks != 0)
+    {
+        throw std::logic_error("Free blocks missing from the free lists");
+    }
+
+    for (uint32_t id = 0; id < m_allocations.size(); id++)
+    {
+        const uint32_t block = m_allocations[id];
+
+        if (block != InvalidBlock && (m_blocks[block].isFree || m_blocks[block].id != id))
+        {
+            throw std::logic_error("AS allocation " + std::to_string(id) + " points at the wrong block");
+        }
+    }
+}
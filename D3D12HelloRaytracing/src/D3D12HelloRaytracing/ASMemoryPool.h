@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/// A range of one heap of an ASMemoryPool. The id stays the same when defragmentation
+/// moves the range.
+struct ASAllocation
+{
+    static const uint32_t InvalidId = 0xFFFFFFFF;
+
+    uint32_t id = InvalidId;
+    uint32_t heap = 0;
+    /// Multiple of ASMemoryPool::Alignment
+    uint64_t offset = 0;
+    /// Aligned size
+    uint64_t size = 0;
+
+    bool IsValid() const { return id != InvalidId; }
+};
+
+/// One move of a defragmentation plan; source and destination never overlap
+struct ASRelocation
+{
+    uint32_t id = ASAllocation::InvalidId;
+    uint32_t sourceHeap = 0;
+    uint64_t sourceOffset = 0;
+    uint32_t destinationHeap = 0;
+    uint64_t destinationOffset = 0;
+    uint64_t size = 0;
+};
+
+struct ASPoolStats
+{
+    /// Heaps that are not released
+    uint32_t heaps = 0;
+    uint32_t allocations = 0;
+    uint64_t reservedBytes = 0;
+    uint64_t allocatedBytes = 0;
+    uint64_t freeBytes = 0;
+    uint64_t largestFreeBlock = 0;
+    /// 1 - largest free block / free bytes: 0 when the free space is one block, near 1
+    /// when it is scattered in pieces too small for a large structure
+    float fragmentation = 0.0f;
+};
+
+/// Suballocates acceleration structures from large heaps instead of one committed
+/// resource each, which wastes most of a 64 KB page on a small bottom level. Ranges are
+/// 256-byte aligned, as D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT requires.
+///
+/// Free ranges are kept in a two-level segregated fit (TLSF) structure, Masmano et al.,
+/// "TLSF: a New Dynamic Memory Allocator for Real-Time Systems": a first level per power
+/// of two and 16 second-level classes within it, each a list of free blocks with a bit
+/// per non-empty list, so that allocation and freeing take constant time. A request is
+/// rounded up to the next class, so any block found fits without searching a list;
+/// freed blocks merge with free neighbours of the same heap.
+///
+/// Over time freed structures leave holes no new one fits, and heaps stay alive for a
+/// few structures. PlanDefragmentation moves the contents of the emptiest heaps into the
+/// free space of the others; once the copies have executed, CompleteDefragmentation
+/// frees the old ranges and the emptied heaps can be released.
+///
+/// The pool only does the bookkeeping and does not depend on D3D12 so that it can be
+/// checked on the CPU; ASBufferPool backs the heaps with buffers.
+class ASMemoryPool
+{
+public:
+    static const uint64_t Alignment = 256;
+
+    struct Settings
+    {
+        /// Size of a new heap; a larger structure gets a heap of its own size
+        uint64_t heapSize = 64 * 1024 * 1024;
+        /// Fragmentation from which NeedsDefragmentation is true
+        float defragmentationThreshold = 0.5f;
+    };
+
+    explicit ASMemoryPool(const Settings& settings);
+
+    /// Allocate size bytes, rounded up to the alignment, creating a heap if no free
+    /// range fits. Check GetHeapCount for new heaps.
+    ASAllocation Allocate(uint64_t size);
+    /// Free an allocation by id. Throws std::logic_error if it is not allocated.
+    void Free(uint32_t id);
+
+    ASAllocation GetAllocation(uint32_t id) const;
+
+    /// Heaps by index, including released ones, whose size is 0
+    uint32_t GetHeapCount() const { return static_cast<uint32_t>(m_heaps.size()); }
+    uint64_t GetHeapSize(uint32_t heap) const { return m_heaps[heap].size; }
+    uint64_t GetHeapAllocatedBytes(uint32_t heap) const { return m_heaps[heap].allocated; }
+
+    ASPoolStats GetStats() const;
+
+    /// Fragmentation over the threshold, and a heap whose allocations would fit in the
+    /// free space of the others
+    bool NeedsDefragmentation() const;
+
+    /// Reserve new ranges for the allocations of as many heaps as the other heaps can
+    /// take, emptiest first, moving at most maxBytes (0 for no limit). The old ranges
+    /// stay allocated until CompleteDefragmentation, so the caller can copy the
+    /// structures in between. Throws std::logic_error if a plan is already pending.
+    const std::vector<ASRelocation>& PlanDefragmentation(uint64_t maxBytes = 0);
+    const std::vector<ASRelocation>& GetPendingRelocations() const { return m_relocations; }
+    /// Point the relocated ids at their new ranges and free the old ones
+    void CompleteDefragmentation();
+
+    /// Release the heaps without allocations and return their indices; Allocate reuses
+    /// released indices
+    std::vector<uint32_t> ReleaseEmptyHeaps();
+
+    /// Check the block lists, free lists and bitmaps against each other. Throws
+    /// std::logic_error describing the first inconsistency.
+    void Validate() const;
+
+private:
+    static const uint32_t SecondLevelBits = 4;
+    static const uint32_t SecondLevelCount = 1 << SecondLevelBits;
+    static const uint32_t FirstLevelCount = 48;
+    static const uint32_t InvalidBlock = 0xFFFFFFFF;
+
+    struct Block
+    {
+        uint32_t heap = 0;
+        /// In units of Alignment
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        uint32_t previousPhysical = InvalidBlock;
+        uint32_t nextPhysical = InvalidBlock;
+        /// Free list links while free
+        uint32_t previousFree = InvalidBlock;
+        uint32_t nextFree = InvalidBlock;
+        uint32_t id = ASAllocation::InvalidId;
+        bool isFree = false;
+        /// Free, but taken off the lists while its heap is being evacuated
+        bool isLocked = false;
+    };
+
+    struct Heap
+    {
+        /// In bytes, 0 once released
+        uint64_t size = 0;
+        uint64_t allocated = 0;
+        uint32_t allocations = 0;
+        uint32_t firstBlock = InvalidBlock;
+        /// Being emptied by a pending defragmentation; its free blocks are off the lists
+        bool isLocked = false;
+    };
+
+    static void GetMapping(uint64_t units, uint32_t& firstLevel, uint32_t& secondLevel);
+
+    uint32_t NewBlock();
+    void DeleteBlock(uint32_t block);
+    void InsertFree(uint32_t block);
+    void RemoveFree(uint32_t block);
+    uint32_t FindFree(uint64_t units) const;
+    uint32_t CreateHeap(uint64_t units);
+    uint32_t AllocateBlock(uint64_t units, uint32_t id, bool canGrow);
+    void FreeBlock(uint32_t block);
+    void SetHeapLocked(uint32_t heap, bool locked);
+    ASAllocation GetBlockAllocation(uint32_t block) const;
+
+    Settings m_settings;
+    std::vector<Block> m_blocks;
+    std::vector<uint32_t> m_unusedBlocks;
+    std::vector<Heap> m_heaps;
+
+    /// Block of each allocation id
+    std::vector<uint32_t> m_allocations;
+    std::vector<uint32_t> m_unusedIds;
+
+    uint64_t m_firstLevelBitmap = 0;
+    uint32_t m_secondLevelBitmaps[FirstLevelCount] = {};
+    uint32_t m_freeLists[FirstLevelCount][SecondLevelCount];
+
+    std::vector<ASRelocation> m_relocations;
+    std::vector<uint32_t> m_relocationBlocks;
+};
@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "BottomLevelASBatch.h"
+
+#include "DXRHelper.h"
+
+uint32_t BottomLevelASBatch::Add(nv_helpers_dx12::BottomLevelASGenerator&& generator)
+{
+    m_generators.push_back(std::move(generator));
+    return static_cast<uint32_t>(m_generators.size() - 1);
+}
+
+void BottomLevelASBatch::Record(ID3D12Device5* device, ID3D12GraphicsCommandList4* commandList, ASBufferPool& resultPool)
+{
+    m_planner.Reset();
+    m_results.clear();
+
+    for (auto& generator : m_generators)
+    {
+        UINT64 scratchSizeInBytes = 0;
+        UINT64 resultSizeInBytes = 0;
+        generator.ComputeASBufferSizes(device, false, &scratchSizeInBytes, &resultSizeInBytes);
+
+        m_planner.AddBuild(scratchSizeInBytes);
+        m_results.push_back(resultPool.Allocate(device, resultSizeInBytes));
+    }
+
+    m_planner.Plan(m_scratchBudget);
+
+    if (m_planner.GetArenaSize() == 0)
+    {
+        return;
+    }
+
+    m_scratch = nv_helpers_dx12::CreateBuffer(device,
+        m_planner.GetArenaSize(),
+        D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_COMMON,
+        nv_helpers_dx12::kDefaultHeapProps);
+
+    const auto& batches = m_planner.GetBatches();
+
+    for (size_t batch = 0; batch < batches.size(); batch++)
+    {
+        // The previous batch used the same scratch memory
+        if (batch > 0)
+        {
+            const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::UAV(m_scratch.Get());
+            commandList->ResourceBarrier(1, &barrier);
+        }
+
+        for (uint32_t build : batches[batch].builds)
+        {
+            m_generators[build].Generate(commandList,
+                m_scratch.Get(),
+                resultPool.GetBuffer(m_results[build].heap),
+                false,
+                nullptr,
+                m_planner.GetPlacement(build).offset,
+                false,
+                m_results[build].offset);
+        }
+    }
+
+    // Every result, before a top-level build reads them
+    const D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+    commandList->ResourceBarrier(1, &barrier);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ASBufferPool.h"
+#include "ScratchPlanner.h"
+#include "nv_helpers_dx12/BottomLevelASGenerator.h"
+
+#include <vector>
+#include <wrl.h>
+
+/// Records many bottom-level builds with one shared scratch buffer, laid out by a
+/// ScratchPlanner, instead of one scratch buffer per build. Builds of a batch run
+/// concurrently on disjoint scratch ranges; a UAV barrier on the scratch buffer separates
+/// batches, and one UAV barrier after the last makes every result usable by a top-level
+/// build. The results are suballocated from an ASBufferPool, which owns them.
+///
+/// The scratch buffer has to stay alive until the command list has executed, so the
+/// batch must outlive the flush, as the top level's AccelerationStructureBuffers do.
+class BottomLevelASBatch
+{
+public:
+    /// At most scratchBudget bytes of scratch, 0 for as much as all builds at once need
+    explicit BottomLevelASBatch(uint64_t scratchBudget) : m_scratchBudget(scratchBudget) {}
+
+    /// Add a generator whose geometry has been added, and return its index
+    uint32_t Add(nv_helpers_dx12::BottomLevelASGenerator&& generator);
+
+    /// Compute the buffer sizes of every build, allocate the results from resultPool and
+    /// the scratch buffer, and record the builds on commandList. Throws
+    /// std::runtime_error if one build needs more scratch than the budget.
+    void Record(ID3D12Device5* device, ID3D12GraphicsCommandList4* commandList, ASBufferPool& resultPool);
+
+    /// Range of the result of a build in resultPool
+    const ASAllocation& GetResult(uint32_t index) const { return m_results[index]; }
+    const ScratchPlanner& GetPlanner() const { return m_planner; }
+
+private:
+    uint64_t m_scratchBudget = 0;
+    std::vector<nv_helpers_dx12::BottomLevelASGenerator> m_generators;
+    std::vector<ASAllocation> m_results;
+    Microsoft::WRL::ComPtr<ID3D12Resource> m_scratch;
+    ScratchPlanner m_planner;
+};
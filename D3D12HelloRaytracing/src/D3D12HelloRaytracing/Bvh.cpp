@@ -0,0 +1,262 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    BvhBounds GetNodeBounds(const BvhNode& node)
+    {
+        BvhBounds bounds;
+        bounds.Grow(node.boundsMin);
+        bounds.Grow(node.boundsMax);
+        return bounds;
+    }
+
+    // Slab test against the bounds of a node, with the reciprocal direction precomputed
+    bool IntersectBounds(const BvhNode& node, const float origin[3], const float inverseDirection[3], float tMin, float tMax, float& tEntry)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            float t0 = (node.boundsMin[axis] - origin[axis]) * inverseDirection[axis];
+            float t1 = (node.boundsMax[axis] - origin[axis]) * inverseDirection[axis];
+
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+        }
+
+        tEntry = tMin;
+        return tMin <= tMax;
+    }
+
+    // Shared by closest and any hit: visit the nearer child first and skip nodes behind
+    // the closest hit so far
+    template <bool AnyHit>
+    bool Traverse(const BvhView& bvh, const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats)
+    {
+        const BvhNode* nodes = bvh.nodes;
+        const uint32_t* primitives = bvh.primitiveIndices;
+
+        hit = BvhHit();
+
+        if (bvh.IsEmpty())
+        {
+            return false;
+        }
+
+        float inverseDirection[3];
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            // Keep 0 * inf out of the slab test
+            const float d = ray.direction[axis];
+            inverseDirection[axis] = 1.0f / (d != 0.0f ? d : (std::signbit(d) ? -1e-30f : 1e-30f));
+        }
+
+        uint64_t nodeVisits = 0;
+        uint64_t triangleTests = 0;
+        float tMax = ray.tMax;
+        float tEntry;
+
+        uint32_t stack[Bvh::MaxDepth];
+        uint32_t stackSize = 0;
+        uint32_t current = 0;
+
+        if (!IntersectBounds(nodes[0], ray.origin, inverseDirection, ray.tMin, tMax, tEntry))
+        {
+            current = BvhHit::NoHit;
+        }
+
+        while (current != BvhHit::NoHit)
+        {
+            const BvhNode& node = nodes[current];
+            nodeVisits++;
+
+            if (node.IsLeaf())
+            {
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                {
+                    const float* corners[3];
+                    geometry.GetTriangle(primitives[i], corners);
+                    triangleTests++;
+
+                    float t, u, v;
+
+                    if (Bvh::IntersectTriangle(corners, ray, tMax, t, u, v))
+                    {
+                        tMax = t;
+                        hit.t = t;
+                        hit.barycentrics[0] = u;
+                        hit.barycentrics[1] = v;
+                        hit.primitiveIndex = primitives[i];
+
+                        if (AnyHit)
+                        {
+                            stackSize = 0;
+                            break;
+                        }
+                    }
+                }
+
+                current = stackSize > 0 ? stack[--stackSize] : BvhHit::NoHit;
+                continue;
+            }
+
+            float tNear, tFar;
+            const bool hitNear = IntersectBounds(nodes[node.offset], ray.origin, inverseDirection, ray.tMin, tMax, tNear);
+            const bool hitFar = IntersectBounds(nodes[node.offset + 1], ray.origin, inverseDirection, ray.tMin, tMax, tFar);
+
+            if (hitNear && hitFar)
+            {
+                const bool swap = tFar < tNear;
+                current = node.offset + (swap ? 1 : 0);
+                stack[stackSize++] = node.offset + (swap ? 0 : 1);
+            }
+            else if (hitNear || hitFar)
+            {
+                current = node.offset + (hitNear ? 0 : 1);
+            }
+            else
+            {
+                current = stackSize > 0 ? stack[--stackSize] : BvhHit::NoHit;
+            }
+        }
+
+        if (stats)
+        {
+            stats->rays++;
+            stats->nodes += nodeVisits;
+            stats->triangles += triangleTests;
+        }
+
+        return hit.IsHit();
+    }
+}
+
+BvhBounds Bvh::GetBounds() const
+{
+    return m_nodes.empty() ? BvhBounds() : GetNodeBounds(m_nodes[0]);
+}
+
+float Bvh::GetSahCost(float traversalCost, float intersectionCost) const
+{
+    if (m_nodes.empty())
+    {
+        return 0.0f;
+    }
+
+    const double rootArea = GetNodeBounds(m_nodes[0]).GetHalfArea();
+
+    if (rootArea <= 0.0)
+    {
+        return intersectionCost * m_nodes[0].count;
+    }
+
+    // Walk from the root, so the padding and any unused slots are skipped
+    double cost = 0.0;
+    std::vector<uint32_t> stack(1, 0);
+
+    while (!stack.empty())
+    {
+        const BvhNode& node = m_nodes[stack.back()];
+        stack.pop_back();
+
+        const double area = GetNodeBounds(node).GetHalfArea();
+
+        if (node.IsLeaf())
+        {
+            cost += intersectionCost * node.count * area;
+        }
+        else
+        {
+            cost += traversalCost * area;
+            stack.push_back(node.offset);
+            stack.push_back(node.offset + 1);
+        }
+    }
+
+    return static_cast<float>(cost / rootArea);
+}
+
+// Moeller-Trumbore
+bool Bvh::IntersectTriangle(const float* corners[3], const BvhRay& ray, float tMax, float& t, float& u, float& v)
+{
+    const float* p0 = corners[0];
+    const float edge1[3] = { corners[1][0] - p0[0], corners[1][1] - p0[1], corners[1][2] - p0[2] };
+    const float edge2[3] = { corners[2][0] - p0[0], corners[2][1] - p0[1], corners[2][2] - p0[2] };
+    const float* d = ray.direction;
+
+    const float p[3] = { d[1] * edge2[2] - d[2] * edge2[1], d[2] * edge2[0] - d[0] * edge2[2], d[0] * edge2[1] - d[1] * edge2[0] };
+    const float determinant = edge1[0] * p[0] + edge1[1] * p[1] + edge1[2] * p[2];
+
+    if (determinant == 0.0f)
+    {
+        return false;
+    }
+
+    const float inverseDeterminant = 1.0f / determinant;
+    const float s[3] = { ray.origin[0] - p0[0], ray.origin[1] - p0[1], ray.origin[2] - p0[2] };
+
+    u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDeterminant;
+
+    if (u < 0.0f || u > 1.0f)
+    {
+        return false;
+    }
+
+    const float q[3] = { s[1] * edge1[2] - s[2] * edge1[1], s[2] * edge1[0] - s[0] * edge1[2], s[0] * edge1[1] - s[1] * edge1[0] };
+
+    v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverseDeterminant;
+
+    if (v < 0.0f || u + v > 1.0f)
+    {
+        return false;
+    }
+
+    t = (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]) * inverseDeterminant;
+
+    return t >= ray.tMin && t <= tMax;
+}
+
+bool Bvh::Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats) const
+{
+    return Traverse<false>(GetView(), geometry, ray, hit, stats);
+}
+
+bool Bvh::IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats) const
+{
+    BvhHit hit;
+    return Traverse<true>(GetView(), geometry, ray, hit, stats);
+}
+
+BvhView Bvh::GetView() const
+{
+    BvhView view;
+    view.nodes = m_nodes.data();
+    view.nodeCount = static_cast<uint32_t>(m_nodes.size());
+    view.primitiveIndices = m_primitiveIndices.data();
+    view.primitiveIndexCount = static_cast<uint32_t>(m_primitiveIndices.size());
+    view.triangleCount = m_triangleCount;
+    return view;
+}
+
+BvhBounds BvhView::GetBounds() const
+{
+    return IsEmpty() ? BvhBounds() : GetNodeBounds(nodes[0]);
+}
+
+bool BvhView::Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats) const
+{
+    return Traverse<false>(*this, geometry, ray, hit, stats);
+}
+
+bool BvhView::IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats) const
+{
+    BvhHit hit;
+    return Traverse<true>(*this, geometry, ray, hit, stats);
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+/// Triangles the way BottomLevelASGenerator::AddVertexBuffer receives them: positions
+/// (three floats at the start of each vertex) with a stride, and an optional 32-bit index
+/// buffer. Without indices every three vertices form a triangle. The data is not copied.
+struct BvhGeometry
+{
+    const float* positions = nullptr;
+    uint32_t vertexStride = 3 * sizeof(float);
+    uint32_t vertexCount = 0;
+    const uint32_t* indices = nullptr;
+    uint32_t indexCount = 0;
+
+    uint32_t GetTriangleCount() const { return (indices ? indexCount : vertexCount) / 3; }
+
+    const float* GetVertex(uint32_t vertex) const
+    {
+        return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(positions) + static_cast<size_t>(vertex) * vertexStride);
+    }
+
+    /// Positions of the three corners of a triangle, in index order
+    void GetTriangle(uint32_t triangle, const float* corners[3]) const
+    {
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            corners[i] = GetVertex(indices ? indices[triangle * 3 + i] : triangle * 3 + i);
+        }
+    }
+};
+
+struct BvhBounds
+{
+    float min[3] = { 3.402823466e+38f, 3.402823466e+38f, 3.402823466e+38f };
+    float max[3] = { -3.402823466e+38f, -3.402823466e+38f, -3.402823466e+38f };
+
+    void Grow(const float point[3])
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            min[axis] = point[axis] < min[axis] ? point[axis] : min[axis];
+            max[axis] = point[axis] > max[axis] ? point[axis] : max[axis];
+        }
+    }
+
+    void Grow(const BvhBounds& bounds)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            min[axis] = bounds.min[axis] < min[axis] ? bounds.min[axis] : min[axis];
+            max[axis] = bounds.max[axis] > max[axis] ? bounds.max[axis] : max[axis];
+        }
+    }
+
+    bool IsEmpty() const { return min[0] > max[0] || min[1] > max[1] || min[2] > max[2]; }
+
+    float GetCenter(uint32_t axis) const { return 0.5f * (min[axis] + max[axis]); }
+
+    /// Half the surface area, which is all SAH ratios need. 0 for empty bounds.
+    float GetHalfArea() const
+    {
+        if (IsEmpty())
+        {
+            return 0.0f;
+        }
+
+        const float x = max[0] - min[0];
+        const float y = max[1] - min[1];
+        const float z = max[2] - min[2];
+
+        return x * y + y * z + z * x;
+    }
+};
+
+/// Fields of the HLSL RayDesc. Hits are reported for tMin <= t <= tMax.
+struct BvhRay
+{
+    float origin[3];
+    float tMin;
+    float direction[3];
+    float tMax;
+};
+
+/// What a closest hit shader sees: RayTCurrent(), the barycentrics of vertices 1 and 2
+/// (BuiltInTriangleIntersectionAttributes) and PrimitiveIndex()
+struct BvhHit
+{
+    static const uint32_t NoHit = 0xFFFFFFFF;
+
+    float t = 0.0f;
+    float barycentrics[2] = {};
+    uint32_t primitiveIndex = NoHit;
+
+    bool IsHit() const { return primitiveIndex != NoHit; }
+};
+
+/// Work done by traversal calls, added to on every call
+struct BvhTraversalStats
+{
+    uint64_t rays = 0;
+    uint64_t nodes = 0;
+    uint64_t triangles = 0;
+};
+
+/// 32 bytes. Both children of an interior node are stored next to each other at an even
+/// index, so with the 64-byte aligned node array a sibling pair shares one cache line.
+struct alignas(32) BvhNode
+{
+    float boundsMin[3];
+    /// Interior nodes: index of the first child, the second follows. Leaves: first entry
+    /// in Bvh::GetPrimitiveIndices.
+    uint32_t offset;
+    float boundsMax[3];
+    /// Triangles in a leaf, 0 for interior nodes
+    uint32_t count;
+
+    bool IsLeaf() const { return count > 0; }
+};
+
+/// Read-only hierarchy in memory someone else owns: the arrays of a Bvh, or a file
+/// BvhCache mapped. Traversal is the same for both; the memory has to outlive the view.
+struct BvhView
+{
+    const BvhNode* nodes = nullptr;
+    uint32_t nodeCount = 0;
+    const uint32_t* primitiveIndices = nullptr;
+    uint32_t primitiveIndexCount = 0;
+    uint32_t triangleCount = 0;
+
+    /// True for a default view, or a hierarchy over no triangles
+    bool IsEmpty() const { return nodeCount == 0; }
+
+    BvhBounds GetBounds() const;
+
+    /// See Bvh::Intersect
+    bool Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats = nullptr) const;
+    /// See Bvh::IsOccluded
+    bool IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats = nullptr) const;
+};
+
+/// std::allocator with a minimum alignment, for arrays that should start on a cache line
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* pointer, size_t) { ::operator delete(pointer, std::align_val_t(Alignment)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+/// Binary bounding volume hierarchy over the triangles of one BvhGeometry, in a flat node
+/// array. Node 0 is the root and node 1 is padding, so that sibling pairs start at even
+/// indices. Leaves reference a range of GetPrimitiveIndices, whose entries are triangle
+/// indices of the geometry, the value HLSL returns from PrimitiveIndex(). A triangle can
+/// be referenced by more than one leaf when the builder uses spatial splits.
+class Bvh
+{
+public:
+    typedef std::vector<BvhNode, AlignedAllocator<BvhNode, 64>> NodeArray;
+
+    /// Deepest leaf a builder may create, the size of the traversal stack
+    static const uint32_t MaxDepth = 64;
+
+    const NodeArray& GetNodes() const { return m_nodes; }
+    const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_primitiveIndices; }
+    uint32_t GetTriangleCount() const { return m_triangleCount; }
+
+    BvhBounds GetBounds() const;
+
+    /// Expected cost of a random ray under the surface area heuristic: traversal cost per
+    /// interior node and intersection cost per triangle, weighted by the area of each node
+    /// relative to the root
+    float GetSahCost(float traversalCost = 1.0f, float intersectionCost = 1.0f) const;
+
+    /// Closest hit along a ray, with the geometry the hierarchy was built from. Triangles
+    /// are two-sided, as TraceRay sees them without culling ray flags.
+    bool Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats = nullptr) const;
+
+    /// Any hit along a ray, for shadow rays (RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH)
+    bool IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats = nullptr) const;
+
+    /// The arrays of this hierarchy, valid until it is rebuilt or destroyed
+    BvhView GetView() const;
+
+    size_t GetMemorySize() const { return m_nodes.size() * sizeof(BvhNode) + m_primitiveIndices.size() * sizeof(uint32_t); }
+
+    /// The ray-triangle test traversal uses, for hierarchies over the same triangles that
+    /// have to agree with this one: t in [ray.tMin, tMax], u and v weighting corners 1 and 2
+    static bool IntersectTriangle(const float* corners[3], const BvhRay& ray, float tMax, float& t, float& u, float& v);
+
+private:
+    friend class BvhBuilder;
+    friend class LbvhBuilder;
+    friend class BvhRefitter;
+
+    NodeArray m_nodes;
+    std::vector<uint32_t> m_primitiveIndices;
+    uint32_t m_triangleCount = 0;
+};
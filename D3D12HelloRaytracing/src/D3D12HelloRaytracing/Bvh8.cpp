@@ -0,0 +1,348 @@
+#include "Bvh8.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    const uint32_t Width = Bvh8Node::Width;
+
+    uint32_t CountTrailingZeros(uint32_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return index;
+#else
+        return __builtin_ctz(value);
+#endif
+    }
+
+    float GetHalfArea(const BvhNode& node)
+    {
+        const float x = node.boundsMax[0] - node.boundsMin[0];
+        const float y = node.boundsMax[1] - node.boundsMin[1];
+        const float z = node.boundsMax[2] - node.boundsMin[2];
+        return x * y + y * z + z * x;
+    }
+
+    // What every node test of one ray shares. The near plane of each axis is the min bounds
+    // for a positive direction and the max bounds for a negative one, so instead of sorting
+    // slab distances per node the ray picks which of the two arrays to load.
+    struct RayContext
+    {
+        float origin[3];
+        float inverseDirection[3];
+        uint32_t nearOffset[3];
+        uint32_t farOffset[3];
+        float tMin;
+
+        explicit RayContext(const BvhRay& ray) : tMin(ray.tMin)
+        {
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                // Keep 0 * inf out of the slab test, as Bvh does
+                const float d = ray.direction[axis];
+                origin[axis] = ray.origin[axis];
+                inverseDirection[axis] = 1.0f / (d != 0.0f ? d : (std::signbit(d) ? -1e-30f : 1e-30f));
+
+                // Offsets in floats from boundsMin[0][0]; boundsMax follows boundsMin
+                const uint32_t minOffset = axis * Width;
+                const uint32_t maxOffset = (3 + axis) * Width;
+                nearOffset[axis] = inverseDirection[axis] >= 0.0f ? minOffset : maxOffset;
+                farOffset[axis] = inverseDirection[axis] >= 0.0f ? maxOffset : minOffset;
+            }
+        }
+    };
+
+    // Test a ray against the children of a node. Writes the entry distances and lanes of
+    // the children hit, packed, and returns how many there are.
+    uint32_t IntersectChildren(const Bvh8Node& node, const RayContext& ray, float tMax, float distances[Width], uint32_t lanes[Width])
+    {
+        const float* bounds = &node.boundsMin[0][0];
+
+#if defined(__AVX2__)
+        __m256 tEntry = _mm256_set1_ps(ray.tMin);
+        __m256 tExit = _mm256_set1_ps(tMax);
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            // (bound - origin) * inverse, the same arithmetic as Bvh's slab test
+            const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+            const __m256 inverse = _mm256_set1_ps(ray.inverseDirection[axis]);
+            const __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds + ray.nearOffset[axis]), origin), inverse);
+            const __m256 tFar = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(bounds + ray.farOffset[axis]), origin), inverse);
+
+            tEntry = _mm256_max_ps(tEntry, tNear);
+            tExit = _mm256_min_ps(tExit, tFar);
+        }
+
+#if defined(__AVX512VL__)
+        const __mmask8 mask = _mm256_cmp_ps_mask(tEntry, tExit, _CMP_LE_OQ);
+        _mm256_mask_compressstoreu_ps(distances, mask, tEntry);
+        _mm256_mask_compressstoreu_epi32(lanes, mask, _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        return static_cast<uint32_t>(_mm_popcnt_u32(mask));
+#else
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ)));
+        alignas(32) float entries[Width];
+        _mm256_store_ps(entries, tEntry);
+
+        uint32_t count = 0;
+
+        for (; mask; mask &= mask - 1)
+        {
+            const uint32_t lane = CountTrailingZeros(mask);
+            distances[count] = entries[lane];
+            lanes[count++] = lane;
+        }
+
+        return count;
+#endif
+#else
+        uint32_t count = 0;
+
+        for (uint32_t lane = 0; lane < Width; lane++)
+        {
+            float tEntry = ray.tMin;
+            float tExit = tMax;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                const float tNear = (bounds[ray.nearOffset[axis] + lane] - ray.origin[axis]) * ray.inverseDirection[axis];
+                const float tFar = (bounds[ray.farOffset[axis] + lane] - ray.origin[axis]) * ray.inverseDirection[axis];
+                tEntry = tNear > tEntry ? tNear : tEntry;
+                tExit = tFar < tExit ? tFar : tExit;
+            }
+
+            if (tEntry <= tExit)
+            {
+                distances[count] = tEntry;
+                lanes[count++] = lane;
+            }
+        }
+
+        return count;
+#endif
+    }
+
+    struct StackEntry
+    {
+        uint32_t offset;
+        /// Triangles of a leaf, 0 for a node
+        uint32_t count;
+        /// Where the ray enters the child's bounds
+        float tEntry;
+    };
+
+    template <bool AnyHit>
+    bool Traverse(const Bvh8& bvh, const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats)
+    {
+        const auto& nodes = bvh.GetNodes();
+        const auto& primitives = bvh.GetPrimitiveIndices();
+
+        hit = BvhHit();
+
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        const RayContext context(ray);
+        uint64_t nodeVisits = 0;
+        uint64_t triangleTests = 0;
+        float tMax = ray.tMax;
+
+        StackEntry stack[Bvh8::StackSize];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = { 0, 0, ray.tMin };
+
+        while (stackSize > 0)
+        {
+            const StackEntry entry = stack[--stackSize];
+
+            // Pushed before a closer hit was found
+            if (entry.tEntry > tMax)
+            {
+                continue;
+            }
+
+            if (entry.count > 0)
+            {
+                for (uint32_t i = entry.offset; i < entry.offset + entry.count; i++)
+                {
+                    const float* corners[3];
+                    geometry.GetTriangle(primitives[i], corners);
+                    triangleTests++;
+
+                    float t, u, v;
+
+                    if (Bvh::IntersectTriangle(corners, ray, tMax, t, u, v))
+                    {
+                        tMax = t;
+                        hit.t = t;
+                        hit.barycentrics[0] = u;
+                        hit.barycentrics[1] = v;
+                        hit.primitiveIndex = primitives[i];
+
+                        if (AnyHit)
+                        {
+                            stackSize = 0;
+                            break;
+                        }
+                    }
+                }
+
+                continue;
+            }
+
+            const Bvh8Node& node = nodes[entry.offset];
+            nodeVisits++;
+
+            float distances[Width];
+            uint32_t lanes[Width];
+            const uint32_t hitCount = IntersectChildren(node, context, tMax, distances, lanes);
+
+            // Farthest first, so that the nearest child is popped next. Rays that start
+            // inside boxes enter many at tMin; those ties go to the lower lanes first, in the
+            // binary tree's left to right order, which for shadow rays from a surface finds
+            // the occluder several times sooner than the reverse.
+            for (uint32_t i = 1; i < hitCount; i++)
+            {
+                const float distance = distances[i];
+                const uint32_t lane = lanes[i];
+                uint32_t j = i;
+
+                for (; j > 0 && distances[j - 1] <= distance; j--)
+                {
+                    distances[j] = distances[j - 1];
+                    lanes[j] = lanes[j - 1];
+                }
+
+                distances[j] = distance;
+                lanes[j] = lane;
+            }
+
+            for (uint32_t i = 0; i < hitCount; i++)
+            {
+                stack[stackSize++] = { node.offsets[lanes[i]], node.counts[lanes[i]], distances[i] };
+            }
+        }
+
+        if (stats)
+        {
+            stats->rays++;
+            stats->nodes += nodeVisits;
+            stats->triangles += triangleTests;
+        }
+
+        return hit.IsHit();
+    }
+}
+
+void Bvh8::Collapse(const Bvh& bvh)
+{
+    m_nodes.clear();
+    m_primitiveIndices = bvh.GetPrimitiveIndices();
+    m_triangleCount = bvh.GetTriangleCount();
+
+    if (!bvh.GetNodes().empty())
+    {
+        m_nodes.reserve(bvh.GetNodes().size() / 4 + 1);
+        CollapseNode(bvh, 0);
+    }
+
+    m_nodes.shrink_to_fit();
+}
+
+// Returns the index of the wide node over the children of binaryNode. A leaf root becomes
+// the only child of node 0.
+uint32_t Bvh8::CollapseNode(const Bvh& bvh, uint32_t binaryNode)
+{
+    const auto& nodes = bvh.GetNodes();
+    uint32_t children[Width] = { binaryNode };
+    uint32_t childCount = 1;
+
+    if (!nodes[binaryNode].IsLeaf())
+    {
+        children[0] = nodes[binaryNode].offset;
+        children[1] = nodes[binaryNode].offset + 1;
+        childCount = 2;
+    }
+
+    while (childCount < Width)
+    {
+        uint32_t largest = Width;
+        float largestArea = -1.0f;
+
+        for (uint32_t i = 0; i < childCount; i++)
+        {
+            const BvhNode& child = nodes[children[i]];
+
+            if (!child.IsLeaf() && GetHalfArea(child) > largestArea)
+            {
+                largest = i;
+                largestArea = GetHalfArea(child);
+            }
+        }
+
+        if (largest == Width)
+        {
+            break;
+        }
+
+        const BvhNode& opened = nodes[children[largest]];
+        children[largest] = opened.offset;
+        children[childCount++] = opened.offset + 1;
+    }
+
+    const uint32_t index = static_cast<uint32_t>(m_nodes.size());
+    Bvh8Node wideNode = {};
+
+    for (uint32_t lane = 0; lane < Width; lane++)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            wideNode.boundsMin[axis][lane] = 3.402823466e+38f;
+            wideNode.boundsMax[axis][lane] = -3.402823466e+38f;
+        }
+    }
+
+    m_nodes.push_back(wideNode);
+
+    for (uint32_t lane = 0; lane < childCount; lane++)
+    {
+        const BvhNode& child = nodes[children[lane]];
+        const uint32_t offset = child.IsLeaf() ? child.offset : CollapseNode(bvh, children[lane]);
+        Bvh8Node& node = m_nodes[index];
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            node.boundsMin[axis][lane] = child.boundsMin[axis];
+            node.boundsMax[axis][lane] = child.boundsMax[axis];
+        }
+
+        node.offsets[lane] = offset;
+        node.counts[lane] = child.count;
+    }
+
+    return index;
+}
+
+bool Bvh8::Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats) const
+{
+    return Traverse<false>(*this, geometry, ray, hit, stats);
+}
+
+bool Bvh8::IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats) const
+{
+    BvhHit hit;
+    return Traverse<true>(*this, geometry, ray, hit, stats);
+}
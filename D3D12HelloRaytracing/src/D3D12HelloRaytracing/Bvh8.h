@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Up to eight children with their bounds in structure-of-arrays form, so that one ray is
+/// tested against all of them with one AVX2 operation per slab plane. 256 bytes, four
+/// cache lines.
+struct alignas(64) Bvh8Node
+{
+    static const uint32_t Width = 8;
+
+    /// Child bounds by axis, one lane per child. Unused lanes have min > max and never hit.
+    float boundsMin[3][Width];
+    float boundsMax[3][Width];
+    /// Interior children: node index. Leaves: first entry in Bvh8::GetPrimitiveIndices.
+    uint32_t offsets[Width];
+    /// Triangles in leaf children, 0 for interior children and unused lanes
+    uint32_t counts[Width];
+};
+
+/// Eight-wide BVH collapsed from a binary one: a node takes the children of a binary node
+/// and keeps opening the child with the largest surface area until it has eight or only
+/// leaves are left. Leaves and the primitive order are the binary tree's, so the two have
+/// the same SAH leaves and differ only in how many boxes a ray visits on the way.
+///
+/// Traversal tests one ray against all children of a node at once, pushes the hit ones
+/// farthest first and skips popped entries that are beyond the closest hit. Triangles are
+/// intersected with Bvh::IntersectTriangle and hits are reported as Bvh reports them, so
+/// the two hierarchies are interchangeable. With AVX-512VL (/arch:AVX512) the hit lanes
+/// are compressed with mask instructions; builds without AVX2 test the lanes in a loop.
+class Bvh8
+{
+public:
+    typedef std::vector<Bvh8Node, AlignedAllocator<Bvh8Node, 64>> NodeArray;
+
+    /// Entries the traversal stack needs: up to seven pushes per level of the binary tree
+    static const uint32_t StackSize = (Bvh8Node::Width - 1) * Bvh::MaxDepth + 1;
+
+    /// Replace the contents with the collapse of a binary hierarchy. Node 0 is the root,
+    /// also when the binary root is a leaf.
+    void Collapse(const Bvh& bvh);
+
+    const NodeArray& GetNodes() const { return m_nodes; }
+    const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_primitiveIndices; }
+    uint32_t GetTriangleCount() const { return m_triangleCount; }
+
+    /// Same results as Bvh::Intersect on the hierarchy this was collapsed from, up to ties
+    /// between triangles at the same distance. Stats count wide nodes.
+    bool Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats = nullptr) const;
+
+    /// Any hit along a ray, for shadow rays (RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH)
+    bool IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats = nullptr) const;
+
+    size_t GetMemorySize() const { return m_nodes.size() * sizeof(Bvh8Node) + m_primitiveIndices.size() * sizeof(uint32_t); }
+
+private:
+    uint32_t CollapseNode(const Bvh& bvh, uint32_t binaryNode);
+
+    NodeArray m_nodes;
+    std::vector<uint32_t> m_primitiveIndices;
+    uint32_t m_triangleCount = 0;
+};
@@ -0,0 +1,541 @@
+#include "BvhAnalyzer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    BvhBounds GetNodeBounds(const BvhNode& node)
+    {
+        BvhBounds bounds;
+        bounds.Grow(node.boundsMin);
+        bounds.Grow(node.boundsMax);
+        return bounds;
+    }
+
+    BvhBounds Intersect(const BvhBounds& a, const BvhBounds& b)
+    {
+        BvhBounds bounds;
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            bounds.min[axis] = (std::max)(a.min[axis], b.min[axis]);
+            bounds.max[axis] = (std::min)(a.max[axis], b.max[axis]);
+        }
+
+        return bounds;
+    }
+
+    bool Contains(const BvhBounds& outer, const BvhBounds& inner)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            if (inner.min[axis] < outer.min[axis] || inner.max[axis] > outer.max[axis])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Area of a convex polygon, by a fan from its first vertex
+    double GetPolygonArea(const float (*vertices)[3], uint32_t count)
+    {
+        double normal[3] = {};
+
+        for (uint32_t i = 1; i + 1 < count; i++)
+        {
+            const double a[3] = { vertices[i][0] - vertices[0][0], vertices[i][1] - vertices[0][1], vertices[i][2] - vertices[0][2] };
+            const double b[3] = { vertices[i + 1][0] - vertices[0][0], vertices[i + 1][1] - vertices[0][1], vertices[i + 1][2] - vertices[0][2] };
+            normal[0] += a[1] * b[2] - a[2] * b[1];
+            normal[1] += a[2] * b[0] - a[0] * b[2];
+            normal[2] += a[0] * b[1] - a[1] * b[0];
+        }
+
+        return 0.5 * std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    }
+
+    // Area of the part of a triangle inside a box, clipping it against the six planes in
+    // turn (Sutherland-Hodgman); each plane adds at most one vertex
+    double GetClippedArea(const float* corners[3], const BvhBounds& box)
+    {
+        float polygon[9][3];
+        float clipped[9][3];
+        uint32_t count = 3;
+
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            std::copy(corners[i], corners[i] + 3, polygon[i]);
+        }
+
+        for (uint32_t plane = 0; plane < 6 && count >= 3; plane++)
+        {
+            const uint32_t axis = plane / 2;
+            const bool isMax = plane % 2 != 0;
+            const float bound = isMax ? box.max[axis] : box.min[axis];
+            auto inside = [&](const float* vertex) { return isMax ? vertex[axis] <= bound : vertex[axis] >= bound; };
+
+            uint32_t clippedCount = 0;
+
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const float* current = polygon[i];
+                const float* next = polygon[(i + 1) % count];
+
+                if (inside(current))
+                {
+                    std::copy(current, current + 3, clipped[clippedCount++]);
+                }
+
+                if (inside(current) != inside(next))
+                {
+                    const float t = (bound - current[axis]) / (next[axis] - current[axis]);
+
+                    for (uint32_t k = 0; k < 3; k++)
+                    {
+                        clipped[clippedCount][k] = current[k] + t * (next[k] - current[k]);
+                    }
+
+                    clipped[clippedCount++][axis] = bound;
+                }
+            }
+
+            std::copy(&clipped[0][0], &clipped[0][0] + clippedCount * 3, &polygon[0][0]);
+            count = clippedCount;
+        }
+
+        return count >= 3 ? GetPolygonArea(polygon, count) : 0.0;
+    }
+
+    double GetTriangleArea(const float* corners[3])
+    {
+        const float vertices[3][3] = { { corners[0][0], corners[0][1], corners[0][2] },
+                                       { corners[1][0], corners[1][1], corners[1][2] },
+                                       { corners[2][0], corners[2][1], corners[2][2] } };
+        return GetPolygonArea(vertices, 3);
+    }
+
+    BvhAnalyzer::Distribution Summarize(const std::vector<uint32_t>& values)
+    {
+        BvhAnalyzer::Distribution distribution;
+
+        if (values.empty())
+        {
+            return distribution;
+        }
+
+        std::vector<uint32_t> sorted = values;
+        std::sort(sorted.begin(), sorted.end());
+
+        double sum = 0.0;
+
+        for (uint32_t value : sorted)
+        {
+            sum += value;
+        }
+
+        auto percentile = [&](double fraction) { return sorted[static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5)]; };
+
+        distribution.mean = sum / sorted.size();
+        distribution.median = percentile(0.5);
+        distribution.percentile95 = percentile(0.95);
+        distribution.percentile99 = percentile(0.99);
+        distribution.max = sorted.back();
+        return distribution;
+    }
+
+    std::string EscapeJson(const std::string& text)
+    {
+        std::string escaped;
+
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+
+            escaped += c;
+        }
+
+        return escaped;
+    }
+
+    std::string FormatNumber(double value)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.6g", value);
+        return buffer;
+    }
+
+    std::string DistributionToJson(const BvhAnalyzer::Distribution& distribution)
+    {
+        return "{ \"mean\": " + FormatNumber(distribution.mean) + ", \"median\": " + std::to_string(distribution.median) +
+               ", \"p95\": " + std::to_string(distribution.percentile95) + ", \"p99\": " + std::to_string(distribution.percentile99) +
+               ", \"max\": " + std::to_string(distribution.max) + " }";
+    }
+}
+
+void BvhAnalyzer::Analyze(const Bvh& bvh, const BvhGeometry& geometry)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const auto& nodes = bvh.GetNodes();
+    const auto& primitives = bvh.GetPrimitiveIndices();
+
+    m_report = Report();
+    m_nodeVisits.clear();
+    m_triangleTests.clear();
+
+    m_report.triangles = geometry.GetTriangleCount();
+    m_report.memorySize = bvh.GetMemorySize();
+    m_report.sahCost = bvh.GetSahCost(m_settings.traversalCost, m_settings.intersectionCost);
+
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    // Depth-first from the root, for the counts, histograms and levels, and the reachable
+    // nodes in preorder for EPO
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t depth;
+    };
+
+    std::vector<Entry> stack(1, { 0, 0 });
+    std::vector<uint32_t> order;
+    uint64_t leafDepthSum = 0;
+    m_report.minLeafDepth = Bvh::MaxDepth;
+
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        const BvhNode& node = nodes[entry.node];
+        order.push_back(entry.node);
+        m_report.nodes++;
+
+        if (m_report.levels.size() <= entry.depth)
+        {
+            m_report.levels.resize(entry.depth + 1);
+        }
+
+        Level& level = m_report.levels[entry.depth];
+        level.nodes++;
+
+        if (node.IsLeaf())
+        {
+            level.leaves++;
+            m_report.leaves++;
+            m_report.references += node.count;
+            m_report.leafSizes.resize((std::max)(m_report.leafSizes.size(), static_cast<size_t>(node.count) + 1));
+            m_report.leafSizes[node.count]++;
+            m_report.minLeafDepth = (std::min)(m_report.minLeafDepth, entry.depth);
+            m_report.maxLeafDepth = (std::max)(m_report.maxLeafDepth, entry.depth);
+            leafDepthSum += entry.depth;
+            continue;
+        }
+
+        const BvhBounds left = GetNodeBounds(nodes[node.offset]);
+        const BvhBounds right = GetNodeBounds(nodes[node.offset + 1]);
+        const double childArea = static_cast<double>(left.GetHalfArea()) + right.GetHalfArea();
+
+        if (childArea > 0.0)
+        {
+            level.childOverlap += Intersect(left, right).GetHalfArea() / childArea;
+        }
+
+        stack.push_back({ node.offset + 1, entry.depth + 1 });
+        stack.push_back({ node.offset, entry.depth + 1 });
+    }
+
+    m_report.averageLeafDepth = m_report.leaves ? static_cast<double>(leafDepthSum) / m_report.leaves : 0.0;
+
+    // Per level, the mean over its interior nodes
+    for (Level& level : m_report.levels)
+    {
+        const uint32_t interiorNodes = level.nodes - level.leaves;
+        level.childOverlap = interiorNodes ? level.childOverlap / interiorNodes : 0.0;
+    }
+
+    if (m_settings.computeEpo)
+    {
+        // For each node, mark the triangles of its subtree, then find the other triangles
+        // whose leaves overlap it and clip them to it. Marks are the node's position in
+        // the preorder, so they never need clearing.
+        const uint32_t triangleCount = geometry.GetTriangleCount();
+        std::vector<uint32_t> inSubtree(triangleCount, UINT32_MAX);
+        std::vector<uint32_t> counted(triangleCount, UINT32_MAX);
+        std::vector<uint32_t> subtreeStack;
+        std::vector<uint32_t> overlapStack;
+        double totalArea = 0.0;
+        double overlapArea = 0.0;
+
+        for (uint32_t triangle = 0; triangle < triangleCount; triangle++)
+        {
+            const float* corners[3];
+            geometry.GetTriangle(triangle, corners);
+            totalArea += GetTriangleArea(corners);
+        }
+
+        for (uint32_t position = 0; position < order.size(); position++)
+        {
+            const uint32_t nodeIndex = order[position];
+            const BvhNode& node = nodes[nodeIndex];
+            const BvhBounds bounds = GetNodeBounds(node);
+            const double cost = node.IsLeaf() ? m_settings.intersectionCost * node.count : m_settings.traversalCost;
+
+            // The root holds everything
+            if (nodeIndex == 0)
+            {
+                continue;
+            }
+
+            for (subtreeStack.assign(1, nodeIndex); !subtreeStack.empty();)
+            {
+                const BvhNode& subtreeNode = nodes[subtreeStack.back()];
+                subtreeStack.pop_back();
+
+                if (!subtreeNode.IsLeaf())
+                {
+                    subtreeStack.push_back(subtreeNode.offset);
+                    subtreeStack.push_back(subtreeNode.offset + 1);
+                    continue;
+                }
+
+                for (uint32_t i = subtreeNode.offset; i < subtreeNode.offset + subtreeNode.count; i++)
+                {
+                    inSubtree[primitives[i]] = position;
+                }
+            }
+
+            double area = 0.0;
+
+            for (overlapStack.assign(1, 0); !overlapStack.empty();)
+            {
+                const uint32_t otherIndex = overlapStack.back();
+                overlapStack.pop_back();
+
+                const BvhNode& other = nodes[otherIndex];
+
+                if (otherIndex == nodeIndex || Intersect(bounds, GetNodeBounds(other)).IsEmpty())
+                {
+                    continue;
+                }
+
+                if (!other.IsLeaf())
+                {
+                    overlapStack.push_back(other.offset);
+                    overlapStack.push_back(other.offset + 1);
+                    continue;
+                }
+
+                for (uint32_t i = other.offset; i < other.offset + other.count; i++)
+                {
+                    const uint32_t triangle = primitives[i];
+
+                    if (inSubtree[triangle] == position || counted[triangle] == position)
+                    {
+                        continue;
+                    }
+
+                    counted[triangle] = position;
+
+                    const float* corners[3];
+                    geometry.GetTriangle(triangle, corners);
+
+                    BvhBounds triangleBounds;
+                    triangleBounds.Grow(corners[0]);
+                    triangleBounds.Grow(corners[1]);
+                    triangleBounds.Grow(corners[2]);
+
+                    area += Contains(bounds, triangleBounds) ? GetTriangleArea(corners) : GetClippedArea(corners, bounds);
+                }
+            }
+
+            overlapArea += cost * area;
+        }
+
+        m_report.epo = totalArea > 0.0 ? static_cast<float>(overlapArea / totalArea) : 0.0f;
+    }
+
+    m_report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void BvhAnalyzer::TraceRays(const Bvh& bvh, const BvhGeometry& geometry, const std::vector<BvhRay>& rays, uint32_t width, uint32_t height)
+{
+    if (static_cast<size_t>(width) * height != rays.size())
+    {
+        throw std::runtime_error("BVH analysis needs one ray per pixel of a " + std::to_string(width) + "x" + std::to_string(height) + " image");
+    }
+
+    m_nodeVisits.resize(rays.size());
+    m_triangleTests.resize(rays.size());
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        BvhTraversalStats stats;
+        BvhHit hit;
+        bvh.Intersect(geometry, rays[i], hit, &stats);
+        m_nodeVisits[i] = static_cast<uint32_t>(stats.nodes);
+        m_triangleTests[i] = static_cast<uint32_t>(stats.triangles);
+    }
+
+    m_report.raySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_report.rays = static_cast<uint32_t>(rays.size());
+    m_report.width = width;
+    m_report.height = height;
+    m_report.nodeVisits = Summarize(m_nodeVisits);
+    m_report.triangleTests = Summarize(m_triangleTests);
+}
+
+std::string BvhAnalyzer::ToJson(const std::string& name) const
+{
+    const Report& report = m_report;
+    std::string json = "{\n";
+
+    json += "  \"name\": \"" + EscapeJson(name) + "\",\n";
+    json += "  \"triangles\": " + std::to_string(report.triangles) + ",\n";
+    json += "  \"references\": " + std::to_string(report.references) + ",\n";
+    json += "  \"nodes\": " + std::to_string(report.nodes) + ",\n";
+    json += "  \"leaves\": " + std::to_string(report.leaves) + ",\n";
+    json += "  \"memoryBytes\": " + std::to_string(report.memorySize) + ",\n";
+    json += "  \"sahCost\": " + FormatNumber(report.sahCost) + ",\n";
+    json += "  \"epo\": " + (report.epo >= 0.0f ? FormatNumber(report.epo) : std::string("null")) + ",\n";
+    json += "  \"leafDepth\": { \"min\": " + std::to_string(report.minLeafDepth) + ", \"mean\": " + FormatNumber(report.averageLeafDepth) +
+            ", \"max\": " + std::to_string(report.maxLeafDepth) + " },\n";
+    json += "  \"leafSizes\": [";
+
+    for (size_t i = 0; i < report.leafSizes.size(); i++)
+    {
+        json += (i ? ", " : "") + std::to_string(report.leafSizes[i]);
+    }
+
+    json += "],\n  \"levels\": [\n";
+
+    for (size_t i = 0; i < report.levels.size(); i++)
+    {
+        const Level& level = report.levels[i];
+        json += "    { \"nodes\": " + std::to_string(level.nodes) + ", \"leaves\": " + std::to_string(level.leaves) +
+                ", \"childOverlap\": " + FormatNumber(level.childOverlap) + " }" + (i + 1 < report.levels.size() ? ",\n" : "\n");
+    }
+
+    json += "  ],\n  \"analysisSeconds\": " + FormatNumber(report.seconds);
+
+    if (report.rays > 0)
+    {
+        json += ",\n  \"rays\": { \"count\": " + std::to_string(report.rays) + ", \"width\": " + std::to_string(report.width) +
+                ", \"height\": " + std::to_string(report.height) + ", \"seconds\": " + FormatNumber(report.raySeconds) + ",\n";
+        json += "    \"nodeVisits\": " + DistributionToJson(report.nodeVisits) + ",\n";
+        json += "    \"triangleTests\": " + DistributionToJson(report.triangleTests) + " }";
+    }
+
+    json += "\n}";
+    return json;
+}
+
+void BvhAnalyzer::SaveJson(const std::string& path, const std::string& name) const
+{
+    std::ofstream file(path);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create BVH report " + path);
+    }
+
+    file << ToJson(name) << "\n";
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot write BVH report " + path);
+    }
+}
+
+void BvhAnalyzer::SaveHeatmap(const std::string& path, bool triangleTests) const
+{
+    const std::vector<uint32_t>& values = triangleTests ? m_triangleTests : m_nodeVisits;
+    const uint32_t width = m_report.width;
+    const uint32_t height = m_report.height;
+
+    if (values.empty())
+    {
+        throw std::runtime_error("No ray counts for a BVH heatmap; trace rays first");
+    }
+
+    const uint32_t scale = (std::max)(1u, triangleTests ? m_report.triangleTests.percentile99 : m_report.nodeVisits.percentile99);
+
+    // Dark blue, blue, cyan, yellow, red
+    const float ramp[5][3] = { { 0.0f, 0.0f, 0.3f }, { 0.0f, 0.2f, 1.0f }, { 0.0f, 0.9f, 0.9f }, { 1.0f, 0.9f, 0.0f }, { 1.0f, 0.0f, 0.0f } };
+
+    // Rows padded to 4 bytes and stored bottom-up, as BGR
+    const uint32_t rowSize = (width * 3 + 3) & ~3u;
+    const uint32_t imageSize = rowSize * height;
+    std::vector<uint8_t> file(54 + imageSize);
+
+    auto write16 = [&](size_t offset, uint32_t value)
+    {
+        file[offset] = static_cast<uint8_t>(value);
+        file[offset + 1] = static_cast<uint8_t>(value >> 8);
+    };
+
+    auto write32 = [&](size_t offset, uint32_t value)
+    {
+        write16(offset, value & 0xFFFF);
+        write16(offset + 2, value >> 16);
+    };
+
+    // BITMAPFILEHEADER and BITMAPINFOHEADER
+    file[0] = 'B';
+    file[1] = 'M';
+    write32(2, static_cast<uint32_t>(file.size()));
+    write32(10, 54);
+    write32(14, 40);
+    write32(18, width);
+    write32(22, height);
+    write16(26, 1);
+    write16(28, 24);
+    write32(34, imageSize);
+    write32(38, 2835);
+    write32(42, 2835);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint8_t* row = &file[54 + static_cast<size_t>(height - 1 - y) * rowSize];
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const float position = 4.0f * (std::min)(1.0f, static_cast<float>(values[static_cast<size_t>(y) * width + x]) / scale);
+            const uint32_t segment = (std::min)(3u, static_cast<uint32_t>(position));
+            const float fraction = position - segment;
+
+            for (uint32_t channel = 0; channel < 3; channel++)
+            {
+                const float value = ramp[segment][channel] + fraction * (ramp[segment + 1][channel] - ramp[segment][channel]);
+                row[x * 3 + 2 - channel] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    std::ofstream stream(path, std::ios::binary);
+
+    if (!stream.good())
+    {
+        throw std::runtime_error("Cannot create BVH heatmap " + path);
+    }
+
+    stream.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+
+    if (!stream.good())
+    {
+        throw std::runtime_error("Cannot write BVH heatmap " + path);
+    }
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Bvh.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Quality measures of a Bvh, to compare builders and mesh preprocessing on numbers
+/// rather than frame times. The structural ones follow Aila et al., "On Quality Metrics
+/// of Bounding Volume Hierarchies": SAH cost predicts traversal cost well only where
+/// nodes do not overlap, and end-point overlap (EPO) measures how much triangle surface
+/// lies inside nodes that do not hold it, which rays hitting that surface have to visit
+/// anyway. Together they track measured ray cost far better than either alone.
+///
+/// The measured ones come from tracing a camera view: node visits and triangle tests of
+/// every ray, kept per pixel for a heatmap.
+class BvhAnalyzer
+{
+public:
+    struct Settings
+    {
+        /// SAH costs of visiting an interior node and intersecting a triangle, which also
+        /// weight the nodes in EPO
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+        /// EPO clips every triangle against every node it overlaps but does not belong to,
+        /// which for millions of triangles takes a while
+        bool computeEpo = true;
+    };
+
+    /// Interior nodes at one depth, and how much their two children overlap
+    struct Level
+    {
+        uint32_t nodes = 0;
+        uint32_t leaves = 0;
+        /// Surface area of the children's intersection over the children's total area,
+        /// summed over the level's interior nodes
+        double childOverlap = 0.0;
+    };
+
+    /// Summary of one per-ray count
+    struct Distribution
+    {
+        double mean = 0.0;
+        uint32_t median = 0;
+        uint32_t percentile95 = 0;
+        uint32_t percentile99 = 0;
+        uint32_t max = 0;
+    };
+
+    struct Report
+    {
+        uint32_t triangles = 0;
+        /// Leaf entries, more than triangles with spatial splits
+        uint32_t references = 0;
+        /// Reachable from the root, so without the padding node
+        uint32_t nodes = 0;
+        uint32_t leaves = 0;
+        size_t memorySize = 0;
+        float sahCost = 0.0f;
+        /// Weighted triangle area in nodes that do not hold it, over the total triangle
+        /// area; negative when not computed. Triangles in a node's subtree count as its
+        /// own, so parts of a spatially split triangle clipped from a leaf do not count.
+        float epo = -1.0f;
+        /// Leaves by how many triangles they hold, indexed by the count
+        std::vector<uint32_t> leafSizes;
+        uint32_t minLeafDepth = 0;
+        uint32_t maxLeafDepth = 0;
+        double averageLeafDepth = 0.0;
+        /// By depth, the root at 0
+        std::vector<Level> levels;
+        double seconds = 0.0;
+
+        /// Per ray counts, when TraceRays was called
+        uint32_t rays = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        Distribution nodeVisits;
+        Distribution triangleTests;
+        double raySeconds = 0.0;
+    };
+
+    explicit BvhAnalyzer(const Settings& settings) : m_settings(settings) {}
+
+    /// Structural measures of bvh over the geometry it was built from; clears the ray counts
+    void Analyze(const Bvh& bvh, const BvhGeometry& geometry);
+
+    /// Closest hits of a width x height image of rays, rows from the top, recording the
+    /// node visits and triangle tests of each
+    void TraceRays(const Bvh& bvh, const BvhGeometry& geometry, const std::vector<BvhRay>& rays, uint32_t width, uint32_t height);
+
+    const Report& GetReport() const { return m_report; }
+    const std::vector<uint32_t>& GetNodeVisits() const { return m_nodeVisits; }
+    const std::vector<uint32_t>& GetTriangleTests() const { return m_triangleTests; }
+
+    /// The report as one JSON object, with name as its "name". Throws
+    /// std::runtime_error if the file cannot be written.
+    void SaveJson(const std::string& path, const std::string& name) const;
+    /// The same object, for writing several reports into one file
+    std::string ToJson(const std::string& name) const;
+
+    /// 24-bit BMP of the node visits (or triangle tests) per pixel, from dark blue for
+    /// none to red at the 99th percentile and above. Throws std::runtime_error if there
+    /// are no ray counts or the file cannot be written.
+    void SaveHeatmap(const std::string& path, bool triangleTests = false) const;
+
+private:
+    Settings m_settings;
+    Report m_report;
+    std::vector<uint32_t> m_nodeVisits;
+    std::vector<uint32_t> m_triangleTests;
+};
@@ -0,0 +1,928 @@
+#include "BvhBuilder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <emmintrin.h>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    typedef BvhBuilder::Settings Settings;
+
+    const float Infinity = 3.402823466e+38f;
+
+    // Bounds in SSE registers; the fourth lane is don't-care
+    struct Box
+    {
+        __m128 min = _mm_set1_ps(Infinity);
+        __m128 max = _mm_set1_ps(-Infinity);
+
+        void Grow(const Box& box)
+        {
+            min = _mm_min_ps(min, box.min);
+            max = _mm_max_ps(max, box.max);
+        }
+
+        void Grow(__m128 point)
+        {
+            min = _mm_min_ps(min, point);
+            max = _mm_max_ps(max, point);
+        }
+
+        float GetHalfArea() const
+        {
+            alignas(16) float extent[4];
+            _mm_store_ps(extent, _mm_sub_ps(max, min));
+
+            if (extent[0] < 0.0f || extent[1] < 0.0f || extent[2] < 0.0f)
+            {
+                return 0.0f;
+            }
+
+            return extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+        }
+    };
+
+    // Bounds of one triangle with its index in the fourth lane of min. The builder sorts
+    // these rather than indices, so binning and partitioning stream through memory.
+    struct PrimitiveRef
+    {
+        __m128 min;
+        __m128 max;
+
+        uint32_t GetPrimitive() const
+        {
+            return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_castps_si128(_mm_shuffle_ps(min, min, _MM_SHUFFLE(3, 3, 3, 3)))));
+        }
+
+        void SetPrimitive(uint32_t primitive)
+        {
+            const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+            const __m128 index = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, static_cast<int>(primitive)));
+            min = _mm_or_ps(_mm_and_ps(min, xyzMask), index);
+        }
+
+        // Twice the centroid, which bins and partitions the same. The index is masked off
+        // so it never reaches float arithmetic as a denormal.
+        __m128 GetCentroid() const
+        {
+            return _mm_add_ps(_mm_and_ps(min, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0))), max);
+        }
+    };
+
+    // A node still to be built, over refs[begin, end). With spatial splits the references
+    // may grow into [end, spaceEnd), its share of the duplication budget.
+    struct BuildTask
+    {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        uint32_t depth;
+        uint32_t spaceEnd;
+        Box bounds;
+        Box centroidBounds;
+    };
+
+    struct Bin
+    {
+        Box bounds;
+        uint32_t count = 0;
+    };
+
+    // Bin of a spatial split search: bounds of the triangle parts inside the bin slab,
+    // and how many triangles start and end in it
+    struct SpatialBin
+    {
+        Box bounds;
+        uint32_t entries = 0;
+        uint32_t exits = 0;
+    };
+
+    struct Split
+    {
+        uint32_t axis = 0;
+        uint32_t bin = 0;
+        float cost = Infinity;
+    };
+
+    // Counters of one task, added to the shared ones when it finishes
+    struct TaskStats
+    {
+        uint32_t leaves = 0;
+        uint32_t maxDepth = 0;
+        uint32_t spatialSplits = 0;
+    };
+
+    // Per-thread storage for the two sides of a spatial split
+    struct SplitScratch
+    {
+        std::vector<PrimitiveRef> left;
+        std::vector<PrimitiveRef> right;
+    };
+
+    __m128 LoadPoint(const float* point)
+    {
+        return _mm_setr_ps(point[0], point[1], point[2], 0.0f);
+    }
+
+    float GetLane(__m128 value, uint32_t lane)
+    {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, value);
+        return lanes[lane];
+    }
+
+    void StoreBounds(const Box& box, float boundsMin[3], float boundsMax[3])
+    {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, box.min);
+        std::copy(lanes, lanes + 3, boundsMin);
+        _mm_store_ps(lanes, box.max);
+        std::copy(lanes, lanes + 3, boundsMax);
+    }
+
+    class BuildContext
+    {
+    public:
+        BuildContext(const Settings& settings, const BvhGeometry& geometry, std::vector<PrimitiveRef>& refs, Bvh::NodeArray& nodes)
+            : m_settings(settings), m_geometry(geometry), m_refs(refs), m_nodes(nodes)
+        {
+        }
+
+        void Run(const BuildTask& root, uint32_t threadCount)
+        {
+            m_minOverlap = m_settings.spatialSplitOverlap * root.bounds.GetHalfArea();
+            Push(root);
+
+            std::vector<std::thread> threads;
+
+            for (uint32_t i = 1; i < threadCount; i++)
+            {
+                threads.emplace_back(&BuildContext::Work, this);
+            }
+
+            Work();
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+
+        uint32_t GetNodeCount() const { return m_nextNode; }
+        uint32_t GetLeafCount() const { return m_leaves; }
+        uint32_t GetMaxDepth() const { return m_maxDepth; }
+        uint32_t GetTaskCount() const { return m_taskCount; }
+        uint32_t GetSpatialSplitCount() const { return m_spatialSplits; }
+
+    private:
+        void Push(const BuildTask& task)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(task);
+            m_pending++;
+            m_taskCount++;
+            m_condition.notify_one();
+        }
+
+        void Work()
+        {
+            SplitScratch scratch;
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            for (;;)
+            {
+                m_condition.wait(lock, [this]() { return !m_tasks.empty() || m_pending == 0; });
+
+                if (m_tasks.empty())
+                {
+                    return;
+                }
+
+                const BuildTask task = m_tasks.back();
+                m_tasks.pop_back();
+                lock.unlock();
+
+                TaskStats stats;
+                BuildSubtree(task, stats, scratch);
+
+                m_leaves += stats.leaves;
+                m_spatialSplits += stats.spatialSplits;
+
+                for (uint32_t depth = m_maxDepth; stats.maxDepth > depth && !m_maxDepth.compare_exchange_weak(depth, stats.maxDepth);)
+                {
+                }
+
+                lock.lock();
+
+                if (--m_pending == 0)
+                {
+                    m_condition.notify_all();
+                }
+            }
+        }
+
+        // Scale from centroid to bin index per axis, 0 where all centroids coincide
+        __m128 GetBinScales(const BuildTask& task) const
+        {
+            alignas(16) float extent[4];
+            _mm_store_ps(extent, _mm_sub_ps(task.centroidBounds.max, task.centroidBounds.min));
+
+            alignas(16) float scales[4] = {};
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                scales[axis] = extent[axis] > 0.0f ? m_settings.binCount / extent[axis] * 0.99999f : 0.0f;
+            }
+
+            return _mm_load_ps(scales);
+        }
+
+        Split FindSplit(const BuildTask& task, Bin (&bins)[3][BvhBuilder::MaxBinCount]) const
+        {
+            const uint32_t binCount = m_settings.binCount;
+            const __m128 scales = GetBinScales(task);
+            const __m128i lastBin = _mm_set1_epi32(static_cast<int>(binCount - 1));
+
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                const PrimitiveRef& ref = m_refs[i];
+                __m128i bin = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(ref.GetCentroid(), task.centroidBounds.min), scales));
+
+                // min(bin, lastBin) without SSE4.1
+                const __m128i over = _mm_cmpgt_epi32(bin, lastBin);
+                bin = _mm_or_si128(_mm_and_si128(over, lastBin), _mm_andnot_si128(over, bin));
+
+                alignas(16) int32_t indices[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(indices), bin);
+
+                for (uint32_t axis = 0; axis < 3; axis++)
+                {
+                    Bin& target = bins[axis][indices[axis]];
+                    target.bounds.min = _mm_min_ps(target.bounds.min, ref.min);
+                    target.bounds.max = _mm_max_ps(target.bounds.max, ref.max);
+                    target.count++;
+                }
+            }
+
+            alignas(16) float scaleLanes[4];
+            _mm_store_ps(scaleLanes, scales);
+
+            // Sweep from the right to get the cost of every right side, then from the left
+            Split best;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                if (scaleLanes[axis] == 0.0f)
+                {
+                    continue;
+                }
+
+                float rightCosts[BvhBuilder::MaxBinCount];
+                Box right;
+                uint32_t rightCount = 0;
+
+                for (uint32_t bin = binCount - 1; bin > 0; bin--)
+                {
+                    right.Grow(bins[axis][bin].bounds);
+                    rightCount += bins[axis][bin].count;
+                    rightCosts[bin] = rightCount > 0 ? right.GetHalfArea() * rightCount : -1.0f;
+                }
+
+                Box left;
+                uint32_t leftCount = 0;
+
+                for (uint32_t bin = 1; bin < binCount; bin++)
+                {
+                    left.Grow(bins[axis][bin - 1].bounds);
+                    leftCount += bins[axis][bin - 1].count;
+
+                    if (leftCount == 0 || rightCosts[bin] < 0.0f)
+                    {
+                        continue;
+                    }
+
+                    const float cost = left.GetHalfArea() * leftCount + rightCosts[bin];
+
+                    if (cost < best.cost)
+                    {
+                        best.axis = axis;
+                        best.bin = bin;
+                        best.cost = cost;
+                    }
+                }
+            }
+
+            return best;
+        }
+
+        // Bounds of the parts of a reference's triangle on either side of a plane, within
+        // the reference's bounds (Stich et al., "Spatial Splits in Bounding Volume
+        // Hierarchies")
+        void SplitReference(const PrimitiveRef& ref, uint32_t axis, float position, PrimitiveRef& left, PrimitiveRef& right) const
+        {
+            const float* corners[3];
+            m_geometry.GetTriangle(ref.GetPrimitive(), corners);
+
+            Box leftBox;
+            Box rightBox;
+
+            for (uint32_t i = 0; i < 3; i++)
+            {
+                const float* a = corners[i];
+                const float* b = corners[(i + 1) % 3];
+                const __m128 point = LoadPoint(a);
+
+                if (a[axis] <= position)
+                {
+                    leftBox.Grow(point);
+                }
+
+                if (a[axis] >= position)
+                {
+                    rightBox.Grow(point);
+                }
+
+                // The edge crosses the plane: both sides get the crossing point
+                if ((a[axis] < position && b[axis] > position) || (a[axis] > position && b[axis] < position))
+                {
+                    const float t = (position - a[axis]) / (b[axis] - a[axis]);
+                    alignas(16) float crossing[4] = { a[0] + (b[0] - a[0]) * t, a[1] + (b[1] - a[1]) * t, a[2] + (b[2] - a[2]) * t, 0.0f };
+                    crossing[axis] = position;
+
+                    leftBox.Grow(_mm_load_ps(crossing));
+                    rightBox.Grow(_mm_load_ps(crossing));
+                }
+            }
+
+            // Earlier splits may have cut the reference already
+            const uint32_t primitive = ref.GetPrimitive();
+            left.min = _mm_max_ps(leftBox.min, ref.min);
+            left.max = _mm_min_ps(leftBox.max, ref.max);
+            right.min = _mm_max_ps(rightBox.min, ref.min);
+            right.max = _mm_min_ps(rightBox.max, ref.max);
+            left.SetPrimitive(primitive);
+            right.SetPrimitive(primitive);
+        }
+
+        // Bins of a reference along a spatial split axis, from the slab it starts in to the
+        // one it ends in
+        void GetSpatialBins(const PrimitiveRef& ref, uint32_t axis, float minimum, float scale, uint32_t& first, uint32_t& last) const
+        {
+            const float lastBin = static_cast<float>(m_settings.binCount - 1);
+            first = static_cast<uint32_t>((std::max)(0.0f, (std::min)(lastBin, (GetLane(ref.min, axis) - minimum) * scale)));
+            last = static_cast<uint32_t>((std::max)(0.0f, (std::min)(lastBin, (GetLane(ref.max, axis) - minimum) * scale)));
+            last = (std::max)(first, last);
+        }
+
+        // Sweep planes between slabs of equal width over the node bounds, clipping every
+        // triangle into each slab it crosses
+        Split FindSpatialSplit(const BuildTask& task, SpatialBin (&bins)[3][BvhBuilder::MaxBinCount]) const
+        {
+            const uint32_t binCount = m_settings.binCount;
+            Split best;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                const float minimum = GetLane(task.bounds.min, axis);
+                const float extent = GetLane(task.bounds.max, axis) - minimum;
+
+                if (extent <= 0.0f)
+                {
+                    continue;
+                }
+
+                const float scale = binCount / extent;
+                const float width = extent / binCount;
+
+                for (uint32_t i = task.begin; i < task.end; i++)
+                {
+                    uint32_t first, last;
+                    GetSpatialBins(m_refs[i], axis, minimum, scale, first, last);
+
+                    PrimitiveRef rest = m_refs[i];
+
+                    for (uint32_t bin = first; bin < last; bin++)
+                    {
+                        PrimitiveRef part;
+                        SplitReference(rest, axis, minimum + (bin + 1) * width, part, rest);
+                        bins[axis][bin].bounds.min = _mm_min_ps(bins[axis][bin].bounds.min, part.min);
+                        bins[axis][bin].bounds.max = _mm_max_ps(bins[axis][bin].bounds.max, part.max);
+                    }
+
+                    bins[axis][last].bounds.min = _mm_min_ps(bins[axis][last].bounds.min, rest.min);
+                    bins[axis][last].bounds.max = _mm_max_ps(bins[axis][last].bounds.max, rest.max);
+                    bins[axis][first].entries++;
+                    bins[axis][last].exits++;
+                }
+
+                float rightCosts[BvhBuilder::MaxBinCount];
+                Box right;
+                uint32_t rightCount = 0;
+
+                for (uint32_t bin = binCount - 1; bin > 0; bin--)
+                {
+                    right.Grow(bins[axis][bin].bounds);
+                    rightCount += bins[axis][bin].exits;
+                    rightCosts[bin] = rightCount > 0 ? right.GetHalfArea() * rightCount : -1.0f;
+                }
+
+                Box left;
+                uint32_t leftCount = 0;
+
+                for (uint32_t bin = 1; bin < binCount; bin++)
+                {
+                    left.Grow(bins[axis][bin - 1].bounds);
+                    leftCount += bins[axis][bin - 1].entries;
+
+                    if (leftCount == 0 || rightCosts[bin] < 0.0f)
+                    {
+                        continue;
+                    }
+
+                    const float cost = left.GetHalfArea() * leftCount + rightCosts[bin];
+
+                    if (cost < best.cost)
+                    {
+                        best.axis = axis;
+                        best.bin = bin;
+                        best.cost = cost;
+                    }
+                }
+            }
+
+            return best;
+        }
+
+        // Apply a spatial split into the node's space. References that straddle the plane
+        // are kept whole on one side when that is cheaper than splitting them. Returns false,
+        // changing nothing, when the duplicates do not fit the node's budget.
+        bool SplitSpatially(const BuildTask& task, const Split& split, const SpatialBin (&bins)[3][BvhBuilder::MaxBinCount],
+                            BuildTask& left, BuildTask& right, SplitScratch& scratch) const
+        {
+            const uint32_t axis = split.axis;
+            const float minimum = GetLane(task.bounds.min, axis);
+            const float extent = GetLane(task.bounds.max, axis) - minimum;
+            const float scale = m_settings.binCount / extent;
+            const float position = minimum + split.bin * (extent / m_settings.binCount);
+
+            Box leftBounds;
+            Box rightBounds;
+            uint32_t leftCount = 0;
+            uint32_t rightCount = 0;
+
+            for (uint32_t bin = 0; bin < m_settings.binCount; bin++)
+            {
+                (bin < split.bin ? leftBounds : rightBounds).Grow(bins[axis][bin].bounds);
+                (bin < split.bin ? leftCount : rightCount) += bin < split.bin ? bins[axis][bin].entries : bins[axis][bin].exits;
+            }
+
+            scratch.left.clear();
+            scratch.right.clear();
+
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                const PrimitiveRef& ref = m_refs[i];
+                uint32_t first, last;
+                GetSpatialBins(ref, axis, minimum, scale, first, last);
+
+                if (last < split.bin)
+                {
+                    scratch.left.push_back(ref);
+                    continue;
+                }
+
+                if (first >= split.bin)
+                {
+                    scratch.right.push_back(ref);
+                    continue;
+                }
+
+                // Reference unsplitting
+                Box whole;
+                whole.min = ref.min;
+                whole.max = ref.max;
+
+                Box leftWithRef = leftBounds;
+                leftWithRef.Grow(whole);
+                Box rightWithRef = rightBounds;
+                rightWithRef.Grow(whole);
+
+                const float splitCost = leftBounds.GetHalfArea() * leftCount + rightBounds.GetHalfArea() * rightCount;
+                const float leftCost = leftWithRef.GetHalfArea() * leftCount + rightBounds.GetHalfArea() * (rightCount - 1);
+                const float rightCost = leftBounds.GetHalfArea() * (leftCount - 1) + rightWithRef.GetHalfArea() * rightCount;
+
+                if (leftCost < splitCost && leftCost <= rightCost)
+                {
+                    scratch.left.push_back(ref);
+                    leftBounds = leftWithRef;
+                    rightCount--;
+                }
+                else if (rightCost < splitCost)
+                {
+                    scratch.right.push_back(ref);
+                    rightBounds = rightWithRef;
+                    leftCount--;
+                }
+                else
+                {
+                    PrimitiveRef leftPart, rightPart;
+                    SplitReference(ref, axis, position, leftPart, rightPart);
+                    scratch.left.push_back(leftPart);
+                    scratch.right.push_back(rightPart);
+                }
+            }
+
+            const uint32_t leftSize = static_cast<uint32_t>(scratch.left.size());
+            const uint32_t rightSize = static_cast<uint32_t>(scratch.right.size());
+
+            if (leftSize == 0 || rightSize == 0 || leftSize + rightSize > task.spaceEnd - task.begin)
+            {
+                return false;
+            }
+
+            // What is left of the budget goes to the children in proportion to their size
+            const uint32_t extra = task.spaceEnd - task.begin - leftSize - rightSize;
+            const uint32_t leftExtra = static_cast<uint32_t>(static_cast<uint64_t>(extra) * leftSize / (leftSize + rightSize));
+
+            std::copy(scratch.left.begin(), scratch.left.end(), m_refs.begin() + task.begin);
+            std::copy(scratch.right.begin(), scratch.right.end(), m_refs.begin() + task.begin + leftSize + leftExtra);
+
+            left.end = task.begin + leftSize;
+            left.spaceEnd = left.end + leftExtra;
+            right.begin = left.spaceEnd;
+            right.end = right.begin + rightSize;
+            right.spaceEnd = task.spaceEnd;
+
+            ComputeBounds(left);
+            ComputeBounds(right);
+            return true;
+        }
+
+        // Give the children of an object split their share of the node's unused space, by
+        // moving the right child up
+        void DistributeSpace(const BuildTask& task, BuildTask& left, BuildTask& right)
+        {
+            const uint32_t extra = task.spaceEnd - task.end;
+            const uint32_t leftExtra = static_cast<uint32_t>(static_cast<uint64_t>(extra) * (left.end - left.begin) / (task.end - task.begin));
+
+            if (leftExtra > 0)
+            {
+                std::copy_backward(m_refs.begin() + right.begin, m_refs.begin() + right.end, m_refs.begin() + right.end + leftExtra);
+                right.begin += leftExtra;
+                right.end += leftExtra;
+            }
+
+            left.spaceEnd = right.begin;
+            right.spaceEnd = task.spaceEnd;
+        }
+
+        void ComputeBounds(BuildTask& task) const
+        {
+            task.bounds = Box();
+            task.centroidBounds = Box();
+
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                task.bounds.min = _mm_min_ps(task.bounds.min, m_refs[i].min);
+                task.bounds.max = _mm_max_ps(task.bounds.max, m_refs[i].max);
+                task.centroidBounds.Grow(m_refs[i].GetCentroid());
+            }
+        }
+
+        void MakeLeaf(const BuildTask& task, TaskStats& stats)
+        {
+            BvhNode& node = m_nodes[task.node];
+            StoreBounds(task.bounds, node.boundsMin, node.boundsMax);
+            node.offset = task.begin;
+            node.count = task.end - task.begin;
+
+            stats.leaves++;
+            stats.maxDepth = (std::max)(stats.maxDepth, task.depth);
+        }
+
+        // Build the subtree of task, looping down the larger child and recursing into (or
+        // handing off) the smaller one, so the stack stays logarithmic
+        void BuildSubtree(BuildTask task, TaskStats& stats, SplitScratch& scratch)
+        {
+            for (;;)
+            {
+                const uint32_t count = task.end - task.begin;
+
+                if (count == 1 || task.depth + 1 == Bvh::MaxDepth)
+                {
+                    MakeLeaf(task, stats);
+                    return;
+                }
+
+                Bin bins[3][BvhBuilder::MaxBinCount];
+                const Split split = FindSplit(task, bins);
+
+                // Try a spatial split where the object split leaves the children overlapping
+                // and there is budget left for duplicates
+                Split spatialSplit;
+                SpatialBin spatialBins[3][BvhBuilder::MaxBinCount];
+
+                if (m_settings.spatialSplits && split.cost < Infinity && task.spaceEnd > task.end)
+                {
+                    Box leftBounds;
+                    Box rightBounds;
+
+                    for (uint32_t bin = 0; bin < m_settings.binCount; bin++)
+                    {
+                        (bin < split.bin ? leftBounds : rightBounds).Grow(bins[split.axis][bin].bounds);
+                    }
+
+                    Box overlap;
+                    overlap.min = _mm_max_ps(leftBounds.min, rightBounds.min);
+                    overlap.max = _mm_min_ps(leftBounds.max, rightBounds.max);
+
+                    if (overlap.GetHalfArea() > m_minOverlap)
+                    {
+                        spatialSplit = FindSpatialSplit(task, spatialBins);
+                    }
+                }
+
+                BuildTask left = { 0, task.begin, 0, task.depth + 1, 0, Box(), Box() };
+                BuildTask right = { 0, 0, task.end, task.depth + 1, 0, Box(), Box() };
+
+                const float bestCost = (std::min)(split.cost, spatialSplit.cost);
+
+                if (bestCost < Infinity)
+                {
+                    const float leafCost = m_settings.intersectionCost * count;
+                    const float splitCost =
+                        m_settings.traversalCost + m_settings.intersectionCost * bestCost / task.bounds.GetHalfArea();
+
+                    if (count <= m_settings.maxLeafSize && leafCost <= splitCost)
+                    {
+                        MakeLeaf(task, stats);
+                        return;
+                    }
+                }
+
+                if (spatialSplit.cost < split.cost && SplitSpatially(task, spatialSplit, spatialBins, left, right, scratch))
+                {
+                    stats.spatialSplits++;
+                }
+                else if (split.cost < Infinity)
+                {
+                    const uint32_t axis = split.axis;
+                    const float minimum = GetLane(task.centroidBounds.min, axis);
+                    const float scale = GetLane(GetBinScales(task), axis);
+                    const uint32_t lastBin = m_settings.binCount - 1;
+
+                    auto isLeft = [&](__m128 centroid)
+                    {
+                        const uint32_t bin = static_cast<uint32_t>((GetLane(centroid, axis) - minimum) * scale);
+                        return (std::min)(bin, lastBin) < split.bin;
+                    };
+
+                    // Hoare partition that grows the centroid bounds of both sides on the way,
+                    // rather than another pass over the children
+                    uint32_t i = task.begin;
+                    uint32_t j = task.end;
+
+                    for (;;)
+                    {
+                        __m128 centroid;
+
+                        while (i < j && isLeft(centroid = m_refs[i].GetCentroid()))
+                        {
+                            left.centroidBounds.Grow(centroid);
+                            i++;
+                        }
+
+                        while (i < j && !isLeft(centroid = m_refs[j - 1].GetCentroid()))
+                        {
+                            right.centroidBounds.Grow(centroid);
+                            j--;
+                        }
+
+                        if (i == j)
+                        {
+                            break;
+                        }
+
+                        std::swap(m_refs[i], m_refs[j - 1]);
+                    }
+
+                    left.end = right.begin = i;
+
+                    // The bins already hold the bounds of both sides
+                    for (uint32_t bin = 0; bin < m_settings.binCount; bin++)
+                    {
+                        (bin < split.bin ? left : right).bounds.Grow(bins[axis][bin].bounds);
+                    }
+
+                    DistributeSpace(task, left, right);
+                }
+                else if (count <= m_settings.maxLeafSize)
+                {
+                    MakeLeaf(task, stats);
+                    return;
+                }
+                else
+                {
+                    // Every centroid in the same place: any split is as good as another
+                    left.end = right.begin = task.begin + count / 2;
+                    DistributeSpace(task, left, right);
+                    ComputeBounds(left);
+                    ComputeBounds(right);
+                }
+
+                const uint32_t children = m_nextNode.fetch_add(2);
+                left.node = children;
+                right.node = children + 1;
+
+                BvhNode& node = m_nodes[task.node];
+                StoreBounds(task.bounds, node.boundsMin, node.boundsMax);
+                node.offset = children;
+                node.count = 0;
+
+                BuildTask& smaller = left.end - left.begin < right.end - right.begin ? left : right;
+                BuildTask& larger = &smaller == &left ? right : left;
+
+                if (smaller.end - smaller.begin >= m_settings.minTaskSize)
+                {
+                    Push(smaller);
+                }
+                else
+                {
+                    BuildSubtree(smaller, stats, scratch);
+                }
+
+                task = larger;
+            }
+        }
+
+        const Settings& m_settings;
+        const BvhGeometry& m_geometry;
+        std::vector<PrimitiveRef>& m_refs;
+        Bvh::NodeArray& m_nodes;
+
+        // Node 0 is the root and node 1 padding, so pairs start at even indices
+        std::atomic<uint32_t> m_nextNode{ 2 };
+        std::atomic<uint32_t> m_leaves{ 0 };
+        std::atomic<uint32_t> m_maxDepth{ 0 };
+        std::atomic<uint32_t> m_spatialSplits{ 0 };
+        float m_minOverlap = 0.0f;
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::vector<BuildTask> m_tasks;
+        uint32_t m_pending = 0;
+        uint32_t m_taskCount = 0;
+    };
+}
+
+BvhBuilder::BvhBuilder(const Settings& settings) : m_settings(settings)
+{
+    if (settings.binCount < 2 || settings.binCount > MaxBinCount)
+    {
+        throw std::runtime_error("BVH bin count must be between 2 and " + std::to_string(MaxBinCount));
+    }
+
+    if (settings.maxLeafSize == 0)
+    {
+        throw std::runtime_error("BVH leaves must hold at least one triangle");
+    }
+
+    m_settings.minTaskSize = (std::max)(m_settings.minTaskSize, 2u);
+}
+
+void BvhBuilder::Build(const BvhGeometry& geometry, Bvh& bvh)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t triangleCount = geometry.GetTriangleCount();
+
+    bvh.m_triangleCount = triangleCount;
+    bvh.m_nodes.clear();
+    bvh.m_primitiveIndices.clear();
+    m_stats = Stats();
+    m_stats.triangles = triangleCount;
+
+    if (triangleCount == 0)
+    {
+        return;
+    }
+
+    const uint32_t hardwareThreads = m_settings.threads > 0 ? m_settings.threads : (std::max)(1u, std::thread::hardware_concurrency());
+    const uint32_t threadCount = (std::min)(hardwareThreads, (std::max)(1u, triangleCount / m_settings.minTaskSize));
+
+    // Triangle bounds, in parallel chunks, followed by the room spatial splits may fill
+    const uint32_t budget = m_settings.spatialSplits ? static_cast<uint32_t>(triangleCount * (std::max)(0.0f, m_settings.duplicationBudget)) : 0;
+    std::vector<PrimitiveRef> refs(static_cast<size_t>(triangleCount) + budget);
+    std::vector<Box> chunkBounds(threadCount);
+    std::vector<Box> chunkCentroids(threadCount);
+
+    auto boundTriangles = [&](uint32_t chunk)
+    {
+        const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(triangleCount) * chunk / threadCount);
+        const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(triangleCount) * (chunk + 1) / threadCount);
+
+        for (uint32_t triangle = begin; triangle < end; triangle++)
+        {
+            const float* corners[3];
+            geometry.GetTriangle(triangle, corners);
+
+            const __m128 a = _mm_setr_ps(corners[0][0], corners[0][1], corners[0][2], 0.0f);
+            const __m128 b = _mm_setr_ps(corners[1][0], corners[1][1], corners[1][2], 0.0f);
+            const __m128 c = _mm_setr_ps(corners[2][0], corners[2][1], corners[2][2], 0.0f);
+
+            PrimitiveRef& ref = refs[triangle];
+            ref.min = _mm_min_ps(_mm_min_ps(a, b), c);
+            ref.max = _mm_max_ps(_mm_max_ps(a, b), c);
+
+            chunkBounds[chunk].min = _mm_min_ps(chunkBounds[chunk].min, ref.min);
+            chunkBounds[chunk].max = _mm_max_ps(chunkBounds[chunk].max, ref.max);
+            chunkCentroids[chunk].Grow(ref.GetCentroid());
+
+            // The index rides in the unused lane
+            float index;
+            memcpy(&index, &triangle, sizeof(index));
+            alignas(16) float lanes[4];
+            _mm_store_ps(lanes, ref.min);
+            lanes[3] = index;
+            ref.min = _mm_load_ps(lanes);
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        threads.emplace_back(boundTriangles, i);
+    }
+
+    boundTriangles(0);
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    BuildTask root = { 0, 0, triangleCount, 0, static_cast<uint32_t>(refs.size()), Box(), Box() };
+
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        root.bounds.Grow(chunkBounds[i]);
+        root.centroidBounds.Grow(chunkCentroids[i]);
+    }
+
+    // A tree with n leaves has 2n - 1 nodes, plus the padding node
+    bvh.m_nodes.resize(refs.size() * 2);
+
+    BuildContext context(m_settings, geometry, refs, bvh.m_nodes);
+    context.Run(root, threadCount);
+
+    bvh.m_nodes.resize(context.GetNodeCount());
+    bvh.m_nodes.shrink_to_fit();
+
+    if (budget == 0)
+    {
+        bvh.m_primitiveIndices.resize(triangleCount);
+
+        for (uint32_t i = 0; i < triangleCount; i++)
+        {
+            bvh.m_primitiveIndices[i] = refs[i].GetPrimitive();
+        }
+    }
+    else
+    {
+        // Leaves are spread over the budgeted space; pack them in node order
+        bvh.m_primitiveIndices.reserve(refs.size());
+
+        for (auto& node : bvh.m_nodes)
+        {
+            if (node.IsLeaf())
+            {
+                const uint32_t offset = static_cast<uint32_t>(bvh.m_primitiveIndices.size());
+
+                for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                {
+                    bvh.m_primitiveIndices.push_back(refs[i].GetPrimitive());
+                }
+
+                node.offset = offset;
+            }
+        }
+
+        bvh.m_primitiveIndices.shrink_to_fit();
+    }
+
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_stats.nodes = context.GetNodeCount() - 1;
+    m_stats.leaves = context.GetLeafCount();
+    m_stats.maxDepth = context.GetMaxDepth();
+    m_stats.tasks = context.GetTaskCount();
+    m_stats.references = static_cast<uint32_t>(bvh.m_primitiveIndices.size());
+    m_stats.spatialSplits = context.GetSpatialSplitCount();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Bvh.h"
+
+#include <cstdint>
+
+/// Top-down BVH builder with binned SAH split selection (Wald, "On fast Construction of
+/// SAH-based Bounding Volume Hierarchies"). Triangle centroids are binned along all
+/// three axes and the plane between two bins with the lowest SAH cost wins; a node
+/// becomes a leaf when it holds at most maxLeafSize triangles and splitting would not
+/// be cheaper.
+///
+/// Subtrees are built as tasks: a thread that splits a node with at least minTaskSize
+/// triangles hands the smaller child to the other threads and continues with the
+/// larger. Nodes are allocated in sibling pairs from a shared counter, so the node order
+/// depends on scheduling but the tree does not.
+///
+/// With spatialSplits the builder is an SBVH (Stich et al., "Spatial Splits in Bounding
+/// Volume Hierarchies"): where the best object split leaves children that overlap, it
+/// also sweeps planes through the node bounds, clipping triangles to each side, and keeps
+/// the cheaper split. Long thin triangles, such as the two of the sample's ground plane,
+/// then end up in several small leaves instead of one large box. The references this adds
+/// are bounded by duplicationBudget; each node's share of it goes to its children in
+/// proportion to their size, so the result still does not depend on scheduling.
+class BvhBuilder
+{
+public:
+    static const uint32_t MaxBinCount = 32;
+
+    struct Settings
+    {
+        /// Bins per axis, 2 to MaxBinCount. 16 is close to a full sweep for most meshes.
+        uint32_t binCount = 16;
+        /// Most triangles in a leaf, at least 1
+        uint32_t maxLeafSize = 4;
+        /// SAH costs of visiting an interior node and intersecting a triangle
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+        /// Smallest subtree worth handing to another thread
+        uint32_t minTaskSize = 4096;
+        /// Worker threads, 0 for one per hardware thread
+        uint32_t threads = 0;
+
+        /// Try spatial splits as well as object splits
+        bool spatialSplits = false;
+        /// Overlap of the object split children, relative to the root's surface area, above
+        /// which spatial splits are tried (alpha in the paper). 0 tries them everywhere.
+        float spatialSplitOverlap = 1e-5f;
+        /// Most references spatial splits may add, as a fraction of the triangle count
+        float duplicationBudget = 0.3f;
+    };
+
+    struct Stats
+    {
+        double seconds = 0.0;
+        uint32_t triangles = 0;
+        uint32_t nodes = 0;
+        uint32_t leaves = 0;
+        uint32_t maxDepth = 0;
+        /// Subtrees built as separate tasks, including the root
+        uint32_t tasks = 0;
+        /// Triangle references in leaves: triangles plus spatial split duplicates
+        uint32_t references = 0;
+        uint32_t spatialSplits = 0;
+    };
+
+    /// Throws std::runtime_error if the settings are out of range
+    explicit BvhBuilder(const Settings& settings);
+
+    /// Replace the contents of bvh with a hierarchy over the triangles of geometry
+    void Build(const BvhGeometry& geometry, Bvh& bvh);
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    Settings m_settings;
+    Stats m_stats;
+};
@@ -0,0 +1,383 @@
+#include "BvhCache.h"
+
+#include "ContentHash.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    // "BVHC"
+    const uint32_t Magic = 0x43485642;
+    const uint32_t Version = 1;
+
+    // Node arrays start on a cache line, as Bvh::NodeArray does in memory
+    const uint64_t NodesOffset = 128;
+
+    /// The builder settings that change the hierarchy; threads and task sizes only change
+    /// how fast it is built
+    struct BuildParameters
+    {
+        uint32_t binCount;
+        uint32_t maxLeafSize;
+        float traversalCost;
+        float intersectionCost;
+        uint32_t spatialSplits;
+        float spatialSplitOverlap;
+        float duplicationBudget;
+    };
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t contentHash;
+        /// HashContent of everything after the header
+        uint64_t payloadChecksum;
+        /// HashContent of the header with this field 0
+        uint64_t headerChecksum;
+        BuildParameters parameters;
+        uint32_t triangleCount;
+        uint32_t nodeCount;
+        uint32_t primitiveIndexCount;
+        uint64_t nodesOffset;
+        uint64_t primitiveIndicesOffset;
+        uint8_t reserved[40];
+    };
+
+    static_assert(sizeof(BuildParameters) == 28, "BuildParameters must match the file layout");
+    static_assert(sizeof(FileHeader) == NodesOffset, "FileHeader must match the file layout");
+    static_assert(sizeof(BvhNode) == 32, "BvhNode must match the file layout");
+
+    BuildParameters GetBuildParameters(const BvhBuilder::Settings& settings)
+    {
+        BuildParameters parameters;
+        memset(&parameters, 0, sizeof(parameters));
+        parameters.binCount = settings.binCount;
+        parameters.maxLeafSize = settings.maxLeafSize;
+        parameters.traversalCost = settings.traversalCost;
+        parameters.intersectionCost = settings.intersectionCost;
+        parameters.spatialSplits = settings.spatialSplits ? 1 : 0;
+        parameters.spatialSplitOverlap = settings.spatialSplitOverlap;
+        parameters.duplicationBudget = settings.duplicationBudget;
+        return parameters;
+    }
+
+    uint64_t HashParameters(const BuildParameters& parameters)
+    {
+        return HashContent(&parameters, sizeof(parameters));
+    }
+
+    uint64_t GetHeaderChecksum(FileHeader header)
+    {
+        header.headerChecksum = 0;
+        return HashContent(&header, sizeof(header));
+    }
+
+    // Every node within the arrays, with children after their parent so that traversal
+    // cannot loop, and no deeper than traversal's stack
+    void CheckNodes(const BvhView& view, const std::string& path)
+    {
+        std::vector<uint8_t> depths(view.nodeCount, 0);
+
+        for (uint32_t i = 0; i < view.nodeCount; i++)
+        {
+            // Node 1 is padding
+            if (i == 1)
+            {
+                continue;
+            }
+
+            const BvhNode& node = view.nodes[i];
+
+            if (node.IsLeaf())
+            {
+                if (node.offset > view.primitiveIndexCount || node.count > view.primitiveIndexCount - node.offset)
+                {
+                    throw std::runtime_error("Leaf " + std::to_string(i) + " is out of the primitive indices in " + path);
+                }
+
+                continue;
+            }
+
+            // Children after their parent rule out cycles
+            if (node.offset % 2 != 0 || node.offset <= i || node.offset >= view.nodeCount - 1 || depths[i] + 1u > Bvh::MaxDepth)
+            {
+                throw std::runtime_error("Invalid node " + std::to_string(i) + " in " + path);
+            }
+
+            depths[node.offset] = depths[node.offset + 1] = static_cast<uint8_t>(depths[i] + 1);
+        }
+
+        for (uint32_t i = 0; i < view.primitiveIndexCount; i++)
+        {
+            if (view.primitiveIndices[i] >= view.triangleCount)
+            {
+                throw std::runtime_error("Primitive index " + std::to_string(i) + " is out of range in " + path);
+            }
+        }
+    }
+
+    double GetSeconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+//-----------------------------------------------------------------------------
+//
+// BvhCacheFile
+//
+void BvhCacheFile::Save(const Bvh& bvh, uint64_t contentHash, const BvhBuilder::Settings& settings, const std::string& path)
+{
+    const Bvh::NodeArray& nodes = bvh.GetNodes();
+    const std::vector<uint32_t>& primitiveIndices = bvh.GetPrimitiveIndices();
+
+    const size_t nodesSize = nodes.size() * sizeof(BvhNode);
+    const size_t primitiveIndicesSize = primitiveIndices.size() * sizeof(uint32_t);
+
+    // Both arrays in one block, to checksum them as they will be laid out
+    std::vector<uint8_t> payload(nodesSize + primitiveIndicesSize);
+
+    if (nodesSize > 0)
+    {
+        memcpy(payload.data(), nodes.data(), nodesSize);
+    }
+
+    if (primitiveIndicesSize > 0)
+    {
+        memcpy(payload.data() + nodesSize, primitiveIndices.data(), primitiveIndicesSize);
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = Magic;
+    header.version = Version;
+    header.contentHash = contentHash;
+    header.payloadChecksum = HashContent(payload.data(), payload.size());
+    header.parameters = GetBuildParameters(settings);
+    header.triangleCount = bvh.GetTriangleCount();
+    header.nodeCount = static_cast<uint32_t>(nodes.size());
+    header.primitiveIndexCount = static_cast<uint32_t>(primitiveIndices.size());
+    header.nodesOffset = NodesOffset;
+    header.primitiveIndicesOffset = NodesOffset + nodesSize;
+    header.headerChecksum = GetHeaderChecksum(header);
+
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create BVH cache file " + path);
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Failed to write BVH cache file " + path);
+    }
+}
+
+void BvhCacheFile::Open(const std::string& path, bool verifyPayload)
+{
+    Close();
+    m_file.Open(path);
+
+    try
+    {
+        const uint64_t fileSize = m_file.GetSize();
+        FileHeader header;
+
+        if (fileSize < sizeof(header))
+        {
+            throw std::runtime_error("Not a BVH cache file: " + path);
+        }
+
+        memcpy(&header, m_file.GetData(), sizeof(header));
+
+        if (header.magic != Magic)
+        {
+            throw std::runtime_error("Not a BVH cache file: " + path);
+        }
+
+        if (header.version != Version)
+        {
+            throw std::runtime_error("Unsupported BVH cache version in " + path);
+        }
+
+        if (header.headerChecksum != GetHeaderChecksum(header))
+        {
+            throw std::runtime_error("Corrupted BVH cache header in " + path);
+        }
+
+        // The arrays follow the header back to back and end the file
+        const uint64_t nodesEnd = header.nodesOffset + static_cast<uint64_t>(header.nodeCount) * sizeof(BvhNode);
+        const uint64_t primitiveIndicesEnd = header.primitiveIndicesOffset + static_cast<uint64_t>(header.primitiveIndexCount) * sizeof(uint32_t);
+
+        if (header.nodesOffset != NodesOffset || header.primitiveIndicesOffset != nodesEnd || primitiveIndicesEnd != fileSize ||
+            header.nodeCount == 1)
+        {
+            throw std::runtime_error("Invalid BVH cache layout in " + path);
+        }
+
+        if (verifyPayload && HashContent(m_file.GetData() + sizeof(header), fileSize - sizeof(header)) != header.payloadChecksum)
+        {
+            throw std::runtime_error("BVH cache checksum mismatch in " + path);
+        }
+
+        m_view.nodes = header.nodeCount > 0 ? reinterpret_cast<const BvhNode*>(m_file.GetData() + header.nodesOffset) : nullptr;
+        m_view.nodeCount = header.nodeCount;
+        m_view.primitiveIndices = reinterpret_cast<const uint32_t*>(m_file.GetData() + header.primitiveIndicesOffset);
+        m_view.primitiveIndexCount = header.primitiveIndexCount;
+        m_view.triangleCount = header.triangleCount;
+
+        if (verifyPayload)
+        {
+            CheckNodes(m_view, path);
+        }
+
+        m_contentHash = header.contentHash;
+        m_settingsHash = HashParameters(header.parameters);
+    }
+    catch (const std::runtime_error&)
+    {
+        Close();
+        throw;
+    }
+}
+
+void BvhCacheFile::Close()
+{
+    m_file.Close();
+    m_view = BvhView();
+    m_contentHash = 0;
+    m_settingsHash = 0;
+}
+
+bool BvhCacheFile::Matches(uint64_t contentHash, const BvhBuilder::Settings& settings) const
+{
+    return m_file.IsOpen() && contentHash == m_contentHash && HashParameters(GetBuildParameters(settings)) == m_settingsHash;
+}
+
+//-----------------------------------------------------------------------------
+//
+// BvhCache
+//
+BvhCache::BvhCache(const std::string& directory, bool verifyPayload) :
+    m_directory(directory),
+    m_verifyPayload(verifyPayload)
+{
+}
+
+uint64_t BvhCache::HashGeometry(const BvhGeometry& geometry)
+{
+    // Gather the positions when other attributes are interleaved with them
+    std::vector<float> positions;
+    const float* data = geometry.positions;
+
+    if (geometry.vertexStride != 3 * sizeof(float) && geometry.vertexCount > 0)
+    {
+        positions.resize(static_cast<size_t>(geometry.vertexCount) * 3);
+
+        for (uint32_t i = 0; i < geometry.vertexCount; i++)
+        {
+            memcpy(&positions[static_cast<size_t>(i) * 3], geometry.GetVertex(i), 3 * sizeof(float));
+        }
+
+        data = positions.data();
+    }
+
+    const uint64_t positionsHash = HashContent(data, static_cast<size_t>(geometry.vertexCount) * 3 * sizeof(float));
+
+    // A different seed for non-indexed geometry, so that it never shares a key with indexed
+    // geometry over the same vertices
+    return geometry.indices ? HashContent(geometry.indices, static_cast<size_t>(geometry.indexCount) * sizeof(uint32_t), positionsHash)
+                            : HashContent(nullptr, 0, ~positionsHash);
+}
+
+std::string BvhCache::GetPath(uint64_t contentHash, const BvhBuilder::Settings& settings) const
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%016llx.bvhc", static_cast<unsigned long long>(contentHash),
+             static_cast<unsigned long long>(HashParameters(GetBuildParameters(settings))));
+
+    return m_directory.empty() ? name : m_directory + "/" + name;
+}
+
+BvhView BvhCache::Load(const BvhGeometry& geometry, const BvhBuilder::Settings& settings)
+{
+    auto start = std::chrono::steady_clock::now();
+    const uint64_t contentHash = HashGeometry(geometry);
+    const std::string path = GetPath(contentHash, settings);
+    m_stats.hashSeconds += GetSeconds(start);
+
+    std::unique_ptr<BvhCacheFile> file(new BvhCacheFile());
+    std::error_code error;
+
+    if (std::filesystem::exists(path, error))
+    {
+        start = std::chrono::steady_clock::now();
+
+        try
+        {
+            file->Open(path, m_verifyPayload);
+
+            if (file->Matches(contentHash, settings) && file->GetView().triangleCount == geometry.GetTriangleCount())
+            {
+                m_stats.hits++;
+                m_stats.loadSeconds += GetSeconds(start);
+                m_files.push_back(std::move(file));
+                return m_files.back()->GetView();
+            }
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+
+        // Stale or damaged; close it so that it can be replaced
+        file->Close();
+        m_stats.rejected++;
+    }
+
+    start = std::chrono::steady_clock::now();
+    std::unique_ptr<Bvh> bvh(new Bvh());
+    BvhBuilder(settings).Build(geometry, *bvh);
+    m_stats.builds++;
+    m_stats.buildSeconds += GetSeconds(start);
+
+    // Write to a temporary name and rename, so that an interrupted save never leaves a
+    // file behind that passes the header checks
+    try
+    {
+        if (!m_directory.empty())
+        {
+            std::filesystem::create_directories(m_directory, error);
+        }
+
+        const std::string temporaryPath = path + ".tmp";
+        BvhCacheFile::Save(*bvh, contentHash, settings, temporaryPath);
+
+        std::filesystem::rename(temporaryPath, path, error);
+
+        if (error)
+        {
+            std::filesystem::remove(temporaryPath, error);
+            throw std::runtime_error("Cannot rename BVH cache file " + temporaryPath);
+        }
+
+        file->Open(path, false);
+        m_files.push_back(std::move(file));
+        return m_files.back()->GetView();
+    }
+    catch (const std::runtime_error&)
+    {
+        m_stats.unsaved++;
+        m_unsaved.push_back(std::move(bvh));
+        return m_unsaved.back()->GetView();
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Bvh.h"
+#include "BvhBuilder.h"
+#include "MappedFile.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// One hierarchy saved by BvhCache (.bvhc), used in place from a read-only mapping.
+///
+/// Layout: a 128-byte header, then the node array at a 64-byte aligned offset, then the
+/// primitive indices, all as they are in memory (little endian). The header holds the
+/// content hash of the geometry, the builder settings that shape the hierarchy, and
+/// checksums of itself and of the rest of the file.
+class BvhCacheFile
+{
+public:
+    /// Write a hierarchy built from geometry with the given content hash and settings.
+    /// Throws std::runtime_error on failure.
+    static void Save(const Bvh& bvh, uint64_t contentHash, const BvhBuilder::Settings& settings, const std::string& path);
+
+    /// Map path and check its header. With verifyPayload, also check the checksum of the
+    /// nodes and indices and that they form a hierarchy traversal can walk; this reads
+    /// the whole file. Throws std::runtime_error if anything is wrong.
+    void Open(const std::string& path, bool verifyPayload = true);
+    void Close();
+
+    /// True if the file was built from this content with settings that give the same
+    /// hierarchy
+    bool Matches(uint64_t contentHash, const BvhBuilder::Settings& settings) const;
+
+    uint64_t GetContentHash() const { return m_contentHash; }
+    size_t GetFileSize() const { return m_file.GetSize(); }
+
+    /// The hierarchy, in the mapping; valid until the file is closed
+    const BvhView& GetView() const { return m_view; }
+
+private:
+    MappedFile m_file;
+    BvhView m_view;
+    uint64_t m_contentHash = 0;
+    uint64_t m_settingsHash = 0;
+};
+
+/// Directory of hierarchies keyed by the content of the geometry they were built from,
+/// so that large static meshes are built once rather than on every launch. A hit costs
+/// hashing the geometry and mapping the file; nodes are paged in as traversal touches
+/// them.
+class BvhCache
+{
+public:
+    struct Stats
+    {
+        /// Loads served from the directory
+        uint32_t hits = 0;
+        /// Loads that built the hierarchy, including those after a rejected file
+        uint32_t builds = 0;
+        /// Files that were present but invalid or stale
+        uint32_t rejected = 0;
+        /// Hierarchies that could not be saved, kept in memory instead
+        uint32_t unsaved = 0;
+        double hashSeconds = 0.0;
+        double loadSeconds = 0.0;
+        double buildSeconds = 0.0;
+    };
+
+    /// verifyPayload is passed to BvhCacheFile::Open for every file
+    explicit BvhCache(const std::string& directory, bool verifyPayload = true);
+
+    /// Hash of the triangles a hierarchy is built over: positions and indices, not the
+    /// other vertex attributes
+    static uint64_t HashGeometry(const BvhGeometry& geometry);
+
+    /// File name of the hierarchy for this content and these settings
+    std::string GetPath(uint64_t contentHash, const BvhBuilder::Settings& settings) const;
+
+    /// The hierarchy over geometry, from the directory if a valid file is there, else
+    /// built with settings and saved. The view stays valid as long as the cache.
+    BvhView Load(const BvhGeometry& geometry, const BvhBuilder::Settings& settings);
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    std::string m_directory;
+    bool m_verifyPayload;
+    std::vector<std::unique_ptr<BvhCacheFile>> m_files;
+    std::vector<std::unique_ptr<Bvh>> m_unsaved;
+    Stats m_stats;
+};
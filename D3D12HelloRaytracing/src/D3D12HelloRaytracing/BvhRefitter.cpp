@@ -0,0 +1,233 @@
+#include "BvhRefitter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace
+{
+    BvhBounds GetNodeBounds(const BvhNode& node)
+    {
+        BvhBounds bounds;
+        bounds.Grow(node.boundsMin);
+        bounds.Grow(node.boundsMax);
+        return bounds;
+    }
+
+    void SetNodeBounds(const BvhBounds& bounds, BvhNode& node)
+    {
+        std::copy(bounds.min, bounds.min + 3, node.boundsMin);
+        std::copy(bounds.max, bounds.max + 3, node.boundsMax);
+    }
+
+    // Nodes below root in preorder, skipping the padding and any unused slots
+    void GetPreorder(const Bvh::NodeArray& nodes, uint32_t root, std::vector<uint32_t>& order)
+    {
+        std::vector<uint32_t> stack(1, root);
+
+        while (!stack.empty())
+        {
+            const uint32_t node = stack.back();
+            stack.pop_back();
+            order.push_back(node);
+
+            if (!nodes[node].IsLeaf())
+            {
+                stack.push_back(nodes[node].offset + 1);
+                stack.push_back(nodes[node].offset);
+            }
+        }
+    }
+}
+
+BvhRefitter::BvhRefitter(const Settings& settings, const BvhBuilder::Settings& buildSettings) :
+    m_settings(settings),
+    m_buildSettings(buildSettings),
+    m_builder(buildSettings)
+{
+    if (!(settings.rebuildThreshold >= 0.0f))
+    {
+        throw std::runtime_error("BVH rebuild threshold must not be negative");
+    }
+
+    m_settings.minTaskSize = (std::max)(m_settings.minTaskSize, 1u);
+}
+
+void BvhRefitter::Build(const BvhGeometry& geometry, Bvh& bvh)
+{
+    m_builder.Build(geometry, bvh);
+    PlanTasks(bvh);
+
+    m_builtCost = bvh.GetSahCost(m_buildSettings.traversalCost, m_buildSettings.intersectionCost);
+    m_cost = m_builtCost;
+}
+
+BvhRefitter::UpdateKind BvhRefitter::Update(const BvhGeometry& geometry, Bvh& bvh)
+{
+    const auto start = std::chrono::steady_clock::now();
+    m_stats.refitSeconds = 0.0;
+    m_stats.rebuildSeconds = 0.0;
+
+    // Refitting only to rebuild would be wasted
+    const bool planned = !m_taskNodes.empty() || !m_topNodes.empty();
+
+    if (planned && m_settings.rebuildThreshold > 0.0f)
+    {
+        const uint32_t taskCount = static_cast<uint32_t>(m_taskNodes.size());
+        const uint32_t hardwareThreads = m_settings.threads > 0 ? m_settings.threads : (std::max)(1u, std::thread::hardware_concurrency());
+        const uint32_t threadCount = (std::max)(1u, (std::min)(hardwareThreads, taskCount));
+
+        std::vector<double> taskCosts(taskCount);
+        std::atomic<uint32_t> nextTask(0);
+
+        auto work = [&]()
+        {
+            for (uint32_t task = nextTask++; task < taskCount; task = nextTask++)
+            {
+                taskCosts[task] = RefitNodes(geometry, bvh, m_taskNodes[task]);
+            }
+        };
+
+        std::vector<std::thread> threads;
+
+        for (uint32_t i = 1; i < threadCount; i++)
+        {
+            threads.emplace_back(work);
+        }
+
+        work();
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        // Summed in task order, so that the cost does not depend on scheduling
+        double cost = RefitNodes(geometry, bvh, m_topNodes);
+
+        for (double taskCost : taskCosts)
+        {
+            cost += taskCost;
+        }
+
+        const BvhNode& root = bvh.m_nodes[0];
+        const double rootArea = GetNodeBounds(root).GetHalfArea();
+        m_cost = rootArea > 0.0 ? static_cast<float>(cost / rootArea) : m_buildSettings.intersectionCost * root.count;
+
+        m_stats.threads = threadCount;
+        m_stats.refits++;
+        m_stats.refitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (m_cost <= m_settings.rebuildThreshold * m_builtCost)
+        {
+            m_stats.seconds = m_stats.refitSeconds;
+            return UpdateKind::Refit;
+        }
+    }
+
+    const auto rebuildStart = std::chrono::steady_clock::now();
+    Build(geometry, bvh);
+
+    const auto end = std::chrono::steady_clock::now();
+    m_stats.rebuilds++;
+    m_stats.rebuildSeconds = std::chrono::duration<double>(end - rebuildStart).count();
+    m_stats.seconds = std::chrono::duration<double>(end - start).count();
+    return UpdateKind::Rebuild;
+}
+
+// Split the largest subtree until there are enough tasks for the threads or the rest are
+// too small to be worth one
+void BvhRefitter::PlanTasks(const Bvh& bvh)
+{
+    const auto& nodes = bvh.m_nodes;
+
+    m_taskNodes.clear();
+    m_topNodes.clear();
+
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    // References below each node, summed back to front over the preorder
+    std::vector<uint32_t> order;
+    order.reserve(nodes.size());
+    GetPreorder(nodes, 0, order);
+
+    std::vector<uint32_t> references(nodes.size());
+
+    for (size_t i = order.size(); i-- > 0;)
+    {
+        const BvhNode& node = nodes[order[i]];
+        references[order[i]] = node.IsLeaf() ? node.count : references[node.offset] + references[node.offset + 1];
+    }
+
+    const uint32_t hardwareThreads = m_settings.threads > 0 ? m_settings.threads : (std::max)(1u, std::thread::hardware_concurrency());
+    const size_t targetTasks = static_cast<size_t>(hardwareThreads) * TasksPerThread;
+
+    std::priority_queue<std::pair<uint32_t, uint32_t>> subtrees;
+    subtrees.push({ references[0], 0 });
+
+    while (subtrees.size() < targetTasks)
+    {
+        const uint32_t node = subtrees.top().second;
+
+        if (nodes[node].IsLeaf() || subtrees.top().first < 2 * m_settings.minTaskSize)
+        {
+            break;
+        }
+
+        subtrees.pop();
+        m_topNodes.push_back(node);
+        subtrees.push({ references[nodes[node].offset], nodes[node].offset });
+        subtrees.push({ references[nodes[node].offset + 1], nodes[node].offset + 1 });
+    }
+
+    for (; !subtrees.empty(); subtrees.pop())
+    {
+        m_taskNodes.emplace_back();
+        GetPreorder(nodes, subtrees.top().second, m_taskNodes.back());
+    }
+
+    m_stats.tasks = static_cast<uint32_t>(m_taskNodes.size());
+}
+
+double BvhRefitter::RefitNodes(const BvhGeometry& geometry, Bvh& bvh, const std::vector<uint32_t>& nodes) const
+{
+    const auto& primitives = bvh.m_primitiveIndices;
+    double cost = 0.0;
+
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = bvh.m_nodes[nodes[i]];
+        BvhBounds bounds;
+
+        if (node.IsLeaf())
+        {
+            for (uint32_t j = node.offset; j < node.offset + node.count; j++)
+            {
+                const float* corners[3];
+                geometry.GetTriangle(primitives[j], corners);
+                bounds.Grow(corners[0]);
+                bounds.Grow(corners[1]);
+                bounds.Grow(corners[2]);
+            }
+
+            cost += static_cast<double>(m_buildSettings.intersectionCost) * node.count * bounds.GetHalfArea();
+        }
+        else
+        {
+            bounds.Grow(GetNodeBounds(bvh.m_nodes[node.offset]));
+            bounds.Grow(GetNodeBounds(bvh.m_nodes[node.offset + 1]));
+            cost += static_cast<double>(m_buildSettings.traversalCost) * bounds.GetHalfArea();
+        }
+
+        SetNodeBounds(bounds, node);
+    }
+
+    return cost;
+}
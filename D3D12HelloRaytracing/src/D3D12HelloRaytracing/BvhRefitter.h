@@ -0,0 +1,96 @@
+#pragma once
+
+#include "BvhBuilder.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Keeps the Bvh of a deforming mesh valid as its vertices move, the way a bottom-level
+/// update (BottomLevelASGenerator::Generate with updateOnly) does on the GPU: the tree and
+/// its leaves stay as built, and only the bounds are recomputed, from the triangles up.
+/// Leaves made by spatial splits get the bounds of their whole triangles, which still
+/// contain the clipped parts.
+///
+/// A refit tree gets worse as triangles move away from the ones they were grouped with,
+/// so every refit also sums the SAH cost, and Update rebuilds with the mesh's own
+/// BvhBuilder settings instead once that cost is more than rebuildThreshold times the
+/// cost right after the last build. Each mesh keeps its own refitter, so the policy is
+/// per mesh: cloth that folds over on itself wants a lower threshold than a character
+/// whose triangles stay near their neighbours.
+///
+/// Refitting is parallel over subtrees. After each build the tree is cut into about
+/// TasksPerThread subtrees per thread, each listed in preorder; a thread refits a subtree
+/// by walking its list backwards, so children come before their parents, and the nodes
+/// above the cut are refit last.
+class BvhRefitter
+{
+public:
+    /// Subtrees per thread, so that threads that finish early can take another
+    static const uint32_t TasksPerThread = 4;
+
+    struct Settings
+    {
+        /// Rebuild once the SAH cost passes this many times the cost after the last
+        /// build: 0 rebuilds on every update, infinity never does
+        float rebuildThreshold = 1.5f;
+        /// Smallest subtree worth refitting as a task, in triangle references
+        uint32_t minTaskSize = 4096;
+        /// Worker threads, 0 for one per hardware thread
+        uint32_t threads = 0;
+    };
+
+    enum class UpdateKind
+    {
+        Refit,
+        Rebuild,
+    };
+
+    struct Stats
+    {
+        /// Last update, the refit and, if there was one, the rebuild
+        double seconds = 0.0;
+        double refitSeconds = 0.0;
+        double rebuildSeconds = 0.0;
+        uint32_t refits = 0;
+        uint32_t rebuilds = 0;
+        /// Subtrees refit as tasks, and the threads that ran them
+        uint32_t tasks = 0;
+        uint32_t threads = 0;
+    };
+
+    /// Throws std::runtime_error if either settings are out of range
+    BvhRefitter(const Settings& settings, const BvhBuilder::Settings& buildSettings);
+
+    /// Replace the contents of bvh with a new hierarchy over geometry, the reference for
+    /// the quality of later refits
+    void Build(const BvhGeometry& geometry, Bvh& bvh);
+
+    /// Bring bvh up to the current vertex positions of geometry, which must have the same
+    /// triangles as at the last Build. Counts as a first build if bvh has never been built
+    /// by this refitter.
+    UpdateKind Update(const BvhGeometry& geometry, Bvh& bvh);
+
+    /// SAH cost now over the cost right after the last build, 1 right after it. The costs
+    /// are Bvh::GetSahCost's, with the builder's traversal and intersection costs.
+    float GetQuality() const { return m_builtCost > 0.0f ? m_cost / m_builtCost : 1.0f; }
+    float GetSahCost() const { return m_cost; }
+
+    const Settings& GetSettings() const { return m_settings; }
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    void PlanTasks(const Bvh& bvh);
+    /// Refit the nodes of a list back to front, returning their part of the SAH sum
+    double RefitNodes(const BvhGeometry& geometry, Bvh& bvh, const std::vector<uint32_t>& nodes) const;
+
+    Settings m_settings;
+    BvhBuilder::Settings m_buildSettings;
+    BvhBuilder m_builder;
+    Stats m_stats;
+    /// Nodes of each subtree in preorder, and the nodes above them in an order with
+    /// parents first
+    std::vector<std::vector<uint32_t>> m_taskNodes;
+    std::vector<uint32_t> m_topNodes;
+    float m_builtCost = 0.0f;
+    float m_cost = 0.0f;
+};
@@ -0,0 +1,410 @@
+#include "CompressedTexture.h"
+
+#include "LZCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    // "CTEX"
+    const uint32_t Magic = 0x58455443;
+    const uint32_t Version = 1;
+
+    const uint32_t FlagCubeMap = 1;
+    const uint32_t FlagSplitBlocks = 2;
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t arraySize;
+        uint32_t mipLevels;
+        uint32_t flags;
+        uint32_t alphaMode;
+        uint32_t chunkCount;
+    };
+
+    static_assert(sizeof(FileHeader) == 40, "FileHeader must match the file layout");
+    static_assert(sizeof(CompressedTextureFile::Chunk) == 24, "Chunk must match the file layout");
+
+    // Byte widths of the fields of a block, in block order, e.g. BC1 is two 16-bit color
+    // endpoints followed by 32 bits of indices. Returns 0 for formats that are not split.
+    uint32_t GetBlockFields(TextureFormat format, const uint32_t*& fields)
+    {
+        static const uint32_t BC1Fields[] = { 4, 4 };
+        static const uint32_t BC2Fields[] = { 8, 4, 4 };
+        static const uint32_t BC3Fields[] = { 2, 6, 4, 4 };
+        static const uint32_t BC4Fields[] = { 2, 6 };
+        static const uint32_t BC5Fields[] = { 2, 6, 2, 6 };
+
+        switch (format)
+        {
+        case TextureFormat::BC1_UNorm:
+        case TextureFormat::BC1_UNorm_sRGB:
+            fields = BC1Fields;
+            return 2;
+        case TextureFormat::BC2_UNorm:
+        case TextureFormat::BC2_UNorm_sRGB:
+            fields = BC2Fields;
+            return 3;
+        case TextureFormat::BC3_UNorm:
+        case TextureFormat::BC3_UNorm_sRGB:
+            fields = BC3Fields;
+            return 4;
+        case TextureFormat::BC4_UNorm:
+        case TextureFormat::BC4_SNorm:
+            fields = BC4Fields;
+            return 2;
+        case TextureFormat::BC5_UNorm:
+        case TextureFormat::BC5_SNorm:
+            fields = BC5Fields;
+            return 4;
+        default:
+            fields = nullptr;
+            return 0;
+        }
+    }
+
+    void SplitBlocks(const uint8_t* source, size_t size, uint32_t blockSize,
+                     const uint32_t* fields, uint32_t fieldCount, uint8_t* destination)
+    {
+        const size_t blockCount = size / blockSize;
+        uint32_t fieldOffset = 0;
+
+        for (uint32_t field = 0; field < fieldCount; field++)
+        {
+            for (size_t block = 0; block < blockCount; block++)
+            {
+                memcpy(destination, source + block * blockSize + fieldOffset, fields[field]);
+                destination += fields[field];
+            }
+
+            fieldOffset += fields[field];
+        }
+    }
+
+    // Rebuild the blocks in a single pass, one fixed-width copy per field. The widths
+    // are template arguments so every copy compiles to plain moves.
+    template <uint32_t Field0, uint32_t Field1, uint32_t Field2 = 0, uint32_t Field3 = 0>
+    void MergeFields(const uint8_t* source, size_t blockCount, uint8_t* destination)
+    {
+        const uint32_t BlockSize = Field0 + Field1 + Field2 + Field3;
+
+        const uint8_t* stream0 = source;
+        const uint8_t* stream1 = stream0 + blockCount * Field0;
+        const uint8_t* stream2 = stream1 + blockCount * Field1;
+        const uint8_t* stream3 = stream2 + blockCount * Field2;
+
+        for (size_t block = 0; block < blockCount; block++)
+        {
+            uint8_t* output = destination + block * BlockSize;
+
+            memcpy(output, stream0 + block * Field0, Field0);
+            memcpy(output + Field0, stream1 + block * Field1, Field1);
+
+            if (Field2 > 0)
+            {
+                memcpy(output + Field0 + Field1, stream2 + block * Field2, Field2);
+            }
+
+            if (Field3 > 0)
+            {
+                memcpy(output + Field0 + Field1 + Field2, stream3 + block * Field3, Field3);
+            }
+        }
+    }
+
+    void MergeBlocks(const uint8_t* source, size_t size, TextureFormat format, uint8_t* destination)
+    {
+        const size_t blockCount = size / GetBytesPerBlock(format);
+
+        switch (format)
+        {
+        case TextureFormat::BC1_UNorm:
+        case TextureFormat::BC1_UNorm_sRGB:
+            MergeFields<4, 4>(source, blockCount, destination);
+            break;
+        case TextureFormat::BC2_UNorm:
+        case TextureFormat::BC2_UNorm_sRGB:
+            MergeFields<8, 4, 4>(source, blockCount, destination);
+            break;
+        case TextureFormat::BC3_UNorm:
+        case TextureFormat::BC3_UNorm_sRGB:
+            MergeFields<2, 6, 4, 4>(source, blockCount, destination);
+            break;
+        case TextureFormat::BC4_UNorm:
+        case TextureFormat::BC4_SNorm:
+            MergeFields<2, 6>(source, blockCount, destination);
+            break;
+        case TextureFormat::BC5_UNorm:
+        case TextureFormat::BC5_SNorm:
+            MergeFields<2, 6, 2, 6>(source, blockCount, destination);
+            break;
+        default:
+            throw std::logic_error("Blocks of this format are not split");
+        }
+    }
+
+    // Byte range of the subresources [first, first + count) in the payload
+    void GetPayloadRange(const DDSFile& info, uint32_t first, uint32_t count, size_t& begin, size_t& end)
+    {
+        const DDSSubresource& last = info.GetSubresource(first + count - 1);
+        begin = info.GetSubresource(first).offset;
+        end = last.offset + last.slicePitch;
+    }
+}
+
+bool CompressedTextureFile::IsCompressedTexturePath(const std::string& path)
+{
+    return path.size() >= 5 && path.compare(path.size() - 5, 5, ".ctex") == 0;
+}
+
+void CompressedTextureFile::Save(const DDSFile& texture, const std::string& path, const Settings& settings)
+{
+    const uint32_t* fields = nullptr;
+    const uint32_t fieldCount = settings.splitBlocks ? GetBlockFields(texture.format, fields) : 0;
+    const uint32_t blockSize = GetBytesPerBlock(texture.format);
+
+    std::vector<Chunk> chunks;
+    std::vector<uint8_t> chunkData;
+    std::vector<uint8_t> split;
+    std::vector<uint8_t> compressed;
+
+    const uint32_t subresourceCount = texture.GetSubresourceCount();
+    const uint32_t subresourcesPerChunk = settings.chunkPerSubresource ? 1 : subresourceCount;
+
+    for (uint32_t first = 0; first < subresourceCount; first += subresourcesPerChunk)
+    {
+        Chunk chunk;
+        chunk.firstSubresource = first;
+        chunk.subresourceCount = std::min(subresourcesPerChunk, subresourceCount - first);
+
+        size_t begin, end;
+        GetPayloadRange(texture, chunk.firstSubresource, chunk.subresourceCount, begin, end);
+
+        const uint8_t* source = texture.data.data() + begin;
+        const size_t size = end - begin;
+
+        if (size > UINT32_MAX)
+        {
+            throw std::runtime_error("Texture chunk exceeds 4 GB: " + path);
+        }
+
+        if (fieldCount > 0)
+        {
+            split.resize(size);
+            SplitBlocks(source, size, blockSize, fields, fieldCount, split.data());
+        }
+
+        compressed.resize(GetLZCompressBound(size));
+        const size_t compressedSize = LZCompress(fieldCount > 0 ? split.data() : source, size, compressed.data(), compressed.size());
+
+        chunk.offset = chunkData.size();
+        chunk.uncompressedSize = static_cast<uint32_t>(size);
+
+        // Chunks that do not shrink are stored as is, unsplit
+        if (compressedSize < size)
+        {
+            chunk.compressedSize = static_cast<uint32_t>(compressedSize);
+            chunkData.insert(chunkData.end(), compressed.begin(), compressed.begin() + compressedSize);
+        }
+        else
+        {
+            chunk.compressedSize = chunk.uncompressedSize;
+            chunkData.insert(chunkData.end(), source, source + size);
+        }
+
+        chunks.push_back(chunk);
+    }
+
+    FileHeader header = {};
+    header.magic = Magic;
+    header.version = Version;
+    header.format = static_cast<uint32_t>(texture.format);
+    header.width = texture.width;
+    header.height = texture.height;
+    header.arraySize = texture.arraySize;
+    header.mipLevels = texture.mipLevels;
+    header.flags = (texture.isCubeMap ? FlagCubeMap : 0) | (fieldCount > 0 ? FlagSplitBlocks : 0);
+    header.alphaMode = texture.alphaMode;
+    header.chunkCount = static_cast<uint32_t>(chunks.size());
+
+    const uint64_t dataOffset = sizeof(header) + chunks.size() * sizeof(Chunk);
+
+    for (auto& chunk : chunks)
+    {
+        chunk.offset += dataOffset;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create compressed texture " + path);
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(chunks.data()), static_cast<std::streamsize>(chunks.size() * sizeof(Chunk)));
+    file.write(reinterpret_cast<const char*>(chunkData.data()), static_cast<std::streamsize>(chunkData.size()));
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Failed to write compressed texture " + path);
+    }
+}
+
+void CompressedTextureFile::Open(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot open compressed texture " + path);
+    }
+
+    const uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    FileHeader header = {};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!file.good() || header.magic != Magic)
+    {
+        throw std::runtime_error("Not a compressed texture: " + path);
+    }
+
+    if (header.version != Version)
+    {
+        throw std::runtime_error("Unsupported compressed texture version in " + path);
+    }
+
+    m_path = path;
+    m_splitBlocks = (header.flags & FlagSplitBlocks) != 0;
+    m_info.SetDescription(static_cast<TextureFormat>(header.format), header.width, header.height,
+                          header.arraySize, header.mipLevels, (header.flags & FlagCubeMap) != 0);
+    m_info.alphaMode = header.alphaMode;
+
+    m_chunks.resize(header.chunkCount);
+    file.read(reinterpret_cast<char*>(m_chunks.data()), static_cast<std::streamsize>(m_chunks.size() * sizeof(Chunk)));
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Compressed texture is truncated: " + path);
+    }
+
+    // The chunks must cover every subresource once, in order, with consistent sizes
+    uint32_t nextSubresource = 0;
+
+    for (const auto& chunk : m_chunks)
+    {
+        if (chunk.firstSubresource != nextSubresource || chunk.subresourceCount == 0 ||
+            chunk.subresourceCount > m_info.GetSubresourceCount() - nextSubresource)
+        {
+            throw std::runtime_error("Invalid chunk table in " + path);
+        }
+
+        size_t begin, end;
+        GetPayloadRange(m_info, chunk.firstSubresource, chunk.subresourceCount, begin, end);
+
+        if (chunk.uncompressedSize != end - begin || chunk.compressedSize > chunk.uncompressedSize ||
+            chunk.offset + chunk.compressedSize > fileSize)
+        {
+            throw std::runtime_error("Invalid chunk table in " + path);
+        }
+
+        nextSubresource += chunk.subresourceCount;
+    }
+
+    if (nextSubresource != m_info.GetSubresourceCount())
+    {
+        throw std::runtime_error("Invalid chunk table in " + path);
+    }
+}
+
+void CompressedTextureFile::DecodeChunk(const Chunk& chunk, const uint8_t* compressed, uint8_t* destination,
+                                        std::vector<uint8_t>& scratch) const
+{
+    if (chunk.compressedSize == chunk.uncompressedSize)
+    {
+        memcpy(destination, compressed, chunk.uncompressedSize);
+        return;
+    }
+
+    const uint32_t* fields = nullptr;
+
+    if (!m_splitBlocks || GetBlockFields(m_info.format, fields) == 0)
+    {
+        LZDecompress(compressed, chunk.compressedSize, destination, chunk.uncompressedSize);
+        return;
+    }
+
+    scratch.resize(chunk.uncompressedSize);
+    LZDecompress(compressed, chunk.compressedSize, scratch.data(), scratch.size());
+    MergeBlocks(scratch.data(), scratch.size(), m_info.format, destination);
+}
+
+void CompressedTextureFile::ReadSubresources(uint32_t first, uint32_t count, uint8_t* destination) const
+{
+    std::ifstream file(m_path, std::ios::binary);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot open compressed texture " + m_path);
+    }
+
+    size_t begin, end;
+    GetPayloadRange(m_info, first, count, begin, end);
+
+    std::vector<uint8_t> compressed;
+    std::vector<uint8_t> scratch;
+    std::vector<uint8_t> decoded;
+
+    for (const auto& chunk : m_chunks)
+    {
+        if (chunk.firstSubresource + chunk.subresourceCount <= first || chunk.firstSubresource >= first + count)
+        {
+            continue;
+        }
+
+        compressed.resize(chunk.compressedSize);
+        file.seekg(static_cast<std::streamoff>(chunk.offset));
+        file.read(reinterpret_cast<char*>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
+
+        if (!file.good())
+        {
+            throw std::runtime_error("Compressed texture is truncated: " + m_path);
+        }
+
+        size_t chunkBegin, chunkEnd;
+        GetPayloadRange(m_info, chunk.firstSubresource, chunk.subresourceCount, chunkBegin, chunkEnd);
+
+        if (chunkBegin >= begin && chunkEnd <= end)
+        {
+            DecodeChunk(chunk, compressed.data(), destination + (chunkBegin - begin), scratch);
+        }
+        else
+        {
+            // The chunk holds more subresources than requested, keep the overlap
+            decoded.resize(chunk.uncompressedSize);
+            DecodeChunk(chunk, compressed.data(), decoded.data(), scratch);
+
+            const size_t overlapBegin = std::max(begin, chunkBegin);
+            const size_t overlapEnd = std::min(end, chunkEnd);
+            memcpy(destination + (overlapBegin - begin), decoded.data() + (overlapBegin - chunkBegin), overlapEnd - overlapBegin);
+        }
+    }
+}
+
+void CompressedTextureFile::Load(DDSFile& texture) const
+{
+    texture = m_info;
+    texture.data.resize(texture.GetPayloadSize());
+
+    ReadSubresources(0, texture.GetSubresourceCount(), texture.data.data());
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "DDSFile.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Supercompressed texture container (.ctex): the payload of a DDS file, compressed with
+/// LZCodec in independent chunks.
+///
+/// Layout: a header with the texture description, a chunk table, then the chunk data.
+/// Each chunk covers a run of subresources in DDS payload order (all mips of slice 0,
+/// then slice 1...). With one chunk per subresource, streaming can decode a single mip;
+/// one chunk for the whole payload compresses slightly better.
+///
+/// Before compression, the blocks of BC formats are split into one stream per field
+/// (endpoints, then indices...), so similar bytes sit next to each other. This usually
+/// gains 10-20% over compressing the interleaved blocks. BC6H and BC7 have mode-dependent
+/// layouts and are compressed as is.
+///
+/// Decoding, block merge included, measured 1.1-3.1 GB/s of output on one core with
+/// AssetTools bench-decode over the model textures (Xeon VM, g++ 12 -O2). Chunks that
+/// barely compress, like the small BC1 array, are the slowest.
+class CompressedTextureFile
+{
+public:
+    struct Settings
+    {
+        /// One chunk per subresource instead of one for the whole payload
+        bool chunkPerSubresource = true;
+        /// Split BC blocks into field streams before compressing
+        bool splitBlocks = true;
+    };
+
+    struct Chunk
+    {
+        /// Offset of the compressed bytes in the file
+        uint64_t offset = 0;
+        /// Equal to uncompressedSize when the chunk is stored without compression
+        uint32_t compressedSize = 0;
+        uint32_t uncompressedSize = 0;
+        uint32_t firstSubresource = 0;
+        uint32_t subresourceCount = 0;
+    };
+
+    /// True if the path has the .ctex extension
+    static bool IsCompressedTexturePath(const std::string& path);
+
+    /// Compress the payload of a texture and write it. Throws std::runtime_error on failure.
+    static void Save(const DDSFile& texture, const std::string& path, const Settings& settings);
+
+    /// Read the header and the chunk table. Throws std::runtime_error on failure.
+    void Open(const std::string& path);
+
+    /// Description and subresource layout of the texture, without data
+    const DDSFile& GetInfo() const { return m_info; }
+
+    const std::vector<Chunk>& GetChunks() const { return m_chunks; }
+    bool HasSplitBlocks() const { return m_splitBlocks; }
+
+    /// Decode the whole texture: description, layout and payload
+    void Load(DDSFile& texture) const;
+
+    /// Decode the consecutive subresources [first, first + count) into destination, laid out
+    /// as in the payload. Only the chunks overlapping the range are read. Safe to call from
+    /// several threads, each call opens the file.
+    void ReadSubresources(uint32_t first, uint32_t count, uint8_t* destination) const;
+
+    /// Decode one chunk from its compressed bytes to the payload bytes it covers. scratch
+    /// is reused between calls to undo the block split.
+    void DecodeChunk(const Chunk& chunk, const uint8_t* compressed, uint8_t* destination,
+                     std::vector<uint8_t>& scratch) const;
+
+private:
+    std::string m_path;
+    DDSFile m_info;
+    std::vector<Chunk> m_chunks;
+    bool m_splitBlocks = false;
+};
@@ -0,0 +1,112 @@
+#include "ContentHash.h"
+
+#include <cstring>
+
+namespace
+{
+    const uint64_t Prime1 = 11400714785074694791ull;
+    const uint64_t Prime2 = 14029467366897019727ull;
+    const uint64_t Prime3 = 1609587929392839161ull;
+    const uint64_t Prime4 = 9650029242287828579ull;
+    const uint64_t Prime5 = 2870177450012600261ull;
+
+    uint64_t RotateLeft(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // Unaligned little-endian reads; every target of the project is little-endian
+    uint64_t Read64(const uint8_t* bytes)
+    {
+        uint64_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    uint32_t Read32(const uint8_t* bytes)
+    {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    uint64_t Round(uint64_t accumulator, uint64_t input)
+    {
+        accumulator += input * Prime2;
+        accumulator = RotateLeft(accumulator, 31);
+        return accumulator * Prime1;
+    }
+
+    uint64_t MergeRound(uint64_t hash, uint64_t accumulator)
+    {
+        hash ^= Round(0, accumulator);
+        return hash * Prime1 + Prime4;
+    }
+}
+
+uint64_t HashContent(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    const uint8_t* end = bytes + size;
+    uint64_t hash;
+
+    if (size >= 32)
+    {
+        // Four independent lanes over 32-byte stripes
+        uint64_t v1 = seed + Prime1 + Prime2;
+        uint64_t v2 = seed + Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - Prime1;
+
+        const uint8_t* limit = end - 32;
+
+        do
+        {
+            v1 = Round(v1, Read64(bytes));
+            v2 = Round(v2, Read64(bytes + 8));
+            v3 = Round(v3, Read64(bytes + 16));
+            v4 = Round(v4, Read64(bytes + 24));
+            bytes += 32;
+        } while (bytes <= limit);
+
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else
+    {
+        hash = seed + Prime5;
+    }
+
+    hash += static_cast<uint64_t>(size);
+
+    for (; bytes + 8 <= end; bytes += 8)
+    {
+        hash ^= Round(0, Read64(bytes));
+        hash = RotateLeft(hash, 27) * Prime1 + Prime4;
+    }
+
+    if (bytes + 4 <= end)
+    {
+        hash ^= static_cast<uint64_t>(Read32(bytes)) * Prime1;
+        hash = RotateLeft(hash, 23) * Prime2 + Prime3;
+        bytes += 4;
+    }
+
+    for (; bytes < end; bytes++)
+    {
+        hash ^= *bytes * Prime5;
+        hash = RotateLeft(hash, 11) * Prime1;
+    }
+
+    // Final avalanche
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// 64-bit non-cryptographic hash of a byte range, bit-exact with XXH64. Fast enough to
+/// key caches on file contents (several GB/s), with a negligible collision rate for
+/// asset-sized inputs.
+uint64_t HashContent(const void* data, size_t size, uint64_t seed = 0);
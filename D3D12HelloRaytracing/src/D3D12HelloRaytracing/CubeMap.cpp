@@ -0,0 +1,205 @@
+#include "CubeMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    // Integral of the solid angle from the face center to (x, y), in face coordinates
+    float AreaElement(float x, float y)
+    {
+        return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+    }
+
+    Texel Lerp(const Texel& a, const Texel& b, float t)
+    {
+        Texel result;
+        result.r = a.r + (b.r - a.r) * t;
+        result.g = a.g + (b.g - a.g) * t;
+        result.b = a.b + (b.b - a.b) * t;
+        result.a = a.a + (b.a - a.a) * t;
+        return result;
+    }
+}
+
+void CubeMapImage::Initialize(uint32_t size)
+{
+    m_size = size;
+    m_levels.assign(1, std::vector<Texel>(static_cast<size_t>(size) * size * FaceCount));
+}
+
+void CubeMapImage::Load(const DDSFile& texture)
+{
+    if (!texture.isCubeMap || texture.arraySize != FaceCount || texture.width != texture.height)
+    {
+        throw std::runtime_error("Expected a single square cube map");
+    }
+
+    Initialize(texture.width);
+
+    for (uint32_t face = 0; face < FaceCount; face++)
+    {
+        const uint32_t index = texture.GetSubresourceIndex(0, face);
+        DecodeSurface(texture.format, texture.GetSubresourceData(index), texture.GetSubresource(index).rowPitch,
+                      m_size, m_size, GetFace(face));
+    }
+}
+
+void CubeMapImage::BuildMipChain()
+{
+    m_levels.resize(1);
+
+    for (uint32_t mip = 1; mip < CountMips(m_size, m_size); mip++)
+    {
+        const uint32_t size = GetSize(mip);
+        const uint32_t sourceSize = GetSize(mip - 1);
+
+        m_levels.emplace_back(static_cast<size_t>(size) * size * FaceCount);
+
+        for (uint32_t face = 0; face < FaceCount; face++)
+        {
+            const Texel* source = GetFace(face, mip - 1);
+            Texel* destination = GetFace(face, mip);
+
+            for (uint32_t y = 0; y < size; y++)
+            {
+                for (uint32_t x = 0; x < size; x++)
+                {
+                    const Texel& t00 = source[(y * 2) * sourceSize + x * 2];
+                    const Texel& t01 = source[(y * 2) * sourceSize + x * 2 + 1];
+                    const Texel& t10 = source[(y * 2 + 1) * sourceSize + x * 2];
+                    const Texel& t11 = source[(y * 2 + 1) * sourceSize + x * 2 + 1];
+
+                    Texel& output = destination[y * size + x];
+                    output.r = (t00.r + t01.r + t10.r + t11.r) * 0.25f;
+                    output.g = (t00.g + t01.g + t10.g + t11.g) * 0.25f;
+                    output.b = (t00.b + t01.b + t10.b + t11.b) * 0.25f;
+                    output.a = (t00.a + t01.a + t10.a + t11.a) * 0.25f;
+                }
+            }
+        }
+    }
+}
+
+Texel* CubeMapImage::GetFace(uint32_t face, uint32_t mip)
+{
+    const uint32_t size = GetSize(mip);
+    return m_levels[mip].data() + static_cast<size_t>(face) * size * size;
+}
+
+const Texel* CubeMapImage::GetFace(uint32_t face, uint32_t mip) const
+{
+    const uint32_t size = GetSize(mip);
+    return m_levels[mip].data() + static_cast<size_t>(face) * size * size;
+}
+
+Texel CubeMapImage::SampleLevel(uint32_t face, float u, float v, uint32_t mip) const
+{
+    const uint32_t size = GetSize(mip);
+    const Texel* texels = GetFace(face, mip);
+
+    const float x = std::min(std::max(u * size - 0.5f, 0.0f), static_cast<float>(size - 1));
+    const float y = std::min(std::max(v * size - 0.5f, 0.0f), static_cast<float>(size - 1));
+
+    const uint32_t x0 = static_cast<uint32_t>(x);
+    const uint32_t y0 = static_cast<uint32_t>(y);
+    const uint32_t x1 = std::min(x0 + 1, size - 1);
+    const uint32_t y1 = std::min(y0 + 1, size - 1);
+    const float fx = x - x0;
+    const float fy = y - y0;
+
+    const Texel top = Lerp(texels[y0 * size + x0], texels[y0 * size + x1], fx);
+    const Texel bottom = Lerp(texels[y1 * size + x0], texels[y1 * size + x1], fx);
+
+    return Lerp(top, bottom, fy);
+}
+
+Texel CubeMapImage::Sample(const float direction[3], float lod) const
+{
+    uint32_t face;
+    float u, v;
+    GetFaceCoordinates(direction, face, u, v);
+
+    lod = std::min(std::max(lod, 0.0f), static_cast<float>(GetMipCount() - 1));
+
+    const uint32_t mip0 = static_cast<uint32_t>(lod);
+    const uint32_t mip1 = std::min(mip0 + 1, GetMipCount() - 1);
+    const float t = lod - mip0;
+
+    const Texel sample0 = SampleLevel(face, u, v, mip0);
+
+    return t > 0.0f ? Lerp(sample0, SampleLevel(face, u, v, mip1), t) : sample0;
+}
+
+void CubeMapImage::GetTexelDirection(uint32_t face, uint32_t x, uint32_t y, uint32_t size, float direction[3])
+{
+    GetFaceDirection(face, 2.0f * (x + 0.5f) / size - 1.0f, 2.0f * (y + 0.5f) / size - 1.0f, direction);
+}
+
+void CubeMapImage::GetFaceDirection(uint32_t face, float s, float t, float direction[3])
+{
+    switch (face)
+    {
+    case 0: direction[0] = 1.0f;  direction[1] = -t;    direction[2] = -s;    break;
+    case 1: direction[0] = -1.0f; direction[1] = -t;    direction[2] = s;     break;
+    case 2: direction[0] = s;     direction[1] = 1.0f;  direction[2] = t;     break;
+    case 3: direction[0] = s;     direction[1] = -1.0f; direction[2] = -t;    break;
+    case 4: direction[0] = s;     direction[1] = -t;    direction[2] = 1.0f;  break;
+    default: direction[0] = -s;   direction[1] = -t;    direction[2] = -1.0f; break;
+    }
+
+    const float length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+
+    direction[0] /= length;
+    direction[1] /= length;
+    direction[2] /= length;
+}
+
+void CubeMapImage::GetFaceCoordinates(const float direction[3], uint32_t& face, float& u, float& v)
+{
+    const float x = direction[0];
+    const float y = direction[1];
+    const float z = direction[2];
+    const float ax = std::fabs(x);
+    const float ay = std::fabs(y);
+    const float az = std::fabs(z);
+
+    float sc, tc, ma;
+
+    if (ax >= ay && ax >= az)
+    {
+        face = x >= 0.0f ? 0 : 1;
+        sc = x >= 0.0f ? -z : z;
+        tc = -y;
+        ma = ax;
+    }
+    else if (ay >= az)
+    {
+        face = y >= 0.0f ? 2 : 3;
+        sc = x;
+        tc = y >= 0.0f ? z : -z;
+        ma = ay;
+    }
+    else
+    {
+        face = z >= 0.0f ? 4 : 5;
+        sc = z >= 0.0f ? x : -x;
+        tc = -y;
+        ma = az;
+    }
+
+    u = 0.5f * (sc / ma + 1.0f);
+    v = 0.5f * (tc / ma + 1.0f);
+}
+
+float CubeMapImage::GetTexelSolidAngle(uint32_t x, uint32_t y, uint32_t size)
+{
+    const float texelSize = 2.0f / size;
+    const float x0 = x * texelSize - 1.0f;
+    const float y0 = y * texelSize - 1.0f;
+    const float x1 = x0 + texelSize;
+    const float y1 = y0 + texelSize;
+
+    return AreaElement(x0, y0) - AreaElement(x0, y1) - AreaElement(x1, y0) + AreaElement(x1, y1);
+}
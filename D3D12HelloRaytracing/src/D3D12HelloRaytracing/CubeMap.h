@@ -0,0 +1,56 @@
+#pragma once
+
+#include "DDSFile.h"
+#include "TexelCodec.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/// Cube map held as linear float texels on the CPU, with a box-filtered mip chain for
+/// filtered lookups. Faces follow the D3D order and orientation: +X, -X, +Y, -Y, +Z, -Z,
+/// texel (0, 0) at the top left of each face as seen from the center.
+class CubeMapImage
+{
+public:
+    static const uint32_t FaceCount = 6;
+
+    /// Allocate black faces of size x size texels, with mip 0 only
+    void Initialize(uint32_t size);
+
+    /// Decode mip 0 of every face of a cube DDS texture. Throws std::runtime_error if the
+    /// texture is not a square cube map or its format cannot be decoded.
+    void Load(const DDSFile& texture);
+
+    /// Recompute mips 1..N from mip 0 with a 2x2 box filter
+    void BuildMipChain();
+
+    uint32_t GetSize(uint32_t mip = 0) const { return (std::max)(1u, m_size >> mip); }
+    uint32_t GetMipCount() const { return static_cast<uint32_t>(m_levels.size()); }
+
+    Texel* GetFace(uint32_t face, uint32_t mip = 0);
+    const Texel* GetFace(uint32_t face, uint32_t mip = 0) const;
+
+    /// Trilinear lookup in the direction (need not be normalized). Bilinear taps are
+    /// clamped to the face they fall on.
+    Texel Sample(const float direction[3], float lod) const;
+
+    /// Normalized direction through the center of texel (x, y) of a face
+    static void GetTexelDirection(uint32_t face, uint32_t x, uint32_t y, uint32_t size, float direction[3]);
+
+    /// Normalized direction through the point (s, t) of a face, s and t in [-1, 1]
+    static void GetFaceDirection(uint32_t face, float s, float t, float direction[3]);
+
+    /// Face hit by a direction and the position on it, u and v in [0, 1]
+    static void GetFaceCoordinates(const float direction[3], uint32_t& face, float& u, float& v);
+
+    /// Solid angle covered by texel (x, y) of a size x size face, in steradians
+    static float GetTexelSolidAngle(uint32_t x, uint32_t y, uint32_t size);
+
+private:
+    Texel SampleLevel(uint32_t face, float u, float v, uint32_t mip) const;
+
+    uint32_t m_size = 0;
+    /// One vector per mip, holding the six faces one after another
+    std::vector<std::vector<Texel>> m_levels;
+};
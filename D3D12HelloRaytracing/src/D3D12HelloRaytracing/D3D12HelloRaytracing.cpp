@@ -19,8 +19,32 @@
 #include "nv_helpers_dx12/RaytracingPipelineGenerator.h"
 #include "nv_helpers_dx12/RootSignatureGenerator.h"
 
+#include "ASMemoryEstimator.h"
+#include "BottomLevelASBatch.h"
+#include "BvhBuilder.h"
+
+#include <algorithm>
 #include <chrono>
 
+namespace
+{
+    // Rows of the 3x4 object-to-world matrix D3D12_RAYTRACING_INSTANCE_DESC holds, which
+    // is the transpose of the XMMATRIX AddInstance takes
+    void GetInstanceTransform(const XMMATRIX& matrix, float rows[3][4])
+    {
+        XMFLOAT4X4 values;
+        XMStoreFloat4x4(&values, matrix);
+
+        for (uint32_t row = 0; row < 3; row++)
+        {
+            for (uint32_t column = 0; column < 4; column++)
+            {
+                rows[row][column] = values.m[column][row];
+            }
+        }
+    }
+}
+
 D3D12HelloRaytracing::D3D12HelloRaytracing(UINT width, UINT height, std::wstring name) :
     DXSample(width, height, name),
     m_frameIndex(0),
@@ -310,6 +334,9 @@ void D3D12HelloRaytracing::LoadAssets()
         memcpy(pVertexDataBegin, triangleVertices, sizeof(triangleVertices));
         m_vertexBuffer->Unmap(0, nullptr);
 
+        // Kept for the CPU mirror of the acceleration structures
+        m_triangleVertices.assign(std::begin(triangleVertices), std::end(triangleVertices));
+
         // Initialize the vertex buffer view.
         m_vertexBufferView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
         m_vertexBufferView.StrideInBytes = sizeof(Vertex);
@@ -341,6 +368,13 @@ void D3D12HelloRaytracing::LoadAssets()
     model.load("Models/bunny.obj");
 	//model.load("Models/dragon.obj");
 	//model.load("Models/cube.obj");
+
+	// Bounding sphere around the model origin, used for texture streaming priorities
+	for (const auto& vertex : model.mesh.vertices)
+	{
+		const float distance = XMVectorGetX(XMVector3Length(XMLoadFloat3(&vertex.position)));
+		m_modelBoundingRadius = (std::max)(m_modelBoundingRadius, distance);
+	}
     skybox.load("Models/cube.obj");
 
     createModelVertexBuffer(model, m_modelVertexBufferView);
@@ -349,11 +383,26 @@ void D3D12HelloRaytracing::LoadAssets()
 	createModelVertexBuffer(skybox, m_skyboxVertexBufferView);
 	createModelIndexBuffer(skybox, m_skyboxIndexBufferView);
 
-	loadDDSTexture(L"Textures/WoodCrate01.dds", m_ModelTexture1);
-	loadDDSTexture(L"Textures/bricks1.dds", m_ModelTexture2);
-	loadDDSTexture(L"Textures/bricks2.dds", m_ModelTexture3);
-	loadDDSTexture(L"Textures/bricks3.dds", m_ModelTexture4);
-	loadDDSTexture(L"Textures/Day_1024.dds", m_skyboxTexture);
+	m_textureCache.LoadIndex("Textures/TextureCache.index");
+
+	loadModelTextureArrays("Textures/ModelTextures.remap");
+	// The GGX-prefiltered chain written by AssetTools "prefilter" keeps the source in mip 0,
+	// so the miss shader is unchanged and glossy lookups are a single SampleLevel
+	const bool prefilteredSkybox = GetFileAttributesW(L"Textures/Day_1024_ggx.dds") != INVALID_FILE_ATTRIBUTES;
+	const wchar_t* skyboxPath = prefilteredSkybox ? L"Textures/Day_1024_ggx.dds" : L"Textures/Day_1024.dds";
+	m_skyboxTextureHandle = queueDDSTexture(skyboxPath, m_skyboxTexture);
+	createEnvironmentLighting(skyboxPath, prefilteredSkybox);
+	flushTextureUploads();
+
+	m_textureCache.SaveIndex("Textures/TextureCache.index");
+
+	const TextureCacheStats cacheStats = m_textureCache.GetStats();
+
+	char message[256];
+	sprintf_s(message, "Texture cache: %u textures, %u unique, %.1f MB saved, %u of %u hashes from the index\n",
+		cacheStats.requests, cacheStats.uniqueTextures, cacheStats.savedBytes / (1024.0f * 1024.0f),
+		cacheStats.indexHits, cacheStats.indexHits + cacheStats.filesHashed);
+	OutputDebugStringA(message);
 
     createSkyboxSamplerDescriptorHeap();
     createSkyboxSampler();
@@ -368,7 +417,9 @@ void D3D12HelloRaytracing::OnUpdate()
     UpdateCameraMovement(m_frameTime);
 	UpdateCameraBuffer();
 	UpdateConstantBuffer();
+    UpdateInstanceAnimation();
     UpdateInstancePropertiesBuffer();
+    UpdateTextureStreaming();
 }
 
 // Render the scene.
@@ -393,6 +444,20 @@ void D3D12HelloRaytracing::OnDestroy()
     // cleaned up by the destructor.
     WaitForPreviousFrame();
 
+	for (uint32_t handle : m_modelTextureArrayHandles)
+	{
+		releaseCachedTexture(handle);
+	}
+
+	m_modelTextureArrayHandles.clear();
+	m_modelTextureArrays.clear();
+
+	if (m_skyboxTextureHandle != TextureCache::InvalidHandle)
+	{
+		releaseCachedTexture(m_skyboxTextureHandle);
+		m_skyboxTextureHandle = TextureCache::InvalidHandle;
+	}
+
     CloseHandle(m_fenceEvent);
 }
 
@@ -411,6 +476,11 @@ void D3D12HelloRaytracing::OnKeyUp(uint8_t key)
             extraInfo = L" Raytracer";
         }
     }
+
+    if (key == 'I')
+    {
+        m_animateInstances = !m_animateInstances;
+    }
 }
 
 void D3D12HelloRaytracing::OnMouseMove(WPARAM buttonState, float x, float y)
@@ -571,6 +641,18 @@ void D3D12HelloRaytracing::PopulateCommandList()
     }
     else
     {
+        // Bring the TLAS up to the instances' transforms. Generate only rewrites the
+        // descriptors of the instances UpdateInstanceAnimation marked; what the CPU
+        // mirror decides is whether the builder only refits the existing hierarchy or
+        // builds a new one.
+        if (m_pendingTopLevelUpdate != SceneBvh::UpdateKind::None)
+        {
+            m_topLevelASGenerator.Generate(m_commandList.Get(), m_topLevelASBuffers.scratch.Get(), m_topLevelASBuffers.result.Get(),
+                                           m_topLevelASBuffers.instanceDesc.Get(), m_pendingTopLevelUpdate == SceneBvh::UpdateKind::Refit,
+                                           m_topLevelASBuffers.result.Get(), &m_instanceDescWriter);
+            m_pendingTopLevelUpdate = SceneBvh::UpdateKind::None;
+        }
+
 		// Bind the descriptor heap giving access to the top-level acceleration
         // structure, as well as the ray tracing output
 		std::vector<ID3D12DescriptorHeap*> heaps = { m_srvUavHeap.Get(), m_skyboxSamplerDescriptorHeap.Get() };
@@ -600,6 +682,14 @@ void D3D12HelloRaytracing::PopulateCommandList()
 
 		m_commandList->SetComputeRootDescriptorTable(4, samplerDescriptorHandle);
 
+		m_commandList->SetComputeRootConstantBufferView(5, m_environmentLightingBuffer->GetGPUVirtualAddress());
+
+		// The skybox SRV, slot 8 of the heap
+		auto environmentDescriptorHandle = m_srvUavHeap->GetGPUDescriptorHandleForHeapStart();
+		environmentDescriptorHandle.ptr += m_SRVCBVUAVDescriptorHandleIncrementSize * 8;
+
+		m_commandList->SetComputeRootDescriptorTable(6, environmentDescriptorHandle);
+
 		// On the last frame, the ray tracing output was used as a copy source, to
         // copy its contents into the render target. Now we need to transition it to
         // a UAV so that the shaders can write in it.
@@ -723,68 +813,13 @@ void D3D12HelloRaytracing::CheckRayTracingSupport()
 
 //-----------------------------------------------------------------------------
 //
-// Create a bottom-level acceleration structure based on a list of vertex
-// buffers in GPU memory along with their vertex count. The build is then done
-// in 3 steps: gathering the geometry, computing the sizes of the required
-// buffers, and building the actual AS
+// Add the vertex buffers of a bottom level, indexed where an index buffer is given.
+// CreateAccelerationStructures records the builds in a BottomLevelASBatch
 //
-D3D12HelloRaytracing::AccelerationStructureBuffers D3D12HelloRaytracing::CreateBottomLevelAS(const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& vertexBuffers)
+void D3D12HelloRaytracing::AddBottomLevelGeometry(nv_helpers_dx12::BottomLevelASGenerator& bottomLevelAS,
+                                                  const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& vertexBuffers,
+                                                  const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& indexBuffers)
 {
-    nv_helpers_dx12::BottomLevelASGenerator bottomLevelAS;
-
-    // Adding all vertex buffers and not transforming their position. 
-    for (const auto &buffer : vertexBuffers) 
-    {
-        bottomLevelAS.AddVertexBuffer(buffer.first.Get(), 
-                                    0, 
-                                    buffer.second, 
-                                    sizeof(Vertex),
-                                    0, 
-                                    0);
-    } 
-    
-    // The AS build requires some scratch space to store temporary information. 
-    // The amount of scratch memory is dependent on the scene complexity.
-    UINT64 scratchSizeInBytes = 0; 
-    
-    // The final AS also needs to be stored in addition to the existing vertex 
-    // buffers. It size is also dependent on the scene complexity. 
-    UINT64 resultSizeInBytes = 0; 
-    bottomLevelAS.ComputeASBufferSizes(m_device.Get(), false, &scratchSizeInBytes, &resultSizeInBytes); 
-    
-    // Once the sizes are obtained, the application is responsible for allocating 
-    // the necessary buffers. Since the entire generation will be done on the GPU, 
-    // we can directly allocate those on the default heap 
-    AccelerationStructureBuffers buffers; 
-    buffers.scratch = nv_helpers_dx12::CreateBuffer( m_device.Get(), 
-                                                    scratchSizeInBytes, 
-                                              D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, 
-                                           D3D12_RESOURCE_STATE_COMMON,
-                                                    nv_helpers_dx12::kDefaultHeapProps); 
-
-    buffers.result = nv_helpers_dx12::CreateBuffer( m_device.Get(), 
-                                                    resultSizeInBytes, 
-                                              D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, 
-                                           D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE, 
-                                                    nv_helpers_dx12::kDefaultHeapProps); 
-    
-    // Build the acceleration structure. Note that this call integrates a barrier
-    // on the generated AS, so that it can be used to compute a top-level AS right 
-    // after this method. 
-    bottomLevelAS.Generate(m_commandList.Get(), 
-               buffers.scratch.Get(), 
-                buffers.result.Get(), 
-                 false,
-              nullptr);
-    
-    return buffers;
-}
-
-D3D12HelloRaytracing::AccelerationStructureBuffers D3D12HelloRaytracing::CreateBottomLevelAS(const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& vertexBuffers,
-                                                                                         const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& indexBuffers /*= {}*/)
-{
-    nv_helpers_dx12::BottomLevelASGenerator bottomLevelAS;
-
     // Adding all vertex buffers and not transforming their position.
     for (size_t i = 0; i < vertexBuffers.size(); i++) 
     {
@@ -804,42 +839,135 @@ D3D12HelloRaytracing::AccelerationStructureBuffers D3D12HelloRaytracing::CreateB
                 0);
         }
     }
+}
+
+//-----------------------------------------------------------------------------
+// Query the prebuild sizes of bottom levels, with and without an index buffer, and top
+// levels over a sweep of primitive counts and build flags, and save them as a table
+// ASMemoryEstimator can load where there is no device. The addresses in the inputs are
+// not read by the query, so no buffers are needed. Only run with -recordASSizes.
+//
+void D3D12HelloRaytracing::RecordASSizes(const std::string& path)
+{
+    ASMemoryEstimator estimator;
+
+    ComPtr<IDXGIFactory4> factory;
+    ComPtr<IDXGIAdapter1> adapter;
+    DXGI_ADAPTER_DESC1 adapterDesc = {};
 
-	// The AS build requires some scratch space to store temporary information. 
-  // The amount of scratch memory is dependent on the scene complexity.
-	UINT64 scratchSizeInBytes = 0;
-
-	// The final AS also needs to be stored in addition to the existing vertex 
-	// buffers. It size is also dependent on the scene complexity. 
-	UINT64 resultSizeInBytes = 0;
-	bottomLevelAS.ComputeASBufferSizes(m_device.Get(), false, &scratchSizeInBytes, &resultSizeInBytes);
-
-	// Once the sizes are obtained, the application is responsible for allocating 
-	// the necessary buffers. Since the entire generation will be done on the GPU, 
-	// we can directly allocate those on the default heap 
-	AccelerationStructureBuffers buffers;
-	buffers.scratch = nv_helpers_dx12::CreateBuffer(m_device.Get(),
-		scratchSizeInBytes,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		D3D12_RESOURCE_STATE_COMMON,
-		nv_helpers_dx12::kDefaultHeapProps);
-
-	buffers.result = nv_helpers_dx12::CreateBuffer(m_device.Get(),
-		resultSizeInBytes,
-		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
-		D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE,
-		nv_helpers_dx12::kDefaultHeapProps);
-
-	// Build the acceleration structure. Note that this call integrates a barrier
-	// on the generated AS, so that it can be used to compute a top-level AS right 
-	// after this method. 
-	bottomLevelAS.Generate(m_commandList.Get(),
-		buffers.scratch.Get(),
-		buffers.result.Get(),
-		false,
-		nullptr);
-
-	return buffers;
+    if (SUCCEEDED(CreateDXGIFactory1(IID_PPV_ARGS(&factory))) &&
+        SUCCEEDED(factory->EnumAdapterByLuid(m_device->GetAdapterLuid(), IID_PPV_ARGS(&adapter))) &&
+        SUCCEEDED(adapter->GetDesc1(&adapterDesc)))
+    {
+        char name[128];
+        sprintf_s(name, "%ls %04x:%04x", adapterDesc.Description, adapterDesc.VendorId, adapterDesc.DeviceId);
+        estimator.SetDeviceName(name);
+    }
+
+    // Every set is swept for both kinds. The sample's own builds, no flags for the bottom
+    // levels and ALLOW_UPDATE for the top level, are among them, since plan-as-memory
+    // budgets each structure with the flags it is built with
+    const uint32_t flagSets[] =
+    {
+        0,
+        ASMemoryEstimator::AllowUpdate,
+        ASMemoryEstimator::AllowCompaction,
+        ASMemoryEstimator::PreferFastTrace,
+        ASMemoryEstimator::PreferFastTrace | ASMemoryEstimator::AllowUpdate,
+        ASMemoryEstimator::PreferFastBuild,
+        ASMemoryEstimator::PreferFastBuild | ASMemoryEstimator::AllowUpdate,
+    };
+
+    // Powers of two and the midpoints between them, up to 4M
+    std::vector<uint32_t> counts;
+
+    for (uint32_t count = 1; count <= (1u << 22); count *= 2)
+    {
+        counts.push_back(count);
+
+        if (count >= 2 && count < (1u << 22))
+        {
+            counts.push_back(count + count / 2);
+        }
+    }
+
+    auto query = [&](ASKind kind, uint32_t flags, uint32_t geometries, uint32_t primitives, bool indexed)
+    {
+        std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> geometryDescs(kind == ASKind::BottomLevel ? geometries : 0);
+
+        for (uint32_t i = 0; i < geometryDescs.size(); i++)
+        {
+            // The triangles split evenly, the first geometries taking the remainder
+            const uint32_t triangles = primitives / geometries + (i < primitives % geometries ? 1 : 0);
+
+            D3D12_RAYTRACING_GEOMETRY_DESC& desc = geometryDescs[i];
+            desc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+            desc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+            desc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+            desc.Triangles.VertexCount = triangles * 3;
+            desc.Triangles.VertexBuffer.StrideInBytes = sizeof(Vertex);
+
+            // Like the model: 32-bit indices, and as many vertices as corners at most
+            if (indexed)
+            {
+                desc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
+                desc.Triangles.IndexCount = triangles * 3;
+            }
+        }
+
+        D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS inputs = {};
+        inputs.Type = kind == ASKind::BottomLevel ? D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL
+                                                  : D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+        inputs.DescsLayout = D3D12_ELEMENTS_LAYOUT_ARRAY;
+        inputs.Flags = static_cast<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS>(flags);
+        inputs.NumDescs = kind == ASKind::BottomLevel ? geometries : primitives;
+
+        if (kind == ASKind::BottomLevel)
+        {
+            inputs.pGeometryDescs = geometryDescs.data();
+        }
+
+        D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info = {};
+        m_device->GetRaytracingAccelerationStructurePrebuildInfo(&inputs, &info);
+
+        ASSizeSample sample;
+        sample.kind = kind;
+        sample.flags = flags;
+        sample.geometries = geometries;
+        sample.primitives = primitives;
+        sample.indexed = indexed;
+        sample.sizes.result = info.ResultDataMaxSizeInBytes;
+        sample.sizes.scratch = info.ScratchDataSizeInBytes;
+        sample.sizes.updateScratch = info.UpdateScratchDataSizeInBytes;
+        estimator.AddSample(sample);
+    };
+
+    for (uint32_t flags : flagSets)
+    {
+        for (uint32_t count : counts)
+        {
+            query(ASKind::BottomLevel, flags, 1, count, false);
+            query(ASKind::BottomLevel, flags, 1, count, true);
+            query(ASKind::TopLevel, flags, 1, count, false);
+        }
+
+        // What each extra geometry desc costs
+        for (uint32_t geometries : { 2u, 4u, 16u, 64u })
+        {
+            for (uint32_t triangles : { 1024u, 65536u })
+            {
+                query(ASKind::BottomLevel, flags, geometries, triangles, false);
+                query(ASKind::BottomLevel, flags, geometries, triangles, true);
+            }
+        }
+    }
+
+    estimator.Save(path);
+
+    char message[256];
+    sprintf_s(message, "AS sizes: %zu samples of %s saved to %s\n",
+        estimator.GetSamples().size(), estimator.GetDeviceName().c_str(), path.c_str());
+    OutputDebugStringA(message);
 }
 
 //-----------------------------------------------------------------------------
@@ -849,7 +977,7 @@ D3D12HelloRaytracing::AccelerationStructureBuffers D3D12HelloRaytracing::CreateB
 // AS itself
 //
 // pair of bottom level AS and matrix of the instance
-void D3D12HelloRaytracing::CreateTopLevelAS(const std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, bool>>& instances)
+void D3D12HelloRaytracing::CreateTopLevelAS(const std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, bool, uint64_t>>& instances)
 {
     // Gather all the instances into the builder helper
     // AddInstanceinstanceIDHitɫInstanceIDȡ
@@ -863,20 +991,23 @@ void D3D12HelloRaytracing::CreateTopLevelAS(const std::vector<std::tuple<ComPtr<
         m_topLevelASGenerator.AddInstance(std::get<0>(instances[i]).Get(), 
                                              std::get<1>(instances[i]), 
                                             static_cast<uint32_t>(i),
-                                          0);
+                                          0,
+                                          std::get<3>(instances[i]));
     }
     
     // Plane
 	m_topLevelASGenerator.AddInstance(std::get<0>(instances[3]).Get(),
                                          std::get<1>(instances[3]),
 		                                static_cast<uint32_t>(3),
-		                              2);
+		                              2,
+		                              std::get<3>(instances[3]));
 
     // Model
 	m_topLevelASGenerator.AddInstance(std::get<0>(instances[instances.size() - 1]).Get(),
                                          std::get<1>(instances[instances.size() - 1]),
 		                                static_cast<uint32_t>(instances.size() - 1),
-                                      4);
+                                      4,
+                                      std::get<3>(instances[instances.size() - 1]));
     
     // As for the bottom-level AS, the building the AS requires some scratch space 
     // to store temporary data in addition to the actual AS. In the case of the 
@@ -910,7 +1041,8 @@ void D3D12HelloRaytracing::CreateTopLevelAS(const std::vector<std::tuple<ComPtr<
     // we also pass the existing AS as the 'previous' AS, so that it can be 
     // refitted in place. 
     m_topLevelASGenerator.Generate(m_commandList.Get(), m_topLevelASBuffers.scratch.Get(), 
-                        m_topLevelASBuffers.result.Get(), m_topLevelASBuffers.instanceDesc.Get());
+                        m_topLevelASBuffers.result.Get(), m_topLevelASBuffers.instanceDesc.Get(), false, nullptr,
+                        &m_instanceDescWriter);
 }
 
 //-----------------------------------------------------------------------------
@@ -920,15 +1052,34 @@ void D3D12HelloRaytracing::CreateTopLevelAS(const std::vector<std::tuple<ComPtr<
 //
 void D3D12HelloRaytracing::CreateAccelerationStructures()
 {
+    // The bottom levels share one scratch buffer, built in batches that fit the budget
+    BottomLevelASBatch bottomLevelBatch(BottomLevelScratchBudget);
+    nv_helpers_dx12::BottomLevelASGenerator generator;
+
     // Build the bottom AS from the Triangle vertex buffer 
-    AccelerationStructureBuffers bottomLevelBuffers = CreateBottomLevelAS({{m_vertexBuffer.Get(), 3}}); 
+    AddBottomLevelGeometry(generator, {{m_vertexBuffer.Get(), 3}});
+    const uint32_t triangleBuild = bottomLevelBatch.Add(std::move(generator));
 
 	// #DXR Extra: Per-Instance Data
-	AccelerationStructureBuffers planeBottomLevelBuffers = CreateBottomLevelAS({ {m_planeVertexBuffer.Get(), 6} });
+    generator = {};
+    AddBottomLevelGeometry(generator, { {m_planeVertexBuffer.Get(), 6} });
+    const uint32_t planeBuild = bottomLevelBatch.Add(std::move(generator));
 
-	AccelerationStructureBuffers modelBottomLevelBuffers = CreateBottomLevelAS(
+    generator = {};
+    AddBottomLevelGeometry(generator,
         { {m_modelVertexBuffer.Get(), model.mesh.vertexCount } },
          { {m_modelIndexBuffer.Get(), model.mesh.indexCount} });
+    const uint32_t modelBuild = bottomLevelBatch.Add(std::move(generator));
+
+    // The results are suballocated from the pool, which keeps them alive
+    bottomLevelBatch.Record(m_device.Get(), m_commandList.Get(), m_bottomLevelASPool);
+
+    const ASAllocation& triangleResult = bottomLevelBatch.GetResult(triangleBuild);
+    const ASAllocation& planeResult = bottomLevelBatch.GetResult(planeBuild);
+    const ASAllocation& modelResult = bottomLevelBatch.GetResult(modelBuild);
+    ComPtr<ID3D12Resource> triangleBuffer = m_bottomLevelASPool.GetBuffer(triangleResult.heap);
+    ComPtr<ID3D12Resource> planeBuffer = m_bottomLevelASPool.GetBuffer(planeResult.heap);
+    ComPtr<ID3D12Resource> modelBuffer = m_bottomLevelASPool.GetBuffer(modelResult.heap);
 
 	//auto translation = XMMatrixTranslation(0.0f, -0.75f, 0.3f);
 	auto translation = XMMatrixTranslation(0.0f, -0.5f, -0.3f);
@@ -950,14 +1101,25 @@ void D3D12HelloRaytracing::CreateAccelerationStructures()
     };
 
     // Just one instance for now 
-    m_instances = { {bottomLevelBuffers.result, transforms[0], false},
-                    {bottomLevelBuffers.result, transforms[1], false},
-                    {bottomLevelBuffers.result, transforms[2], false},
+    m_instances = { {triangleBuffer, transforms[0], false, triangleResult.offset},
+                    {triangleBuffer, transforms[1], false, triangleResult.offset},
+                    {triangleBuffer, transforms[2], false, triangleResult.offset},
                     // #DXR Extra: Per-Instance Data
-                    {planeBottomLevelBuffers.result, transforms[3], false},
-                    {modelBottomLevelBuffers.result, transform, model.mesh.hasTexture} };
+                    {planeBuffer, transforms[3], false, planeResult.offset},
+                    {modelBuffer, transform, model.mesh.hasTexture, modelResult.offset} };
+
+    // Only the obj model is textured
+    m_instanceTextures.assign(m_instances.size(), TextureRemapEntry());
+    m_instanceTextures[4] = m_modelTexture;
 
     CreateTopLevelAS(m_instances); 
+    CreateSceneBvh();
+
+    // Sizes for ASMemoryEstimator, only when asked for with -recordASSizes
+    if (!m_recordASSizesPath.empty())
+    {
+        RecordASSizes(m_recordASSizesPath);
+    }
     
     // Flush the command list and wait for it to finish 
     m_commandList->Close(); 
@@ -973,9 +1135,8 @@ void D3D12HelloRaytracing::CreateAccelerationStructures()
     // Once the command list is finished executing, reset it to be reused for rendering 
     ThrowIfFailed( m_commandList->Reset(m_commandAllocator.Get(), m_pipelineState.Get())); 
     
-    // Store the AS buffers. The rest of the buffers will be released once we exit 
-    // the function
-    m_bottomLevelAS = bottomLevelBuffers.result;
+    // The bottom levels stay in m_bottomLevelASPool. The rest of the buffers will be
+    // released once we exit the function
 }
 
 //-----------------------------------------------------------------------------
@@ -1177,7 +1338,7 @@ void D3D12HelloRaytracing::CreateRayTracingPipeline()
     // exchanged between shaders, such as the HitInfo structure in the HLSL code.
     // It is important to keep this value as low as possible as a too high value
     // would result in unnecessary memory consumption and cache trashing.
-	pipeline.SetMaxPayloadSize(8 * sizeof(float)); // RGB + distance + depth
+	pipeline.SetMaxPayloadSize(10 * sizeof(float)); // RGB + distance + normal + depth + ray cone
 
 	// Upon hitting a surface, DXR can provide several attributes to the hit. In
 	// our sample we just use the barycentric coordinates defined by the weights
@@ -1303,49 +1464,15 @@ void D3D12HelloRaytracing::CreateShaderResourceHeap()
 	// Write the per-instance properties buffer view in the heap
 	m_device->CreateShaderResourceView(m_instanceProperties.Get(), &srvDesc, srvHandle);
 
-	// Slot4 - ӦHit.hlslеģ
-    // Texture2D texture1 : register(t4);
-	srvHandle.ptr += m_SRVCBVUAVDescriptorHandleIncrementSize;
-
-    // ģSRV
-	D3D12_RESOURCE_DESC textureDesc = m_ModelTexture1->GetDesc();
-
-    auto shaderResourceViewDesc = CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION_TEXTURE2D, textureDesc.Format, textureDesc.MipLevels);
-
-	m_device->CreateShaderResourceView(m_ModelTexture1.Get(), &shaderResourceViewDesc, srvHandle);
-
-	// Slot5 - ӦHit.hlslеģ
-    // Texture2D texture2 : register(t5);
-	srvHandle.ptr += m_SRVCBVUAVDescriptorHandleIncrementSize;
-
-	// ģSRV
-	textureDesc = m_ModelTexture2->GetDesc();
-
-    shaderResourceViewDesc = CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION_TEXTURE2D, textureDesc.Format, textureDesc.MipLevels);
-
-    m_device->CreateShaderResourceView(m_ModelTexture2.Get(), &shaderResourceViewDesc, srvHandle);
-
-	// Slot6 - ӦHit.hlslеģ
-    // Texture2D texture3 : register(t6);
-	srvHandle.ptr += m_SRVCBVUAVDescriptorHandleIncrementSize;
-
-	// ģSRV
-	textureDesc = m_ModelTexture3->GetDesc();
-
-    shaderResourceViewDesc = CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION_TEXTURE2D, textureDesc.Format, textureDesc.MipLevels);
-
-	m_device->CreateShaderResourceView(m_ModelTexture3.Get(), &shaderResourceViewDesc, srvHandle);
-
-	// Slot7 - ӦHit.hlslеģ
-    // Texture2D texture4 : register(t7);
-	srvHandle.ptr += m_SRVCBVUAVDescriptorHandleIncrementSize;
-
-	// ģSRV
-	textureDesc = m_ModelTexture4->GetDesc();
-
-	shaderResourceViewDesc = CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION_TEXTURE2D, textureDesc.Format, textureDesc.MipLevels);
+	// Slot4-7 - Hit.hlsl:
+	// Texture2DArray modelTextures0..3 : register(t0..t3, space1);
+	// One array per bucket of the packed model textures, unused slots get null descriptors
+	for (uint32_t i = 0; i < MaxModelTextureArrays; i++)
+	{
+		createModelTextureArrayView(i);
+	}
 
-	m_device->CreateShaderResourceView(m_ModelTexture4.Get(), &shaderResourceViewDesc, srvHandle);
+	srvHandle.ptr += MaxModelTextureArrays * m_SRVCBVUAVDescriptorHandleIncrementSize;
 
 	// Slot8 - ӦMiss.hlslеģ
     // Texture2D environmentTexture : register(t0, space1);
@@ -1539,6 +1666,7 @@ void D3D12HelloRaytracing::CreatePlaneVB()
     ThrowIfFailed(m_planeVertexBuffer->Map( 0, &readRange, reinterpret_cast<void**>(&pVertexDataBegin))); 
     memcpy_s(pVertexDataBegin, sizeof(planeVertices), planeVertices, sizeof(planeVertices));
     m_planeVertexBuffer->Unmap(0, nullptr);
+    m_planeVertices.assign(std::begin(planeVertices), std::end(planeVertices));
         
     // Initialize the vertex buffer view. 
     m_planeVertexBufferView.BufferLocation = m_planeVertexBuffer->GetGPUVirtualAddress(); 
@@ -1857,89 +1985,395 @@ void D3D12HelloRaytracing::CreateInstancePropertiesBuffer()
 		0, 0); // We do not intend to read from this resource on the CPU.
 	ThrowIfFailed(m_instanceProperties->Map(0, &readRange,
 		reinterpret_cast<void**>(&m_instancePropertiesBufferData)));
+
+	// Nothing is written yet, so the first update fills every instance
+	m_dirtyInstanceProperties.Resize(static_cast<uint32_t>(m_instances.size()));
+}
+
+//--------------------------------------------------------------------------------------------------
+// CPU mirror of the TLAS: bottom levels over the same vertices as the BottomLevelASBatch
+// of CreateAccelerationStructures, and the instances CreateTopLevelAS added, in the same
+// order
+void D3D12HelloRaytracing::CreateSceneBvh()
+{
+    BvhBuilder builder(BvhBuilder::Settings{});
+
+    auto getGeometry = [](const Vertex* vertices, uint32_t vertexCount)
+    {
+        BvhGeometry geometry;
+        geometry.positions = &vertices->position.x;
+        geometry.vertexStride = sizeof(Vertex);
+        geometry.vertexCount = vertexCount;
+        return geometry;
+    };
+
+    const BvhGeometry triangleGeometry = getGeometry(m_triangleVertices.data(), static_cast<uint32_t>(m_triangleVertices.size()));
+    const BvhGeometry planeGeometry = getGeometry(m_planeVertices.data(), static_cast<uint32_t>(m_planeVertices.size()));
+
+    BvhGeometry modelGeometry;
+    modelGeometry.positions = &model.mesh.vertices[0].position.x;
+    modelGeometry.vertexStride = sizeof(DXVertex);
+    modelGeometry.vertexCount = static_cast<uint32_t>(model.mesh.vertices.size());
+    modelGeometry.indices = model.mesh.indices.empty() ? nullptr : model.mesh.indices.data();
+    modelGeometry.indexCount = static_cast<uint32_t>(model.mesh.indices.size());
+
+    builder.Build(triangleGeometry, m_triangleBvh);
+    builder.Build(planeGeometry, m_planeBvh);
+
+    // The model is the one mesh large enough to be worth caching: built on the first
+    // launch, mapped from BvhCache/ on the next ones
+    m_modelBvh = m_bvhCache.Load(modelGeometry, BvhBuilder::Settings{});
+
+    const BvhCache::Stats& cacheStats = m_bvhCache.GetStats();
+    char message[256];
+    sprintf_s(message, "BVH cache: %u hits, %u builds, %u rejected, %.1f ms hashing, %.1f ms loading, %.1f ms building\n",
+        cacheStats.hits, cacheStats.builds, cacheStats.rejected, cacheStats.hashSeconds * 1000.0,
+        cacheStats.loadSeconds * 1000.0, cacheStats.buildSeconds * 1000.0);
+    OutputDebugStringA(message);
+
+    // Instance IDs and hit groups as CreateTopLevelAS passes them to AddInstance
+    std::vector<SceneInstance> instances(m_instances.size());
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+        SceneInstance& instance = instances[i];
+        const bool isTriangle = i < 3;
+        const bool isPlane = i == 3;
+
+        instance.bottomLevel = isTriangle ? m_triangleBvh.GetView() : isPlane ? m_planeBvh.GetView() : m_modelBvh;
+        instance.geometry = isTriangle ? triangleGeometry : isPlane ? planeGeometry : modelGeometry;
+        instance.instanceID = static_cast<uint32_t>(i);
+        instance.hitGroupIndex = isTriangle ? 0 : isPlane ? 2 : 4;
+        GetInstanceTransform(std::get<1>(m_instances[i]), instance.transform);
+    }
+
+    m_sceneBvh.Build(instances);
 }
 
 //--------------------------------------------------------------------------------------------------
-// Copy the per-instance data into the buffer
+// Spin the triangles about their own vertical axis while 'I' is on, and tell the CPU
+// mirror which instances moved so that the next TLAS build knows how much work it is
+void D3D12HelloRaytracing::UpdateInstanceAnimation()
+{
+    if (!m_animateInstances)
+    {
+        return;
+    }
+
+    m_animationTime += m_frameTime;
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        XMMATRIX& transform = std::get<1>(m_instances[i]);
+        transform = XMMatrixRotationY(m_animationTime * (i + 1)) * transforms[i];
+
+        float rows[3][4];
+        GetInstanceTransform(transform, rows);
+        m_sceneBvh.SetTransform(i, rows);
+
+        m_instanceDescWriter.Mark(i);
+        m_dirtyInstanceProperties.Mark(i);
+    }
+
+    const SceneBvh::UpdateKind update = m_sceneBvh.Update();
+
+    if (update > m_pendingTopLevelUpdate)
+    {
+        m_pendingTopLevelUpdate = update;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Copy the per-instance data of the instances that changed into the buffer, which
+// stays mapped; the others keep what earlier frames wrote
 // #DXR Extra - Refitting
 void D3D12HelloRaytracing::UpdateInstancePropertiesBuffer()
 {
-	InstanceProperties* current = m_instancePropertiesBufferData;
+	for (const DirtyRange& range : m_dirtyInstanceProperties.CollectRanges())
+	{
+		for (uint32_t i = range.begin; i < range.end; i++)
+		{
+			InstanceProperties* current = m_instancePropertiesBufferData + i;
+			current->objectToWorld = std::get<1>(m_instances[i]);
+			current->hasTexture = std::get<2>(m_instances[i]);
+			current->textureArray = static_cast<int>(m_instanceTextures[i].arrayIndex);
+			current->textureSlice = static_cast<int>(m_instanceTextures[i].slice);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// Project the skybox onto L2 spherical harmonics once at load time, so the diffuse
+// ambient of ModelClosestHit is one polynomial instead of rays to the sky. Skyboxes
+// the CPU cannot decode (BC6H/BC7) keep the previous flat ambient. The glossy
+// reflection of ModelClosestHit is enabled only for a GGX-prefiltered skybox.
+//
+void D3D12HelloRaytracing::createEnvironmentLighting(const std::wstring& skyboxPath, bool prefiltered)
+{
+	const std::string filePath(skyboxPath.begin(), skyboxPath.end());
 
-	for (const auto& instance : m_instances) 
-    {
-        current->objectToWorld = std::get<1>(instance);
-        current->hasTexture = std::get<2>(instance);
-        current++;
+	EnvironmentLightingConstants constants;
+	char message[256];
+
+	try
+	{
+		DDSFile texture;
+
+		if (CompressedTextureFile::IsCompressedTexturePath(filePath))
+		{
+			CompressedTextureFile compressed;
+			compressed.Open(filePath);
+			compressed.Load(texture);
+		}
+		else
+		{
+			texture.Load(filePath);
+		}
+
+		CubeMapImage environment;
+		environment.Load(texture);
+		environment.BuildMipChain();
+
+		EnvironmentSHProjector projector{ EnvironmentSHProjector::Settings() };
+
+		SHCoefficients radiance;
+		projector.Project(environment, radiance);
+
+		EnvironmentSHProjector::GetLightingConstants(radiance, constants);
+
+		sprintf_s(message, "Environment lighting: projected %ux%u per face in %.3f ms\n",
+			projector.GetStats().size, projector.GetStats().size, projector.GetStats().seconds * 1000.0);
+	}
+	catch (const std::exception& exception)
+	{
+		const float ambient[3] = { 0.1f, 0.1f, 0.1f };
+		EnvironmentSHProjector::GetUniformLightingConstants(ambient, constants);
+
+		sprintf_s(message, "Environment lighting: flat ambient, %s\n", exception.what());
 	}
+
+	OutputDebugStringA(message);
+
+	// glossyEnvironment follows the coefficients in cbuffer EnvironmentLighting
+	const float glossyEnvironment = prefiltered ? 1.0f : 0.0f;
+
+	// Constant buffers are sized in multiples of 256 bytes
+	const uint32_t bufferSize = (sizeof(constants) + sizeof(glossyEnvironment) + 255) & ~255;
+
+	m_environmentLightingBuffer = nv_helpers_dx12::CreateBuffer(m_device.Get(), bufferSize, D3D12_RESOURCE_FLAG_NONE,
+		D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+
+	uint8_t* data = nullptr;
+	ThrowIfFailed(m_environmentLightingBuffer->Map(0, nullptr, reinterpret_cast<void**>(&data)));
+	memcpy(data, &constants, sizeof(constants));
+	memcpy(data + sizeof(constants), &glossyEnvironment, sizeof(glossyEnvironment));
+	m_environmentLightingBuffer->Unmap(0, nullptr);
 }
 
-uint64_t D3D12HelloRaytracing::loadDDSTexture(const std::wstring& path, ComPtr<ID3D12Resource>& texture)
+//-----------------------------------------------------------------------------
+//
+// Create a texture from a DDS or .ctex file and queue its data for the next
+// flushTextureUploads. The texture stays in the COPY_DEST state until then. A file whose
+// content is already cached reuses the existing texture.
+//
+uint32_t D3D12HelloRaytracing::queueDDSTexture(const std::wstring& path, ComPtr<ID3D12Resource>& texture)
 {
-	//Skybox Cube Map Ҫı
-	std::unique_ptr<uint8_t[]> ddsData;
-	std::vector<D3D12_SUBRESOURCE_DATA> subResources;
-	DDS_ALPHA_MODE alphaMode = DDS_ALPHA_MODE_UNKNOWN;
-	bool bIsCube = false;
-
-	ID3D12Resource* textureResource = nullptr;
-
-	ThrowIfFailed(LoadDDSTextureFromFile(
-		m_device.Get(),
-        path.c_str(),
-		&textureResource,
-		ddsData,
-		subResources,
-		SIZE_MAX,
-		&alphaMode,
-		&bIsCube));
-
-	// 溯صʽĬ϶ϣCopyҪԼ
-    texture.Attach(textureResource);
+	const std::string filePath(path.begin(), path.end());
+
+	// Files with the same content share one resource
+	bool created = false;
+	const uint32_t handle = m_textureCache.Acquire(filePath, created);
+
+	if (!created)
+	{
+		texture = m_cachedTextures[handle];
+		return handle;
+	}
+
+	PendingTextureUpload upload;
+
+	if (CompressedTextureFile::IsCompressedTexturePath(filePath))
+	{
+		// Decoded on the CPU into the same subresource array LoadDDSTextureFromFile fills
+		CompressedTextureFile compressed;
+		compressed.Open(filePath);
+
+		DDSFile decoded;
+		compressed.Load(decoded);
+
+		texture = createStreamedTexture(decoded, 0);
+		upload.streamedData = std::move(decoded.data);
+
+		for (const auto& subresource : decoded.subresources)
+		{
+			D3D12_SUBRESOURCE_DATA data;
+			data.pData = upload.streamedData.data() + subresource.offset;
+			data.RowPitch = static_cast<LONG_PTR>(subresource.rowPitch);
+			data.SlicePitch = static_cast<LONG_PTR>(subresource.slicePitch);
+			upload.subresources.push_back(data);
+		}
+	}
+	else
+	{
+		DDS_ALPHA_MODE alphaMode = DDS_ALPHA_MODE_UNKNOWN;
+		bool bIsCube = false;
+
+		ID3D12Resource* textureResource = nullptr;
+
+		ThrowIfFailed(LoadDDSTextureFromFile(
+			m_device.Get(),
+            path.c_str(),
+			&textureResource,
+			upload.ddsData,
+			upload.subresources,
+			SIZE_MAX,
+			&alphaMode,
+			&bIsCube));
+
+        texture.Attach(textureResource);
+	}
+
+	upload.texture = texture;
+
+	m_cachedTextures.resize(m_textureCache.GetHandleCount());
+	m_cachedTextures[handle] = texture;
 
     auto textureDesc = texture->GetDesc();
 
-	// ȡskyboxԴСϴ
-	auto textureUploadBufferSize = GetRequiredIntermediateSize(texture.Get(), 0, static_cast<uint32_t>(subResources.size()));
+	// The DXGI_FORMAT values of the formats the planner knows about match TextureFormat
+	TextureUploadDesc uploadDesc;
+	uploadDesc.format = static_cast<TextureFormat>(textureDesc.Format);
+	uploadDesc.width = static_cast<uint32_t>(textureDesc.Width);
+	uploadDesc.height = textureDesc.Height;
+	uploadDesc.arraySize = textureDesc.DepthOrArraySize;
+	uploadDesc.mipLevels = textureDesc.MipLevels;
 
-	D3D12_HEAP_DESC textureUploadHeapDesc{};
-	textureUploadHeapDesc.Alignment = 0;
-	textureUploadHeapDesc.SizeInBytes = ROUND_UP(2 * textureUploadBufferSize, D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT);
-	textureUploadHeapDesc.Properties.Type = D3D12_HEAP_TYPE_UPLOAD;
-	textureUploadHeapDesc.Properties.CPUPageProperty = D3D12_CPU_PAGE_PROPERTY_UNKNOWN;
-	textureUploadHeapDesc.Properties.MemoryPoolPreference = D3D12_MEMORY_POOL_UNKNOWN;
+	if (textureDesc.Dimension == D3D12_RESOURCE_DIMENSION_TEXTURE2D && IsKnownTextureFormat(uploadDesc.format))
+	{
+		m_textureUploadPlanner.AddTexture(uploadDesc);
+	}
+	else
+	{
+		// Any other format or dimension the DDS loader accepts is laid out by the runtime
+		const UINT subresourceCount = static_cast<UINT>(upload.subresources.size());
 
-	// ϴѾǻ壬԰ڷ
-	textureUploadHeapDesc.Flags = D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS;
-   
-    ThrowIfFailed(m_device->CreateHeap(&textureUploadHeapDesc, IID_PPV_ARGS(&m_textureUploadHeap)));
+		std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT> layouts(subresourceCount);
+		std::vector<UINT> numRows(subresourceCount);
+		std::vector<UINT64> rowSizes(subresourceCount);
 
-	// skyboxϴдϴݵĻԴ
-    ThrowIfFailed(m_device->CreatePlacedResource(
-        m_textureUploadHeap.Get(),
-		0,
-		&CD3DX12_RESOURCE_DESC::Buffer(textureUploadBufferSize),
-		D3D12_RESOURCE_STATE_GENERIC_READ,
-		nullptr,
-		IID_PPV_ARGS(&m_textureUploadBuffer)));
-
-	// ϴskybox
-	UpdateSubresources(
-        m_commandList.Get(),
-        texture.Get(),
-        m_textureUploadBuffer.Get(),
-		0,
-		0,
-		static_cast<uint32_t>(subResources.size()),
-		subResources.data()
-	);
-
-    m_commandList->ResourceBarrier(
-		1,
-		&CD3DX12_RESOURCE_BARRIER::Transition(
-            texture.Get(),
-		D3D12_RESOURCE_STATE_COPY_DEST,
-		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+		m_device->GetCopyableFootprints(&textureDesc, 0, subresourceCount, 0, layouts.data(), numRows.data(), rowSizes.data(), nullptr);
+
+		std::vector<TextureUploadCopy> footprints(subresourceCount);
+
+		for (UINT i = 0; i < subresourceCount; i++)
+		{
+			footprints[i].subresource = i;
+			footprints[i].offset = layouts[i].Offset;
+			footprints[i].rowPitch = layouts[i].Footprint.RowPitch;
+			footprints[i].width = layouts[i].Footprint.Width;
+			footprints[i].height = layouts[i].Footprint.Height;
+			footprints[i].depth = layouts[i].Footprint.Depth;
+			footprints[i].numRows = numRows[i];
+			footprints[i].rowBytes = rowSizes[i];
+		}
+
+		// The footprints are already valid for the copy, flushTextureUploads must not round them
+		uploadDesc.format = TextureFormat::Unknown;
+		m_textureUploadPlanner.AddTexture(uploadDesc, footprints);
+	}
+
+	m_pendingTextureUploads.push_back(std::move(upload));
+
+	return handle;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Drop a reference taken by queueDDSTexture or loadModelTextureArrays, and the resource
+// with the last one
+//
+void D3D12HelloRaytracing::releaseCachedTexture(uint32_t handle)
+{
+	if (m_textureCache.Release(handle))
+	{
+		m_cachedTextures[handle].Reset();
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// Copy all queued textures through a single staging buffer laid out by the upload
+// planner, and wait for the copies once
+//
+void D3D12HelloRaytracing::flushTextureUploads()
+{
+	if (m_pendingTextureUploads.empty())
+	{
+		return;
+	}
+
+	uint8_t* arena = nullptr;
+
+	// Pending uploads may only need their state transition, e.g. after a streaming eviction
+	if (m_textureUploadPlanner.GetArenaSize() > 0)
+	{
+		m_textureUploadBuffer = nv_helpers_dx12::CreateBuffer(
+			m_device.Get(), m_textureUploadPlanner.GetArenaSize(), D3D12_RESOURCE_FLAG_NONE,
+			D3D12_RESOURCE_STATE_GENERIC_READ, nv_helpers_dx12::kUploadHeapProps);
+
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(m_textureUploadBuffer->Map(0, &readRange, reinterpret_cast<void**>(&arena)));
+	}
+
+	for (const auto& copy : m_textureUploadPlanner.GetCopies())
+	{
+		const PendingTextureUpload& upload = m_pendingTextureUploads[copy.texture];
+		const D3D12_SUBRESOURCE_DATA& subresource = upload.subresources[copy.subresource];
+
+		TextureUploadPlanner::WriteSubresource(arena, copy, static_cast<const uint8_t*>(subresource.pData), subresource.RowPitch, subresource.SlicePitch);
+
+		D3D12_TEXTURE_COPY_LOCATION source{};
+		source.pResource = m_textureUploadBuffer.Get();
+		source.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+		source.PlacedFootprint.Offset = copy.offset;
+		source.PlacedFootprint.Footprint.Format = upload.texture->GetDesc().Format;
+		source.PlacedFootprint.Footprint.Width = copy.width;
+		source.PlacedFootprint.Footprint.Height = copy.height;
+		source.PlacedFootprint.Footprint.Depth = copy.depth;
+		source.PlacedFootprint.Footprint.RowPitch = copy.rowPitch;
+
+		// Block-compressed footprints must cover whole blocks
+		if (IsBlockCompressed(m_textureUploadPlanner.GetTexture(copy.texture).format))
+		{
+			source.PlacedFootprint.Footprint.Width = ROUND_UP(copy.width, 4);
+			source.PlacedFootprint.Footprint.Height = ROUND_UP(copy.height, 4);
+		}
+
+		D3D12_TEXTURE_COPY_LOCATION destination{};
+		destination.pResource = upload.texture.Get();
+		destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+		destination.SubresourceIndex = copy.subresource;
+
+		m_commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+	}
+
+	if (m_textureUploadBuffer)
+	{
+		m_textureUploadBuffer->Unmap(0, nullptr);
+	}
+
+	std::vector<D3D12_RESOURCE_BARRIER> barriers;
+
+	for (const auto& upload : m_pendingTextureUploads)
+	{
+		barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(
+			upload.texture.Get(),
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+	}
+
+	m_commandList->ResourceBarrier(static_cast<uint32_t>(barriers.size()), barriers.data());
 
     ThrowIfFailed(m_commandList->Close());
 
@@ -1951,7 +2385,314 @@ uint64_t D3D12HelloRaytracing::loadDDSTexture(const std::wstring& path, ComPtr<I
 
     WaitForPreviousFrame();
 
-    return textureUploadBufferSize;
+	// The copies are complete, the staging memory and the CPU copies can go
+	m_textureUploadBuffer.Reset();
+	m_pendingTextureUploads.clear();
+	m_textureUploadPlanner.Reset();
+}
+
+//-----------------------------------------------------------------------------
+//
+// Load the texture arrays listed in a remap table written by "AssetTools pack", and
+// look up the slice used by the model
+//
+void D3D12HelloRaytracing::loadModelTextureArrays(const std::string& remapTablePath)
+{
+	m_modelTextureRemap.Load(remapTablePath);
+
+	if (m_modelTextureRemap.arrays.size() > MaxModelTextureArrays)
+	{
+		throw std::logic_error("Too many model texture arrays, Hit.hlsl binds at most 4");
+	}
+
+	const std::string directory = remapTablePath.substr(0, remapTablePath.find_last_of("/\\") + 1);
+
+	TextureStreamer::Settings streamerSettings;
+	streamerSettings.budgetBytes = static_cast<uint64_t>(m_textureBudgetMB) * 1024 * 1024;
+	m_textureStreamer = std::make_unique<TextureStreamer>(streamerSettings);
+
+	m_modelTextureArrays.resize(m_modelTextureRemap.arrays.size());
+	m_modelTextureArrayHandles.resize(m_modelTextureRemap.arrays.size());
+	m_modelTextureArrayStreams.resize(m_modelTextureRemap.arrays.size());
+
+	// Only the mip tails are loaded here, UpdateTextureStreaming brings in the rest
+	for (size_t i = 0; i < m_modelTextureRemap.arrays.size(); i++)
+	{
+		const std::string path = directory + m_modelTextureRemap.arrays[i];
+
+		bool created = false;
+		const uint32_t handle = m_textureCache.Acquire(path, created);
+		m_modelTextureArrayHandles[i] = handle;
+
+		// An array with the content of an earlier one streams through the same texture
+		const auto shared = std::find(m_modelTextureArrayHandles.begin(), m_modelTextureArrayHandles.begin() + i, handle);
+
+		if (!created && shared != m_modelTextureArrayHandles.begin() + i)
+		{
+			const size_t original = shared - m_modelTextureArrayHandles.begin();
+			m_modelTextureArrayStreams[i] = m_modelTextureArrayStreams[original];
+			m_modelTextureArrays[i] = m_modelTextureArrays[original];
+			continue;
+		}
+
+		TextureResidencyChange tail = m_textureStreamer->AddTexture(path);
+		const DDSFile& info = m_textureStreamer->GetTextureInfo(tail.texture);
+
+		m_modelTextureArrayStreams[i] = tail.texture;
+		m_modelTextureArrays[i] = createStreamedTexture(info, tail.topMip);
+		queueStreamedMips(m_modelTextureArrays[i], info, std::move(tail));
+
+		// Content already loaded whole by queueDDSTexture keeps that resource in the cache
+		if (created)
+		{
+			m_cachedTextures.resize(m_textureCache.GetHandleCount());
+			m_cachedTextures[handle] = m_modelTextureArrays[i];
+		}
+	}
+
+	const TextureRemapEntry* entry = m_modelTextureRemap.Find("bricks1.dds");
+
+	if (entry == nullptr)
+	{
+		throw std::logic_error("bricks1.dds is missing from " + remapTablePath);
+	}
+
+	m_modelTexture = *entry;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Create a texture holding the mips [topMip, mipLevels) of a streamed DDS file, in the
+// COPY_DEST state. With topMip 0 this creates the full texture.
+//
+ComPtr<ID3D12Resource> D3D12HelloRaytracing::createStreamedTexture(const DDSFile& info, uint32_t topMip)
+{
+	const DDSSubresource& top = info.GetSubresource(topMip);
+
+	auto textureDesc = CD3DX12_RESOURCE_DESC::Tex2D(
+		static_cast<DXGI_FORMAT>(info.format),
+		top.width,
+		top.height,
+		static_cast<UINT16>(info.arraySize),
+		static_cast<UINT16>(info.mipLevels - topMip));
+
+	ComPtr<ID3D12Resource> texture;
+
+	ThrowIfFailed(m_device->CreateCommittedResource(
+		&nv_helpers_dx12::kDefaultHeapProps,
+		D3D12_HEAP_FLAG_NONE,
+		&textureDesc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(&texture)));
+
+	return texture;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Queue the mips read by the streamer for the next flushTextureUploads. The texture
+// starts at change.topMip, so the loaded mips are its first ones.
+//
+void D3D12HelloRaytracing::queueStreamedMips(ComPtr<ID3D12Resource>& texture, const DDSFile& info, TextureResidencyChange&& change)
+{
+	const uint32_t resourceMips = info.mipLevels - change.topMip;
+	const uint32_t loadedMips = change.data.empty() ? 0 : change.previousTopMip - change.topMip;
+	const DDSSubresource& top = info.GetSubresource(change.topMip);
+
+	PendingTextureUpload upload;
+	upload.texture = texture;
+	upload.streamedData = std::move(change.data);
+	upload.subresources.resize(info.arraySize * resourceMips);
+
+	for (uint32_t slice = 0; slice < info.arraySize; slice++)
+	{
+		for (uint32_t mip = 0; mip < loadedMips; mip++)
+		{
+			const DDSSubresource& source = change.subresources[mip + slice * loadedMips];
+			D3D12_SUBRESOURCE_DATA& destination = upload.subresources[mip + slice * resourceMips];
+
+			destination.pData = upload.streamedData.data() + source.offset;
+			destination.RowPitch = static_cast<LONG_PTR>(source.rowPitch);
+			destination.SlicePitch = static_cast<LONG_PTR>(source.slicePitch);
+		}
+	}
+
+	TextureUploadDesc uploadDesc;
+	uploadDesc.format = info.format;
+	uploadDesc.width = top.width;
+	uploadDesc.height = top.height;
+	uploadDesc.arraySize = info.arraySize;
+	uploadDesc.mipLevels = resourceMips;
+
+	m_textureUploadPlanner.AddTexture(uploadDesc, 0, loadedMips);
+	m_pendingTextureUploads.push_back(std::move(upload));
+}
+
+//-----------------------------------------------------------------------------
+//
+// Replace a model texture array by one with the new mip range. The mips both textures
+// have are copied on the GPU, newly loaded mips are queued for upload.
+//
+void D3D12HelloRaytracing::applyResidencyChange(TextureResidencyChange&& change, std::vector<ComPtr<ID3D12Resource>>& retiredTextures)
+{
+	const DDSFile& info = m_textureStreamer->GetTextureInfo(change.texture);
+	const size_t arrayIndex = std::find(m_modelTextureArrayStreams.begin(), m_modelTextureArrayStreams.end(), change.texture) - m_modelTextureArrayStreams.begin();
+	ComPtr<ID3D12Resource>& texture = m_modelTextureArrays[arrayIndex];
+
+	ComPtr<ID3D12Resource> previous = texture;
+	texture = createStreamedTexture(info, change.topMip);
+
+	// The arrays sharing this stream, and the cache, now refer to the new texture
+	for (size_t i = arrayIndex + 1; i < m_modelTextureArrays.size(); i++)
+	{
+		if (m_modelTextureArrayStreams[i] == change.texture)
+		{
+			m_modelTextureArrays[i] = texture;
+		}
+	}
+
+	const uint32_t handle = m_modelTextureArrayHandles[arrayIndex];
+
+	if (m_cachedTextures[handle] == previous)
+	{
+		m_cachedTextures[handle] = texture;
+	}
+
+	m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
+		previous.Get(),
+		D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE,
+		D3D12_RESOURCE_STATE_COPY_SOURCE));
+
+	const uint32_t firstSharedMip = (std::max)(change.topMip, change.previousTopMip);
+	const uint32_t previousMips = info.mipLevels - change.previousTopMip;
+	const uint32_t newMips = info.mipLevels - change.topMip;
+
+	for (uint32_t slice = 0; slice < info.arraySize; slice++)
+	{
+		for (uint32_t mip = firstSharedMip; mip < info.mipLevels; mip++)
+		{
+			CD3DX12_TEXTURE_COPY_LOCATION destination(texture.Get(), (mip - change.topMip) + slice * newMips);
+			CD3DX12_TEXTURE_COPY_LOCATION source(previous.Get(), (mip - change.previousTopMip) + slice * previousMips);
+
+			m_commandList->CopyTextureRegion(&destination, 0, 0, 0, &source, nullptr);
+		}
+	}
+
+	// Keep the old texture alive until the copies have executed
+	retiredTextures.push_back(previous);
+
+	queueStreamedMips(texture, info, std::move(change));
+}
+
+//-----------------------------------------------------------------------------
+//
+// Report where the model textures are used, and apply the residency changes decided by
+// the streamer
+//
+void D3D12HelloRaytracing::UpdateTextureStreaming()
+{
+	if (!m_textureStreamer)
+	{
+		return;
+	}
+
+	TextureStreamingView view;
+	XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(view.cameraPosition), m_eye);
+	view.verticalFov = 45.0f * XM_PI / 180.0f;
+	view.screenHeight = GetHeight();
+
+	m_textureStreamer->BeginFrame(view);
+
+	// Every textured instance reports the array it samples, so each array streams in
+	// for the instances that use it
+	for (size_t i = 0; i < m_instances.size(); i++)
+	{
+		if (!std::get<2>(m_instances[i]))
+		{
+			continue;
+		}
+
+		const XMMATRIX& transform = std::get<1>(m_instances[i]);
+
+		XMFLOAT3 center;
+		XMStoreFloat3(&center, transform.r[3]);
+		const float scale = XMVectorGetX(XMVector3Length(transform.r[0]));
+
+		// Hit.hlsl repeats the model texture twice across the texture coordinates
+		m_textureStreamer->AddUsage(m_modelTextureArrayStreams[m_instanceTextures[i].arrayIndex], &center.x, m_modelBoundingRadius * scale, 2.0f);
+	}
+
+	m_textureStreamer->Update();
+
+	std::vector<TextureResidencyChange> changes = m_textureStreamer->TakeResidencyChanges();
+
+	if (changes.empty())
+	{
+		return;
+	}
+
+	ThrowIfFailed(m_commandList->Reset(m_commandAllocator.Get(), m_pipelineState.Get()));
+
+	std::vector<ComPtr<ID3D12Resource>> retiredTextures;
+	std::vector<uint32_t> changedTextures;
+
+	for (auto& change : changes)
+	{
+		changedTextures.push_back(change.texture);
+		applyResidencyChange(std::move(change), retiredTextures);
+	}
+
+	flushTextureUploads();
+	ThrowIfFailed(m_commandList->Close());
+
+	for (uint32_t i = 0; i < m_modelTextureArrays.size(); i++)
+	{
+		if (std::find(changedTextures.begin(), changedTextures.end(), m_modelTextureArrayStreams[i]) != changedTextures.end())
+		{
+			createModelTextureArrayView(i);
+		}
+	}
+
+	// Residency changes with every camera move, so only report the budget becoming too
+	// small for the desired mips, once each time it happens
+	const TextureStreamerStats stats = m_textureStreamer->GetStats();
+	const bool overBudget = stats.desiredBytes > stats.budgetBytes;
+
+	if (overBudget && !m_textureStreamingOverBudget)
+	{
+		char message[256];
+		sprintf_s(message, "Texture streaming: over budget, %.1f MB desired, %.1f MB budget, %u/%u textures at desired mip\n",
+			stats.desiredBytes / (1024.0f * 1024.0f), stats.budgetBytes / (1024.0f * 1024.0f), stats.texturesAtDesiredMip, stats.textureCount);
+		OutputDebugStringA(message);
+	}
+
+	m_textureStreamingOverBudget = overBudget;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Write the SRV of a model texture array to its slot (4 + index) in the heap, or a null
+// descriptor if there is no array at this index
+//
+void D3D12HelloRaytracing::createModelTextureArrayView(uint32_t index)
+{
+	CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle(m_srvUavHeap->GetCPUDescriptorHandleForHeapStart(), 4 + index, m_SRVCBVUAVDescriptorHandleIncrementSize);
+
+	if (index < m_modelTextureArrays.size())
+	{
+		D3D12_RESOURCE_DESC textureDesc = m_modelTextureArrays[index]->GetDesc();
+
+		auto shaderResourceViewDesc = CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION_TEXTURE2DARRAY, textureDesc.Format, textureDesc.MipLevels, textureDesc.DepthOrArraySize);
+
+		m_device->CreateShaderResourceView(m_modelTextureArrays[index].Get(), &shaderResourceViewDesc, srvHandle);
+	}
+	else
+	{
+		auto shaderResourceViewDesc = CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION_TEXTURE2DARRAY, DXGI_FORMAT_R8G8B8A8_UNORM, 1);
+
+		m_device->CreateShaderResourceView(nullptr, &shaderResourceViewDesc, srvHandle);
+	}
 }
 
 void D3D12HelloRaytracing::createSkyboxSamplerDescriptorHeap()
@@ -1997,7 +2738,7 @@ void D3D12HelloRaytracing::createSkyboxSampler()
 	m_device->CreateSampler(&skyboxSamplerDesc, skyboxSamplerDescriptorHandle);
 }
 
-D3D12_SHADER_RESOURCE_VIEW_DESC D3D12HelloRaytracing::CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION ViewDimension, DXGI_FORMAT format, uint32_t mipLevels)
+D3D12_SHADER_RESOURCE_VIEW_DESC D3D12HelloRaytracing::CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION ViewDimension, DXGI_FORMAT format, uint32_t mipLevels, uint32_t arraySize)
 {
 	D3D12_SHADER_RESOURCE_VIEW_DESC shaderResourceViewDesc{};
     shaderResourceViewDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
@@ -2009,6 +2750,11 @@ D3D12_SHADER_RESOURCE_VIEW_DESC D3D12HelloRaytracing::CreateShaderResourceViewDe
 	{
         shaderResourceViewDesc.TextureCube.MipLevels = mipLevels;
 	}
+	else if (shaderResourceViewDesc.ViewDimension == D3D12_SRV_DIMENSION_TEXTURE2DARRAY)
+	{
+		shaderResourceViewDesc.Texture2DArray.MipLevels = mipLevels;
+		shaderResourceViewDesc.Texture2DArray.ArraySize = arraySize;
+	}
 	else
 	{
         shaderResourceViewDesc.Texture2D.MipLevels = mipLevels;
@@ -2128,6 +2874,17 @@ void D3D12HelloRaytracing::CreateGlobalRootSignature()
 		1 /*2nd slot of the table*/},
 	});
 
+	// cbuffer EnvironmentLighting, the diffuse ambient of Hit.hlsl
+	rootSignatureGenerator.AddRootParameter(D3D12_ROOT_PARAMETER_TYPE_CBV, 0 /*b0*/, 1 /*space1*/);
+
+	// TextureCube environmentTexture, the skybox whose prefiltered mips give the glossy
+	// reflections of Hit.hlsl
+	rootSignatureGenerator.AddHeapRangesParameter({
+	{
+		4 /*t4*/, 1, 1, D3D12_DESCRIPTOR_RANGE_TYPE_SRV,
+		0 /*1st slot of the table*/},
+	});
+
 	m_globalRootSignature = rootSignatureGenerator.Generate(m_device.Get(), false);
 
 	CD3DX12_ROOT_PARAMETER constantParameters[5]{};
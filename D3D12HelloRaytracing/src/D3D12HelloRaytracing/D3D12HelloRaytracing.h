@@ -15,10 +15,25 @@
 
 #include <dxcapi.h>
 #include <vector>
+#include "nv_helpers_dx12/BottomLevelASGenerator.h"
 #include "nv_helpers_dx12/TopLevelASGenerator.h"
 #include "nv_helpers_dx12/ShaderBindingTableGenerator.h"
 
+#include "ASBufferPool.h"
+#include "Bvh.h"
+#include "BvhCache.h"
+#include "DirtyInstanceDescWriter.h"
+#include "DirtyInstanceSet.h"
 #include "Model.h"
+#include "SceneBvh.h"
+#include "CompressedTexture.h"
+#include "SphericalHarmonics.h"
+#include "TextureArrayPacker.h"
+#include "TextureCache.h"
+#include "TextureUploadPlanner.h"
+#include "TextureStreamer.h"
+
+#include <memory>
 
 using namespace DirectX;
 
@@ -48,7 +63,10 @@ struct InstanceProperties
 {
     XMMATRIX objectToWorld;
     int hasTexture;
-    XMFLOAT3 padding;
+    // Texture2DArray register (modelTextures0..3 in Hit.hlsl) and slice of the texture
+    int textureArray;
+    int textureSlice;
+    float padding;
 };
 
 class D3D12HelloRaytracing : public DXSample
@@ -119,28 +137,26 @@ private:
         ComPtr<ID3D12Resource> instanceDesc;
     };
 
-	/// Create the acceleration structure of an instance
-    ///
-    /// \param vVertexBuffers : pair of buffer and vertex count
-    /// \return AccelerationStructureBuffers for TLAS
-    AccelerationStructureBuffers CreateBottomLevelAS(const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& vertexBuffers);
+    /// Add the vertex buffers, indexed where an index buffer is given, to a bottom level
+    void AddBottomLevelGeometry(nv_helpers_dx12::BottomLevelASGenerator& bottomLevelAS,
+                                const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& vertexBuffers,
+                                const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& indexBuffers = {});
 
-	/// Create the acceleration structure of an instance
-    ///
-    /// \param     vVertexBuffers : pair of buffer and vertex count
-    /// \return    AccelerationStructureBuffers for TLAS
-	AccelerationStructureBuffers CreateBottomLevelAS(
-		const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& vertexBuffers,
-		const std::vector<std::pair<ComPtr<ID3D12Resource>, uint32_t>>& indexBuffers);
+    /// Scratch memory the bottom-level builds of CreateAccelerationStructures may use at once
+    static const uint64_t BottomLevelScratchBudget = 64 * 1024 * 1024;
 
 	/// Create the main acceleration structure that holds
     /// all instances of the scene
     /// \param instances : pair of BLAS and transform
-    void CreateTopLevelAS(const std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, bool>>& instances);
+    void CreateTopLevelAS(const std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, bool, uint64_t>>& instances);
 
     /// Create all acceleration structures, bottom and top
     void CreateAccelerationStructures();
 
+    /// Save the device's prebuild sizes for a sweep of sizes and flags as an
+    /// ASMemoryEstimator table
+    void RecordASSizes(const std::string& path);
+
     ComPtr<ID3D12RootSignature> CreateRayGenRootSignature();
     ComPtr<ID3D12RootSignature> CreateMissRootSignature();
     ComPtr<ID3D12RootSignature> CreateHitRootSignature();
@@ -150,11 +166,32 @@ private:
 	void CreateShaderResourceHeap();
 	void CreateShaderBindingTable();
 
-    // Storage for the bottom level AS
-    ComPtr<ID3D12Resource> m_bottomLevelAS;
+    // Storage for the bottom level AS, suballocated from a few large buffers
+    ASBufferPool m_bottomLevelASPool{ ASMemoryPool::Settings() };
     nv_helpers_dx12::TopLevelASGenerator m_topLevelASGenerator;
+    DirtyInstanceDescWriter m_instanceDescWriter;
     AccelerationStructureBuffers m_topLevelASBuffers;
-    std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, bool>> m_instances;
+    // Buffer of the bottom level, transform, textured, offset of the bottom level in its buffer
+    std::vector<std::tuple<ComPtr<ID3D12Resource>, DirectX::XMMATRIX, bool, uint64_t>> m_instances;
+
+    // 'I' spins the three triangle instances in the ray tracer. Their transforms change
+    // in m_instances, which m_topLevelASGenerator reads by reference once they are marked
+    // in m_instanceDescWriter, and in a CPU mirror of the top level whose Update decides whether the next
+    // Generate refits the TLAS in place (updateOnly) or rebuilds it
+    void CreateSceneBvh();
+    void UpdateInstanceAnimation();
+    bool m_animateInstances = false;
+    float m_animationTime = 0.0f;
+    std::vector<Vertex> m_triangleVertices;
+    std::vector<Vertex> m_planeVertices;
+    Bvh m_triangleBvh;
+    Bvh m_planeBvh;
+    BvhCache m_bvhCache{ "BvhCache" };
+    // Mapped from a file of m_bvhCache
+    BvhView m_modelBvh;
+    SceneBvh m_sceneBvh;
+    // Strongest update since the TLAS was last generated; rebuilds win over refits
+    SceneBvh::UpdateKind m_pendingTopLevelUpdate = SceneBvh::UpdateKind::None;
 
     ComPtr<IDxcBlob> m_rayGenLibrary;
 	ComPtr<IDxcBlob> m_hitLibrary;
@@ -233,24 +270,71 @@ private:
 	void UpdateInstancePropertiesBuffer();
     ComPtr<ID3D12Resource> m_instanceProperties;
 	InstanceProperties* m_instancePropertiesBufferData;
+	// Instances whose InstanceProperties are out of date in the mapped buffer
+	DirtyInstanceSet m_dirtyInstanceProperties;
 
 	// #DXR Extra - Another ray type
 	ComPtr<IDxcBlob> m_shadowLibrary;
 	ComPtr<ID3D12RootSignature> m_shadowRootSignature;
 
-    uint64_t loadDDSTexture(const std::wstring& path, ComPtr<ID3D12Resource>& texture);
+    // Textures are created immediately but their data is only copied by
+    // flushTextureUploads, which records all pending copies from one staging buffer and
+    // submits them at once
+    struct PendingTextureUpload
+    {
+        ComPtr<ID3D12Resource> texture;
+        std::unique_ptr<uint8_t[]> ddsData;
+        std::vector<uint8_t> streamedData;
+        std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+    };
+    uint32_t queueDDSTexture(const std::wstring& path, ComPtr<ID3D12Resource>& texture);
+    void flushTextureUploads();
+    // DDS files are deduplicated by content: m_cachedTextures holds the resource of each
+    // TextureCache handle, and the content hashes persist in the index between runs.
+    // Every handle is released with releaseCachedTexture when its user goes away.
+    TextureCache m_textureCache;
+    std::vector<ComPtr<ID3D12Resource>> m_cachedTextures;
+    void releaseCachedTexture(uint32_t handle);
+    TextureUploadPlanner m_textureUploadPlanner;
+    std::vector<PendingTextureUpload> m_pendingTextureUploads;
     void createSkyboxSamplerDescriptorHeap();
     void createSkyboxSampler();
-	ComPtr<ID3D12Heap> m_textureUploadHeap;
-	ComPtr<ID3D12Resource> m_ModelTexture1;
-	ComPtr<ID3D12Resource> m_ModelTexture2;
-	ComPtr<ID3D12Resource> m_ModelTexture3;
-	ComPtr<ID3D12Resource> m_ModelTexture4;
+	// Model textures are packed offline by AssetTools into one Texture2DArray per format
+	// and size, see TextureArrayPacker. At most MaxModelTextureArrays arrays can be bound.
+	static const uint32_t MaxModelTextureArrays = 4;
+	void loadModelTextureArrays(const std::string& remapTablePath);
+	std::vector<ComPtr<ID3D12Resource>> m_modelTextureArrays;
+	// TextureCache handle and streamer texture of each array; arrays with the same
+	// content share both, and their resource
+	std::vector<uint32_t> m_modelTextureArrayHandles;
+	std::vector<uint32_t> m_modelTextureArrayStreams;
+	TextureRemapTable m_modelTextureRemap;
+	TextureRemapEntry m_modelTexture;
+	// Array and slice sampled by each entry of m_instances that has a texture
+	std::vector<TextureRemapEntry> m_instanceTextures;
+
+	// The model texture arrays are streamed: only their mip tail is loaded at startup,
+	// UpdateTextureStreaming recreates them with more or fewer mips as the streamer
+	// decides, and rewrites their SRVs
+	void UpdateTextureStreaming();
+	ComPtr<ID3D12Resource> createStreamedTexture(const DDSFile& info, uint32_t topMip);
+	void queueStreamedMips(ComPtr<ID3D12Resource>& texture, const DDSFile& info, TextureResidencyChange&& change);
+	void applyResidencyChange(TextureResidencyChange&& change, std::vector<ComPtr<ID3D12Resource>>& retiredTextures);
+	void createModelTextureArrayView(uint32_t index);
+	std::unique_ptr<TextureStreamer> m_textureStreamer;
+	bool m_textureStreamingOverBudget = false;
+	float m_modelBoundingRadius = 1.0f;
 	ComPtr<ID3D12Resource> m_skyboxTexture;
+	uint32_t m_skyboxTextureHandle = TextureCache::InvalidHandle;
+	// Diffuse ambient of ModelClosestHit: the L2 spherical harmonics of the skybox, bound as
+	// cbuffer EnvironmentLighting (b0, space1) of the global root signature, which also
+	// says whether the skybox is GGX-prefiltered for the glossy reflection
+	void createEnvironmentLighting(const std::wstring& skyboxPath, bool prefiltered);
+	ComPtr<ID3D12Resource> m_environmentLightingBuffer;
 	ComPtr<ID3D12Resource> m_textureUploadBuffer;
 	ComPtr<ID3D12DescriptorHeap> m_skyboxSamplerDescriptorHeap;
 
-    D3D12_SHADER_RESOURCE_VIEW_DESC CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION ViewDimension, DXGI_FORMAT format, uint32_t mipLevels);
+    D3D12_SHADER_RESOURCE_VIEW_DESC CreateShaderResourceViewDesc(D3D12_SRV_DIMENSION ViewDimension, DXGI_FORMAT format, uint32_t mipLevels, uint32_t arraySize = 1);
 
 	void CreateSkyboxGraphicsPipelineState();
 	D3D12_VERTEX_BUFFER_VIEW m_skyboxVertexBufferView{};
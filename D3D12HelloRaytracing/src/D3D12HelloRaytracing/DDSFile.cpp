@@ -0,0 +1,547 @@
+#include "DDSFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace
+{
+    // The DDS structures below mirror the ones of DDSTextureLoader12.cpp, which are not
+    // exposed by its header.
+#pragma pack(push, 1)
+    struct DDSPixelFormat
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t fourCC;
+        uint32_t RGBBitCount;
+        uint32_t RBitMask;
+        uint32_t GBitMask;
+        uint32_t BBitMask;
+        uint32_t ABitMask;
+    };
+
+    struct DDSHeader
+    {
+        uint32_t size;
+        uint32_t flags;
+        uint32_t height;
+        uint32_t width;
+        uint32_t pitchOrLinearSize;
+        uint32_t depth;
+        uint32_t mipMapCount;
+        uint32_t reserved1[11];
+        DDSPixelFormat ddspf;
+        uint32_t caps;
+        uint32_t caps2;
+        uint32_t caps3;
+        uint32_t caps4;
+        uint32_t reserved2;
+    };
+
+    struct DDSHeaderDXT10
+    {
+        uint32_t dxgiFormat;
+        uint32_t resourceDimension;
+        uint32_t miscFlag;
+        uint32_t arraySize;
+        uint32_t miscFlags2;
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(DDSHeader) == 124, "DDS Header size mismatch");
+    static_assert(sizeof(DDSHeaderDXT10) == 20, "DDS DX10 Extended Header size mismatch");
+
+    constexpr uint32_t MakeFourCC(char a, char b, char c, char d)
+    {
+        return static_cast<uint32_t>(static_cast<uint8_t>(a)) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(b)) << 8) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(c)) << 16) |
+               (static_cast<uint32_t>(static_cast<uint8_t>(d)) << 24);
+    }
+
+    constexpr uint32_t kDDSMagic = 0x20534444; // "DDS "
+
+    constexpr uint32_t kDDSFourCC = 0x00000004;
+    constexpr uint32_t kDDSRGB = 0x00000040;
+
+    constexpr uint32_t kDDSHeaderFlagsTexture = 0x00001007; // DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT
+    constexpr uint32_t kDDSHeaderFlagsMipmap = 0x00020000;  // DDSD_MIPMAPCOUNT
+    constexpr uint32_t kDDSHeaderFlagsPitch = 0x00000008;   // DDSD_PITCH
+    constexpr uint32_t kDDSHeaderFlagsLinearSize = 0x00080000; // DDSD_LINEARSIZE
+
+    constexpr uint32_t kDDSSurfaceFlagsTexture = 0x00001000; // DDSCAPS_TEXTURE
+    constexpr uint32_t kDDSSurfaceFlagsMipmap = 0x00400008;  // DDSCAPS_COMPLEX | DDSCAPS_MIPMAP
+    constexpr uint32_t kDDSSurfaceFlagsCubemap = 0x00000008; // DDSCAPS_COMPLEX
+
+    constexpr uint32_t kDDSCubemap = 0x00000200;
+    constexpr uint32_t kDDSCubemapAllFaces = 0x0000FE00;
+    constexpr uint32_t kDDSHeaderFlagsVolume = 0x00800000;
+
+    constexpr uint32_t kResourceDimensionTexture2D = 3;
+    constexpr uint32_t kResourceMiscTextureCube = 0x4;
+
+    // D3DFMT values that legacy headers store in the FourCC field
+    constexpr uint32_t kD3DFmtA16B16G16R16F = 113;
+    constexpr uint32_t kD3DFmtA32B32G32R32F = 116;
+
+    TextureFormat GetFormatFromLegacyHeader(const DDSPixelFormat& ddpf)
+    {
+        if (ddpf.flags & kDDSRGB)
+        {
+            if (ddpf.RGBBitCount == 32)
+            {
+                if (ddpf.RBitMask == 0x000000ff && ddpf.GBitMask == 0x0000ff00 && ddpf.BBitMask == 0x00ff0000)
+                {
+                    return TextureFormat::R8G8B8A8_UNorm;
+                }
+
+                if (ddpf.RBitMask == 0x00ff0000 && ddpf.GBitMask == 0x0000ff00 && ddpf.BBitMask == 0x000000ff)
+                {
+                    return TextureFormat::B8G8R8A8_UNorm;
+                }
+            }
+
+            return TextureFormat::Unknown;
+        }
+
+        if (ddpf.flags & kDDSFourCC)
+        {
+            switch (ddpf.fourCC)
+            {
+            case MakeFourCC('D', 'X', 'T', '1'): return TextureFormat::BC1_UNorm;
+            case MakeFourCC('D', 'X', 'T', '2'):
+            case MakeFourCC('D', 'X', 'T', '3'): return TextureFormat::BC2_UNorm;
+            case MakeFourCC('D', 'X', 'T', '4'):
+            case MakeFourCC('D', 'X', 'T', '5'): return TextureFormat::BC3_UNorm;
+            case MakeFourCC('A', 'T', 'I', '1'):
+            case MakeFourCC('B', 'C', '4', 'U'): return TextureFormat::BC4_UNorm;
+            case MakeFourCC('B', 'C', '4', 'S'): return TextureFormat::BC4_SNorm;
+            case MakeFourCC('A', 'T', 'I', '2'):
+            case MakeFourCC('B', 'C', '5', 'U'): return TextureFormat::BC5_UNorm;
+            case MakeFourCC('B', 'C', '5', 'S'): return TextureFormat::BC5_SNorm;
+            case kD3DFmtA16B16G16R16F: return TextureFormat::R16G16B16A16_Float;
+            case kD3DFmtA32B32G32R32F: return TextureFormat::R32G32B32A32_Float;
+            default: break;
+            }
+        }
+
+        return TextureFormat::Unknown;
+    }
+}
+
+const char* GetTextureFormatName(TextureFormat format)
+{
+    switch (format)
+    {
+    case TextureFormat::R32G32B32A32_Float: return "R32G32B32A32_FLOAT";
+    case TextureFormat::R16G16B16A16_Float: return "R16G16B16A16_FLOAT";
+    case TextureFormat::R8G8B8A8_UNorm: return "R8G8B8A8_UNORM";
+    case TextureFormat::R8G8B8A8_UNorm_sRGB: return "R8G8B8A8_UNORM_SRGB";
+    case TextureFormat::BC1_UNorm: return "BC1_UNORM";
+    case TextureFormat::BC1_UNorm_sRGB: return "BC1_UNORM_SRGB";
+    case TextureFormat::BC2_UNorm: return "BC2_UNORM";
+    case TextureFormat::BC2_UNorm_sRGB: return "BC2_UNORM_SRGB";
+    case TextureFormat::BC3_UNorm: return "BC3_UNORM";
+    case TextureFormat::BC3_UNorm_sRGB: return "BC3_UNORM_SRGB";
+    case TextureFormat::BC4_UNorm: return "BC4_UNORM";
+    case TextureFormat::BC4_SNorm: return "BC4_SNORM";
+    case TextureFormat::BC5_UNorm: return "BC5_UNORM";
+    case TextureFormat::BC5_SNorm: return "BC5_SNORM";
+    case TextureFormat::B8G8R8A8_UNorm: return "B8G8R8A8_UNORM";
+    case TextureFormat::B8G8R8A8_UNorm_sRGB: return "B8G8R8A8_UNORM_SRGB";
+    case TextureFormat::BC6H_UF16: return "BC6H_UF16";
+    case TextureFormat::BC6H_SF16: return "BC6H_SF16";
+    case TextureFormat::BC7_UNorm: return "BC7_UNORM";
+    case TextureFormat::BC7_UNorm_sRGB: return "BC7_UNORM_SRGB";
+    default: return "?";
+    }
+}
+
+bool IsKnownTextureFormat(TextureFormat format)
+{
+    return GetTextureFormatName(format)[0] != '?';
+}
+
+bool IsBlockCompressed(TextureFormat format)
+{
+    const auto value = static_cast<uint32_t>(format);
+    return (value >= static_cast<uint32_t>(TextureFormat::BC1_UNorm) && value <= static_cast<uint32_t>(TextureFormat::BC5_SNorm)) ||
+           (value >= static_cast<uint32_t>(TextureFormat::BC6H_UF16) && value <= static_cast<uint32_t>(TextureFormat::BC7_UNorm_sRGB));
+}
+
+bool IsUncompressed8BitRGBA(TextureFormat format)
+{
+    return format == TextureFormat::R8G8B8A8_UNorm || format == TextureFormat::R8G8B8A8_UNorm_sRGB ||
+           format == TextureFormat::B8G8R8A8_UNorm || format == TextureFormat::B8G8R8A8_UNorm_sRGB;
+}
+
+uint32_t GetBytesPerBlock(TextureFormat format)
+{
+    switch (format)
+    {
+    case TextureFormat::BC1_UNorm:
+    case TextureFormat::BC1_UNorm_sRGB:
+    case TextureFormat::BC4_UNorm:
+    case TextureFormat::BC4_SNorm:
+        return 8;
+
+    case TextureFormat::BC2_UNorm:
+    case TextureFormat::BC2_UNorm_sRGB:
+    case TextureFormat::BC3_UNorm:
+    case TextureFormat::BC3_UNorm_sRGB:
+    case TextureFormat::BC5_UNorm:
+    case TextureFormat::BC5_SNorm:
+    case TextureFormat::BC6H_UF16:
+    case TextureFormat::BC6H_SF16:
+    case TextureFormat::BC7_UNorm:
+    case TextureFormat::BC7_UNorm_sRGB:
+    case TextureFormat::R32G32B32A32_Float:
+        return 16;
+
+    case TextureFormat::R16G16B16A16_Float:
+        return 8;
+
+    case TextureFormat::R8G8B8A8_UNorm:
+    case TextureFormat::R8G8B8A8_UNorm_sRGB:
+    case TextureFormat::B8G8R8A8_UNorm:
+    case TextureFormat::B8G8R8A8_UNorm_sRGB:
+        return 4;
+
+    default:
+        throw std::runtime_error("Unsupported texture format");
+    }
+}
+
+void GetSurfaceInfo(TextureFormat format, uint32_t width, uint32_t height,
+                    size_t* rowBytes, uint32_t* numRows, size_t* numBytes)
+{
+    size_t rowSize = 0;
+    uint32_t rowCount = 0;
+
+    if (IsBlockCompressed(format))
+    {
+        const size_t blocksWide = width > 0 ? std::max<size_t>(1, (static_cast<size_t>(width) + 3) / 4) : 0;
+        const uint32_t blocksHigh = height > 0 ? std::max<uint32_t>(1, (height + 3) / 4) : 0;
+        rowSize = blocksWide * GetBytesPerBlock(format);
+        rowCount = blocksHigh;
+    }
+    else
+    {
+        rowSize = static_cast<size_t>(width) * GetBytesPerBlock(format);
+        rowCount = height;
+    }
+
+    if (rowBytes)
+    {
+        *rowBytes = rowSize;
+    }
+
+    if (numRows)
+    {
+        *numRows = rowCount;
+    }
+
+    if (numBytes)
+    {
+        *numBytes = rowSize * rowCount;
+    }
+}
+
+uint32_t CountMips(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+
+    while (width > 1 || height > 1)
+    {
+        width = std::max(1u, width >> 1);
+        height = std::max(1u, height >> 1);
+        count++;
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Read the whole file and hand it to the memory parser
+//
+void DDSFile::Load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot open DDS file " + path);
+    }
+
+    const auto size = static_cast<size_t>(file.tellg());
+    std::vector<uint8_t> bytes(size);
+
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(size));
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot read DDS file " + path);
+    }
+
+    LoadFromMemory(bytes.data(), bytes.size());
+}
+
+size_t DDSFile::ParseHeader(const uint8_t* bytes, size_t size)
+{
+    if (size < sizeof(uint32_t) + sizeof(DDSHeader))
+    {
+        throw std::runtime_error("DDS file is too small");
+    }
+
+    uint32_t magic = 0;
+    memcpy(&magic, bytes, sizeof(magic));
+
+    DDSHeader header;
+    memcpy(&header, bytes + sizeof(uint32_t), sizeof(header));
+
+    if (magic != kDDSMagic || header.size != sizeof(DDSHeader) || header.ddspf.size != sizeof(DDSPixelFormat))
+    {
+        throw std::runtime_error("Not a DDS file");
+    }
+
+    if (header.flags & kDDSHeaderFlagsVolume)
+    {
+        throw std::runtime_error("Volume DDS textures are not supported");
+    }
+
+    size_t offset = sizeof(uint32_t) + sizeof(DDSHeader);
+
+    uint32_t newArraySize = 1;
+    bool newIsCubeMap = false;
+    uint32_t newAlphaMode = 0;
+    TextureFormat newFormat = TextureFormat::Unknown;
+
+    if ((header.ddspf.flags & kDDSFourCC) && header.ddspf.fourCC == MakeFourCC('D', 'X', '1', '0'))
+    {
+        if (size < offset + sizeof(DDSHeaderDXT10))
+        {
+            throw std::runtime_error("DDS file is too small for its DX10 header");
+        }
+
+        DDSHeaderDXT10 extendedHeader;
+        memcpy(&extendedHeader, bytes + offset, sizeof(extendedHeader));
+        offset += sizeof(DDSHeaderDXT10);
+
+        if (extendedHeader.resourceDimension != kResourceDimensionTexture2D || !IsKnownTextureFormat(static_cast<TextureFormat>(extendedHeader.dxgiFormat)))
+        {
+            throw std::runtime_error("Unsupported DX10 DDS texture");
+        }
+
+        newFormat = static_cast<TextureFormat>(extendedHeader.dxgiFormat);
+        newArraySize = std::max(1u, extendedHeader.arraySize);
+        newAlphaMode = extendedHeader.miscFlags2 & 0x7;
+
+        if (extendedHeader.miscFlag & kResourceMiscTextureCube)
+        {
+            newIsCubeMap = true;
+            newArraySize *= 6;
+        }
+    }
+    else
+    {
+        newFormat = GetFormatFromLegacyHeader(header.ddspf);
+
+        if (header.caps2 & kDDSCubemap)
+        {
+            // Partial cube maps are not supported by D3D12 either
+            if ((header.caps2 & kDDSCubemapAllFaces) != kDDSCubemapAllFaces)
+            {
+                throw std::runtime_error("Partial cube maps are not supported");
+            }
+
+            newIsCubeMap = true;
+            newArraySize = 6;
+        }
+    }
+
+    if (newFormat == TextureFormat::Unknown)
+    {
+        throw std::runtime_error("Unsupported DDS pixel format");
+    }
+
+    format = newFormat;
+    width = header.width;
+    height = std::max(1u, header.height);
+    arraySize = newArraySize;
+    mipLevels = std::max(1u, header.mipMapCount);
+    isCubeMap = newIsCubeMap;
+    alphaMode = newAlphaMode;
+
+    ComputeLayout();
+
+    return offset;
+}
+
+void DDSFile::LoadFromMemory(const uint8_t* bytes, size_t size)
+{
+    payloadOffset = ParseHeader(bytes, size);
+
+    const size_t payloadSize = GetPayloadSize();
+
+    if (size - payloadOffset < payloadSize)
+    {
+        throw std::runtime_error("DDS file is truncated");
+    }
+
+    data.assign(bytes + payloadOffset, bytes + payloadOffset + payloadSize);
+}
+
+void DDSFile::LoadHeader(const std::string& path)
+{
+    // Magic, DDS_HEADER and DDS_HEADER_DXT10
+    uint8_t bytes[sizeof(uint32_t) + sizeof(DDSHeader) + sizeof(DDSHeaderDXT10)] = {};
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot open DDS file " + path);
+    }
+
+    file.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+
+    // Files without the DX10 header may be shorter than the buffer
+    payloadOffset = ParseHeader(bytes, static_cast<size_t>(file.gcount()));
+    data.clear();
+}
+
+//-----------------------------------------------------------------------------
+//
+// Always write a DX10 header: it is the only way to describe arrays and sRGB formats,
+// and DDSTextureLoader12 reads it natively
+//
+void DDSFile::Save(const std::string& path) const
+{
+    DDSHeader header = {};
+    header.size = sizeof(DDSHeader);
+    header.flags = kDDSHeaderFlagsTexture | kDDSHeaderFlagsMipmap;
+    header.height = height;
+    header.width = width;
+    header.mipMapCount = mipLevels;
+    header.ddspf.size = sizeof(DDSPixelFormat);
+    header.ddspf.flags = kDDSFourCC;
+    header.ddspf.fourCC = MakeFourCC('D', 'X', '1', '0');
+    header.caps = kDDSSurfaceFlagsTexture;
+
+    size_t rowBytes = 0;
+    size_t numBytes = 0;
+    GetSurfaceInfo(format, width, height, &rowBytes, nullptr, &numBytes);
+
+    if (IsBlockCompressed(format))
+    {
+        header.flags |= kDDSHeaderFlagsLinearSize;
+        header.pitchOrLinearSize = static_cast<uint32_t>(numBytes);
+    }
+    else
+    {
+        header.flags |= kDDSHeaderFlagsPitch;
+        header.pitchOrLinearSize = static_cast<uint32_t>(rowBytes);
+    }
+
+    if (mipLevels > 1)
+    {
+        header.caps |= kDDSSurfaceFlagsMipmap;
+    }
+
+    DDSHeaderDXT10 extendedHeader = {};
+    extendedHeader.dxgiFormat = static_cast<uint32_t>(format);
+    extendedHeader.resourceDimension = kResourceDimensionTexture2D;
+    extendedHeader.arraySize = arraySize;
+    extendedHeader.miscFlags2 = alphaMode;
+
+    if (isCubeMap)
+    {
+        header.caps |= kDDSSurfaceFlagsCubemap;
+        header.caps2 = kDDSCubemap | kDDSCubemapAllFaces;
+        extendedHeader.miscFlag = kResourceMiscTextureCube;
+        extendedHeader.arraySize = arraySize / 6;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create DDS file " + path);
+    }
+
+    file.write(reinterpret_cast<const char*>(&kDDSMagic), sizeof(kDDSMagic));
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(&extendedHeader), sizeof(extendedHeader));
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot write DDS file " + path);
+    }
+}
+
+void DDSFile::SetDescription(TextureFormat newFormat, uint32_t newWidth, uint32_t newHeight,
+                             uint32_t newArraySize, uint32_t newMipLevels, bool newIsCubeMap)
+{
+    format = newFormat;
+    width = newWidth;
+    height = newHeight;
+    arraySize = newArraySize;
+    mipLevels = newMipLevels;
+    isCubeMap = newIsCubeMap;
+    alphaMode = 0;
+    payloadOffset = 0;
+
+    ComputeLayout();
+    data.clear();
+}
+
+void DDSFile::Initialize(TextureFormat newFormat, uint32_t newWidth, uint32_t newHeight,
+                         uint32_t newArraySize, uint32_t newMipLevels, bool newIsCubeMap)
+{
+    SetDescription(newFormat, newWidth, newHeight, newArraySize, newMipLevels, newIsCubeMap);
+    data.assign(GetPayloadSize(), 0);
+}
+
+size_t DDSFile::GetPayloadSize() const
+{
+    return subresources.empty() ? 0 : subresources.back().offset + subresources.back().slicePitch;
+}
+
+void DDSFile::ComputeLayout()
+{
+    if (isCubeMap && arraySize % 6 != 0)
+    {
+        throw std::runtime_error("Cube map array size must be a multiple of 6");
+    }
+
+    subresources.clear();
+    subresources.reserve(static_cast<size_t>(arraySize) * mipLevels);
+
+    size_t offset = 0;
+
+    for (uint32_t slice = 0; slice < arraySize; slice++)
+    {
+        uint32_t mipWidth = width;
+        uint32_t mipHeight = height;
+
+        for (uint32_t mip = 0; mip < mipLevels; mip++)
+        {
+            DDSSubresource subresource;
+            subresource.offset = offset;
+            subresource.width = mipWidth;
+            subresource.height = mipHeight;
+            GetSurfaceInfo(format, mipWidth, mipHeight, &subresource.rowPitch, &subresource.numRows, &subresource.slicePitch);
+
+            subresources.push_back(subresource);
+            offset += subresource.slicePitch;
+
+            mipWidth = std::max(1u, mipWidth >> 1);
+            mipHeight = std::max(1u, mipHeight >> 1);
+        }
+    }
+}
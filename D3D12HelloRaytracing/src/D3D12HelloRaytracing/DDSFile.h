@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Subset of DXGI_FORMAT used by the asset pipeline. The values match dxgiformat.h so
+// they can be cast directly when a texture is handed to D3D12, but this header does
+// not depend on any Windows SDK header and can be used by the command line tools.
+enum class TextureFormat : uint32_t
+{
+    Unknown = 0,
+    R32G32B32A32_Float = 2,
+    R16G16B16A16_Float = 10,
+    R8G8B8A8_UNorm = 28,
+    R8G8B8A8_UNorm_sRGB = 29,
+    BC1_UNorm = 71,
+    BC1_UNorm_sRGB = 72,
+    BC2_UNorm = 74,
+    BC2_UNorm_sRGB = 75,
+    BC3_UNorm = 77,
+    BC3_UNorm_sRGB = 78,
+    BC4_UNorm = 80,
+    BC4_SNorm = 81,
+    BC5_UNorm = 83,
+    BC5_SNorm = 84,
+    B8G8R8A8_UNorm = 87,
+    B8G8R8A8_UNorm_sRGB = 91,
+    BC6H_UF16 = 95,
+    BC6H_SF16 = 96,
+    BC7_UNorm = 98,
+    BC7_UNorm_sRGB = 99,
+};
+
+/// Human readable name of a format, as used in tool output and remap tables
+const char* GetTextureFormatName(TextureFormat format);
+
+/// True for the formats listed in TextureFormat; the size functions below throw for any
+/// other value
+bool IsKnownTextureFormat(TextureFormat format);
+
+/// True for the BCn block-compressed formats
+bool IsBlockCompressed(TextureFormat format);
+
+/// True for the formats the CPU tools can read and write texel by texel
+bool IsUncompressed8BitRGBA(TextureFormat format);
+
+/// Size in bytes of a 4x4 block for BC formats, or of a single texel otherwise
+uint32_t GetBytesPerBlock(TextureFormat format);
+
+/// Size in bytes of one surface (one mip of one array slice), following the same rules
+/// as GetSurfaceInfo in DDSTextureLoader12
+void GetSurfaceInfo(TextureFormat format, uint32_t width, uint32_t height,
+                    size_t* rowBytes, uint32_t* numRows, size_t* numBytes);
+
+/// Location of one subresource inside DDSFile::data. Subresources are stored the way
+/// DDS files store them: all mips of slice 0, then all mips of slice 1, and so on. The
+/// subresource index is mip + slice * mipLevels, like D3D12CalcSubresource.
+struct DDSSubresource
+{
+    size_t offset = 0;
+    size_t rowPitch = 0;
+    size_t slicePitch = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t numRows = 0;
+};
+
+/// Platform-neutral in-memory copy of a 2D, 2D array or cube DDS file
+class DDSFile
+{
+public:
+    /// Read a DDS file from disk. Throws std::runtime_error on failure.
+    void Load(const std::string& path);
+
+    /// Parse a DDS file already in memory (including the "DDS " magic)
+    void LoadFromMemory(const uint8_t* bytes, size_t size);
+
+    /// Read only the headers of a DDS file: the description, the subresource layout and
+    /// payloadOffset are set but data stays empty. Used to read mips on demand.
+    void LoadHeader(const std::string& path);
+
+    /// Write the texture with a DX10 extended header, so arrays and every format of
+    /// TextureFormat round-trip exactly
+    void Save(const std::string& path) const;
+
+    /// Set the description and compute the layout without allocating data, for readers
+    /// that fill the payload themselves
+    void SetDescription(TextureFormat format, uint32_t width, uint32_t height,
+                        uint32_t arraySize, uint32_t mipLevels, bool isCubeMap);
+
+    /// Allocate zeroed storage for the given description and compute the layout
+    void Initialize(TextureFormat format, uint32_t width, uint32_t height,
+                    uint32_t arraySize, uint32_t mipLevels, bool isCubeMap);
+
+    uint32_t GetSubresourceCount() const { return arraySize * mipLevels; }
+    uint32_t GetSubresourceIndex(uint32_t mip, uint32_t slice) const { return mip + slice * mipLevels; }
+
+    const DDSSubresource& GetSubresource(uint32_t index) const { return subresources[index]; }
+    uint8_t* GetSubresourceData(uint32_t index) { return data.data() + subresources[index].offset; }
+    const uint8_t* GetSubresourceData(uint32_t index) const { return data.data() + subresources[index].offset; }
+
+    TextureFormat format = TextureFormat::Unknown;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// Number of 2D slices; 6 per cube for cube maps
+    uint32_t arraySize = 1;
+    uint32_t mipLevels = 1;
+    bool isCubeMap = false;
+    /// DDS_ALPHA_MODE stored in the DX10 header, kept so rewritten files keep it
+    uint32_t alphaMode = 0;
+
+    /// Offset of the texel payload in the file it was loaded from
+    size_t payloadOffset = 0;
+
+    /// Texel payload, without the DDS headers
+    std::vector<uint8_t> data;
+    std::vector<DDSSubresource> subresources;
+
+    /// Size of the texel payload described by subresources
+    size_t GetPayloadSize() const;
+
+private:
+    /// Parse the headers, set the description and subresources, and return the offset of
+    /// the payload
+    size_t ParseHeader(const uint8_t* bytes, size_t size);
+    void ComputeLayout();
+};
+
+/// Number of mips in a full chain down to 1x1
+uint32_t CountMips(uint32_t width, uint32_t height);
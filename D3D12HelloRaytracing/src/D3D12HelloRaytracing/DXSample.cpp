@@ -159,5 +159,14 @@ void DXSample::ParseCommandLineArgs(WCHAR* argv[], int argc)
             m_useWarpDevice = true;
             m_title = m_title + L" (WARP)";
         }
+        else if ((_wcsicmp(argv[i], L"-textureBudget") == 0 || _wcsicmp(argv[i], L"/textureBudget") == 0) && i + 1 < argc)
+        {
+            m_textureBudgetMB = static_cast<uint32_t>(_wtoi(argv[++i]));
+        }
+        else if ((_wcsicmp(argv[i], L"-recordASSizes") == 0 || _wcsicmp(argv[i], L"/recordASSizes") == 0) && i + 1 < argc)
+        {
+            const std::wstring path = argv[++i];
+            m_recordASSizesPath.assign(path.begin(), path.end());
+        }
     }
 }
@@ -61,6 +61,13 @@ protected:
     bool m_useWarpDevice;
     std::wstring extraInfo{ L" Rasterizer" };
     float m_frameTime = 0.01666667f;
+
+    // Residency budget of the streamed textures, set with -textureBudget <MB>
+    uint32_t m_textureBudgetMB = 64;
+
+    // Table of acceleration structure prebuild sizes to record at startup, set with
+    // -recordASSizes <file>; empty for a normal run
+    std::string m_recordASSizesPath;
 private:
     // Root assets path.
     std::wstring m_assetsPath;
@@ -0,0 +1,38 @@
+#include "stdafx.h"
+#include "DirtyInstanceDescWriter.h"
+
+#include "InstanceDescPacker.h"
+
+void DirtyInstanceDescWriter::Write(const std::vector<nv_helpers_dx12::TopLevelASGenerator::Instance>& instances,
+                                    D3D12_RAYTRACING_INSTANCE_DESC* descs, bool writeAll)
+{
+    // Instances added since the previous call start dirty
+    m_dirty.Resize(static_cast<uint32_t>(instances.size()));
+
+    if (writeAll)
+    {
+        m_dirty.MarkAll();
+    }
+
+    // Every byte of a descriptor is written, with streaming stores that suit the
+    // write-combined upload heap, so the buffer does not need to be zeroed first
+    static_assert(sizeof(PackedInstanceDesc) == sizeof(D3D12_RAYTRACING_INSTANCE_DESC),
+                  "PackedInstanceDesc must match D3D12_RAYTRACING_INSTANCE_DESC");
+    auto packedDescs = reinterpret_cast<PackedInstanceDesc*>(descs);
+
+    for (const DirtyRange& range : m_dirty.CollectRanges())
+    {
+        for (uint32_t i = range.begin; i < range.end; i++)
+        {
+            // The generator's defaults: visibility mask 0xFF and no instance flags. The
+            // transform is transposed, XMMATRIX using row vectors while the
+            // INSTANCE_DESC is row major
+            InstanceDescPacker::PackInstance(reinterpret_cast<const float*>(&instances[i].transform), instances[i].instanceID, 0xFF,
+                                             instances[i].hitGroupIndex, D3D12_RAYTRACING_INSTANCE_FLAG_NONE,
+                                             instances[i].bottomLevelAS->GetGPUVirtualAddress() + instances[i].bottomLevelASOffset,
+                                             packedDescs + i);
+        }
+    }
+
+    InstanceDescPacker::Flush();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "DirtyInstanceSet.h"
+#include "nv_helpers_dx12/TopLevelASGenerator.h"
+
+/// Instance descriptor writer for TopLevelASGenerator::Generate that only rewrites the
+/// instances marked since the previous Generate, with InstanceDescPacker. The generator
+/// reads the transforms by reference, so the application marks each instance whose
+/// transform it changes.
+class DirtyInstanceDescWriter : public nv_helpers_dx12::TopLevelASGenerator::InstanceDescWriter
+{
+public:
+    void Mark(uint32_t index) { m_dirty.Mark(index); }
+    void MarkAll() { m_dirty.MarkAll(); }
+
+    void Write(const std::vector<nv_helpers_dx12::TopLevelASGenerator::Instance>& instances, D3D12_RAYTRACING_INSTANCE_DESC* descs,
+               bool writeAll) override;
+
+private:
+    DirtyInstanceSet m_dirty;
+};
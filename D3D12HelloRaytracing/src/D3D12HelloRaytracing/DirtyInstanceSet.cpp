@@ -0,0 +1,184 @@
+#include "DirtyInstanceSet.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    uint32_t CountTrailingZeros(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return index;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+
+    uint32_t CountBits(uint64_t value)
+    {
+        uint32_t count = 0;
+
+        for (; value; value &= value - 1)
+        {
+            count++;
+        }
+
+        return count;
+    }
+}
+
+void DirtyInstanceSet::Resize(uint32_t count)
+{
+    const uint32_t oldCount = m_count;
+    m_count = count;
+    m_words.resize((count + 63) / 64, 0);
+
+    if (count >= oldCount)
+    {
+        for (uint32_t i = oldCount; i < count; i++)
+        {
+            Mark(i);
+        }
+
+        return;
+    }
+
+    // Drop the bits past the new end, then rebuild the word list and the count
+    if (count % 64)
+    {
+        m_words.back() &= (uint64_t(1) << (count % 64)) - 1;
+    }
+
+    m_dirtyWords.clear();
+    m_dirtyCount = 0;
+
+    for (uint32_t word = 0; word < m_words.size(); word++)
+    {
+        if (m_words[word])
+        {
+            m_dirtyWords.push_back(word);
+            m_dirtyCount += CountBits(m_words[word]);
+        }
+    }
+}
+
+void DirtyInstanceSet::Mark(uint32_t index)
+{
+    uint64_t& word = m_words[index / 64];
+    const uint64_t bit = uint64_t(1) << (index % 64);
+
+    if (word & bit)
+    {
+        return;
+    }
+
+    if (word == 0)
+    {
+        m_dirtyWords.push_back(index / 64);
+    }
+
+    word |= bit;
+    m_dirtyCount++;
+}
+
+void DirtyInstanceSet::MarkAll()
+{
+    m_dirtyWords.resize(m_words.size());
+
+    for (uint32_t word = 0; word < m_words.size(); word++)
+    {
+        m_words[word] = ~uint64_t(0);
+        m_dirtyWords[word] = word;
+    }
+
+    if (m_count % 64)
+    {
+        m_words.back() = (uint64_t(1) << (m_count % 64)) - 1;
+    }
+
+    m_dirtyCount = m_count;
+}
+
+const std::vector<DirtyRange>& DirtyInstanceSet::CollectRanges()
+{
+    m_ranges.clear();
+
+    // Few words are dirty in a typical frame, so sorting them is cheaper than scanning
+    // the bitset
+    std::sort(m_dirtyWords.begin(), m_dirtyWords.end());
+
+    for (uint32_t word : m_dirtyWords)
+    {
+        for (uint64_t bits = m_words[word]; bits; bits &= bits - 1)
+        {
+            const uint32_t index = word * 64 + CountTrailingZeros(bits);
+
+            if (!m_ranges.empty() && m_ranges.back().end == index)
+            {
+                m_ranges.back().end++;
+            }
+            else
+            {
+                m_ranges.push_back(DirtyRange{ index, index + 1 });
+            }
+        }
+
+        m_words[word] = 0;
+    }
+
+    m_dirtyWords.clear();
+    m_dirtyCount = 0;
+
+    return m_ranges;
+}
+
+void DirtyInstanceSet::Validate() const
+{
+    if (m_words.size() != (m_count + 63) / 64)
+    {
+        throw std::logic_error("Dirty set of " + std::to_string(m_count) + " instances has " +
+                               std::to_string(m_words.size()) + " words");
+    }
+
+    if (m_count % 64 && m_words.back() >> (m_count % 64))
+    {
+        throw std::logic_error("Dirty set has bits set past its " + std::to_string(m_count) + " instances");
+    }
+
+    std::vector<bool> listed(m_words.size(), false);
+
+    for (uint32_t word : m_dirtyWords)
+    {
+        if (word >= m_words.size() || listed[word])
+        {
+            throw std::logic_error("Dirty word " + std::to_string(word) + " is out of range or listed twice");
+        }
+
+        listed[word] = true;
+    }
+
+    uint32_t dirtyCount = 0;
+
+    for (uint32_t word = 0; word < m_words.size(); word++)
+    {
+        if (m_words[word] && !listed[word])
+        {
+            throw std::logic_error("Dirty word " + std::to_string(word) + " is missing from the word list");
+        }
+
+        dirtyCount += CountBits(m_words[word]);
+    }
+
+    if (dirtyCount != m_dirtyCount)
+    {
+        throw std::logic_error("Dirty set counts " + std::to_string(m_dirtyCount) + " instances but has " +
+                               std::to_string(dirtyCount) + " bits set");
+    }
+}
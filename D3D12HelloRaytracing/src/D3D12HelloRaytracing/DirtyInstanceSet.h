@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/// Consecutive instances [begin, end) that changed
+struct DirtyRange
+{
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+/// Remembers which instances changed since their data was last written to the GPU, so
+/// that per-frame uploads such as the top-level instance descriptors or the
+/// InstanceProperties buffer only rewrite what moved.
+///
+/// The instances are a bitset, and the words holding a dirty bit are listed as well:
+/// marking is O(1) and CollectRanges is O(dirty instances), whatever the instance count.
+/// Each consumer keeps its own set, since collecting clears it.
+class DirtyInstanceSet
+{
+public:
+    /// Track count instances. Instances added by growing the set start dirty, since
+    /// nothing was written for them yet.
+    void Resize(uint32_t count);
+
+    void Mark(uint32_t index);
+    void MarkAll();
+
+    bool IsDirty(uint32_t index) const { return (m_words[index / 64] >> (index % 64)) & 1; }
+    uint32_t GetCount() const { return m_count; }
+    uint32_t GetDirtyCount() const { return m_dirtyCount; }
+
+    /// The dirty instances as ascending, non-adjacent ranges, after which the set is
+    /// clean. The vector is reused by the next call.
+    const std::vector<DirtyRange>& CollectRanges();
+
+    /// Check that the word list and the dirty count agree with the bitset. Throws
+    /// std::logic_error describing the first violation.
+    void Validate() const;
+
+private:
+    /// One bit per instance
+    std::vector<uint64_t> m_words;
+    /// Indices of the words with at least one bit set, in marking order
+    std::vector<uint32_t> m_dirtyWords;
+    std::vector<DirtyRange> m_ranges;
+    uint32_t m_count = 0;
+    uint32_t m_dirtyCount = 0;
+};
@@ -0,0 +1,242 @@
+#include "EnvironmentImportanceSampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+    typedef EnvironmentImportanceSampler::AliasEntry AliasEntry;
+
+    // Largest float below 1, so remainders stay in [0, 1)
+    const float OneMinusEpsilon = 0.99999994f;
+
+    // Scratch of BuildAliasTable, kept per thread
+    struct AliasScratch
+    {
+        std::vector<double> scaled;
+        std::vector<uint32_t> small;
+        std::vector<uint32_t> large;
+    };
+
+    void BuildAliasTable(const double* weights, uint32_t count, AliasEntry* entries, AliasScratch& scratch)
+    {
+        double sum = 0.0;
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            sum += weights[i];
+        }
+
+        scratch.scaled.resize(count);
+        scratch.small.clear();
+        scratch.large.clear();
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // An all-black row is never picked, so any valid table will do
+            scratch.scaled[i] = sum > 0.0 ? weights[i] * count / sum : 1.0;
+            (scratch.scaled[i] < 1.0 ? scratch.small : scratch.large).push_back(i);
+        }
+
+        while (!scratch.small.empty() && !scratch.large.empty())
+        {
+            const uint32_t less = scratch.small.back();
+            const uint32_t more = scratch.large.back();
+            scratch.small.pop_back();
+
+            entries[less].threshold = static_cast<float>(scratch.scaled[less]);
+            entries[less].alias = more;
+
+            scratch.scaled[more] -= 1.0 - scratch.scaled[less];
+
+            if (scratch.scaled[more] < 1.0)
+            {
+                scratch.large.pop_back();
+                scratch.small.push_back(more);
+            }
+        }
+
+        // What is left is 1 up to rounding
+        for (uint32_t i : scratch.small)
+        {
+            entries[i].threshold = 1.0f;
+            entries[i].alias = i;
+        }
+
+        for (uint32_t i : scratch.large)
+        {
+            entries[i].threshold = 1.0f;
+            entries[i].alias = i;
+        }
+    }
+
+    // Pick a slot and turn the unused part of u into a fresh uniform number
+    uint32_t SampleAliasTable(const AliasEntry* entries, uint32_t count, float& u)
+    {
+        const float scaled = u * count;
+        const uint32_t index = (std::min)(static_cast<uint32_t>(scaled), count - 1);
+        const float remainder = scaled - index;
+        const AliasEntry& entry = entries[index];
+
+        if (remainder < entry.threshold)
+        {
+            u = (std::min)(remainder / entry.threshold, OneMinusEpsilon);
+            return index;
+        }
+
+        u = (std::min)((remainder - entry.threshold) / (1.0f - entry.threshold), OneMinusEpsilon);
+        return entry.alias;
+    }
+
+    float GetProjectionJacobian(float s, float t)
+    {
+        const float length2 = 1.0f + s * s + t * t;
+        return length2 * std::sqrt(length2);
+    }
+}
+
+void EnvironmentImportanceSampler::Build(const CubeMapImage& source)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    uint32_t mip = 0;
+
+    while (m_settings.maxSize > 0 && mip + 1 < source.GetMipCount() && source.GetSize(mip) > m_settings.maxSize)
+    {
+        mip++;
+    }
+
+    const uint32_t size = source.GetSize(mip);
+    const uint32_t rowCount = size * CubeMapImage::FaceCount;
+    const size_t rowTables = CubeMapImage::FaceCount;
+    const size_t columnTables = rowTables + rowCount;
+
+    m_size = size;
+    m_entries.resize(columnTables + static_cast<size_t>(rowCount) * size);
+    m_texelPdfs.resize(static_cast<size_t>(rowCount) * size);
+
+    std::vector<double> rowWeights(rowCount);
+
+    // Texel weights and column tables, one job per row of a face
+    const uint32_t hardwareThreads = m_settings.threads > 0 ? m_settings.threads : (std::max)(1u, std::thread::hardware_concurrency());
+    const uint32_t threadCount = (std::min)(hardwareThreads, (std::max)(1u, rowCount / 16));
+    std::atomic<uint32_t> nextRow(0);
+
+    auto worker = [&]()
+    {
+        AliasScratch scratch;
+        std::vector<double> weights(size);
+
+        for (uint32_t row = nextRow++; row < rowCount; row = nextRow++)
+        {
+            const uint32_t face = row / size;
+            const uint32_t y = row % size;
+            const Texel* texels = source.GetFace(face, mip) + static_cast<size_t>(y) * size;
+            double rowWeight = 0.0;
+
+            for (uint32_t x = 0; x < size; x++)
+            {
+                const float luminance = 0.2126f * texels[x].r + 0.7152f * texels[x].g + 0.0722f * texels[x].b;
+
+                weights[x] = (std::max)(luminance, 0.0f) * static_cast<double>(CubeMapImage::GetTexelSolidAngle(x, y, size));
+                rowWeight += weights[x];
+
+                // Normalized once the total is known
+                m_texelPdfs[static_cast<size_t>(row) * size + x] = static_cast<float>(weights[x]);
+            }
+
+            rowWeights[row] = rowWeight;
+            BuildAliasTable(weights.data(), size, &m_entries[columnTables + static_cast<size_t>(row) * size], scratch);
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        threads.emplace_back(worker);
+    }
+
+    worker();
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // Row tables of each face, then the face table
+    AliasScratch scratch;
+    double faceWeights[CubeMapImage::FaceCount] = {};
+    double total = 0.0;
+
+    for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+    {
+        const double* weights = rowWeights.data() + static_cast<size_t>(face) * size;
+
+        BuildAliasTable(weights, size, &m_entries[rowTables + static_cast<size_t>(face) * size], scratch);
+
+        for (uint32_t y = 0; y < size; y++)
+        {
+            faceWeights[face] += weights[y];
+        }
+
+        total += faceWeights[face];
+    }
+
+    BuildAliasTable(faceWeights, CubeMapImage::FaceCount, m_entries.data(), scratch);
+
+    // Probability of a texel over its area in the face plane. A black environment
+    // falls back to uniform sampling.
+    const double texelArea = 4.0 / (static_cast<double>(size) * size);
+
+    if (total > 0.0)
+    {
+        const float scale = static_cast<float>(1.0 / (total * texelArea));
+
+        for (float& pdf : m_texelPdfs)
+        {
+            pdf *= scale;
+        }
+    }
+    else
+    {
+        std::fill(m_texelPdfs.begin(), m_texelPdfs.end(), static_cast<float>(1.0 / (CubeMapImage::FaceCount * 4.0)));
+    }
+
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_stats.size = size;
+}
+
+float EnvironmentImportanceSampler::Sample(float u1, float u2, float direction[3]) const
+{
+    const size_t rowTables = CubeMapImage::FaceCount;
+    const size_t columnTables = rowTables + static_cast<size_t>(m_size) * CubeMapImage::FaceCount;
+
+    const uint32_t face = SampleAliasTable(m_entries.data(), CubeMapImage::FaceCount, u1);
+    const uint32_t y = SampleAliasTable(&m_entries[rowTables + static_cast<size_t>(face) * m_size], m_size, u1);
+    const size_t row = static_cast<size_t>(face) * m_size + y;
+    const uint32_t x = SampleAliasTable(&m_entries[columnTables + row * m_size], m_size, u2);
+
+    // What is left of u1 and u2 places the direction inside the texel
+    const float s = 2.0f * (x + u2) / m_size - 1.0f;
+    const float t = 2.0f * (y + u1) / m_size - 1.0f;
+
+    CubeMapImage::GetFaceDirection(face, s, t, direction);
+
+    return m_texelPdfs[row * m_size + x] * GetProjectionJacobian(s, t);
+}
+
+float EnvironmentImportanceSampler::GetPdf(const float direction[3]) const
+{
+    uint32_t face;
+    float u, v;
+    CubeMapImage::GetFaceCoordinates(direction, face, u, v);
+
+    const uint32_t x = (std::min)(static_cast<uint32_t>(u * m_size), m_size - 1);
+    const uint32_t y = (std::min)(static_cast<uint32_t>(v * m_size), m_size - 1);
+
+    return m_texelPdfs[(static_cast<size_t>(face) * m_size + y) * m_size + x] * GetProjectionJacobian(2.0f * u - 1.0f, 2.0f * v - 1.0f);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "CubeMap.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Importance sampling of an environment cube map by luminance, in O(1) per direction
+/// with alias tables (Vose's method). The tables form a hierarchy: pick a face, then a
+/// row given the face, then a texel given the row, then a uniform point in the texel.
+/// Each texel is weighted by luminance times solid angle, so the sun gets the samples
+/// it deserves and dim sky gets few.
+///
+/// Everything lives in two flat arrays that can be uploaded to the GPU as is:
+///
+///   GetAliasEntries()  face table (6 entries), then the row table of each face (size
+///                      entries each), then the column table of each row (size entries
+///                      each, face-major)
+///   GetTexelPdfs()     per texel, the density per unit area of the face plane ([-1, 1]^2)
+///
+/// The density per steradian of a direction through (s, t) of a face is the texel's
+/// value times (1 + s^2 + t^2)^(3/2), the Jacobian of the cube projection.
+class EnvironmentImportanceSampler
+{
+public:
+    struct Settings
+    {
+        /// Largest face size to build tables for, 0 for mip 0 whatever its size
+        uint32_t maxSize = 256;
+        /// Worker threads, 0 for one per hardware thread
+        uint32_t threads = 0;
+    };
+
+    struct Stats
+    {
+        double seconds = 0.0;
+        uint32_t size = 0;
+    };
+
+    /// One slot of an alias table: keep the slot if the remainder of the random number is
+    /// below threshold, else take alias
+    struct AliasEntry
+    {
+        float threshold;
+        uint32_t alias;
+    };
+
+    explicit EnvironmentImportanceSampler(const Settings& settings) : m_settings(settings) {}
+
+    /// Build the tables from the first mip of the cube map no larger than
+    /// Settings::maxSize. Call CubeMapImage::BuildMipChain first so that one exists.
+    void Build(const CubeMapImage& source);
+
+    /// Map two uniform random numbers in [0, 1) to a normalized direction and return its
+    /// density per steradian
+    float Sample(float u1, float u2, float direction[3]) const;
+
+    /// Density per steradian of drawing a direction (need not be normalized)
+    float GetPdf(const float direction[3]) const;
+
+    uint32_t GetSize() const { return m_size; }
+    const std::vector<AliasEntry>& GetAliasEntries() const { return m_entries; }
+    const std::vector<float>& GetTexelPdfs() const { return m_texelPdfs; }
+    size_t GetMemorySize() const { return m_entries.size() * sizeof(AliasEntry) + m_texelPdfs.size() * sizeof(float); }
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    Settings m_settings;
+    Stats m_stats;
+
+    uint32_t m_size = 0;
+    std::vector<AliasEntry> m_entries;
+    std::vector<float> m_texelPdfs;
+};
@@ -0,0 +1,213 @@
+#include "EnvironmentPrefilter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const float Pi = 3.14159265358979f;
+
+    // Sample of the GGX lobe around +Z, shared by every texel of a mip
+    struct LobeSample
+    {
+        float direction[3];
+        float weight;
+        float lod;
+    };
+
+    float RadicalInverse(uint32_t bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return bits * 2.3283064365386963e-10f;
+    }
+
+    // Importance sample the half vectors of the lobe, reflect the view direction (+Z)
+    // around them, and pick the source mip whose texels match the solid angle of each
+    // sample (Colbert and Krivanek, GPU Gems 3 chapter 20)
+    std::vector<LobeSample> BuildLobe(float roughness, uint32_t sampleCount, uint32_t sourceSize)
+    {
+        const float alpha = roughness * roughness;
+        const float alpha2 = alpha * alpha;
+        const float texelSolidAngle = 4.0f * Pi / (6.0f * sourceSize * sourceSize);
+
+        std::vector<LobeSample> lobe;
+
+        for (uint32_t i = 0; i < sampleCount; i++)
+        {
+            const float phi = 2.0f * Pi * (i + 0.5f) / sampleCount;
+            const float xi = RadicalInverse(i);
+            const float cosTheta = std::sqrt((1.0f - xi) / (1.0f + (alpha2 - 1.0f) * xi));
+            const float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+
+            const float h[3] = { sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+
+            LobeSample sample;
+            sample.direction[0] = 2.0f * cosTheta * h[0];
+            sample.direction[1] = 2.0f * cosTheta * h[1];
+            sample.direction[2] = 2.0f * cosTheta * h[2] - 1.0f;
+            sample.weight = sample.direction[2];
+
+            if (sample.weight <= 0.0f)
+            {
+                continue;
+            }
+
+            // With N = V, pdf(L) = D(H) * NdotH / (4 * VdotH) = D(H) / 4
+            const float denominator = cosTheta * cosTheta * (alpha2 - 1.0f) + 1.0f;
+            const float distribution = alpha2 / (Pi * denominator * denominator);
+            const float sampleSolidAngle = 1.0f / (sampleCount * distribution * 0.25f + 1e-6f);
+
+            sample.lod = std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f);
+
+            lobe.push_back(sample);
+        }
+
+        return lobe;
+    }
+}
+
+float EnvironmentPrefilter::GetMipRoughness(uint32_t mip, uint32_t mipLevels)
+{
+    return mipLevels > 1 ? static_cast<float>(mip) / (mipLevels - 1) : 0.0f;
+}
+
+void EnvironmentPrefilter::Prefilter(const DDSFile& source, DDSFile& output)
+{
+    CubeMapImage image;
+    image.Load(source);
+
+    Prefilter(image, output);
+}
+
+void EnvironmentPrefilter::Prefilter(const CubeMapImage& source, DDSFile& output)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    CubeMapImage filtered = source;
+    filtered.BuildMipChain();
+
+    const uint32_t size = source.GetSize();
+    const uint32_t fullChain = CountMips(size, size);
+    const uint32_t mipLevels = m_settings.mipLevels > 0 ? std::min(m_settings.mipLevels, fullChain) : fullChain;
+
+    output.Initialize(TextureFormat::R16G16B16A16_Float, size, size, CubeMapImage::FaceCount, mipLevels, true);
+
+    const uint32_t threadCount = m_settings.threads > 0 ? m_settings.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Texel> texels;
+
+    m_stats = Stats();
+
+    for (uint32_t mip = 0; mip < mipLevels; mip++)
+    {
+        const uint32_t mipSize = std::max(1u, size >> mip);
+        const std::vector<LobeSample> lobe = BuildLobe(GetMipRoughness(mip, mipLevels), m_settings.sampleCount, size);
+
+        texels.assign(static_cast<size_t>(mipSize) * mipSize * CubeMapImage::FaceCount, Texel());
+
+        if (mip == 0)
+        {
+            // Roughness 0 is a mirror: the source itself
+            for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+            {
+                std::copy(source.GetFace(face), source.GetFace(face) + static_cast<size_t>(size) * size,
+                          texels.begin() + static_cast<size_t>(face) * size * size);
+            }
+        }
+        else
+        {
+            // One job per row of a face
+            std::atomic<uint32_t> nextRow(0);
+            const uint32_t rowCount = mipSize * CubeMapImage::FaceCount;
+
+            auto worker = [&]()
+            {
+                for (uint32_t row = nextRow++; row < rowCount; row = nextRow++)
+                {
+                    const uint32_t face = row / mipSize;
+                    const uint32_t y = row % mipSize;
+
+                    for (uint32_t x = 0; x < mipSize; x++)
+                    {
+                        float normal[3];
+                        CubeMapImage::GetTexelDirection(face, x, y, mipSize, normal);
+
+                        // Tangent frame around the normal
+                        const float up[3] = { std::fabs(normal[2]) < 0.999f ? 0.0f : 1.0f, 0.0f, std::fabs(normal[2]) < 0.999f ? 1.0f : 0.0f };
+                        float tangent[3] = {
+                            up[1] * normal[2] - up[2] * normal[1],
+                            up[2] * normal[0] - up[0] * normal[2],
+                            up[0] * normal[1] - up[1] * normal[0] };
+                        const float length = std::sqrt(tangent[0] * tangent[0] + tangent[1] * tangent[1] + tangent[2] * tangent[2]);
+                        tangent[0] /= length;
+                        tangent[1] /= length;
+                        tangent[2] /= length;
+
+                        const float bitangent[3] = {
+                            normal[1] * tangent[2] - normal[2] * tangent[1],
+                            normal[2] * tangent[0] - normal[0] * tangent[2],
+                            normal[0] * tangent[1] - normal[1] * tangent[0] };
+
+                        Texel sum;
+                        float totalWeight = 0.0f;
+
+                        for (const auto& sample : lobe)
+                        {
+                            const float direction[3] = {
+                                tangent[0] * sample.direction[0] + bitangent[0] * sample.direction[1] + normal[0] * sample.direction[2],
+                                tangent[1] * sample.direction[0] + bitangent[1] * sample.direction[1] + normal[1] * sample.direction[2],
+                                tangent[2] * sample.direction[0] + bitangent[2] * sample.direction[1] + normal[2] * sample.direction[2] };
+
+                            const Texel radiance = filtered.Sample(direction, sample.lod);
+
+                            sum.r += radiance.r * sample.weight;
+                            sum.g += radiance.g * sample.weight;
+                            sum.b += radiance.b * sample.weight;
+                            sum.a += radiance.a * sample.weight;
+                            totalWeight += sample.weight;
+                        }
+
+                        Texel& texel = texels[(static_cast<size_t>(face) * mipSize + y) * mipSize + x];
+                        texel.r = sum.r / totalWeight;
+                        texel.g = sum.g / totalWeight;
+                        texel.b = sum.b / totalWeight;
+                        texel.a = sum.a / totalWeight;
+                    }
+                }
+            };
+
+            std::vector<std::thread> threads;
+
+            for (uint32_t i = 1; i < threadCount; i++)
+            {
+                threads.emplace_back(worker);
+            }
+
+            worker();
+
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+
+            m_stats.samples += static_cast<uint64_t>(texels.size()) * lobe.size();
+        }
+
+        for (uint32_t face = 0; face < CubeMapImage::FaceCount; face++)
+        {
+            const uint32_t index = output.GetSubresourceIndex(mip, face);
+
+            EncodeSurface(output.format, texels.data() + static_cast<size_t>(face) * mipSize * mipSize, mipSize, mipSize,
+                          output.GetSubresourceData(index), output.GetSubresource(index).rowPitch);
+        }
+    }
+
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
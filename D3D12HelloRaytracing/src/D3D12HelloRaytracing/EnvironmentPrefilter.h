@@ -0,0 +1,52 @@
+#pragma once
+
+#include "CubeMap.h"
+#include "DDSFile.h"
+
+#include <cstdint>
+
+/// Generates the GGX-prefiltered specular mip chain of an environment cube map
+/// ("split sum" prefiltering): mip m of the output holds the radiance convolved with
+/// the GGX lobe of roughness m / (mipLevels - 1), assuming N = V = R. A glossy
+/// reflection is then a single SampleLevel at lod roughness * (mipLevels - 1).
+///
+/// Each texel importance samples the lobe with a Hammersley sequence. Samples read a
+/// box-filtered mip of the source chosen from their PDF, so a few dozen samples per
+/// texel are enough to avoid fireflies. Faces and rows are spread over threads.
+class EnvironmentPrefilter
+{
+public:
+    struct Settings
+    {
+        uint32_t sampleCount = 64;
+        /// Number of output mips, 0 for the full chain down to 1x1
+        uint32_t mipLevels = 0;
+        /// Worker threads, 0 for one per hardware thread
+        uint32_t threads = 0;
+    };
+
+    struct Stats
+    {
+        double seconds = 0.0;
+        uint64_t samples = 0;
+    };
+
+    explicit EnvironmentPrefilter(const Settings& settings) : m_settings(settings) {}
+
+    /// Prefilter a cube map and return it as an RGBA16F cube DDS with the roughness mip
+    /// chain. Mip 0 (roughness 0) is the source itself. Throws std::runtime_error if the
+    /// source cannot be decoded.
+    void Prefilter(const DDSFile& source, DDSFile& output);
+
+    /// Same, from already decoded texels
+    void Prefilter(const CubeMapImage& source, DDSFile& output);
+
+    /// Roughness stored in a mip of a chain of mipLevels
+    static float GetMipRoughness(uint32_t mip, uint32_t mipLevels);
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    Settings m_settings;
+    Stats m_stats;
+};
@@ -0,0 +1,50 @@
+#include "InstanceDescPacker.h"
+
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    void PackRange(const InstanceDescSource& source, uint32_t begin, uint32_t end, PackedInstanceDesc* destination)
+    {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            InstanceDescPacker::PackInstance(source.transforms + static_cast<size_t>(i) * 16,
+                                             source.instanceIds ? source.instanceIds[i] : 0,
+                                             source.masks ? source.masks[i] : 0xFF,
+                                             source.hitGroupOffsets ? source.hitGroupOffsets[i] : 0,
+                                             source.flags ? source.flags[i] : 0,
+                                             source.accelerationStructures ? source.accelerationStructures[i] : 0,
+                                             destination + i);
+        }
+
+        // Each thread orders its own stores
+        InstanceDescPacker::Flush();
+    }
+}
+
+void InstanceDescPacker::Pack(const InstanceDescSource& source, uint32_t count, PackedInstanceDesc* destination, uint32_t threads)
+{
+    const uint32_t hardwareThreads = threads > 0 ? threads : (std::max)(1u, std::thread::hardware_concurrency());
+    const uint32_t threadCount = (std::max)(1u, (std::min)(hardwareThreads, count / MinInstancesPerThread));
+
+    // Ranges of whole 64-byte descriptors, so no two threads share a cache line
+    const uint32_t rangeSize = (count + threadCount - 1) / threadCount;
+    std::vector<std::thread> workers;
+
+    for (uint32_t thread = 1; thread < threadCount; thread++)
+    {
+        const uint32_t begin = (std::min)(count, thread * rangeSize);
+        const uint32_t end = (std::min)(count, begin + rangeSize);
+        workers.emplace_back(PackRange, std::cref(source), begin, end, destination);
+    }
+
+    PackRange(source, 0, (std::min)(count, rangeSize), destination);
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+}
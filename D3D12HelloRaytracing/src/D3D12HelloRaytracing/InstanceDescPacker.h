@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+#include <emmintrin.h>
+
+/// Byte layout of D3D12_RAYTRACING_INSTANCE_DESC, without the bit fields, so that
+/// descriptors can be written without d3d12.h
+struct alignas(16) PackedInstanceDesc
+{
+    /// Row-major 3x4 object-to-world transform
+    float transform[3][4];
+    /// InstanceID in the low 24 bits, InstanceMask in the high 8
+    uint32_t instanceIdAndMask;
+    /// InstanceContributionToHitGroupIndex in the low 24 bits, Flags in the high 8
+    uint32_t hitGroupOffsetAndFlags;
+    /// GPU virtual address of the bottom level
+    uint64_t accelerationStructure;
+};
+
+static_assert(sizeof(PackedInstanceDesc) == 64, "PackedInstanceDesc must match D3D12_RAYTRACING_INSTANCE_DESC");
+
+/// Instances as separate arrays, the transforms as DirectX::XMMATRIX (row vectors, 16
+/// floats each, 16-byte aligned). Null arrays take the defaults TopLevelASGenerator
+/// uses: ID and hit group offset 0, mask 0xFF, no flags.
+struct InstanceDescSource
+{
+    const float* transforms = nullptr;
+    const uint32_t* instanceIds = nullptr;
+    const uint8_t* masks = nullptr;
+    const uint32_t* hitGroupOffsets = nullptr;
+    const uint8_t* flags = nullptr;
+    const uint64_t* accelerationStructures = nullptr;
+};
+
+/// Writes instance descriptors for a top-level build. Each transform is transposed from
+/// an XMMATRIX to the 3x4 rows of the descriptor in SSE registers, and the descriptor
+/// leaves as four 16-byte non-temporal stores: the destination is normally a mapped
+/// upload buffer, write-combined memory that is slow to read and that only full,
+/// in-order writes fill efficiently. Every byte is written, so the buffer does not have
+/// to be zeroed first. Large batches are split across threads.
+///
+/// Destinations must be 16-byte aligned, which mapped buffers always are.
+class InstanceDescPacker
+{
+public:
+    /// Fewer instances than this per thread are not worth starting one
+    static const uint32_t MinInstancesPerThread = 16384;
+
+    /// Write count descriptors from source; threads 0 uses every hardware thread
+    static void Pack(const InstanceDescSource& source, uint32_t count, PackedInstanceDesc* destination, uint32_t threads = 0);
+
+    /// Write one descriptor, as DirtyInstanceDescWriter does per instance. Call
+    /// Flush after the last one.
+    static void PackInstance(const float* transform, uint32_t instanceId, uint8_t mask, uint32_t hitGroupOffset, uint8_t flags,
+                             uint64_t accelerationStructure, PackedInstanceDesc* destination)
+    {
+        __m128 row0 = _mm_load_ps(transform);
+        __m128 row1 = _mm_load_ps(transform + 4);
+        __m128 row2 = _mm_load_ps(transform + 8);
+        __m128 row3 = _mm_load_ps(transform + 12);
+        _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+
+        const __m128i fields = _mm_set_epi64x(static_cast<int64_t>(accelerationStructure),
+                                              static_cast<int64_t>((static_cast<uint64_t>((hitGroupOffset & 0xFFFFFF) | (static_cast<uint32_t>(flags) << 24)) << 32) |
+                                                                   ((instanceId & 0xFFFFFF) | (static_cast<uint32_t>(mask) << 24))));
+
+        float* output = &destination->transform[0][0];
+        _mm_stream_ps(output, row0);
+        _mm_stream_ps(output + 4, row1);
+        _mm_stream_ps(output + 8, row2);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(output + 12), fields);
+    }
+
+    /// Order the non-temporal stores before the buffer is unmapped or read
+    static void Flush() { _mm_sfence(); }
+};
@@ -0,0 +1,338 @@
+#include "LZCodec.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    const uint32_t MinMatch = 4;
+    const uint32_t HashLog = 16;
+    const size_t MaxOffset = 65535;
+    // Like LZ4, the last bytes are always literals so the decoder's fast paths can
+    // over-copy without special cases near the end
+    const size_t LastLiterals = 5;
+    const size_t MatchSearchLimit = 12;
+    // Extra bytes the fast paths of the decoder read or write past a copy
+    const size_t CopyMargin = 16;
+
+    uint32_t Read32(const uint8_t* bytes)
+    {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+
+    uint32_t Hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - HashLog);
+    }
+
+    uint8_t* WriteLength(uint8_t* output, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+        {
+            *output++ = 255;
+        }
+
+        *output++ = static_cast<uint8_t>(length);
+        return output;
+    }
+
+    uint8_t* WriteSequence(uint8_t* output, const uint8_t* literals, size_t literalLength,
+                           size_t offset, size_t matchLength)
+    {
+        uint8_t* token = output++;
+        *token = static_cast<uint8_t>((literalLength < 15 ? literalLength : 15) << 4);
+
+        if (literalLength >= 15)
+        {
+            output = WriteLength(output, literalLength - 15);
+        }
+
+        memcpy(output, literals, literalLength);
+        output += literalLength;
+
+        // The last sequence has no match
+        if (matchLength == 0)
+        {
+            return output;
+        }
+
+        *output++ = static_cast<uint8_t>(offset);
+        *output++ = static_cast<uint8_t>(offset >> 8);
+
+        const size_t length = matchLength - MinMatch;
+        *token |= static_cast<uint8_t>(length < 15 ? length : 15);
+
+        if (length >= 15)
+        {
+            output = WriteLength(output, length - 15);
+        }
+
+        return output;
+    }
+
+    // Room for the fast path of the decoder: up to 14 literals read as 16 bytes plus the
+    // offset, and up to 14 + 18 output bytes, with some slack for the over-copy
+    bool HasFastPathRoom(const uint8_t* input, const uint8_t* inputEnd, const uint8_t* output, const uint8_t* outputEnd)
+    {
+        return inputEnd - input >= 16 + 2 && outputEnd - output >= 14 + 18 + 8;
+    }
+
+    size_t ReadLength(const uint8_t*& input, const uint8_t* inputEnd)
+    {
+        size_t length = 0;
+        uint8_t value;
+
+        do
+        {
+            if (input == inputEnd)
+            {
+                throw std::runtime_error("LZ stream is truncated");
+            }
+
+            value = *input++;
+            length += value;
+        } while (value == 255);
+
+        return length;
+    }
+}
+
+size_t GetLZCompressBound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+size_t LZCompress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity)
+{
+    if (capacity < GetLZCompressBound(size))
+    {
+        throw std::logic_error("LZ output buffer is smaller than GetLZCompressBound");
+    }
+
+    uint8_t* output = destination;
+    size_t anchor = 0;
+
+    if (size > MatchSearchLimit)
+    {
+        // Position + 1 of the last occurrence of each hashed 4-byte sequence, 0 if none
+        std::vector<uint32_t> table(size_t(1) << HashLog, 0);
+
+        const size_t matchEnd = size - LastLiterals;
+        const size_t searchEnd = size - MatchSearchLimit;
+        size_t position = 0;
+
+        while (position < searchEnd)
+        {
+            const uint32_t sequence = Read32(source + position);
+            uint32_t& slot = table[Hash(sequence)];
+            const size_t candidate = slot;
+            slot = static_cast<uint32_t>(position + 1);
+
+            if (candidate == 0 || position + 1 - candidate > MaxOffset || Read32(source + candidate - 1) != sequence)
+            {
+                // Skip faster through data that does not compress
+                position += 1 + ((position - anchor) >> 6);
+                continue;
+            }
+
+            size_t match = candidate - 1;
+
+            // Extend backwards into the pending literals, then forwards
+            while (position > anchor && match > 0 && source[position - 1] == source[match - 1])
+            {
+                position--;
+                match--;
+            }
+
+            size_t length = MinMatch;
+
+            while (position + length < matchEnd && source[position + length] == source[match + length])
+            {
+                length++;
+            }
+
+            output = WriteSequence(output, source + anchor, position - anchor, position - match, length);
+
+            position += length;
+            anchor = position;
+
+            if (position - 2 < searchEnd)
+            {
+                table[Hash(Read32(source + position - 2))] = static_cast<uint32_t>(position - 1);
+            }
+        }
+    }
+
+    output = WriteSequence(output, source + anchor, size - anchor, 0, 0);
+
+    return static_cast<size_t>(output - destination);
+}
+
+void LZDecompress(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t destinationSize)
+{
+    const uint8_t* input = source;
+    const uint8_t* const inputEnd = source + sourceSize;
+    uint8_t* output = destination;
+    uint8_t* const outputEnd = destination + destinationSize;
+
+    for (;;)
+    {
+        if (input == inputEnd)
+        {
+            throw std::runtime_error("LZ stream is truncated");
+        }
+
+        const uint8_t token = *input++;
+        size_t literalLength = token >> 4;
+
+        // Most sequences are short: copy their literals and match with fixed-size chunks
+        // as long as both buffers have room for the over-copy
+        if (literalLength != 15 && (token & 15) != 15 && HasFastPathRoom(input, inputEnd, output, outputEnd))
+        {
+            memcpy(output, input, 16);
+            input += literalLength;
+            output += literalLength;
+
+            const size_t offset = input[0] | (static_cast<size_t>(input[1]) << 8);
+            input += 2;
+
+            if (offset == 0 || offset > static_cast<size_t>(output - destination))
+            {
+                throw std::runtime_error("LZ match offset is out of range");
+            }
+
+            const size_t matchLength = (token & 15) + MinMatch;
+            const uint8_t* match = output - offset;
+
+            if (offset >= 16)
+            {
+                memcpy(output, match, 16);
+                memcpy(output + 16, match + 16, 2);
+            }
+            else if (offset >= 8)
+            {
+                memcpy(output, match, 8);
+                memcpy(output + 8, match + 8, 8);
+                memcpy(output + 16, match + 16, 2);
+            }
+            else
+            {
+                for (size_t i = 0; i < matchLength; i++)
+                {
+                    output[i] = match[i];
+                }
+            }
+
+            output += matchLength;
+            continue;
+        }
+
+        if (literalLength == 15)
+        {
+            literalLength += ReadLength(input, inputEnd);
+        }
+
+        if (literalLength > static_cast<size_t>(inputEnd - input) || literalLength > static_cast<size_t>(outputEnd - output))
+        {
+            throw std::runtime_error("LZ literals overrun the buffers");
+        }
+
+        if (static_cast<size_t>(inputEnd - input) >= literalLength + CopyMargin &&
+            static_cast<size_t>(outputEnd - output) >= literalLength + CopyMargin)
+        {
+            // Copy whole 16-byte chunks, possibly past the end of the literals
+            for (size_t i = 0; i < literalLength; i += 16)
+            {
+                memcpy(output + i, input + i, 16);
+            }
+        }
+        else
+        {
+            memcpy(output, input, literalLength);
+        }
+
+        input += literalLength;
+        output += literalLength;
+
+        if (input == inputEnd)
+        {
+            break;
+        }
+
+        if (inputEnd - input < 2)
+        {
+            throw std::runtime_error("LZ stream is truncated");
+        }
+
+        const size_t offset = input[0] | (static_cast<size_t>(input[1]) << 8);
+        input += 2;
+
+        if (offset == 0 || offset > static_cast<size_t>(output - destination))
+        {
+            throw std::runtime_error("LZ match offset is out of range");
+        }
+
+        size_t matchLength = (token & 15) + MinMatch;
+
+        if ((token & 15) == 15)
+        {
+            matchLength += ReadLength(input, inputEnd);
+        }
+
+        if (matchLength > static_cast<size_t>(outputEnd - output))
+        {
+            throw std::runtime_error("LZ match overruns the output");
+        }
+
+        const uint8_t* match = output - offset;
+
+        if (static_cast<size_t>(outputEnd - output) >= matchLength + CopyMargin && offset >= 16)
+        {
+            // Chunks never overlap the bytes they read when the offset is at least 16
+            for (size_t i = 0; i < matchLength; i += 16)
+            {
+                memcpy(output + i, match + i, 16);
+            }
+        }
+        else if (static_cast<size_t>(outputEnd - output) >= matchLength + CopyMargin && offset >= 8)
+        {
+            for (size_t i = 0; i < matchLength; i += 8)
+            {
+                memcpy(output + i, match + i, 8);
+            }
+        }
+        else if (static_cast<size_t>(outputEnd - output) >= matchLength + CopyMargin)
+        {
+            // Short offsets repeat a pattern, as in runs of identical BC endpoints: expand it
+            // to 8 bytes, then copy 8 bytes at a time from a multiple of the offset back
+            for (size_t i = 0; i < 8; i++)
+            {
+                output[i] = match[i];
+            }
+
+            const size_t stride = offset * ((8 + offset - 1) / offset);
+
+            for (size_t i = 8; i < matchLength; i += 8)
+            {
+                memcpy(output + i, output + i - stride, 8);
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < matchLength; i++)
+            {
+                output[i] = match[i];
+            }
+        }
+
+        output += matchLength;
+    }
+
+    if (output != outputEnd)
+    {
+        throw std::runtime_error("LZ stream does not match the expected size");
+    }
+}
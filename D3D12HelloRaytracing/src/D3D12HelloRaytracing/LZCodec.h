@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Byte-oriented LZ77 codec with the sequence layout of the LZ4 block format: a token
+// holding the literal and match lengths, the literals, a 16-bit offset, then length
+// extension bytes. There is no entropy stage, so decoding is mostly copies of literals
+// and matches; the compression gains on BC data come from splitting the blocks into
+// separate streams before compressing (see CompressedTexture).
+
+/// Worst-case compressed size of size input bytes
+size_t GetLZCompressBound(size_t size);
+
+/// Compress source into destination, whose capacity must be at least
+/// GetLZCompressBound(size). Returns the compressed size.
+size_t LZCompress(const uint8_t* source, size_t size, uint8_t* destination, size_t capacity);
+
+/// Decompress exactly destinationSize bytes. Throws std::runtime_error if the input is
+/// malformed or does not decode to destinationSize bytes; never reads or writes outside
+/// the given ranges.
+void LZDecompress(const uint8_t* source, size_t sourceSize, uint8_t* destination, size_t destinationSize);
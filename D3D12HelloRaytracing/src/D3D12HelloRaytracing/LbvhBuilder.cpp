@@ -0,0 +1,928 @@
+#include "LbvhBuilder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    const uint32_t InvalidNode = 0xFFFFFFFF;
+
+    // Fewer triangles than this per thread are not worth the synchronization
+    const uint32_t MinTrianglesPerThread = 4096;
+
+    uint32_t CountLeadingZeros(uint64_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        return _BitScanReverse64(&index, value) ? 63 - index : 64;
+#else
+        return value ? __builtin_clzll(value) : 64;
+#endif
+    }
+
+    // Spread the low 10 or 21 bits of value so that two zero bits follow each
+    uint64_t SpreadBits(uint32_t value)
+    {
+        uint64_t x = value & 0x1FFFFF;
+        x = (x | x << 32) & 0x1F00000000FFFFull;
+        x = (x | x << 16) & 0x1F0000FF0000FFull;
+        x = (x | x << 8) & 0x100F00F00F00F00Full;
+        x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+    }
+
+    uint32_t GetChunkBegin(uint32_t count, uint32_t chunk, uint32_t chunkCount)
+    {
+        return static_cast<uint32_t>(static_cast<uint64_t>(count) * chunk / chunkCount);
+    }
+
+    // Holds every worker until all have arrived, between the stages of a build
+    class Barrier
+    {
+    public:
+        explicit Barrier(uint32_t count) : m_count(count) {}
+
+        void Wait()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const uint32_t generation = m_generation;
+
+            if (++m_arrived == m_count)
+            {
+                m_arrived = 0;
+                m_generation++;
+                m_condition.notify_all();
+            }
+            else
+            {
+                m_condition.wait(lock, [&]() { return generation != m_generation; });
+            }
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        uint32_t m_count;
+        uint32_t m_arrived = 0;
+        uint32_t m_generation = 0;
+    };
+
+    // A subtree of the output whose node slot, child pairs and primitive range are known
+    struct OutputTask
+    {
+        uint32_t node;
+        uint32_t slot;
+        uint32_t pairBase;
+        uint32_t primitiveOffset;
+        uint32_t depth;
+    };
+
+    // Subsets of a treelet's leaves, by increasing size, so that the search sees every
+    // subset's parts before the subset
+    struct TreeletSubsets
+    {
+        uint8_t subsets[(1 << LbvhBuilder::TreeletSize) - 1];
+
+        TreeletSubsets()
+        {
+            uint32_t count = 0;
+
+            for (uint32_t size = 1; size <= LbvhBuilder::TreeletSize; size++)
+            {
+                for (uint32_t subset = 1; subset < (1u << LbvhBuilder::TreeletSize); subset++)
+                {
+                    if (GetSize(subset) == size)
+                    {
+                        subsets[count++] = static_cast<uint8_t>(subset);
+                    }
+                }
+            }
+        }
+
+        static uint32_t GetSize(uint32_t subset)
+        {
+            uint32_t size = 0;
+
+            for (; subset; subset &= subset - 1)
+            {
+                size++;
+            }
+
+            return size;
+        }
+    };
+}
+
+// Karras' tree: interior nodes 0 to n - 2, with 0 the root, then one leaf per sorted
+// triangle. Per node arrays, so each pass touches only what it needs.
+struct LbvhBuilder::Scratch
+{
+    std::vector<BvhBounds> triangleBounds;
+    std::vector<uint64_t> codes[2];
+    std::vector<uint32_t> order[2];
+    std::vector<uint32_t> histograms;
+
+    std::vector<uint32_t> children;
+    std::vector<uint32_t> parents;
+    std::vector<BvhBounds> bounds;
+    /// SAH cost of the subtree, not yet divided by the root's area
+    std::vector<float> costs;
+    std::vector<uint32_t> triangleCounts;
+    /// Interior nodes the subtree has in the output; 0 where it becomes a leaf
+    std::vector<uint32_t> pairCounts;
+    std::unique_ptr<std::atomic<uint32_t>[]> visits;
+    size_t visitCapacity = 0;
+
+    std::vector<OutputTask> outputTasks;
+};
+
+class LbvhBuilder::BuildContext
+{
+public:
+    BuildContext(const Settings& settings, const BvhGeometry& geometry, Scratch& scratch, Bvh::NodeArray& nodes,
+                 std::vector<uint32_t>& primitives, uint32_t threadCount) :
+        m_settings(settings),
+        m_geometry(geometry),
+        m_scratch(scratch),
+        m_nodes(nodes),
+        m_primitives(primitives),
+        m_triangleCount(geometry.GetTriangleCount()),
+        m_threadCount(threadCount),
+        m_barrier(threadCount),
+        m_chunkCentroids(threadCount),
+        m_threadStats(threadCount)
+    {
+    }
+
+    void Run(Stats& stats)
+    {
+        std::vector<std::thread> threads;
+
+        for (uint32_t i = 1; i < m_threadCount; i++)
+        {
+            threads.emplace_back(&BuildContext::Work, this, i, std::ref(stats));
+        }
+
+        Work(0, stats);
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        for (const ThreadStats& threadStats : m_threadStats)
+        {
+            stats.leaves += threadStats.leaves;
+            stats.maxDepth = (std::max)(stats.maxDepth, threadStats.maxDepth);
+            stats.treeletsRestructured += threadStats.treeletsRestructured;
+        }
+    }
+
+private:
+    struct ThreadStats
+    {
+        uint32_t leaves = 0;
+        uint32_t maxDepth = 0;
+        uint32_t treeletsRestructured = 0;
+    };
+
+    // Every stage is split over the threads in fixed chunks, with a barrier between
+    // stages; thread 0 does the serial parts and is the only one to write the stage times
+    void Work(uint32_t thread, Stats& stats)
+    {
+        auto stageStart = std::chrono::steady_clock::now();
+
+        auto endStage = [&](double& seconds)
+        {
+            m_barrier.Wait();
+
+            if (thread == 0)
+            {
+                const auto now = std::chrono::steady_clock::now();
+                seconds += std::chrono::duration<double>(now - stageStart).count();
+                stageStart = now;
+            }
+        };
+
+        const uint32_t begin = GetChunkBegin(m_triangleCount, thread, m_threadCount);
+        const uint32_t end = GetChunkBegin(m_triangleCount, thread + 1, m_threadCount);
+
+        BoundTriangles(thread, begin, end);
+        m_barrier.Wait();
+
+        if (thread == 0)
+        {
+            for (const BvhBounds& bounds : m_chunkCentroids)
+            {
+                m_centroidBounds.Grow(bounds);
+            }
+        }
+
+        m_barrier.Wait();
+        ComputeCodes(begin, end);
+        endStage(stats.mortonSeconds);
+
+        const uint32_t sorted = Sort(thread, begin, end);
+
+        if (thread == 0)
+        {
+            m_codes = m_scratch.codes[sorted].data();
+            m_order = m_scratch.order[sorted].data();
+        }
+
+        endStage(stats.sortSeconds);
+
+        if (m_triangleCount > 1)
+        {
+            BuildHierarchy(GetChunkBegin(m_triangleCount - 1, thread, m_threadCount), GetChunkBegin(m_triangleCount - 1, thread + 1, m_threadCount));
+        }
+
+        InitializeLeaves(begin, end);
+        endStage(stats.hierarchySeconds);
+
+        for (uint32_t pass = 0; pass < (std::max)(1u, m_settings.treeletPasses); pass++)
+        {
+            if (pass > 0)
+            {
+                ResetVisits(thread);
+                m_barrier.Wait();
+            }
+
+            if (m_triangleCount > 1)
+            {
+                // Later passes only revisit the larger subtrees, as in the paper
+                const uint32_t minTreeletTriangles = pass < m_settings.treeletPasses ? TreeletSize << pass : 0;
+                UpdateBottomUp(begin, end, minTreeletTriangles, m_threadStats[thread]);
+            }
+
+            endStage(pass == 0 ? stats.boundsSeconds : stats.treeletSeconds);
+        }
+
+        if (thread == 0)
+        {
+            PlanOutput();
+        }
+
+        m_barrier.Wait();
+
+        for (uint32_t task = m_nextOutputTask++; task < m_scratch.outputTasks.size(); task = m_nextOutputTask++)
+        {
+            WriteSubtree(m_scratch.outputTasks[task], m_threadStats[thread]);
+        }
+
+        endStage(stats.outputSeconds);
+    }
+
+    void BoundTriangles(uint32_t thread, uint32_t begin, uint32_t end)
+    {
+        BvhBounds centroids;
+
+        for (uint32_t triangle = begin; triangle < end; triangle++)
+        {
+            const float* corners[3];
+            m_geometry.GetTriangle(triangle, corners);
+
+            BvhBounds& bounds = m_scratch.triangleBounds[triangle];
+            bounds = BvhBounds();
+            bounds.Grow(corners[0]);
+            bounds.Grow(corners[1]);
+            bounds.Grow(corners[2]);
+
+            const float centroid[3] = { bounds.GetCenter(0), bounds.GetCenter(1), bounds.GetCenter(2) };
+            centroids.Grow(centroid);
+        }
+
+        m_chunkCentroids[thread] = centroids;
+    }
+
+    // Quantize each centroid on a grid over the centroid bounds and interleave the bits
+    void ComputeCodes(uint32_t begin, uint32_t end)
+    {
+        const uint32_t bitsPerAxis = m_settings.wideMortonCodes ? 21 : 10;
+        const float cells = static_cast<float>(1u << bitsPerAxis);
+        const uint32_t lastCell = (1u << bitsPerAxis) - 1;
+        float scale[3];
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            const float extent = m_centroidBounds.max[axis] - m_centroidBounds.min[axis];
+            scale[axis] = extent > 0.0f ? cells / extent : 0.0f;
+        }
+
+        uint64_t* codes = m_scratch.codes[0].data();
+        uint32_t* order = m_scratch.order[0].data();
+
+        for (uint32_t triangle = begin; triangle < end; triangle++)
+        {
+            const BvhBounds& bounds = m_scratch.triangleBounds[triangle];
+            uint64_t code = 0;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                const float cell = (bounds.GetCenter(axis) - m_centroidBounds.min[axis]) * scale[axis];
+                code |= SpreadBits((std::min)(static_cast<uint32_t>(cell), lastCell)) << (2 - axis);
+            }
+
+            codes[triangle] = code;
+            order[triangle] = triangle;
+        }
+    }
+
+    // Least significant digit first radix sort of the codes, carrying the triangle
+    // indices along. Each thread counts its chunk, thread 0 turns the counts into
+    // offsets, and each thread scatters its chunk, which keeps the sort stable.
+    // Returns which of the two buffers holds the result.
+    uint32_t Sort(uint32_t thread, uint32_t begin, uint32_t end)
+    {
+        const uint32_t codeBits = m_settings.wideMortonCodes ? 63 : 30;
+        const uint32_t passCount = (codeBits + 10) / 11;
+        const uint32_t digitBits = (codeBits + passCount - 1) / passCount;
+        const uint32_t digitCount = 1u << digitBits;
+        const uint64_t digitMask = digitCount - 1;
+        uint32_t* histogram = &m_scratch.histograms[static_cast<size_t>(thread) * digitCount];
+        uint32_t source = 0;
+
+        for (uint32_t pass = 0; pass < passCount; pass++)
+        {
+            const uint32_t shift = pass * digitBits;
+            const uint64_t* codes = m_scratch.codes[source].data();
+            const uint32_t* order = m_scratch.order[source].data();
+
+            std::fill(histogram, histogram + digitCount, 0);
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                histogram[(codes[i] >> shift) & digitMask]++;
+            }
+
+            m_barrier.Wait();
+
+            if (thread == 0)
+            {
+                // Offsets by digit, then by thread; a digit every code shares needs no pass
+                uint32_t offset = 0;
+                m_skipPass = false;
+
+                for (uint32_t digit = 0; digit < digitCount; digit++)
+                {
+                    for (uint32_t i = 0; i < m_threadCount; i++)
+                    {
+                        uint32_t& count = m_scratch.histograms[static_cast<size_t>(i) * digitCount + digit];
+                        m_skipPass |= count == m_triangleCount;
+                        const uint32_t next = offset + count;
+                        count = offset;
+                        offset = next;
+                    }
+                }
+            }
+
+            m_barrier.Wait();
+
+            if (m_skipPass)
+            {
+                continue;
+            }
+
+            uint64_t* sortedCodes = m_scratch.codes[source ^ 1].data();
+            uint32_t* sortedOrder = m_scratch.order[source ^ 1].data();
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const uint32_t position = histogram[(codes[i] >> shift) & digitMask]++;
+                sortedCodes[position] = codes[i];
+                sortedOrder[position] = order[i];
+            }
+
+            source ^= 1;
+            m_barrier.Wait();
+        }
+
+        return source;
+    }
+
+    // Length of the common prefix of two sorted codes, with equal codes told apart by
+    // their position; -1 outside the array
+    int32_t GetCommonPrefix(int64_t i, int64_t j) const
+    {
+        if (j < 0 || j >= m_triangleCount)
+        {
+            return -1;
+        }
+
+        const uint64_t difference = m_codes[i] ^ m_codes[j];
+
+        if (difference != 0)
+        {
+            return static_cast<int32_t>(CountLeadingZeros(difference));
+        }
+
+        // 64 plus the leading zeros of the 32-bit positions
+        return static_cast<int32_t>(32 + CountLeadingZeros(static_cast<uint64_t>(i ^ j)));
+    }
+
+    // Each interior node finds the range of sorted triangles it covers and where that
+    // range splits, independently of all others
+    void BuildHierarchy(uint32_t begin, uint32_t end)
+    {
+        const uint32_t firstLeaf = m_triangleCount - 1;
+
+        if (begin == 0)
+        {
+            m_scratch.parents[0] = InvalidNode;
+        }
+
+        for (uint32_t node = begin; node < end; node++)
+        {
+            const int64_t i = node;
+            const int64_t direction = GetCommonPrefix(i, i + 1) > GetCommonPrefix(i, i - 1) ? 1 : -1;
+            const int32_t minPrefix = GetCommonPrefix(i, i - direction);
+
+            // Upper bound on the length of the range, then its exact other end
+            int64_t maxLength = 2;
+
+            while (GetCommonPrefix(i, i + maxLength * direction) > minPrefix)
+            {
+                maxLength *= 2;
+            }
+
+            int64_t length = 0;
+
+            for (int64_t step = maxLength / 2; step >= 1; step /= 2)
+            {
+                if (GetCommonPrefix(i, i + (length + step) * direction) > minPrefix)
+                {
+                    length += step;
+                }
+            }
+
+            const int64_t j = i + length * direction;
+            const int32_t nodePrefix = GetCommonPrefix(i, j);
+
+            // The split is where the prefix of the whole range ends
+            int64_t split = 0;
+
+            for (int64_t divisor = 2;; divisor *= 2)
+            {
+                const int64_t step = (length + divisor - 1) / divisor;
+
+                if (GetCommonPrefix(i, i + (split + step) * direction) > nodePrefix)
+                {
+                    split += step;
+                }
+
+                if (step <= 1)
+                {
+                    break;
+                }
+            }
+
+            const int64_t gamma = i + split * direction + (std::min)(direction, int64_t(0));
+            const uint32_t left = static_cast<uint32_t>((std::min)(i, j) == gamma ? firstLeaf + gamma : gamma);
+            const uint32_t right = static_cast<uint32_t>((std::max)(i, j) == gamma + 1 ? firstLeaf + gamma + 1 : gamma + 1);
+
+            m_scratch.children[node * 2] = left;
+            m_scratch.children[node * 2 + 1] = right;
+            m_scratch.parents[left] = node;
+            m_scratch.parents[right] = node;
+            m_scratch.visits[node].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void InitializeLeaves(uint32_t begin, uint32_t end)
+    {
+        const uint32_t firstLeaf = m_triangleCount - 1;
+
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const BvhBounds& bounds = m_scratch.triangleBounds[m_order[i]];
+            m_scratch.bounds[firstLeaf + i] = bounds;
+            m_scratch.costs[firstLeaf + i] = m_settings.intersectionCost * bounds.GetHalfArea();
+            m_scratch.triangleCounts[firstLeaf + i] = 1;
+            m_scratch.pairCounts[firstLeaf + i] = 0;
+        }
+    }
+
+    void ResetVisits(uint32_t thread)
+    {
+        const uint32_t interiorCount = m_triangleCount - 1;
+
+        for (uint32_t node = GetChunkBegin(interiorCount, thread, m_threadCount); node < GetChunkBegin(interiorCount, thread + 1, m_threadCount); node++)
+        {
+            m_scratch.visits[node].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Climb from each leaf of the chunk; the first thread to reach a node stops there,
+    // the second finds both children done and updates it. Treelets are restructured at
+    // nodes with at least minTreeletTriangles below them, 0 for none.
+    void UpdateBottomUp(uint32_t begin, uint32_t end, uint32_t minTreeletTriangles, ThreadStats& threadStats)
+    {
+        const uint32_t firstLeaf = m_triangleCount - 1;
+
+        for (uint32_t i = begin; i < end; i++)
+        {
+            uint32_t node = m_scratch.parents[firstLeaf + i];
+
+            while (node != InvalidNode && m_scratch.visits[node].fetch_add(1, std::memory_order_acq_rel) == 1)
+            {
+                UpdateNode(node);
+
+                if (minTreeletTriangles > 0 && m_scratch.triangleCounts[node] >= minTreeletTriangles && RestructureTreelet(node))
+                {
+                    threadStats.treeletsRestructured++;
+                }
+
+                node = m_scratch.parents[node];
+            }
+        }
+    }
+
+    // Bounds and SAH cost from the children, collapsing the subtree into a leaf where
+    // that is allowed and cheaper
+    void UpdateNode(uint32_t node)
+    {
+        const uint32_t left = m_scratch.children[node * 2];
+        const uint32_t right = m_scratch.children[node * 2 + 1];
+
+        BvhBounds bounds = m_scratch.bounds[left];
+        bounds.Grow(m_scratch.bounds[right]);
+
+        const float area = bounds.GetHalfArea();
+        const uint32_t triangleCount = m_scratch.triangleCounts[left] + m_scratch.triangleCounts[right];
+        const float splitCost = m_settings.traversalCost * area + m_scratch.costs[left] + m_scratch.costs[right];
+        const float leafCost = m_settings.intersectionCost * area * triangleCount;
+
+        m_scratch.bounds[node] = bounds;
+        m_scratch.triangleCounts[node] = triangleCount;
+
+        if (triangleCount <= m_settings.maxLeafSize && leafCost <= splitCost)
+        {
+            m_scratch.costs[node] = leafCost;
+            m_scratch.pairCounts[node] = 0;
+        }
+        else
+        {
+            m_scratch.costs[node] = splitCost;
+            m_scratch.pairCounts[node] = 1 + m_scratch.pairCounts[left] + m_scratch.pairCounts[right];
+        }
+    }
+
+    // Grow a treelet below root by opening its largest leaf until it has TreeletSize
+    // leaves, find the cheapest binary tree over them by trying every split of every
+    // subset, and rebuild the treelet's interior nodes to match if it beats the current
+    // one. Returns whether it did.
+    bool RestructureTreelet(uint32_t root)
+    {
+        const uint32_t leafCount = TreeletSize;
+        const uint32_t subsetCount = 1u << leafCount;
+        const uint32_t firstLeaf = m_triangleCount - 1;
+
+        uint32_t leaves[leafCount] = { m_scratch.children[root * 2], m_scratch.children[root * 2 + 1] };
+        uint32_t interiors[leafCount - 1] = { root };
+        uint32_t treeletLeafCount = 2;
+        uint32_t interiorCount = 1;
+
+        while (treeletLeafCount < leafCount)
+        {
+            uint32_t largest = leafCount;
+            float largestArea = -1.0f;
+
+            for (uint32_t i = 0; i < treeletLeafCount; i++)
+            {
+                const float area = m_scratch.bounds[leaves[i]].GetHalfArea();
+
+                if (leaves[i] < firstLeaf && area > largestArea)
+                {
+                    largest = i;
+                    largestArea = area;
+                }
+            }
+
+            const uint32_t opened = leaves[largest];
+            interiors[interiorCount++] = opened;
+            leaves[largest] = m_scratch.children[opened * 2];
+            leaves[treeletLeafCount++] = m_scratch.children[opened * 2 + 1];
+        }
+
+        static const TreeletSubsets order;
+        BvhBounds bounds[subsetCount];
+        float areas[subsetCount];
+        float costs[subsetCount];
+        uint32_t triangleCounts[subsetCount];
+        uint8_t partitions[subsetCount];
+
+        triangleCounts[0] = 0;
+
+        for (uint32_t subset = 1; subset < subsetCount; subset++)
+        {
+            const uint32_t rest = subset & (subset - 1);
+            uint32_t lowest = 0;
+
+            while (!((subset >> lowest) & 1))
+            {
+                lowest++;
+            }
+
+            bounds[subset] = bounds[rest];
+            bounds[subset].Grow(m_scratch.bounds[leaves[lowest]]);
+            areas[subset] = bounds[subset].GetHalfArea();
+            triangleCounts[subset] = triangleCounts[rest] + m_scratch.triangleCounts[leaves[lowest]];
+
+            if (rest == 0)
+            {
+                costs[subset] = m_scratch.costs[leaves[lowest]];
+            }
+        }
+
+        for (uint8_t subset : order.subsets)
+        {
+            if (!(subset & (subset - 1)))
+            {
+                continue;
+            }
+
+            // Every split into two non-empty parts, each pair once
+            const uint32_t delta = (subset - 1) & subset;
+            uint32_t part = (0u - delta) & subset;
+            float bestCost = 3.402823466e+38f;
+            uint32_t bestPart = part;
+
+            do
+            {
+                // Selects rather than a branch, which would be unpredictable
+                const float cost = costs[part] + costs[subset ^ part];
+                const bool better = cost < bestCost;
+                bestCost = better ? cost : bestCost;
+                bestPart = better ? part : bestPart;
+
+                part = (part - delta) & subset;
+            } while (part != 0);
+
+            partitions[subset] = static_cast<uint8_t>(bestPart);
+
+            costs[subset] = m_settings.traversalCost * areas[subset] + bestCost;
+
+            if (triangleCounts[subset] <= m_settings.maxLeafSize)
+            {
+                costs[subset] = (std::min)(costs[subset], m_settings.intersectionCost * areas[subset] * triangleCounts[subset]);
+            }
+        }
+
+        // Ignore float noise, or equal trees would be rebuilt forever
+        if (costs[subsetCount - 1] >= m_scratch.costs[root] * 0.9999f)
+        {
+            return false;
+        }
+
+        uint32_t nextInterior = 1;
+        AssignTreelet(subsetCount - 1, root, leaves, interiors, partitions, nextInterior);
+        return true;
+    }
+
+    void AssignTreelet(uint32_t subset, uint32_t node, const uint32_t* leaves, const uint32_t* interiors, const uint8_t* partitions, uint32_t& nextInterior)
+    {
+        const uint32_t parts[2] = { partitions[subset], subset ^ partitions[subset] };
+
+        for (uint32_t side = 0; side < 2; side++)
+        {
+            uint32_t child;
+
+            if (parts[side] & (parts[side] - 1))
+            {
+                child = interiors[nextInterior++];
+                AssignTreelet(parts[side], child, leaves, interiors, partitions, nextInterior);
+            }
+            else
+            {
+                uint32_t leaf = 0;
+
+                while (!((parts[side] >> leaf) & 1))
+                {
+                    leaf++;
+                }
+
+                child = leaves[leaf];
+            }
+
+            m_scratch.children[node * 2 + side] = child;
+            m_scratch.parents[child] = node;
+        }
+
+        UpdateNode(node);
+    }
+
+    // Write the top of the tree on thread 0, until there are enough subtrees to share
+    // out. Output positions follow from the subtree sizes: a node's children take the
+    // next pair, then the left subtree's pairs and triangles come before the right's.
+    void PlanOutput()
+    {
+        // The root and the padding node come first
+        m_nodes.resize(2 + static_cast<size_t>(m_scratch.pairCounts[0]) * 2);
+        m_nodes[1] = BvhNode();
+
+        auto& tasks = m_scratch.outputTasks;
+        tasks.clear();
+        tasks.push_back({ 0, 0, 0, 0, 0 });
+        m_nextOutputTask = 0;
+
+        const uint32_t taskTarget = m_threadCount > 1 ? m_threadCount * 8 : 1;
+
+        while (tasks.size() < taskTarget)
+        {
+            size_t largest = tasks.size();
+
+            for (size_t i = 0; i < tasks.size(); i++)
+            {
+                const OutputTask& task = tasks[i];
+
+                if (IsOutputInterior(task) &&
+                    (largest == tasks.size() || m_scratch.triangleCounts[task.node] > m_scratch.triangleCounts[tasks[largest].node]))
+                {
+                    largest = i;
+                }
+            }
+
+            if (largest == tasks.size())
+            {
+                break;
+            }
+
+            const OutputTask task = tasks[largest];
+            OutputTask children[2];
+            WriteInterior(task, children);
+            tasks[largest] = children[0];
+            tasks.push_back(children[1]);
+        }
+    }
+
+    bool IsOutputInterior(const OutputTask& task) const
+    {
+        // Anything deeper than the traversal stack allows becomes a leaf
+        return m_scratch.pairCounts[task.node] > 0 && task.depth + 1 < Bvh::MaxDepth;
+    }
+
+    void WriteInterior(const OutputTask& task, OutputTask children[2])
+    {
+        const uint32_t left = m_scratch.children[task.node * 2];
+        const uint32_t right = m_scratch.children[task.node * 2 + 1];
+        const uint32_t firstChild = 2 + task.pairBase * 2;
+
+        WriteNode(task, firstChild, 0);
+
+        children[0] = { left, firstChild, task.pairBase + 1, task.primitiveOffset, task.depth + 1 };
+        children[1] = { right, firstChild + 1, task.pairBase + 1 + m_scratch.pairCounts[left],
+                        task.primitiveOffset + m_scratch.triangleCounts[left], task.depth + 1 };
+    }
+
+    void WriteNode(const OutputTask& task, uint32_t offset, uint32_t count)
+    {
+        const BvhBounds& bounds = m_scratch.bounds[task.node];
+        BvhNode& node = m_nodes[task.slot];
+        std::copy(bounds.min, bounds.min + 3, node.boundsMin);
+        std::copy(bounds.max, bounds.max + 3, node.boundsMax);
+        node.offset = offset;
+        node.count = count;
+    }
+
+    void WriteSubtree(const OutputTask& root, ThreadStats& threadStats)
+    {
+        const uint32_t firstLeaf = m_triangleCount - 1;
+        std::vector<OutputTask> stack(1, root);
+        std::vector<uint32_t> gather;
+
+        while (!stack.empty())
+        {
+            const OutputTask task = stack.back();
+            stack.pop_back();
+
+            if (IsOutputInterior(task))
+            {
+                OutputTask children[2];
+                WriteInterior(task, children);
+                stack.push_back(children[1]);
+                stack.push_back(children[0]);
+                continue;
+            }
+
+            // Collapse the subtree: its triangles, left to right, become the leaf's
+            WriteNode(task, task.primitiveOffset, m_scratch.triangleCounts[task.node]);
+            threadStats.leaves++;
+            threadStats.maxDepth = (std::max)(threadStats.maxDepth, task.depth);
+
+            uint32_t primitive = task.primitiveOffset;
+            gather.assign(1, task.node);
+
+            while (!gather.empty())
+            {
+                const uint32_t node = gather.back();
+                gather.pop_back();
+
+                if (node >= firstLeaf)
+                {
+                    m_primitives[primitive++] = m_order[node - firstLeaf];
+                }
+                else
+                {
+                    gather.push_back(m_scratch.children[node * 2 + 1]);
+                    gather.push_back(m_scratch.children[node * 2]);
+                }
+            }
+        }
+    }
+
+    const Settings& m_settings;
+    const BvhGeometry& m_geometry;
+    Scratch& m_scratch;
+    Bvh::NodeArray& m_nodes;
+    std::vector<uint32_t>& m_primitives;
+    const uint32_t m_triangleCount;
+    const uint32_t m_threadCount;
+
+    Barrier m_barrier;
+    std::vector<BvhBounds> m_chunkCentroids;
+    BvhBounds m_centroidBounds;
+    bool m_skipPass = false;
+    const uint64_t* m_codes = nullptr;
+    const uint32_t* m_order = nullptr;
+    std::atomic<uint32_t> m_nextOutputTask{ 0 };
+    std::vector<ThreadStats> m_threadStats;
+};
+
+LbvhBuilder::LbvhBuilder(const Settings& settings) : m_settings(settings), m_scratch(new Scratch())
+{
+    if (settings.maxLeafSize == 0)
+    {
+        throw std::runtime_error("BVH leaves must hold at least one triangle");
+    }
+}
+
+LbvhBuilder::~LbvhBuilder() = default;
+
+void LbvhBuilder::Build(const BvhGeometry& geometry, Bvh& bvh)
+{
+    const auto start = std::chrono::steady_clock::now();
+    const uint32_t triangleCount = geometry.GetTriangleCount();
+
+    bvh.m_triangleCount = triangleCount;
+    m_stats = Stats();
+    m_stats.triangles = triangleCount;
+
+    if (triangleCount == 0)
+    {
+        bvh.m_nodes.clear();
+        bvh.m_primitiveIndices.clear();
+        return;
+    }
+
+    const uint32_t hardwareThreads = m_settings.threads > 0 ? m_settings.threads : (std::max)(1u, std::thread::hardware_concurrency());
+    const uint32_t threadCount = (std::min)(hardwareThreads, (std::max)(1u, triangleCount / MinTrianglesPerThread));
+    const uint32_t nodeCount = triangleCount * 2 - 1;
+    const uint32_t digitCount = 1u << (m_settings.wideMortonCodes ? 11 : 10);
+
+    // Sizes only grow, so a mesh rebuilt every frame allocates once
+    Scratch& scratch = *m_scratch;
+    scratch.triangleBounds.resize(triangleCount);
+    scratch.histograms.resize(static_cast<size_t>(threadCount) * digitCount);
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        scratch.codes[i].resize(triangleCount);
+        scratch.order[i].resize(triangleCount);
+    }
+
+    scratch.children.resize(static_cast<size_t>(triangleCount - 1) * 2);
+    scratch.parents.resize(nodeCount);
+    scratch.bounds.resize(nodeCount);
+    scratch.costs.resize(nodeCount);
+    scratch.triangleCounts.resize(nodeCount);
+    scratch.pairCounts.resize(nodeCount);
+
+    if (scratch.visitCapacity < triangleCount)
+    {
+        scratch.visits.reset(new std::atomic<uint32_t>[triangleCount]);
+        scratch.visitCapacity = triangleCount;
+    }
+
+    // The node array is sized by the last stage, once the root knows how many interior
+    // nodes there are
+    bvh.m_primitiveIndices.resize(triangleCount);
+
+    BuildContext context(m_settings, geometry, scratch, bvh.m_nodes, bvh.m_primitiveIndices, threadCount);
+    context.Run(m_stats);
+
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_stats.nodes = static_cast<uint32_t>(bvh.m_nodes.size()) - 1;
+    m_stats.threads = threadCount;
+}
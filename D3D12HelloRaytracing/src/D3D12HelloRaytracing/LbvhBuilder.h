@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Bvh.h"
+
+#include <cstdint>
+#include <memory>
+
+/// Linear BVH builder for geometry that changes every frame, trading tree quality for
+/// build speed (Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees,
+/// and k-d Trees"). Triangle centroids are quantized to Morton codes and radix sorted,
+/// every interior node is then found on its own from the sorted codes, and bounds are
+/// filled in bottom-up, the second thread to reach a node carrying on to its parent.
+/// Geometry comes in as the same BvhGeometry view of a DXMesh's vertex and index arrays
+/// that BvhBuilder takes, and the output has BvhBuilder's layout.
+///
+/// Treelet restructuring (Karras and Aila, "Fast Parallel Construction of High-Quality
+/// Bounding Volume Hierarchies") recovers much of the quality: in each bottom-up pass,
+/// every node with enough triangles below it is the root of a treelet of TreeletSize
+/// subtrees, which is rearranged into the cheapest binary tree over them. Enough is
+/// TreeletSize in the first pass and doubles with each further pass.
+/// Without it the tree has one triangle per leaf; in both cases subtrees of up to
+/// maxLeafSize triangles are then collapsed into a leaf where that is cheaper.
+///
+/// Threads and scratch memory are set up per build, but the scratch is kept between
+/// builds so that rebuilding the same mesh every frame does not allocate.
+class LbvhBuilder
+{
+public:
+    /// Subtrees in a treelet; 7 gives 127 subsets for the exhaustive search
+    static const uint32_t TreeletSize = 7;
+
+    struct Settings
+    {
+        /// 63-bit Morton codes (21 bits per axis) instead of 30-bit, for meshes whose
+        /// triangles are small next to the whole
+        bool wideMortonCodes = false;
+        /// Bottom-up treelet restructuring passes, 0 for a plain linear BVH
+        uint32_t treeletPasses = 0;
+        /// Most triangles in a leaf, at least 1
+        uint32_t maxLeafSize = 4;
+        /// SAH costs of visiting an interior node and intersecting a triangle
+        float traversalCost = 1.0f;
+        float intersectionCost = 1.0f;
+        /// Worker threads, 0 for one per hardware thread
+        uint32_t threads = 0;
+    };
+
+    struct Stats
+    {
+        double seconds = 0.0;
+        /// Scene bounds and Morton codes
+        double mortonSeconds = 0.0;
+        double sortSeconds = 0.0;
+        /// Karras' interior nodes
+        double hierarchySeconds = 0.0;
+        /// Bottom-up bounds, including the first treelet pass
+        double boundsSeconds = 0.0;
+        /// Further treelet passes
+        double treeletSeconds = 0.0;
+        /// Leaf collapsing and writing the node array
+        double outputSeconds = 0.0;
+        uint32_t triangles = 0;
+        uint32_t nodes = 0;
+        uint32_t leaves = 0;
+        uint32_t maxDepth = 0;
+        uint32_t threads = 0;
+        /// Treelets rearranged into a cheaper tree, over all passes
+        uint32_t treeletsRestructured = 0;
+    };
+
+    /// Throws std::runtime_error if the settings are out of range
+    explicit LbvhBuilder(const Settings& settings);
+    ~LbvhBuilder();
+
+    /// Replace the contents of bvh with a hierarchy over the triangles of geometry
+    void Build(const BvhGeometry& geometry, Bvh& bvh);
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct Scratch;
+    class BuildContext;
+
+    Settings m_settings;
+    Stats m_stats;
+    std::unique_ptr<Scratch> m_scratch;
+};
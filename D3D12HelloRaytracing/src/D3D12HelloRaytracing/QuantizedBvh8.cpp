@@ -0,0 +1,495 @@
+#include "QuantizedBvh8.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    const uint32_t Width = QuantizedBvh8Node::Width;
+    const uint32_t InvalidNode = 0xFFFFFFFF;
+
+    // Bvh8's bound, plus the levels that split leaves too large for one node can add
+    const uint32_t StackSize = Bvh8::StackSize + (Width - 1) * 8;
+
+    uint32_t CountTrailingZeros(uint32_t value)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return index;
+#else
+        return __builtin_ctz(value);
+#endif
+    }
+
+    uint32_t CountBits(uint32_t value)
+    {
+#ifdef _MSC_VER
+        return __popcnt(value);
+#else
+        return __builtin_popcount(value);
+#endif
+    }
+
+    // 2^exponent, built from the bits so that it is exact and cheap
+    float GetScale(int8_t exponent)
+    {
+        const uint32_t bits = static_cast<uint32_t>(exponent + 127) << 23;
+        float scale;
+        memcpy(&scale, &bits, sizeof(scale));
+        return scale;
+    }
+
+    // A child being compressed: a node of the source hierarchy, or a range of triangle
+    // references that is too large for one lane
+    struct Source
+    {
+        BvhBounds bounds;
+        uint32_t wideNode;
+        uint32_t offset;
+        uint32_t count;
+    };
+
+    // The children of a source as lanes: a source's interior children and ranges that
+    // need splitting become interior lanes
+    uint32_t GetLanes(const Bvh8& bvh, const Source& source, Source lanes[Width])
+    {
+        uint32_t laneCount = 0;
+
+        if (source.wideNode != InvalidNode)
+        {
+            const Bvh8Node& node = bvh.GetNodes()[source.wideNode];
+
+            for (uint32_t lane = 0; lane < Width; lane++)
+            {
+                if (node.boundsMin[0][lane] > node.boundsMax[0][lane])
+                {
+                    continue;
+                }
+
+                Source& child = lanes[laneCount++];
+
+                for (uint32_t axis = 0; axis < 3; axis++)
+                {
+                    child.bounds.min[axis] = node.boundsMin[axis][lane];
+                    child.bounds.max[axis] = node.boundsMax[axis][lane];
+                }
+
+                child.wideNode = node.counts[lane] > 0 ? InvalidNode : node.offsets[lane];
+                child.offset = node.offsets[lane];
+                child.count = node.counts[lane];
+            }
+        }
+        else
+        {
+            // Split the range evenly over the lanes, in lanes of at most MaxLeafTriangles
+            // where that is enough
+            const uint32_t parts = (std::min)(Width, (source.count + QuantizedBvh8Node::MaxLeafTriangles - 1) / QuantizedBvh8Node::MaxLeafTriangles);
+
+            for (uint32_t part = 0; part < parts; part++)
+            {
+                const uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(source.count) * part / parts);
+                const uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(source.count) * (part + 1) / parts);
+                lanes[laneCount++] = { source.bounds, InvalidNode, source.offset + begin, end - begin };
+            }
+        }
+
+        return laneCount;
+    }
+
+    bool IsInteriorLane(const Source& lane)
+    {
+        return lane.wideNode != InvalidNode || lane.count > QuantizedBvh8Node::MaxLeafTriangles;
+    }
+
+    // Smallest power of two grid over the node's box, per axis, on which every child's
+    // decoded bounds contain its bounds. Decoding computes origin + q * scale in floats,
+    // so that is what is checked.
+    void Quantize(const Source lanes[Width], uint32_t laneCount, QuantizedBvh8Node& node)
+    {
+        BvhBounds bounds;
+
+        for (uint32_t lane = 0; lane < laneCount; lane++)
+        {
+            bounds.Grow(lanes[lane].bounds);
+        }
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            const float origin = bounds.min[axis];
+            const float extent = bounds.max[axis] - origin;
+            int exponent = -126;
+
+            // frexp gives extent / 255 < 2^exponent, so the grid covers the box unless
+            // rounding the decoded bounds outwards pushes a child past 255
+            if (extent > 0.0f)
+            {
+                std::frexp(extent / 255.0f, &exponent);
+                exponent = (std::max)(exponent, -126);
+            }
+
+            for (;; exponent++)
+            {
+                const float scale = GetScale(static_cast<int8_t>(exponent));
+                bool fits = true;
+
+                for (uint32_t lane = 0; lane < laneCount && fits; lane++)
+                {
+                    const float childMin = lanes[lane].bounds.min[axis];
+                    const float childMax = lanes[lane].bounds.max[axis];
+                    float low = (std::min)(std::floor((childMin - origin) / scale), 255.0f);
+                    float high = (std::max)(std::ceil((childMax - origin) / scale), 0.0f);
+
+                    while (low > 0.0f && origin + low * scale > childMin)
+                    {
+                        low -= 1.0f;
+                    }
+
+                    while (high <= 255.0f && origin + high * scale < childMax)
+                    {
+                        high += 1.0f;
+                    }
+
+                    fits = high <= 255.0f;
+
+                    if (fits)
+                    {
+                        node.quantizedMin[axis][lane] = static_cast<uint8_t>(low);
+                        node.quantizedMax[axis][lane] = static_cast<uint8_t>(high);
+                    }
+                }
+
+                if (fits)
+                {
+                    break;
+                }
+            }
+
+            node.origin[axis] = origin;
+            node.exponents[axis] = static_cast<int8_t>(exponent);
+
+            // Unused lanes decode to min > max, which never hits
+            for (uint32_t lane = laneCount; lane < Width; lane++)
+            {
+                node.quantizedMin[axis][lane] = 255;
+                node.quantizedMax[axis][lane] = 0;
+            }
+        }
+    }
+
+    struct RayContext
+    {
+        /// Fourth elements 0, for four-wide loads
+        float origin[4] = {};
+        float inverseDirection[4] = {};
+        uint32_t nearOffset[3];
+        uint32_t farOffset[3];
+        float tMin;
+
+        explicit RayContext(const BvhRay& ray) : tMin(ray.tMin)
+        {
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                // Keep 0 * inf out of the slab test, as Bvh does
+                const float d = ray.direction[axis];
+                origin[axis] = ray.origin[axis];
+                inverseDirection[axis] = 1.0f / (d != 0.0f ? d : (std::signbit(d) ? -1e-30f : 1e-30f));
+
+                // Offsets in bytes from quantizedMin[0][0]; quantizedMax follows quantizedMin
+                const uint32_t minOffset = axis * Width;
+                const uint32_t maxOffset = (3 + axis) * Width;
+                nearOffset[axis] = inverseDirection[axis] >= 0.0f ? minOffset : maxOffset;
+                farOffset[axis] = inverseDirection[axis] >= 0.0f ? maxOffset : minOffset;
+            }
+        }
+    };
+
+    // Decode the children's boxes and test the ray against them, as Bvh8 does. Unused
+    // lanes are masked out rather than trusted to miss, as their decoded boxes can be
+    // empty but touching on flat nodes.
+    uint32_t IntersectChildren(const QuantizedBvh8Node& node, const RayContext& ray, float tMax, float distances[Width], uint32_t lanes[Width])
+    {
+        const uint8_t* quantized = &node.quantizedMin[0][0];
+
+#if defined(__AVX2__)
+        const __m128i counts = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.triangleCounts));
+        const uint32_t emptyMask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(counts, _mm_setzero_si128())));
+        const uint32_t usedMask = node.interiorMask | (~emptyMask & 0xFF);
+
+        __m256 tEntry = _mm256_set1_ps(ray.tMin);
+        __m256 tExit = _mm256_set1_ps(tMax);
+
+        // (origin + q * scale - rayOrigin) * inverse as one multiply-add per plane, with the
+        // slopes and offsets of the three axes computed together. The node's fourth lane
+        // holds the exponents' bytes and is cleared so that it cannot be a denormal.
+        int32_t exponentBytes;
+        memcpy(&exponentBytes, node.exponents, sizeof(exponentBytes));
+        const __m128 inverse = _mm_loadu_ps(ray.inverseDirection);
+        const __m128i exponents = _mm_cvtepi8_epi32(_mm_cvtsi32_si128(exponentBytes));
+        const __m128 scales = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(exponents, _mm_set1_epi32(127)), 23));
+        const __m128 nodeOrigin = _mm_and_ps(_mm_loadu_ps(node.origin), _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+        alignas(16) float slopes[4];
+        alignas(16) float offsets[4];
+        _mm_store_ps(slopes, _mm_mul_ps(scales, inverse));
+        _mm_store_ps(offsets, _mm_mul_ps(_mm_sub_ps(nodeOrigin, _mm_loadu_ps(ray.origin)), inverse));
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            const __m256 slope = _mm256_set1_ps(slopes[axis]);
+            const __m256 offset = _mm256_set1_ps(offsets[axis]);
+
+            const __m256 quantizedNear = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(quantized + ray.nearOffset[axis]))));
+            const __m256 quantizedFar = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(quantized + ray.farOffset[axis]))));
+
+            tEntry = _mm256_max_ps(tEntry, _mm256_fmadd_ps(quantizedNear, slope, offset));
+            tExit = _mm256_min_ps(tExit, _mm256_fmadd_ps(quantizedFar, slope, offset));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(tEntry, tExit, _CMP_LE_OQ))) & usedMask;
+        alignas(32) float entries[Width];
+        _mm256_store_ps(entries, tEntry);
+#else
+        uint32_t usedMask = node.interiorMask;
+
+        for (uint32_t lane = 0; lane < Width; lane++)
+        {
+            usedMask |= node.triangleCounts[lane] > 0 ? 1u << lane : 0;
+        }
+
+        float entries[Width];
+        uint32_t mask = 0;
+
+        for (uint32_t lane = 0; lane < Width; lane++)
+        {
+            float tEntry = ray.tMin;
+            float tExit = tMax;
+
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                const float slope = GetScale(node.exponents[axis]) * ray.inverseDirection[axis];
+                const float offset = (node.origin[axis] - ray.origin[axis]) * ray.inverseDirection[axis];
+                const float tNear = quantized[ray.nearOffset[axis] + lane] * slope + offset;
+                const float tFar = quantized[ray.farOffset[axis] + lane] * slope + offset;
+                tEntry = tNear > tEntry ? tNear : tEntry;
+                tExit = tFar < tExit ? tFar : tExit;
+            }
+
+            entries[lane] = tEntry;
+            mask |= tEntry <= tExit ? 1u << lane : 0;
+        }
+
+        mask &= usedMask;
+#endif
+
+        uint32_t count = 0;
+
+        for (; mask; mask &= mask - 1)
+        {
+            const uint32_t lane = CountTrailingZeros(mask);
+            distances[count] = entries[lane];
+            lanes[count++] = lane;
+        }
+
+        return count;
+    }
+
+    struct StackEntry
+    {
+        uint32_t offset;
+        /// Triangles of a leaf, 0 for a node
+        uint32_t count;
+        /// Where the ray enters the child's decoded bounds
+        float tEntry;
+    };
+
+    template <bool AnyHit>
+    bool Traverse(const QuantizedBvh8& bvh, const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats)
+    {
+        const auto& nodes = bvh.GetNodes();
+        const auto& primitives = bvh.GetPrimitiveIndices();
+
+        hit = BvhHit();
+
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        const RayContext context(ray);
+        uint64_t nodeVisits = 0;
+        uint64_t triangleTests = 0;
+        float tMax = ray.tMax;
+
+        StackEntry stack[StackSize];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = { 0, 0, ray.tMin };
+
+        while (stackSize > 0)
+        {
+            const StackEntry entry = stack[--stackSize];
+
+            if (entry.tEntry > tMax)
+            {
+                continue;
+            }
+
+            if (entry.count > 0)
+            {
+                for (uint32_t i = entry.offset; i < entry.offset + entry.count; i++)
+                {
+                    const float* corners[3];
+                    geometry.GetTriangle(primitives[i], corners);
+                    triangleTests++;
+
+                    float t, u, v;
+
+                    if (Bvh::IntersectTriangle(corners, ray, tMax, t, u, v))
+                    {
+                        tMax = t;
+                        hit.t = t;
+                        hit.barycentrics[0] = u;
+                        hit.barycentrics[1] = v;
+                        hit.primitiveIndex = primitives[i];
+
+                        if (AnyHit)
+                        {
+                            stackSize = 0;
+                            break;
+                        }
+                    }
+                }
+
+                continue;
+            }
+
+            const QuantizedBvh8Node& node = nodes[entry.offset];
+            nodeVisits++;
+
+            float distances[Width];
+            uint32_t lanes[Width];
+            const uint32_t hitCount = IntersectChildren(node, context, tMax, distances, lanes);
+
+            // Farthest first with ties to the lower lanes first, as in Bvh8
+            for (uint32_t i = 1; i < hitCount; i++)
+            {
+                const float distance = distances[i];
+                const uint32_t lane = lanes[i];
+                uint32_t j = i;
+
+                for (; j > 0 && distances[j - 1] <= distance; j--)
+                {
+                    distances[j] = distances[j - 1];
+                    lanes[j] = lanes[j - 1];
+                }
+
+                distances[j] = distance;
+                lanes[j] = lane;
+            }
+
+            // Byte i of the product is the sum of the counts before lane i, as the counts
+            // of a node add up to less than 256
+            uint64_t counts;
+            memcpy(&counts, node.triangleCounts, sizeof(counts));
+            const uint64_t firstTriangles = (counts * 0x0101010101010101ull) << 8;
+
+            for (uint32_t i = 0; i < hitCount; i++)
+            {
+                const uint32_t lane = lanes[i];
+                const uint32_t below = (1u << lane) - 1;
+                const uint32_t count = node.triangleCounts[lane];
+                const uint32_t offset = count > 0 ? node.triangleBase + static_cast<uint32_t>((firstTriangles >> (lane * 8)) & 0xFF)
+                                                  : node.childBase + CountBits(node.interiorMask & below);
+
+                stack[stackSize++] = { offset, count, distances[i] };
+            }
+        }
+
+        if (stats)
+        {
+            stats->rays++;
+            stats->nodes += nodeVisits;
+            stats->triangles += triangleTests;
+        }
+
+        return hit.IsHit();
+    }
+}
+
+void QuantizedBvh8::Compress(const Bvh8& bvh)
+{
+    m_nodes.clear();
+    m_primitiveIndices.clear();
+    m_triangleCount = bvh.GetTriangleCount();
+
+    if (bvh.GetNodes().empty())
+    {
+        return;
+    }
+
+    const auto& sourcePrimitives = bvh.GetPrimitiveIndices();
+    m_primitiveIndices.reserve(sourcePrimitives.size());
+    m_nodes.reserve(bvh.GetNodes().size());
+
+    // Breadth first, so that each node's interior children can be given consecutive slots
+    // when the node is written
+    std::deque<std::pair<Source, uint32_t>> queue;
+    Source root = { BvhBounds(), 0, 0, 0 };
+    m_nodes.emplace_back();
+    queue.emplace_back(root, 0);
+
+    while (!queue.empty())
+    {
+        const Source source = queue.front().first;
+        const uint32_t index = queue.front().second;
+        queue.pop_front();
+
+        Source lanes[Width];
+        const uint32_t laneCount = GetLanes(bvh, source, lanes);
+
+        QuantizedBvh8Node node = {};
+        Quantize(lanes, laneCount, node);
+        node.childBase = static_cast<uint32_t>(m_nodes.size());
+        node.triangleBase = static_cast<uint32_t>(m_primitiveIndices.size());
+
+        for (uint32_t lane = 0; lane < laneCount; lane++)
+        {
+            if (IsInteriorLane(lanes[lane]))
+            {
+                node.interiorMask |= 1 << lane;
+                queue.emplace_back(lanes[lane], static_cast<uint32_t>(m_nodes.size()));
+                m_nodes.emplace_back();
+            }
+            else
+            {
+                node.triangleCounts[lane] = static_cast<uint8_t>(lanes[lane].count);
+                m_primitiveIndices.insert(m_primitiveIndices.end(), sourcePrimitives.begin() + lanes[lane].offset,
+                                          sourcePrimitives.begin() + lanes[lane].offset + lanes[lane].count);
+            }
+        }
+
+        m_nodes[index] = node;
+    }
+
+    m_nodes.shrink_to_fit();
+}
+
+bool QuantizedBvh8::Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats) const
+{
+    return Traverse<false>(*this, geometry, ray, hit, stats);
+}
+
+bool QuantizedBvh8::IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats) const
+{
+    BvhHit hit;
+    return Traverse<true>(*this, geometry, ray, hit, stats);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Bvh8.h"
+
+#include <cstdint>
+#include <vector>
+
+/// 80-byte eight-wide node in the layout of Ylitie et al., "Efficient Incoherent Ray
+/// Traversal on GPUs Through Compressed Wide BVHs". Child bounds are 8-bit grid positions
+/// in the node's own box: decoded, a child's min is origin + quantizedMin * 2^exponent
+/// per axis, rounded outwards so that the decoded box always contains the child. Children
+/// are not addressed one by one: the interior ones are consecutive nodes from childBase,
+/// in lane order, and the leaves' triangle references are consecutive from triangleBase.
+struct QuantizedBvh8Node
+{
+    static const uint32_t Width = Bvh8Node::Width;
+    /// Most triangles in one leaf lane; larger leaves are split over several lanes
+    static const uint32_t MaxLeafTriangles = 31;
+
+    float origin[3];
+    int8_t exponents[3];
+    /// Bit per lane for interior children
+    uint8_t interiorMask;
+    uint32_t childBase;
+    uint32_t triangleBase;
+    /// Triangles of each leaf lane, 0 for interior and unused lanes. A leaf's references
+    /// start after those of the leaf lanes before it.
+    uint8_t triangleCounts[Width];
+    uint8_t quantizedMin[3][Width];
+    uint8_t quantizedMax[3][Width];
+};
+
+static_assert(sizeof(QuantizedBvh8Node) == 80, "QuantizedBvh8Node must stay 80 bytes");
+
+/// Bvh8 with quantized nodes, for large meshes whose node memory matters more than the
+/// last few percent of traversal speed. Decoding is folded into the slab test, one
+/// multiply-add per plane, so the cost over Bvh8 is converting the bytes to floats and
+/// the rays the looser boxes let into children they miss; hits are the same as Bvh8's.
+/// Where the wide nodes do not fit in cache, the smaller ones are faster.
+class QuantizedBvh8
+{
+public:
+    /// Replace the contents with the compression of a wide hierarchy. Triangle references
+    /// are reordered so that each node's leaves are consecutive.
+    void Compress(const Bvh8& bvh);
+
+    const std::vector<QuantizedBvh8Node>& GetNodes() const { return m_nodes; }
+    const std::vector<uint32_t>& GetPrimitiveIndices() const { return m_primitiveIndices; }
+    uint32_t GetTriangleCount() const { return m_triangleCount; }
+
+    /// Same results as Bvh8::Intersect, up to ties between triangles at the same distance
+    bool Intersect(const BvhGeometry& geometry, const BvhRay& ray, BvhHit& hit, BvhTraversalStats* stats = nullptr) const;
+
+    /// Any hit along a ray, for shadow rays (RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH)
+    bool IsOccluded(const BvhGeometry& geometry, const BvhRay& ray, BvhTraversalStats* stats = nullptr) const;
+
+    size_t GetMemorySize() const { return m_nodes.size() * sizeof(QuantizedBvh8Node) + m_primitiveIndices.size() * sizeof(uint32_t); }
+
+private:
+    std::vector<QuantizedBvh8Node> m_nodes;
+    std::vector<uint32_t> m_primitiveIndices;
+    uint32_t m_triangleCount = 0;
+};
@@ -0,0 +1,546 @@
+#include "SceneBvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    const uint32_t BinCount = 16;
+
+    BvhBounds GetNodeBounds(const BvhNode& node)
+    {
+        BvhBounds bounds;
+        bounds.Grow(node.boundsMin);
+        bounds.Grow(node.boundsMax);
+        return bounds;
+    }
+
+    void SetNodeBounds(const BvhBounds& bounds, BvhNode& node)
+    {
+        std::copy(bounds.min, bounds.min + 3, node.boundsMin);
+        std::copy(bounds.max, bounds.max + 3, node.boundsMax);
+    }
+
+    // Same slab test as Bvh's
+    bool IntersectBounds(const BvhNode& node, const float origin[3], const float inverseDirection[3], float tMin, float tMax, float& tEntry)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            float t0 = (node.boundsMin[axis] - origin[axis]) * inverseDirection[axis];
+            float t1 = (node.boundsMax[axis] - origin[axis]) * inverseDirection[axis];
+
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+
+            tMin = t0 > tMin ? t0 : tMin;
+            tMax = t1 < tMax ? t1 : tMax;
+        }
+
+        tEntry = tMin;
+        return tMin <= tMax;
+    }
+
+    void TransformPoint(const float rows[3][4], const float point[3], float result[3])
+    {
+        for (uint32_t row = 0; row < 3; row++)
+        {
+            result[row] = rows[row][0] * point[0] + rows[row][1] * point[1] + rows[row][2] * point[2] + rows[row][3];
+        }
+    }
+
+    void TransformDirection(const float rows[3][4], const float direction[3], float result[3])
+    {
+        for (uint32_t row = 0; row < 3; row++)
+        {
+            result[row] = rows[row][0] * direction[0] + rows[row][1] * direction[1] + rows[row][2] * direction[2];
+        }
+    }
+
+    // Inverse of an affine 3x4 matrix: the inverse of the 3x3 part from its cofactors,
+    // and the translation moved through it
+    bool InvertTransform(const float m[3][4], float inverse[3][4])
+    {
+        const float cofactors[3][3] = {
+            { m[1][1] * m[2][2] - m[1][2] * m[2][1], m[1][2] * m[2][0] - m[1][0] * m[2][2], m[1][0] * m[2][1] - m[1][1] * m[2][0] },
+            { m[0][2] * m[2][1] - m[0][1] * m[2][2], m[0][0] * m[2][2] - m[0][2] * m[2][0], m[0][1] * m[2][0] - m[0][0] * m[2][1] },
+            { m[0][1] * m[1][2] - m[0][2] * m[1][1], m[0][2] * m[1][0] - m[0][0] * m[1][2], m[0][0] * m[1][1] - m[0][1] * m[1][0] } };
+        const float determinant = m[0][0] * cofactors[0][0] + m[0][1] * cofactors[0][1] + m[0][2] * cofactors[0][2];
+
+        if (determinant == 0.0f || !std::isfinite(determinant))
+        {
+            return false;
+        }
+
+        for (uint32_t row = 0; row < 3; row++)
+        {
+            for (uint32_t column = 0; column < 3; column++)
+            {
+                // The adjugate is the transposed cofactor matrix
+                inverse[row][column] = cofactors[column][row] / determinant;
+            }
+
+            inverse[row][3] = -(inverse[row][0] * m[0][3] + inverse[row][1] * m[1][3] + inverse[row][2] * m[2][3]);
+        }
+
+        return true;
+    }
+
+    // Bounds of the eight corners of a box moved to world space
+    BvhBounds TransformBounds(const float rows[3][4], const BvhBounds& bounds)
+    {
+        BvhBounds result;
+
+        for (uint32_t corner = 0; corner < 8; corner++)
+        {
+            const float point[3] = { corner & 1 ? bounds.max[0] : bounds.min[0], corner & 2 ? bounds.max[1] : bounds.min[1],
+                                     corner & 4 ? bounds.max[2] : bounds.min[2] };
+            float world[3];
+            TransformPoint(rows, point, world);
+            result.Grow(world);
+        }
+
+        return result;
+    }
+
+    struct BuildTask
+    {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        uint32_t depth;
+    };
+
+    struct Bin
+    {
+        BvhBounds bounds;
+        uint32_t count = 0;
+    };
+}
+
+void SceneBvh::Build(const std::vector<SceneInstance>& instances)
+{
+    m_instances = instances;
+    m_inverseTransforms.resize(instances.size());
+    m_worldBounds.resize(instances.size());
+    m_dirtyInstances.clear();
+    m_isDirty.assign(instances.size(), 0);
+
+    for (uint32_t i = 0; i < static_cast<uint32_t>(instances.size()); i++)
+    {
+        UpdateInstance(i);
+    }
+
+    BuildTopLevel();
+}
+
+void SceneBvh::SetTransform(uint32_t instance, const float transform[3][4])
+{
+    std::copy(&transform[0][0], &transform[0][0] + 12, &m_instances[instance].transform[0][0]);
+    UpdateInstance(instance);
+
+    if (!m_isDirty[instance])
+    {
+        m_isDirty[instance] = 1;
+        m_dirtyInstances.push_back(instance);
+    }
+}
+
+// Inverse transform and world bounds from the instance's transform
+void SceneBvh::UpdateInstance(uint32_t instance)
+{
+    const SceneInstance& data = m_instances[instance];
+
+    if (!InvertTransform(data.transform, m_inverseTransforms[instance].rows))
+    {
+        throw std::runtime_error("Instance " + std::to_string(instance) + " has a transform that cannot be inverted");
+    }
+
+    m_worldBounds[instance] = BvhBounds();
+
+    if (!data.bottomLevel.IsEmpty())
+    {
+        m_worldBounds[instance] = TransformBounds(data.transform, data.bottomLevel.GetBounds());
+    }
+}
+
+SceneBvh::UpdateKind SceneBvh::Update(float rebuildThreshold)
+{
+    if (m_dirtyInstances.empty())
+    {
+        return UpdateKind::None;
+    }
+
+    // Walk up from each moved leaf until a node's bounds come out unchanged; when most of
+    // the tree is dirty a single pass over all nodes is cheaper. Children always come
+    // after their parents, so a backwards pass sees every child before its parent.
+    const uint32_t InvalidNode = 0xFFFFFFFF;
+
+    if (m_dirtyInstances.size() * 8 < m_nodes.size())
+    {
+        for (uint32_t instance : m_dirtyInstances)
+        {
+            for (uint32_t node = m_instanceLeaves[instance]; node != InvalidNode && RefitNode(node); node = m_parents[node])
+            {
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t node = static_cast<uint32_t>(m_nodes.size()); node-- > 2;)
+        {
+            RefitNode(node);
+        }
+
+        if (!m_nodes.empty())
+        {
+            RefitNode(0);
+        }
+    }
+
+    for (uint32_t instance : m_dirtyInstances)
+    {
+        m_isDirty[instance] = 0;
+    }
+
+    m_dirtyInstances.clear();
+
+    if (GetSahCost() > rebuildThreshold * m_builtSahCost)
+    {
+        BuildTopLevel();
+        return UpdateKind::Rebuild;
+    }
+
+    return UpdateKind::Refit;
+}
+
+bool SceneBvh::RefitNode(uint32_t node)
+{
+    BvhNode& data = m_nodes[node];
+    BvhBounds bounds;
+
+    if (data.IsLeaf())
+    {
+        for (uint32_t i = data.offset; i < data.offset + data.count; i++)
+        {
+            bounds.Grow(m_worldBounds[m_instanceIndices[i]]);
+        }
+    }
+    else
+    {
+        bounds.Grow(GetNodeBounds(m_nodes[data.offset]));
+        bounds.Grow(GetNodeBounds(m_nodes[data.offset + 1]));
+    }
+
+    if (std::equal(bounds.min, bounds.min + 3, data.boundsMin) && std::equal(bounds.max, bounds.max + 3, data.boundsMax))
+    {
+        return false;
+    }
+
+    const double weight = data.IsLeaf() ? data.count : 1.0;
+    m_weightedArea += weight * (static_cast<double>(bounds.GetHalfArea()) - GetNodeBounds(data).GetHalfArea());
+    SetNodeBounds(bounds, data);
+    return true;
+}
+
+float SceneBvh::GetSahCost() const
+{
+    const double rootArea = m_nodes.empty() ? 0.0 : GetNodeBounds(m_nodes[0]).GetHalfArea();
+    return rootArea > 0.0 ? static_cast<float>(m_weightedArea / rootArea) : 0.0f;
+}
+
+// Top-down binned SAH over the centroids of the instance boxes, one instance per leaf.
+// Where the centroids cannot be told apart the range is halved, and leaves at the depth
+// limit take what is left.
+void SceneBvh::BuildTopLevel()
+{
+    m_nodes.clear();
+    m_instanceIndices.clear();
+    m_parents.clear();
+    m_instanceLeaves.assign(m_instances.size(), 0xFFFFFFFF);
+    m_weightedArea = 0.0;
+    m_builtSahCost = 0.0f;
+
+    for (uint32_t i = 0; i < static_cast<uint32_t>(m_instances.size()); i++)
+    {
+        if (!m_worldBounds[i].IsEmpty())
+        {
+            m_instanceIndices.push_back(i);
+        }
+    }
+
+    if (m_instanceIndices.empty())
+    {
+        return;
+    }
+
+    std::vector<float> centroids(m_instances.size() * 3);
+
+    for (uint32_t i : m_instanceIndices)
+    {
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            centroids[i * 3 + axis] = m_worldBounds[i].GetCenter(axis);
+        }
+    }
+
+    m_nodes.reserve(m_instanceIndices.size() * 2);
+    m_nodes.resize(2);
+    m_parents.reserve(m_instanceIndices.size() * 2);
+    m_parents.assign(2, 0xFFFFFFFF);
+
+    std::vector<BuildTask> tasks(1, BuildTask{ 0, 0, static_cast<uint32_t>(m_instanceIndices.size()), 0 });
+
+    while (!tasks.empty())
+    {
+        const BuildTask task = tasks.back();
+        tasks.pop_back();
+
+        BvhBounds bounds;
+        BvhBounds centroidBounds;
+
+        for (uint32_t i = task.begin; i < task.end; i++)
+        {
+            bounds.Grow(m_worldBounds[m_instanceIndices[i]]);
+            centroidBounds.Grow(&centroids[m_instanceIndices[i] * 3]);
+        }
+
+        SetNodeBounds(bounds, m_nodes[task.node]);
+
+        const uint32_t count = task.end - task.begin;
+
+        if (count == 1 || task.depth + 1 >= Bvh::MaxDepth)
+        {
+            m_nodes[task.node].offset = task.begin;
+            m_nodes[task.node].count = count;
+            m_weightedArea += static_cast<double>(count) * bounds.GetHalfArea();
+
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                m_instanceLeaves[m_instanceIndices[i]] = task.node;
+            }
+
+            continue;
+        }
+
+        m_weightedArea += bounds.GetHalfArea();
+
+        uint32_t bestAxis = 3;
+        uint32_t bestBin = 0;
+        float bestCost = 3.402823466e+38f;
+
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            const float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+
+            if (extent <= 0.0f)
+            {
+                continue;
+            }
+
+            const float scale = BinCount / extent;
+            Bin bins[BinCount];
+
+            for (uint32_t i = task.begin; i < task.end; i++)
+            {
+                const uint32_t instance = m_instanceIndices[i];
+                const uint32_t bin = (std::min)(BinCount - 1, static_cast<uint32_t>((centroids[instance * 3 + axis] - centroidBounds.min[axis]) * scale));
+                bins[bin].bounds.Grow(m_worldBounds[instance]);
+                bins[bin].count++;
+            }
+
+            // Right to left for the areas of the right sides, then left to right
+            float rightCosts[BinCount];
+            BvhBounds right;
+            uint32_t rightCount = 0;
+
+            for (uint32_t bin = BinCount - 1; bin > 0; bin--)
+            {
+                right.Grow(bins[bin].bounds);
+                rightCount += bins[bin].count;
+                rightCosts[bin] = right.GetHalfArea() * rightCount;
+            }
+
+            BvhBounds left;
+            uint32_t leftCount = 0;
+
+            for (uint32_t bin = 0; bin + 1 < BinCount; bin++)
+            {
+                left.Grow(bins[bin].bounds);
+                leftCount += bins[bin].count;
+                const float cost = left.GetHalfArea() * leftCount + rightCosts[bin + 1];
+
+                if (leftCount > 0 && leftCount < count && cost < bestCost)
+                {
+                    bestAxis = axis;
+                    bestBin = bin;
+                    bestCost = cost;
+                }
+            }
+        }
+
+        uint32_t middle = task.begin + count / 2;
+
+        if (bestAxis < 3)
+        {
+            const float scale = BinCount / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+            const float minimum = centroidBounds.min[bestAxis];
+
+            auto split = std::partition(m_instanceIndices.begin() + task.begin, m_instanceIndices.begin() + task.end, [&](uint32_t instance) {
+                return (std::min)(BinCount - 1, static_cast<uint32_t>((centroids[instance * 3 + bestAxis] - minimum) * scale)) <= bestBin;
+            });
+
+            middle = static_cast<uint32_t>(split - m_instanceIndices.begin());
+        }
+
+        const uint32_t children = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.resize(m_nodes.size() + 2);
+        m_parents.resize(m_parents.size() + 2, task.node);
+        m_nodes[task.node].offset = children;
+        m_nodes[task.node].count = 0;
+
+        tasks.push_back({ children + 1, middle, task.end, task.depth + 1 });
+        tasks.push_back({ children, task.begin, middle, task.depth + 1 });
+    }
+
+    m_builtSahCost = GetSahCost();
+}
+
+BvhBounds SceneBvh::GetBounds() const
+{
+    return m_nodes.empty() ? BvhBounds() : GetNodeBounds(m_nodes[0]);
+}
+
+template <bool AnyHit>
+bool SceneBvh::Traverse(const BvhRay& ray, const SceneRayParameters& parameters, SceneHit& hit, BvhTraversalStats* stats) const
+{
+    hit = SceneHit();
+
+    if (m_nodes.empty())
+    {
+        return false;
+    }
+
+    float inverseDirection[3];
+
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        // Keep 0 * inf out of the slab test
+        const float d = ray.direction[axis];
+        inverseDirection[axis] = 1.0f / (d != 0.0f ? d : (std::signbit(d) ? -1e-30f : 1e-30f));
+    }
+
+    BvhTraversalStats bottomLevelStats;
+    uint64_t nodeVisits = 0;
+    float tMax = ray.tMax;
+    float tEntry;
+
+    uint32_t stack[Bvh::MaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t current = 0;
+
+    if (!IntersectBounds(m_nodes[0], ray.origin, inverseDirection, ray.tMin, tMax, tEntry))
+    {
+        current = BvhHit::NoHit;
+    }
+
+    while (current != BvhHit::NoHit)
+    {
+        const BvhNode& node = m_nodes[current];
+        nodeVisits++;
+
+        if (node.IsLeaf())
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+            {
+                const uint32_t index = m_instanceIndices[i];
+                const SceneInstance& instance = m_instances[index];
+
+                if ((instance.mask & parameters.instanceInclusionMask) == 0)
+                {
+                    continue;
+                }
+
+                BvhRay objectRay;
+                TransformPoint(m_inverseTransforms[index].rows, ray.origin, objectRay.origin);
+                TransformDirection(m_inverseTransforms[index].rows, ray.direction, objectRay.direction);
+                objectRay.tMin = ray.tMin;
+                objectRay.tMax = tMax;
+
+                if (AnyHit)
+                {
+                    if (instance.bottomLevel.IsOccluded(instance.geometry, objectRay, &bottomLevelStats))
+                    {
+                        hit.primitiveIndex = 0;
+                        hit.instanceIndex = index;
+                        stackSize = 0;
+                        break;
+                    }
+                }
+                else
+                {
+                    BvhHit objectHit;
+
+                    if (instance.bottomLevel.Intersect(instance.geometry, objectRay, objectHit, &bottomLevelStats))
+                    {
+                        tMax = objectHit.t;
+                        static_cast<BvhHit&>(hit) = objectHit;
+                        hit.instanceIndex = index;
+                        hit.instanceID = instance.instanceID;
+                        hit.hitGroupIndex = parameters.rayContributionToHitGroupIndex + instance.hitGroupIndex;
+                    }
+                }
+            }
+
+            if (AnyHit && hit.IsHit())
+            {
+                break;
+            }
+
+            current = stackSize > 0 ? stack[--stackSize] : BvhHit::NoHit;
+            continue;
+        }
+
+        float tNear, tFar;
+        const bool hitNear = IntersectBounds(m_nodes[node.offset], ray.origin, inverseDirection, ray.tMin, tMax, tNear);
+        const bool hitFar = IntersectBounds(m_nodes[node.offset + 1], ray.origin, inverseDirection, ray.tMin, tMax, tFar);
+
+        if (hitNear && hitFar)
+        {
+            const bool swap = tFar < tNear;
+            current = node.offset + (swap ? 1 : 0);
+            stack[stackSize++] = node.offset + (swap ? 0 : 1);
+        }
+        else if (hitNear || hitFar)
+        {
+            current = node.offset + (hitNear ? 0 : 1);
+        }
+        else
+        {
+            current = stackSize > 0 ? stack[--stackSize] : BvhHit::NoHit;
+        }
+    }
+
+    if (stats)
+    {
+        stats->rays++;
+        stats->nodes += nodeVisits + bottomLevelStats.nodes;
+        stats->triangles += bottomLevelStats.triangles;
+    }
+
+    return hit.IsHit();
+}
+
+bool SceneBvh::Intersect(const BvhRay& ray, const SceneRayParameters& parameters, SceneHit& hit, BvhTraversalStats* stats) const
+{
+    return Traverse<false>(ray, parameters, hit, stats);
+}
+
+bool SceneBvh::IsOccluded(const BvhRay& ray, const SceneRayParameters& parameters, BvhTraversalStats* stats) const
+{
+    SceneHit hit;
+    return Traverse<true>(ray, parameters, hit, stats);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+/// What TopLevelASGenerator::AddInstance takes and Generate writes into a
+/// D3D12_RAYTRACING_INSTANCE_DESC, with the bottom level as a CPU hierarchy and the
+/// geometry it was built from. Instances can share a bottom level.
+struct SceneInstance
+{
+    /// Empty for an inactive instance, as a null AccelerationStructure address is. The
+    /// memory it refers to, a Bvh or a BvhCache file, must outlive the SceneBvh.
+    BvhView bottomLevel;
+    BvhGeometry geometry;
+    /// Object to world, rows of a 3x4 matrix as in D3D12_RAYTRACING_INSTANCE_DESC::
+    /// Transform: the transpose of the XMMATRIX given to AddInstance
+    float transform[3][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } };
+    /// InstanceID() in hit shaders, 24 bits
+    uint32_t instanceID = 0;
+    /// InstanceContributionToHitGroupIndex, 24 bits
+    uint32_t hitGroupIndex = 0;
+    /// InstanceMask; Generate always writes 0xFF
+    uint8_t mask = 0xFF;
+};
+
+/// The TraceRay arguments that pick instances and hit groups. Bottom levels hold one
+/// geometry, so the multiplier for the geometry contribution never matters.
+struct SceneRayParameters
+{
+    /// InstanceInclusionMask: instances whose mask has none of these bits are skipped
+    uint32_t instanceInclusionMask = 0xFF;
+    /// RayContributionToHitGroupIndex, 0 for Hit.hlsl's primary and reflection rays and
+    /// 1 for its shadow rays
+    uint32_t rayContributionToHitGroupIndex = 0;
+};
+
+/// BvhHit plus what identifies the instance hit: InstanceIndex(), InstanceID(), and the
+/// hit group the shader binding table would call
+struct SceneHit : BvhHit
+{
+    uint32_t instanceIndex = NoHit;
+    uint32_t instanceID = 0;
+    /// Ray contribution + instance contribution, the record index in the hit group table
+    uint32_t hitGroupIndex = 0;
+};
+
+/// CPU mirror of a top-level acceleration structure, so that tools can trace the scene
+/// CreateTopLevelAS builds without a device. The top level is a binary tree over the
+/// world bounds of the instances, in Bvh's node layout with one instance per leaf; a ray
+/// that reaches an instance is moved into its object space and traced through its bottom
+/// level. The direction is transformed without normalizing, so t is the same in both
+/// spaces, as RayTCurrent() is.
+///
+/// The top level is built with binned SAH over the instance boxes, which the GPU builder
+/// also does in some form; its exact tree is not visible to shaders and not reproduced.
+///
+/// Instances that move are marked dirty by SetTransform, and Update brings the top level
+/// up to date the way a TLAS update does: refitting the boxes on the paths from the moved
+/// leaves to the root, without changing the tree. Refitting keeps a tree built for where
+/// the instances were, so Update rebuilds instead once the SAH cost has grown by more
+/// than a threshold since the last build (Lauterbach et al., "Fast BVH Construction on
+/// GPUs"). The dirty set and the choice are what the GPU build needs as well: refit is
+/// Generate with updateOnly, rebuild without.
+class SceneBvh
+{
+public:
+    enum class UpdateKind
+    {
+        /// Nothing was dirty
+        None,
+        Refit,
+        Rebuild,
+    };
+
+    /// Replace the scene. Throws std::runtime_error if a transform cannot be inverted.
+    void Build(const std::vector<SceneInstance>& instances);
+
+    /// Move an instance. Takes effect for traversal at the next Update. Throws
+    /// std::runtime_error if the transform cannot be inverted.
+    void SetTransform(uint32_t instance, const float transform[3][4]);
+
+    /// Instances moved since the last Update, each once, in the order first moved
+    const std::vector<uint32_t>& GetDirtyInstances() const { return m_dirtyInstances; }
+
+    /// Refit to the dirty instances, or rebuild if that leaves the SAH cost above
+    /// rebuildThreshold times the cost after the last build; then clear the dirty set
+    UpdateKind Update(float rebuildThreshold = 1.3f);
+
+    /// SAH cost of the top level, one unit per node visit and per instance, relative to
+    /// the root's area; and that cost right after the last build
+    float GetSahCost() const;
+    float GetBuiltSahCost() const { return m_builtSahCost; }
+
+    const std::vector<SceneInstance>& GetInstances() const { return m_instances; }
+    const Bvh::NodeArray& GetNodes() const { return m_nodes; }
+    BvhBounds GetBounds() const;
+
+    /// Closest hit over all instances the ray's mask includes. Stats count top-level and
+    /// bottom-level nodes together.
+    bool Intersect(const BvhRay& ray, const SceneRayParameters& parameters, SceneHit& hit, BvhTraversalStats* stats = nullptr) const;
+
+    /// Any hit, for shadow rays (RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH)
+    bool IsOccluded(const BvhRay& ray, const SceneRayParameters& parameters, BvhTraversalStats* stats = nullptr) const;
+
+private:
+    struct Transform
+    {
+        float rows[3][4];
+    };
+
+    void UpdateInstance(uint32_t instance);
+    void BuildTopLevel();
+    /// Recompute the bounds of a node from its children or instances; returns whether
+    /// they changed and adds the change in weighted area to m_weightedArea
+    bool RefitNode(uint32_t node);
+
+    template <bool AnyHit>
+    bool Traverse(const BvhRay& ray, const SceneRayParameters& parameters, SceneHit& hit, BvhTraversalStats* stats) const;
+
+    std::vector<SceneInstance> m_instances;
+    /// World to object, per instance
+    std::vector<Transform> m_inverseTransforms;
+    /// Bounds of each instance's bottom level in world space, empty for inactive ones
+    std::vector<BvhBounds> m_worldBounds;
+    Bvh::NodeArray m_nodes;
+    /// Instance of each leaf, in leaf order
+    std::vector<uint32_t> m_instanceIndices;
+    /// Parent of each node, for refitting from the leaves up
+    std::vector<uint32_t> m_parents;
+    /// Leaf of each instance, or no node for inactive ones
+    std::vector<uint32_t> m_instanceLeaves;
+
+    std::vector<uint32_t> m_dirtyInstances;
+    std::vector<uint8_t> m_isDirty;
+    /// Sum over the nodes of their half area, leaves weighted by their instance count;
+    /// kept up to date by refits so that the SAH cost is known without a walk
+    double m_weightedArea = 0.0;
+    float m_builtSahCost = 0.0f;
+};
@@ -0,0 +1,142 @@
+#include "ScratchPlanner.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+uint32_t ScratchPlanner::AddBuild(uint64_t scratchSize)
+{
+    ScratchPlacement placement;
+    placement.size = scratchSize;
+    m_placements.push_back(placement);
+    m_batches.clear();
+    m_arenaSize = 0;
+
+    return static_cast<uint32_t>(m_placements.size() - 1);
+}
+
+void ScratchPlanner::Plan(uint64_t budget)
+{
+    m_batches.clear();
+    m_arenaSize = 0;
+
+    std::vector<uint32_t> order(m_placements.size());
+
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+
+        if (budget > 0 && AlignUp(m_placements[i].size, Alignment) > budget)
+        {
+            throw std::runtime_error("Scratch of build " + std::to_string(i) + " (" + std::to_string(m_placements[i].size) +
+                                     " bytes) exceeds the scratch budget of " + std::to_string(budget) + " bytes");
+        }
+    }
+
+    // Largest first, ties in the order added so that the plan is deterministic
+    std::stable_sort(order.begin(), order.end(),
+                     [this](uint32_t a, uint32_t b) { return m_placements[a].size > m_placements[b].size; });
+
+    for (uint32_t build : order)
+    {
+        ScratchPlacement& placement = m_placements[build];
+        const uint64_t size = AlignUp(placement.size, Alignment);
+        uint32_t batch = 0;
+
+        while (batch < m_batches.size() && budget > 0 && m_batches[batch].size + size > budget)
+        {
+            batch++;
+        }
+
+        if (batch == m_batches.size())
+        {
+            m_batches.emplace_back();
+        }
+
+        placement.batch = batch;
+        placement.offset = m_batches[batch].size;
+        m_batches[batch].builds.push_back(build);
+        m_batches[batch].size += size;
+        m_arenaSize = (std::max)(m_arenaSize, m_batches[batch].size);
+    }
+}
+
+uint64_t ScratchPlanner::GetUnaliasedSize() const
+{
+    uint64_t size = 0;
+
+    for (const auto& placement : m_placements)
+    {
+        size += AlignUp(placement.size, Alignment);
+    }
+
+    return size;
+}
+
+void ScratchPlanner::Validate() const
+{
+    std::vector<uint32_t> seen(m_placements.size(), 0);
+
+    for (uint32_t batch = 0; batch < m_batches.size(); batch++)
+    {
+        uint64_t previousEnd = 0;
+
+        for (uint32_t build : m_batches[batch].builds)
+        {
+            const std::string name = "build " + std::to_string(build);
+
+            if (build >= m_placements.size() || seen[build]++ > 0)
+            {
+                throw std::logic_error(name + ": scheduled more than once or unknown");
+            }
+
+            const ScratchPlacement& placement = m_placements[build];
+
+            if (placement.batch != batch)
+            {
+                throw std::logic_error(name + ": listed in batch " + std::to_string(batch) + " but placed in batch " + std::to_string(placement.batch));
+            }
+
+            if (placement.offset % Alignment != 0)
+            {
+                throw std::logic_error(name + ": scratch offset is not 256-byte aligned");
+            }
+
+            // Ranges are laid out in recording order, so each must start past the last
+            if (placement.offset < previousEnd)
+            {
+                throw std::logic_error(name + ": scratch overlaps another build of its batch");
+            }
+
+            previousEnd = placement.offset + placement.size;
+
+            if (previousEnd > m_batches[batch].size || previousEnd > m_arenaSize)
+            {
+                throw std::logic_error(name + ": scratch exceeds the arena");
+            }
+        }
+    }
+
+    for (uint32_t build = 0; build < seen.size(); build++)
+    {
+        if (seen[build] == 0 && !m_batches.empty())
+        {
+            throw std::logic_error("build " + std::to_string(build) + ": not scheduled");
+        }
+    }
+}
+
+void ScratchPlanner::Reset()
+{
+    m_placements.clear();
+    m_batches.clear();
+    m_arenaSize = 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/// Where the scratch memory of one acceleration structure build lives in the shared arena
+struct ScratchPlacement
+{
+    /// Index of the batch the build is recorded in
+    uint32_t batch = 0;
+    /// Offset in the arena, a multiple of ScratchPlanner::Alignment
+    uint64_t offset = 0;
+    /// Scratch size the build asked for, before alignment
+    uint64_t size = 0;
+};
+
+/// Builds that run concurrently: their scratch ranges are disjoint, and a UAV barrier on
+/// the arena separates them from the next batch, which reuses the same memory
+struct ScratchBatch
+{
+    /// Build indices, in recording order
+    std::vector<uint32_t> builds;
+    /// End of the last range of the batch
+    uint64_t size = 0;
+};
+
+/// Schedules acceleration structure builds into batches that share one scratch arena
+/// instead of one committed scratch buffer per build, all alive until the command list
+/// is flushed. Builds are packed first-fit by decreasing scratch size into batches no
+/// larger than the budget, which keeps the number of batches, and so of barriers, close
+/// to the minimum; the arena then only needs to be as large as the largest batch.
+///
+/// Like TextureUploadPlanner, it does not depend on D3D12 so that the layout can be
+/// checked on the CPU; BottomLevelASBatch records the plan with BottomLevelASGenerator.
+class ScratchPlanner
+{
+public:
+    /// D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BYTE_ALIGNMENT, which scratch addresses
+    /// need as well
+    static const uint64_t Alignment = 256;
+
+    /// Register a build needing scratchSize bytes and return its index
+    uint32_t AddBuild(uint64_t scratchSize);
+
+    /// Assign every build added so far to a batch and an offset, with no batch larger
+    /// than budget. A budget of 0 puts every build in one batch. Throws
+    /// std::runtime_error if a single build does not fit the budget.
+    void Plan(uint64_t budget);
+
+    uint32_t GetBuildCount() const { return static_cast<uint32_t>(m_placements.size()); }
+    const ScratchPlacement& GetPlacement(uint32_t build) const { return m_placements[build]; }
+    const std::vector<ScratchBatch>& GetBatches() const { return m_batches; }
+
+    /// Size of the shared scratch buffer, the largest batch
+    uint64_t GetArenaSize() const { return m_arenaSize; }
+    /// Scratch with one buffer per build, as if no two builds shared it
+    uint64_t GetUnaliasedSize() const;
+
+    /// Check that every build has exactly one aligned range inside the arena and that no
+    /// two ranges of a batch overlap. Throws std::logic_error describing the first
+    /// violation.
+    void Validate() const;
+
+    /// Forget all builds, so the planner can be reused
+    void Reset();
+
+private:
+    std::vector<ScratchPlacement> m_placements;
+    std::vector<ScratchBatch> m_batches;
+    uint64_t m_arenaSize = 0;
+};
@@ -8,6 +8,10 @@ struct HitInfo
     float4 colorAndDistance;
     float3 normal;
     int depth;
+    // Ray cone used to pick texture mips: width of the cone at the ray origin and its
+    // spread angle, in radians
+    float coneWidth;
+    float coneSpread;
 };
 
 // #DXR Extra - Another ray type
@@ -23,3 +27,13 @@ struct Attributes
 {
     float2 bary;
 };
+
+// Glossy reflection from an environment cube map prefiltered by AssetTools "prefilter":
+// mip m holds the radiance convolved with the GGX lobe of roughness m / (mipCount - 1)
+float3 SamplePrefilteredEnvironment(TextureCube environment, SamplerState environmentSampler, float3 direction, float roughness)
+{
+    uint width, height, mipCount;
+    environment.GetDimensions(0, width, height, mipCount);
+
+    return environment.SampleLevel(environmentSampler, direction, roughness * (mipCount - 1)).rgb;
+}
@@ -11,7 +11,9 @@ struct STriVertex {
  { 
     float4x4 objectToWorld;
     int hasTexture;
-    float3 padding;
+    int textureArray;
+    int textureSlice;
+    float padding;
 };
 
 StructuredBuffer<STriVertex> BTriVertex : register(t0);
@@ -29,13 +31,87 @@ RaytracingAccelerationStructure SceneBVH : register(t3);
 // SamplerState textureSampler1 : register(s0);
 // SamplerState textureSampler2 : register(s1);
 
-Texture2D texture1 : register(t0, space1);
-Texture2D texture2 : register(t1, space1);
-Texture2D texture3 : register(t2, space1);
-Texture2D texture4 : register(t3, space1);
+// Model textures packed by AssetTools, one array per format and size. InstanceProperties
+// selects the array and the slice.
+Texture2DArray modelTextures0 : register(t0, space1);
+Texture2DArray modelTextures1 : register(t1, space1);
+Texture2DArray modelTextures2 : register(t2, space1);
+Texture2DArray modelTextures3 : register(t3, space1);
 SamplerState textureSampler1 : register(s0, space1);
 SamplerState textureSampler2 : register(s1, space1);
 
+// The skybox, also bound to the miss shader. When AssetTools "prefilter" wrote it, its
+// mips hold the GGX-convolved radiance read by SamplePrefilteredEnvironment, and
+// glossyEnvironment is set.
+TextureCube environmentTexture : register(t4, space1);
+
+// Roughness of the glossy reflection of the model
+static const float ModelRoughness = 0.5f;
+
+// Diffuse environment lighting, the L2 spherical harmonics of the skybox with the cosine
+// lobe folded in (EnvironmentLightingConstants in SphericalHarmonics.h)
+cbuffer EnvironmentLighting : register(b0, space1)
+{
+    float4 shCoefficients[9];
+    // 1 if environmentTexture is a GGX-prefiltered chain, else 0: plain box-filtered
+    // mips would give wrong reflections, so there is no glossy term
+    float glossyEnvironment;
+}
+
+// Irradiance / pi arriving at a surface of normal n from the whole environment
+float3 EvaluateEnvironmentLighting(float3 n)
+{
+    return shCoefficients[0].rgb +
+           shCoefficients[1].rgb * n.y +
+           shCoefficients[2].rgb * n.z +
+           shCoefficients[3].rgb * n.x +
+           shCoefficients[4].rgb * (n.x * n.y) +
+           shCoefficients[5].rgb * (n.y * n.z) +
+           shCoefficients[6].rgb * (3.0f * n.z * n.z - 1.0f) +
+           shCoefficients[7].rgb * (n.x * n.z) +
+           shCoefficients[8].rgb * (n.x * n.x - n.y * n.y);
+}
+
+// Mip of a texture of the given size under a ray cone, see GetRayConeLod
+float GetTextureLod(Texture2DArray modelTexture, float rayConeLod)
+{
+    uint width, height, elements;
+    modelTexture.GetDimensions(width, height, elements);
+
+    return rayConeLod + 0.5f * log2(width * height);
+}
+
+// Texture level of detail from a ray cone (Akenine-Moller et al., "Texture Level of Detail
+// Strategies for Real-Time Ray Tracing"), without the term of the texture size. The
+// streamed arrays only hold their resident mips, so mip 0 is the most detailed one
+// loaded and the result is relative to it.
+float GetRayConeLod(float3 worldPositions[3], float2 texcoords[3], float coneWidth, float3 rayDirection)
+{
+    float3 worldNormal = cross(worldPositions[1] - worldPositions[0], worldPositions[2] - worldPositions[0]);
+    float worldArea = length(worldNormal);
+
+    float2 uv1 = texcoords[1] - texcoords[0];
+    float2 uv2 = texcoords[2] - texcoords[0];
+    float texcoordArea = abs(uv1.x * uv2.y - uv2.x * uv1.y);
+
+    float cosine = abs(dot(worldNormal / max(worldArea, 1e-12f), rayDirection));
+
+    return 0.5f * log2(max(texcoordArea, 1e-12f) / max(worldArea, 1e-12f)) + log2(max(coneWidth, 1e-12f) / max(cosine, 1e-3f));
+}
+
+float4 SampleModelTexture(int textureArray, int textureSlice, float2 texcoord, float rayConeLod)
+{
+    float3 location = float3(texcoord, textureSlice);
+
+    switch (textureArray)
+    {
+    case 0: return modelTextures0.SampleLevel(textureSampler1, location, GetTextureLod(modelTextures0, rayConeLod));
+    case 1: return modelTextures1.SampleLevel(textureSampler1, location, GetTextureLod(modelTextures1, rayConeLod));
+    case 2: return modelTextures2.SampleLevel(textureSampler1, location, GetTextureLod(modelTextures2, rayConeLod));
+    default: return modelTextures3.SampleLevel(textureSampler1, location, GetTextureLod(modelTextures3, rayConeLod));
+    }
+}
+
 // Logically, the ray assumes it is occluded unless the miss
 // shader executes, when we definitively know the ray is unoccluded. This allows us to
 // avoid execution of closest-hit shaders (RAY_FLAG_SKIP_CLOSEST_HIT_SHADER)
@@ -171,6 +247,10 @@ void PlaneClosestHit(inout HitInfo payload, Attributes attributes)
         HitInfo reflectionPayload;
         reflectionPayload.depth = payload.depth + 1;
 
+        // The plane is flat, so the cone keeps its spread past the reflection
+        reflectionPayload.coneWidth = payload.coneWidth + payload.coneSpread * RayTCurrent();
+        reflectionPayload.coneSpread = payload.coneSpread;
+
         // Trace the reflection ray
         TraceRay(
             // Parameter name: AccelerationStructure
@@ -270,7 +350,7 @@ void ModelClosestHit(inout HitInfo payload, Attributes attributes)
 
     float diffuse = max(0.0f, dot(normal.xyz, -lightDirection));
 
-    float3 ambient = float3(0.1f, 0.1f, 0.1f);
+    float3 ambient = max(EvaluateEnvironmentLighting(normal), 0.0f);
 
     int2 coord = floor(texcoord * 512.0f);
 
@@ -279,10 +359,35 @@ void ModelClosestHit(inout HitInfo payload, Attributes attributes)
     
     if (instanceProperties[InstanceID()].hasTexture)
     {
-       textureColor = texture2.SampleLevel(textureSampler1, texcoord, 0);
+       InstanceProperties properties = instanceProperties[InstanceID()];
+
+       float3 worldPositions[3];
+       float2 texcoords[3];
+
+       for (int i = 0; i < 3; i++)
+       {
+           STriVertex triVertex = BTriVertex[indices[vertexId + i]];
+           worldPositions[i] = mul(ObjectToWorld3x4(), float4(triVertex.vertex, 1.0f));
+           texcoords[i] = triVertex.textcoord * 2.0f;
+       }
+
+       float coneWidth = payload.coneWidth + payload.coneSpread * RayTCurrent();
+       float rayConeLod = GetRayConeLod(worldPositions, texcoords, coneWidth, normalize(WorldRayDirection()));
+
+       textureColor = SampleModelTexture(properties.textureArray, properties.textureSlice, texcoord, rayConeLod);
     //    textureColor = texture1.Load(int3(coord, 0));
     }
 
-    payload.colorAndDistance = float4(ambient * 0.1f + hitColor * diffuse * textureColor.rgb * 0.9f, RayTCurrent());
+    // Glossy reflection of the environment, weighted by Schlick's Fresnel for a
+    // dielectric (F0 = 0.04), only when the skybox was prefiltered
+    float3 specular = float3(0.0f, 0.0f, 0.0f);
+    if (glossyEnvironment != 0.0f)
+    {
+        float3 viewDirection = -normalize(WorldRayDirection());
+        float fresnel = 0.04f + 0.96f * pow(1.0f - saturate(dot(normal, viewDirection)), 5.0f);
+        specular = SamplePrefilteredEnvironment(environmentTexture, textureSampler1, reflect(-viewDirection, normal), ModelRoughness) * fresnel;
+    }
+
+    payload.colorAndDistance = float4(ambient * 0.1f + hitColor * diffuse * textureColor.rgb * 0.9f + specular, RayTCurrent());
     // payload.colorAndDistance = float4(float3(texcoord, 0.0f), RayTCurrent());
 }
\ No newline at end of file
@@ -30,6 +30,10 @@ void RayGen() {
 
     float2 pixelCoordinate = (((launchIndex.xy + 0.5f) / dimentions.xy) * 2.0f - 1.0f);
 
+    // The cone of a primary ray covers one pixel; projection[1][1] is 1 / tan(fovY / 2)
+    payload.coneWidth = 0.0f;
+    payload.coneSpread = atan(2.0f / (projection[1][1] * dimentions.y));
+
     // Define a ray, consisting of origin, direction, and the min-max distance values
     // #DXR Extra: Perspective Camera
     RayDesc ray;
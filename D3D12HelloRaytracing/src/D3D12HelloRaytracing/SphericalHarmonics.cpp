@@ -0,0 +1,262 @@
+#include "SphericalHarmonics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <emmintrin.h>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    const float Pi = 3.14159265358979f;
+
+    // Normalization constants of the real basis functions
+    const float Y0 = 0.282095f;
+    const float Y1 = 0.488603f;
+    const float Y2 = 1.092548f;
+    const float Y20 = 0.315392f;
+    const float Y22 = 0.546274f;
+
+    // Face axes matching CubeMapImage::GetTexelDirection: direction = major + u * uAxis + v * vAxis
+    const float FaceAxes[CubeMapImage::FaceCount][3][3] = {
+        { { 1.0f, 0.0f, 0.0f },  { 0.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, 0.0f } },
+        { { -1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },  { 0.0f, -1.0f, 0.0f } },
+        { { 0.0f, 1.0f, 0.0f },  { 1.0f, 0.0f, 0.0f },  { 0.0f, 0.0f, 1.0f } },
+        { { 0.0f, -1.0f, 0.0f }, { 1.0f, 0.0f, 0.0f },  { 0.0f, 0.0f, -1.0f } },
+        { { 0.0f, 0.0f, 1.0f },  { 1.0f, 0.0f, 0.0f },  { 0.0f, -1.0f, 0.0f } },
+        { { 0.0f, 0.0f, -1.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, -1.0f, 0.0f } },
+    };
+
+    // Per-thread sums: 9 coefficients x RGB, plus the total solid angle, four lanes each
+    struct Accumulator
+    {
+        __m128 sums[SHCoefficients::Count * 3 + 1];
+
+        Accumulator()
+        {
+            for (auto& sum : sums)
+            {
+                sum = _mm_setzero_ps();
+            }
+        }
+    };
+
+    float HorizontalSum(__m128 value)
+    {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, value);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+
+    void ProjectRow(const Texel* row, uint32_t face, uint32_t y, uint32_t size, Accumulator& accumulator)
+    {
+        const float (&axes)[3][3] = FaceAxes[face];
+        const float texelSize = 2.0f / size;
+        const float v = (y + 0.5f) * texelSize - 1.0f;
+
+        // Everything that does not depend on u
+        const __m128 baseX = _mm_set1_ps(axes[0][0] + v * axes[2][0]);
+        const __m128 baseY = _mm_set1_ps(axes[0][1] + v * axes[2][1]);
+        const __m128 baseZ = _mm_set1_ps(axes[0][2] + v * axes[2][2]);
+        const __m128 uAxisX = _mm_set1_ps(axes[1][0]);
+        const __m128 uAxisY = _mm_set1_ps(axes[1][1]);
+        const __m128 uAxisZ = _mm_set1_ps(axes[1][2]);
+        const __m128 oneAndV2 = _mm_set1_ps(1.0f + v * v);
+        const __m128 texelArea = _mm_set1_ps(texelSize * texelSize);
+        const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 scale = _mm_set1_ps(texelSize);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 three = _mm_set1_ps(3.0f);
+
+        for (uint32_t x = 0; x < size; x += 4)
+        {
+            __m128 r, g, b, a;
+
+            if (x + 4 <= size)
+            {
+                r = _mm_loadu_ps(&row[x + 0].r);
+                g = _mm_loadu_ps(&row[x + 1].r);
+                b = _mm_loadu_ps(&row[x + 2].r);
+                a = _mm_loadu_ps(&row[x + 3].r);
+            }
+            else
+            {
+                // Faces of 1 and 2 texels, in the smallest mips
+                Texel tail[4];
+                std::copy(row + x, row + size, tail);
+
+                r = _mm_loadu_ps(&tail[0].r);
+                g = _mm_loadu_ps(&tail[1].r);
+                b = _mm_loadu_ps(&tail[2].r);
+                a = _mm_loadu_ps(&tail[3].r);
+            }
+
+            _MM_TRANSPOSE4_PS(r, g, b, a);
+
+            const __m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets), scale), one);
+
+            // Solid angle of a texel: area / (1 + u^2 + v^2)^(3/2)
+            const __m128 length2 = _mm_add_ps(oneAndV2, _mm_mul_ps(u, u));
+            const __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(length2));
+            __m128 weight = _mm_mul_ps(texelArea, _mm_mul_ps(inverseLength, _mm_mul_ps(inverseLength, inverseLength)));
+
+            if (x + 4 > size)
+            {
+                const __m128 inside = _mm_cmplt_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets),
+                                                   _mm_set1_ps(static_cast<float>(size)));
+                weight = _mm_and_ps(weight, inside);
+            }
+
+            const __m128 dx = _mm_mul_ps(_mm_add_ps(baseX, _mm_mul_ps(u, uAxisX)), inverseLength);
+            const __m128 dy = _mm_mul_ps(_mm_add_ps(baseY, _mm_mul_ps(u, uAxisY)), inverseLength);
+            const __m128 dz = _mm_mul_ps(_mm_add_ps(baseZ, _mm_mul_ps(u, uAxisZ)), inverseLength);
+
+            const __m128 basis[SHCoefficients::Count] = {
+                _mm_set1_ps(Y0),
+                _mm_mul_ps(_mm_set1_ps(Y1), dy),
+                _mm_mul_ps(_mm_set1_ps(Y1), dz),
+                _mm_mul_ps(_mm_set1_ps(Y1), dx),
+                _mm_mul_ps(_mm_set1_ps(Y2), _mm_mul_ps(dx, dy)),
+                _mm_mul_ps(_mm_set1_ps(Y2), _mm_mul_ps(dy, dz)),
+                _mm_mul_ps(_mm_set1_ps(Y20), _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one)),
+                _mm_mul_ps(_mm_set1_ps(Y2), _mm_mul_ps(dx, dz)),
+                _mm_mul_ps(_mm_set1_ps(Y22), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))),
+            };
+
+            const __m128 weightedR = _mm_mul_ps(r, weight);
+            const __m128 weightedG = _mm_mul_ps(g, weight);
+            const __m128 weightedB = _mm_mul_ps(b, weight);
+
+            for (uint32_t i = 0; i < SHCoefficients::Count; i++)
+            {
+                accumulator.sums[i * 3 + 0] = _mm_add_ps(accumulator.sums[i * 3 + 0], _mm_mul_ps(basis[i], weightedR));
+                accumulator.sums[i * 3 + 1] = _mm_add_ps(accumulator.sums[i * 3 + 1], _mm_mul_ps(basis[i], weightedG));
+                accumulator.sums[i * 3 + 2] = _mm_add_ps(accumulator.sums[i * 3 + 2], _mm_mul_ps(basis[i], weightedB));
+            }
+
+            accumulator.sums[SHCoefficients::Count * 3] = _mm_add_ps(accumulator.sums[SHCoefficients::Count * 3], weight);
+        }
+    }
+}
+
+void EnvironmentSHProjector::Project(const CubeMapImage& source, SHCoefficients& radiance)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    uint32_t mip = 0;
+
+    while (m_settings.maxSize > 0 && mip + 1 < source.GetMipCount() && source.GetSize(mip) > m_settings.maxSize)
+    {
+        mip++;
+    }
+
+    const uint32_t size = source.GetSize(mip);
+    const uint32_t rowCount = size * CubeMapImage::FaceCount;
+
+    // Threads are not worth starting for less than a few rows each
+    const uint32_t hardwareThreads = m_settings.threads > 0 ? m_settings.threads : (std::max)(1u, std::thread::hardware_concurrency());
+    const uint32_t threadCount = (std::min)(hardwareThreads, (std::max)(1u, rowCount / 16));
+
+    // One job per row of a face
+    std::vector<Accumulator> accumulators(threadCount);
+    std::atomic<uint32_t> nextRow(0);
+
+    auto worker = [&](Accumulator& accumulator)
+    {
+        for (uint32_t row = nextRow++; row < rowCount; row = nextRow++)
+        {
+            const uint32_t face = row / size;
+            const uint32_t y = row % size;
+
+            ProjectRow(source.GetFace(face, mip) + static_cast<size_t>(y) * size, face, y, size, accumulator);
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 1; i < threadCount; i++)
+    {
+        threads.emplace_back(worker, std::ref(accumulators[i]));
+    }
+
+    worker(accumulators[0]);
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    double sums[SHCoefficients::Count * 3 + 1] = {};
+
+    for (const auto& accumulator : accumulators)
+    {
+        for (uint32_t i = 0; i < SHCoefficients::Count * 3 + 1; i++)
+        {
+            sums[i] += HorizontalSum(accumulator.sums[i]);
+        }
+    }
+
+    // The differential solid angles do not add up to exactly 4 pi on a coarse face
+    const double normalization = 4.0 * Pi / sums[SHCoefficients::Count * 3];
+
+    for (uint32_t i = 0; i < SHCoefficients::Count; i++)
+    {
+        for (uint32_t channel = 0; channel < 3; channel++)
+        {
+            radiance.coefficients[i][channel] = static_cast<float>(sums[i * 3 + channel] * normalization);
+        }
+    }
+
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    m_stats.texels = static_cast<uint64_t>(size) * size * CubeMapImage::FaceCount;
+    m_stats.size = size;
+}
+
+void EnvironmentSHProjector::GetLightingConstants(const SHCoefficients& radiance, EnvironmentLightingConstants& constants)
+{
+    // Clamped cosine convolution per band (pi, 2 pi / 3, pi / 4), divided by pi,
+    // times the normalization constant of each basis function
+    const float scales[SHCoefficients::Count] = {
+        Y0,
+        Y1 * 2.0f / 3.0f, Y1 * 2.0f / 3.0f, Y1 * 2.0f / 3.0f,
+        Y2 * 0.25f, Y2 * 0.25f, Y20 * 0.25f, Y2 * 0.25f, Y22 * 0.25f,
+    };
+
+    for (uint32_t i = 0; i < SHCoefficients::Count; i++)
+    {
+        constants.coefficients[i][0] = radiance.coefficients[i][0] * scales[i];
+        constants.coefficients[i][1] = radiance.coefficients[i][1] * scales[i];
+        constants.coefficients[i][2] = radiance.coefficients[i][2] * scales[i];
+        constants.coefficients[i][3] = 0.0f;
+    }
+}
+
+void EnvironmentSHProjector::GetUniformLightingConstants(const float color[3], EnvironmentLightingConstants& constants)
+{
+    constants = EnvironmentLightingConstants();
+
+    constants.coefficients[0][0] = color[0];
+    constants.coefficients[0][1] = color[1];
+    constants.coefficients[0][2] = color[2];
+}
+
+void EnvironmentSHProjector::EvaluateLighting(const EnvironmentLightingConstants& constants, const float direction[3], float color[3])
+{
+    const float x = direction[0];
+    const float y = direction[1];
+    const float z = direction[2];
+
+    const float basis[SHCoefficients::Count] = { 1.0f, y, z, x, x * y, y * z, 3.0f * z * z - 1.0f, x * z, x * x - y * y };
+
+    for (uint32_t channel = 0; channel < 3; channel++)
+    {
+        color[channel] = 0.0f;
+
+        for (uint32_t i = 0; i < SHCoefficients::Count; i++)
+        {
+            color[channel] += constants.coefficients[i][channel] * basis[i];
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CubeMap.h"
+
+#include <cstdint>
+
+/// Order 2 (9 coefficient) spherical harmonics of an RGB function on the sphere, in
+/// the usual real basis order: Y00, Y1-1, Y10, Y11, Y2-2, Y2-1, Y20, Y21, Y22
+struct SHCoefficients
+{
+    static const uint32_t Count = 9;
+
+    float coefficients[Count][3] = {};
+};
+
+/// Diffuse environment lighting as read by Hit.hlsl (cbuffer EnvironmentLighting). Each
+/// float4 holds one RGB coefficient with the basis constants and the cosine lobe already
+/// folded in, so the shader evaluates the polynomial
+///
+///   c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+///
+/// and gets irradiance / pi, the outgoing radiance of a white Lambertian surface.
+struct EnvironmentLightingConstants
+{
+    float coefficients[SHCoefficients::Count][4];
+};
+
+static_assert(sizeof(EnvironmentLightingConstants) == 144, "Must match cbuffer EnvironmentLighting");
+
+/// Projects an environment cube map onto L2 spherical harmonics (Ramamoorthi and
+/// Hanrahan, "An Efficient Representation for Irradiance Environment Maps"). Every texel
+/// is weighted by its solid angle. Rows of four texels are integrated with SSE, and
+/// the rows of all faces are spread over threads.
+///
+/// L2 keeps nothing above a few degrees of detail. A 64x64 face therefore gives the
+/// same coefficients as the full-resolution map, and the projection reads the first
+/// mip no larger than Settings::maxSize. Call CubeMapImage::BuildMipChain first so
+/// that one exists.
+class EnvironmentSHProjector
+{
+public:
+    struct Settings
+    {
+        /// Largest face size to integrate, 0 for mip 0 whatever its size
+        uint32_t maxSize = 64;
+        /// Worker threads, 0 for one per hardware thread
+        uint32_t threads = 0;
+    };
+
+    struct Stats
+    {
+        double seconds = 0.0;
+        uint64_t texels = 0;
+        uint32_t size = 0;
+    };
+
+    explicit EnvironmentSHProjector(const Settings& settings) : m_settings(settings) {}
+
+    /// Project the radiance of the cube map, in the world directions the cube is
+    /// sampled with
+    void Project(const CubeMapImage& source, SHCoefficients& radiance);
+
+    /// Convolve radiance with the clamped cosine lobe and fold in the basis constants
+    static void GetLightingConstants(const SHCoefficients& radiance, EnvironmentLightingConstants& constants);
+
+    /// Constants of a uniform environment, as a fallback when no cube map is available
+    static void GetUniformLightingConstants(const float color[3], EnvironmentLightingConstants& constants);
+
+    /// Evaluate the shader polynomial on the CPU, for a normalized direction
+    static void EvaluateLighting(const EnvironmentLightingConstants& constants, const float direction[3], float color[3]);
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    Settings m_settings;
+    Stats m_stats;
+};
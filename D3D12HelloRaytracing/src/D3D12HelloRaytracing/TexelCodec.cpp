@@ -0,0 +1,409 @@
+#include "TexelCodec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    bool IsSRGB(TextureFormat format)
+    {
+        return format == TextureFormat::R8G8B8A8_UNorm_sRGB || format == TextureFormat::B8G8R8A8_UNorm_sRGB ||
+               format == TextureFormat::BC1_UNorm_sRGB || format == TextureFormat::BC2_UNorm_sRGB ||
+               format == TextureFormat::BC3_UNorm_sRGB;
+    }
+
+    uint8_t ToUNorm8(float value)
+    {
+        return static_cast<uint8_t>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    // RGB565 endpoint to 8-bit channels, replicating the high bits like the hardware
+    void UnpackRGB565(uint16_t color, uint8_t rgb[3])
+    {
+        const uint32_t r = (color >> 11) & 31;
+        const uint32_t g = (color >> 5) & 63;
+        const uint32_t b = color & 31;
+
+        rgb[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        rgb[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+        rgb[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    }
+
+    // Color part of a BC1/BC2/BC3 block to 16 RGBA texels. BC1 blocks whose first
+    // endpoint is not greater than the second use the 3-color mode with transparent black.
+    void DecodeColorBlock(const uint8_t* block, bool allowThreeColor, uint8_t texels[16][4])
+    {
+        const uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+        const uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+
+        uint8_t palette[4][4];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        palette[0][3] = palette[1][3] = 255;
+
+        for (int c = 0; c < 3; c++)
+        {
+            if (color0 > color1 || !allowThreeColor)
+            {
+                palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c] + 1) / 3);
+                palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+            }
+            else
+            {
+                palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+                palette[3][c] = 0;
+            }
+        }
+
+        palette[2][3] = 255;
+        palette[3][3] = (color0 > color1 || !allowThreeColor) ? 255 : 0;
+
+        uint32_t indices;
+        memcpy(&indices, block + 4, sizeof(indices));
+
+        for (int i = 0; i < 16; i++)
+        {
+            memcpy(texels[i], palette[(indices >> (2 * i)) & 3], 4);
+        }
+    }
+
+    // BC3 interpolated alpha block
+    void DecodeAlphaBlock(const uint8_t* block, uint8_t texels[16][4])
+    {
+        uint8_t alpha[8];
+        alpha[0] = block[0];
+        alpha[1] = block[1];
+
+        if (alpha[0] > alpha[1])
+        {
+            for (int i = 1; i < 7; i++)
+            {
+                alpha[i + 1] = static_cast<uint8_t>(((7 - i) * alpha[0] + i * alpha[1] + 3) / 7);
+            }
+        }
+        else
+        {
+            for (int i = 1; i < 5; i++)
+            {
+                alpha[i + 1] = static_cast<uint8_t>(((5 - i) * alpha[0] + i * alpha[1] + 2) / 5);
+            }
+
+            alpha[6] = 0;
+            alpha[7] = 255;
+        }
+
+        uint64_t indices = 0;
+
+        for (int i = 0; i < 6; i++)
+        {
+            indices |= static_cast<uint64_t>(block[2 + i]) << (8 * i);
+        }
+
+        for (int i = 0; i < 16; i++)
+        {
+            texels[i][3] = alpha[(indices >> (3 * i)) & 7];
+        }
+    }
+
+    void DecodeBlockSurface(TextureFormat format, const uint8_t* source, size_t rowPitch,
+                            uint32_t width, uint32_t height, Texel* destination, bool srgb)
+    {
+        const uint32_t blockSize = GetBytesPerBlock(format);
+        uint8_t texels[16][4];
+
+        for (uint32_t blockY = 0; blockY < (height + 3) / 4; blockY++)
+        {
+            for (uint32_t blockX = 0; blockX < (width + 3) / 4; blockX++)
+            {
+                const uint8_t* block = source + blockY * rowPitch + static_cast<size_t>(blockX) * blockSize;
+
+                switch (format)
+                {
+                case TextureFormat::BC1_UNorm:
+                case TextureFormat::BC1_UNorm_sRGB:
+                    DecodeColorBlock(block, true, texels);
+                    break;
+
+                case TextureFormat::BC2_UNorm:
+                case TextureFormat::BC2_UNorm_sRGB:
+                    DecodeColorBlock(block + 8, false, texels);
+
+                    for (int i = 0; i < 16; i++)
+                    {
+                        const uint32_t alpha = (block[i / 2] >> (4 * (i & 1))) & 15;
+                        texels[i][3] = static_cast<uint8_t>(alpha * 17);
+                    }
+                    break;
+
+                default:
+                    DecodeColorBlock(block + 8, false, texels);
+                    DecodeAlphaBlock(block, texels);
+                    break;
+                }
+
+                for (uint32_t y = 0; y < 4 && blockY * 4 + y < height; y++)
+                {
+                    for (uint32_t x = 0; x < 4 && blockX * 4 + x < width; x++)
+                    {
+                        const uint8_t* texel = texels[y * 4 + x];
+                        Texel& output = destination[(blockY * 4 + y) * static_cast<size_t>(width) + blockX * 4 + x];
+
+                        output.r = texel[0] / 255.0f;
+                        output.g = texel[1] / 255.0f;
+                        output.b = texel[2] / 255.0f;
+                        output.a = texel[3] / 255.0f;
+
+                        if (srgb)
+                        {
+                            output.r = SRGBToLinear(output.r);
+                            output.g = SRGBToLinear(output.g);
+                            output.b = SRGBToLinear(output.b);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff)
+    {
+        // Infinity stays infinity, NaN stays a quiet NaN
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    const int halfExponent = static_cast<int>(exponent) - 127 + 15;
+
+    if (halfExponent >= 31)
+    {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    if (halfExponent <= 0)
+    {
+        // Subnormal or zero
+        if (halfExponent < -10)
+        {
+            return static_cast<uint16_t>(sign);
+        }
+
+        mantissa |= 0x800000;
+        const int shift = 14 - halfExponent;
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+        {
+            half++;
+        }
+
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fff;
+
+    // A carry out of the mantissa correctly bumps the exponent, up to infinity
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+    {
+        half++;
+    }
+
+    return static_cast<uint16_t>(sign | half);
+}
+
+float HalfToFloat(uint16_t value)
+{
+    const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 31;
+    const uint32_t mantissa = value & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0)
+    {
+        if (mantissa == 0)
+        {
+            bits = sign;
+        }
+        else
+        {
+            // Subnormal half, normal float
+            const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+            memcpy(&bits, &magnitude, sizeof(bits));
+            bits |= sign;
+        }
+    }
+    else if (exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+float SRGBToLinear(float value)
+{
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float LinearToSRGB(float value)
+{
+    return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+bool CanDecodeTexels(TextureFormat format)
+{
+    switch (format)
+    {
+    case TextureFormat::R8G8B8A8_UNorm:
+    case TextureFormat::R8G8B8A8_UNorm_sRGB:
+    case TextureFormat::B8G8R8A8_UNorm:
+    case TextureFormat::B8G8R8A8_UNorm_sRGB:
+    case TextureFormat::R16G16B16A16_Float:
+    case TextureFormat::R32G32B32A32_Float:
+    case TextureFormat::BC1_UNorm:
+    case TextureFormat::BC1_UNorm_sRGB:
+    case TextureFormat::BC2_UNorm:
+    case TextureFormat::BC2_UNorm_sRGB:
+    case TextureFormat::BC3_UNorm:
+    case TextureFormat::BC3_UNorm_sRGB:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool CanEncodeTexels(TextureFormat format)
+{
+    return format == TextureFormat::R8G8B8A8_UNorm || format == TextureFormat::R8G8B8A8_UNorm_sRGB ||
+           format == TextureFormat::R16G16B16A16_Float || format == TextureFormat::R32G32B32A32_Float;
+}
+
+void DecodeSurface(TextureFormat format, const uint8_t* source, size_t rowPitch,
+                   uint32_t width, uint32_t height, Texel* destination)
+{
+    if (!CanDecodeTexels(format))
+    {
+        throw std::runtime_error(std::string("Cannot decode texels of format ") + GetTextureFormatName(format));
+    }
+
+    const bool srgb = IsSRGB(format);
+
+    if (IsBlockCompressed(format))
+    {
+        DecodeBlockSurface(format, source, rowPitch, width, height, destination, srgb);
+        return;
+    }
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t* row = source + y * rowPitch;
+        Texel* output = destination + static_cast<size_t>(y) * width;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            Texel& texel = output[x];
+
+            switch (format)
+            {
+            case TextureFormat::R16G16B16A16_Float:
+            {
+                uint16_t half[4];
+                memcpy(half, row + x * 8, sizeof(half));
+                texel.r = HalfToFloat(half[0]);
+                texel.g = HalfToFloat(half[1]);
+                texel.b = HalfToFloat(half[2]);
+                texel.a = HalfToFloat(half[3]);
+                break;
+            }
+
+            case TextureFormat::R32G32B32A32_Float:
+                memcpy(&texel, row + x * 16, sizeof(texel));
+                break;
+
+            default:
+            {
+                const uint8_t* bytes = row + x * 4;
+                const bool bgra = format == TextureFormat::B8G8R8A8_UNorm || format == TextureFormat::B8G8R8A8_UNorm_sRGB;
+
+                texel.r = bytes[bgra ? 2 : 0] / 255.0f;
+                texel.g = bytes[1] / 255.0f;
+                texel.b = bytes[bgra ? 0 : 2] / 255.0f;
+                texel.a = bytes[3] / 255.0f;
+
+                if (srgb)
+                {
+                    texel.r = SRGBToLinear(texel.r);
+                    texel.g = SRGBToLinear(texel.g);
+                    texel.b = SRGBToLinear(texel.b);
+                }
+                break;
+            }
+            }
+        }
+    }
+}
+
+void EncodeSurface(TextureFormat format, const Texel* source, uint32_t width, uint32_t height,
+                   uint8_t* destination, size_t rowPitch)
+{
+    if (!CanEncodeTexels(format))
+    {
+        throw std::runtime_error(std::string("Cannot encode texels of format ") + GetTextureFormatName(format));
+    }
+
+    const bool srgb = IsSRGB(format);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint8_t* row = destination + y * rowPitch;
+        const Texel* input = source + static_cast<size_t>(y) * width;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const Texel& texel = input[x];
+
+            switch (format)
+            {
+            case TextureFormat::R16G16B16A16_Float:
+            {
+                const uint16_t half[4] = { FloatToHalf(texel.r), FloatToHalf(texel.g), FloatToHalf(texel.b), FloatToHalf(texel.a) };
+                memcpy(row + x * 8, half, sizeof(half));
+                break;
+            }
+
+            case TextureFormat::R32G32B32A32_Float:
+                memcpy(row + x * 16, &texel, sizeof(texel));
+                break;
+
+            default:
+            {
+                uint8_t* bytes = row + x * 4;
+                bytes[0] = ToUNorm8(srgb ? LinearToSRGB(texel.r) : texel.r);
+                bytes[1] = ToUNorm8(srgb ? LinearToSRGB(texel.g) : texel.g);
+                bytes[2] = ToUNorm8(srgb ? LinearToSRGB(texel.b) : texel.b);
+                bytes[3] = ToUNorm8(texel.a);
+                break;
+            }
+            }
+        }
+    }
+}
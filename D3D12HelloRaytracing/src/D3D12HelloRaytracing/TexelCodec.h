@@ -0,0 +1,39 @@
+#pragma once
+
+#include "DDSFile.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// Linear RGBA value used by the CPU image processing tools
+struct Texel
+{
+    float r = 0.0f;
+    float g = 0.0f;
+    float b = 0.0f;
+    float a = 0.0f;
+};
+
+/// IEEE 754 half-precision conversions, round to nearest even
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t value);
+
+float SRGBToLinear(float value);
+float LinearToSRGB(float value);
+
+/// True for the formats DecodeSurface can read: 8-bit RGBA/BGRA (UNorm and sRGB),
+/// RGBA16F, RGBA32F and BC1-BC3
+bool CanDecodeTexels(TextureFormat format);
+
+/// True for the formats EncodeSurface can write: 8-bit RGBA (UNorm and sRGB), RGBA16F
+/// and RGBA32F
+bool CanEncodeTexels(TextureFormat format);
+
+/// Decode one surface to width * height linear texels. sRGB formats are converted to
+/// linear. Throws std::runtime_error for formats CanDecodeTexels rejects.
+void DecodeSurface(TextureFormat format, const uint8_t* source, size_t rowPitch,
+                   uint32_t width, uint32_t height, Texel* destination);
+
+/// Encode width * height linear texels into one surface
+void EncodeSurface(TextureFormat format, const Texel* source, uint32_t width, uint32_t height,
+                   uint8_t* destination, size_t rowPitch);
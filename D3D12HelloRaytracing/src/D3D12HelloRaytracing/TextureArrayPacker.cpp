@@ -0,0 +1,294 @@
+#include "TextureArrayPacker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+namespace
+{
+    std::string GetFileName(const std::string& path)
+    {
+        const auto separator = path.find_last_of("/\\");
+        return separator == std::string::npos ? path : path.substr(separator + 1);
+    }
+
+    // 2x2 box filter from one 8-bit RGBA level to the next, clamping at odd edges
+    void DownsampleRGBA8(const uint8_t* source, uint32_t sourceWidth, uint32_t sourceHeight,
+                         uint8_t* destination, uint32_t width, uint32_t height)
+    {
+        for (uint32_t y = 0; y < height; y++)
+        {
+            const uint32_t y0 = std::min(y * 2, sourceHeight - 1);
+            const uint32_t y1 = std::min(y * 2 + 1, sourceHeight - 1);
+
+            for (uint32_t x = 0; x < width; x++)
+            {
+                const uint32_t x0 = std::min(x * 2, sourceWidth - 1);
+                const uint32_t x1 = std::min(x * 2 + 1, sourceWidth - 1);
+
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    const uint32_t sum = source[(y0 * sourceWidth + x0) * 4 + c] + source[(y0 * sourceWidth + x1) * 4 + c] +
+                                         source[(y1 * sourceWidth + x0) * 4 + c] + source[(y1 * sourceWidth + x1) * 4 + c];
+                    destination[(y * width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//
+// Remap table
+//
+void TextureRemapTable::Load(const std::string& path)
+{
+    std::ifstream file(path);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot open texture remap table " + path);
+    }
+
+    arrays.clear();
+    textures.clear();
+
+    std::string line;
+
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string keyword;
+        stream >> keyword;
+
+        if (keyword.empty() || keyword[0] == '#')
+        {
+            continue;
+        }
+
+        if (keyword == "array")
+        {
+            uint32_t index = 0;
+            std::string arrayFile;
+            stream >> index >> arrayFile;
+
+            if (stream.fail() || index != arrays.size())
+            {
+                throw std::runtime_error("Malformed array record in " + path);
+            }
+
+            arrays.push_back(arrayFile);
+        }
+        else if (keyword == "texture")
+        {
+            TextureRemapEntry entry;
+            stream >> entry.name >> entry.arrayIndex >> entry.slice;
+
+            if (stream.fail() || entry.arrayIndex >= arrays.size())
+            {
+                throw std::runtime_error("Malformed texture record in " + path);
+            }
+
+            textures.push_back(entry);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown record '" + keyword + "' in " + path);
+        }
+    }
+}
+
+void TextureRemapTable::Save(const std::string& path) const
+{
+    std::ofstream file(path);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create texture remap table " + path);
+    }
+
+    file << "# Generated by AssetTools pack\n";
+
+    for (size_t i = 0; i < arrays.size(); i++)
+    {
+        file << "array " << i << " " << arrays[i] << "\n";
+    }
+
+    for (const auto& entry : textures)
+    {
+        file << "texture " << entry.name << " " << entry.arrayIndex << " " << entry.slice << "\n";
+    }
+}
+
+const TextureRemapEntry* TextureRemapTable::Find(const std::string& name) const
+{
+    for (const auto& entry : textures)
+    {
+        if (entry.name == name)
+        {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Packer
+//
+void TextureArrayPacker::AddTexture(const std::string& path)
+{
+    SourceTexture source;
+    source.name = GetFileName(path);
+    source.file.Load(path);
+
+    if (source.file.isCubeMap || source.file.arraySize != 1)
+    {
+        throw std::runtime_error("Only single 2D textures can be packed: " + path);
+    }
+
+    if (m_settings.resampleWidth != 0 && m_settings.resampleHeight != 0 &&
+        (source.file.width != m_settings.resampleWidth || source.file.height != m_settings.resampleHeight))
+    {
+        if (IsUncompressed8BitRGBA(source.file.format))
+        {
+            Resample(source.file, m_settings.resampleWidth, m_settings.resampleHeight);
+        }
+        else
+        {
+            m_warnings.push_back(source.name + ": " + GetTextureFormatName(source.file.format) +
+                                 " cannot be resampled, keeping its own size");
+        }
+    }
+
+    m_sources.push_back(std::move(source));
+}
+
+//-----------------------------------------------------------------------------
+//
+// Bilinear resample of the top mip, then rebuild the whole chain with a box filter
+//
+void TextureArrayPacker::Resample(DDSFile& texture, uint32_t width, uint32_t height) const
+{
+    const DDSSubresource& top = texture.GetSubresource(0);
+    const uint8_t* source = texture.GetSubresourceData(0);
+
+    DDSFile resampled;
+    resampled.Initialize(texture.format, width, height, 1, CountMips(width, height), false);
+    resampled.alphaMode = texture.alphaMode;
+
+    uint8_t* destination = resampled.GetSubresourceData(0);
+
+    const float scaleX = static_cast<float>(top.width) / width;
+    const float scaleY = static_cast<float>(top.height) / height;
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const float sourceY = std::max(0.0f, (y + 0.5f) * scaleY - 0.5f);
+        const uint32_t y0 = std::min(static_cast<uint32_t>(sourceY), top.height - 1);
+        const uint32_t y1 = std::min(y0 + 1, top.height - 1);
+        const float fy = sourceY - y0;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            const float sourceX = std::max(0.0f, (x + 0.5f) * scaleX - 0.5f);
+            const uint32_t x0 = std::min(static_cast<uint32_t>(sourceX), top.width - 1);
+            const uint32_t x1 = std::min(x0 + 1, top.width - 1);
+            const float fx = sourceX - x0;
+
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                const float c00 = source[y0 * top.rowPitch + x0 * 4 + c];
+                const float c10 = source[y0 * top.rowPitch + x1 * 4 + c];
+                const float c01 = source[y1 * top.rowPitch + x0 * 4 + c];
+                const float c11 = source[y1 * top.rowPitch + x1 * 4 + c];
+
+                const float value = (c00 * (1.0f - fx) + c10 * fx) * (1.0f - fy) + (c01 * (1.0f - fx) + c11 * fx) * fy;
+                destination[(y * width + x) * 4 + c] = static_cast<uint8_t>(std::lround(std::min(255.0f, value)));
+            }
+        }
+    }
+
+    for (uint32_t mip = 1; mip < resampled.mipLevels; mip++)
+    {
+        const DDSSubresource& parent = resampled.GetSubresource(mip - 1);
+        const DDSSubresource& child = resampled.GetSubresource(mip);
+
+        DownsampleRGBA8(resampled.GetSubresourceData(mip - 1), parent.width, parent.height,
+                        resampled.GetSubresourceData(mip), child.width, child.height);
+    }
+
+    texture = std::move(resampled);
+}
+
+void TextureArrayPacker::Pack(const std::string& outputPrefix)
+{
+    // Buckets are ordered by key so the output is deterministic for a given input set
+    using BucketKey = std::tuple<uint32_t, uint32_t, uint32_t>;
+    std::map<BucketKey, std::vector<const SourceTexture*>> buckets;
+
+    for (const auto& source : m_sources)
+    {
+        buckets[BucketKey(static_cast<uint32_t>(source.file.format), source.file.width, source.file.height)].push_back(&source);
+    }
+
+    m_remapTable = TextureRemapTable();
+
+    const std::string prefixName = GetFileName(outputPrefix);
+
+    for (const auto& bucket : buckets)
+    {
+        const auto& members = bucket.second;
+        const DDSFile& first = members.front()->file;
+
+        uint32_t mipLevels = first.mipLevels;
+
+        for (const auto* member : members)
+        {
+            if (member->file.mipLevels != mipLevels)
+            {
+                m_warnings.push_back(member->name + ": mip count differs from other textures of its bucket");
+            }
+
+            mipLevels = std::min(mipLevels, member->file.mipLevels);
+        }
+
+        DDSFile packed;
+        packed.Initialize(first.format, first.width, first.height, static_cast<uint32_t>(members.size()), mipLevels, false);
+        packed.alphaMode = first.alphaMode;
+
+        const uint32_t arrayIndex = static_cast<uint32_t>(m_remapTable.arrays.size());
+
+        for (uint32_t slice = 0; slice < members.size(); slice++)
+        {
+            const DDSFile& member = members[slice]->file;
+
+            for (uint32_t mip = 0; mip < mipLevels; mip++)
+            {
+                const uint32_t destinationIndex = packed.GetSubresourceIndex(mip, slice);
+                const uint32_t sourceIndex = member.GetSubresourceIndex(mip, 0);
+
+                memcpy(packed.GetSubresourceData(destinationIndex), member.GetSubresourceData(sourceIndex),
+                       packed.GetSubresource(destinationIndex).slicePitch);
+            }
+
+            TextureRemapEntry entry;
+            entry.name = members[slice]->name;
+            entry.arrayIndex = arrayIndex;
+            entry.slice = slice;
+            m_remapTable.textures.push_back(entry);
+        }
+
+        const std::string suffix = "_" + std::to_string(arrayIndex) + ".dds";
+        packed.Save(outputPrefix + suffix);
+        m_remapTable.arrays.push_back(prefixName + suffix);
+    }
+
+    m_remapTable.Save(outputPrefix + ".remap");
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "DDSFile.h"
+
+#include <string>
+#include <vector>
+
+/// Where a source texture ended up after packing: which array file, and which slice of it
+struct TextureRemapEntry
+{
+    std::string name;
+    uint32_t arrayIndex = 0;
+    uint32_t slice = 0;
+};
+
+/// Text table written next to the packed arrays, mapping the original texture names to
+/// (array, slice). One line per record:
+///
+///   array <arrayIndex> <file>
+///   texture <name> <arrayIndex> <slice>
+///
+/// Names are the source file names without directory, e.g. "bricks1.dds".
+class TextureRemapTable
+{
+public:
+    /// Read a table from disk. Throws std::runtime_error on failure.
+    void Load(const std::string& path);
+
+    void Save(const std::string& path) const;
+
+    /// Return the entry of a texture, or nullptr if it was not packed
+    const TextureRemapEntry* Find(const std::string& name) const;
+
+    /// Array files, relative to the directory of the table
+    std::vector<std::string> arrays;
+    std::vector<TextureRemapEntry> textures;
+};
+
+/// Groups textures of the same format and size into Texture2DArray DDS files, so that the
+/// renderer can bind one resource and one SRV per bucket instead of one per texture.
+///
+/// Textures are bucketed by (format, width, height). Optionally, uncompressed 8-bit RGBA
+/// textures can be resampled to a target size first so that textures which only differ by
+/// resolution share a bucket. Block-compressed textures cannot be resampled on the CPU and
+/// always keep their own size.
+class TextureArrayPacker
+{
+public:
+    struct Settings
+    {
+        /// If non-zero, 8-bit RGBA textures are resampled to this size before bucketing
+        uint32_t resampleWidth = 0;
+        uint32_t resampleHeight = 0;
+    };
+
+    explicit TextureArrayPacker(const Settings& settings) : m_settings(settings) {}
+
+    /// Add a source texture. Cube maps and texture arrays are rejected.
+    void AddTexture(const std::string& path);
+
+    /// Build one array per bucket and write "<outputPrefix>_<index>.dds" along with
+    /// "<outputPrefix>.remap". Arrays keep the smallest mip count of their members.
+    void Pack(const std::string& outputPrefix);
+
+    const TextureRemapTable& GetRemapTable() const { return m_remapTable; }
+
+    /// Non-fatal issues encountered while packing, e.g. textures that could not be resampled
+    const std::vector<std::string>& GetWarnings() const { return m_warnings; }
+
+private:
+    struct SourceTexture
+    {
+        std::string name;
+        DDSFile file;
+    };
+
+    void Resample(DDSFile& texture, uint32_t width, uint32_t height) const;
+
+    Settings m_settings;
+    std::vector<SourceTexture> m_sources;
+    TextureRemapTable m_remapTable;
+    std::vector<std::string> m_warnings;
+};
@@ -0,0 +1,224 @@
+#include "TextureCache.h"
+
+#include "CompressedTexture.h"
+#include "ContentHash.h"
+#include "DDSFile.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    const char* const IndexHeader = "# TextureCache index v1";
+}
+
+//-----------------------------------------------------------------------------
+//
+// Index
+//
+// One record per line, the path last so it may contain spaces:
+//
+//   file <fileSize> <modifiedTime> <hash> <payloadSize> <path>
+//
+void TextureCache::LoadIndex(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string line;
+
+    if (!file.good() || !std::getline(file, line) || line != IndexHeader)
+    {
+        return;
+    }
+
+    while (std::getline(file, line))
+    {
+        std::istringstream stream(line);
+        std::string keyword;
+        IndexEntry entry;
+
+        stream >> keyword >> entry.fileSize >> entry.modifiedTime >> std::hex >> entry.hash >> std::dec >> entry.payloadSize;
+        stream.get();
+
+        std::string texturePath;
+        std::getline(stream, texturePath);
+
+        if (stream.fail() || keyword != "file" || texturePath.empty())
+        {
+            // A damaged index only costs a rehash
+            m_index.clear();
+            return;
+        }
+
+        m_index[texturePath] = entry;
+    }
+
+    m_indexChanged = false;
+}
+
+void TextureCache::SaveIndex(const std::string& path) const
+{
+    if (!m_indexChanged)
+    {
+        return;
+    }
+
+    std::ofstream file(path);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot create texture cache index " + path);
+    }
+
+    file << IndexHeader << "\n";
+
+    for (const auto& record : m_index)
+    {
+        const IndexEntry& entry = record.second;
+
+        file << "file " << entry.fileSize << " " << entry.modifiedTime << " "
+             << std::hex << entry.hash << std::dec << " " << entry.payloadSize << " " << record.first << "\n";
+    }
+}
+
+const TextureCache::IndexEntry& TextureCache::Lookup(const std::string& path)
+{
+    std::error_code error;
+    const uint64_t fileSize = std::filesystem::file_size(path, error);
+    const int64_t modifiedTime = error ? 0 : static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+
+    if (error)
+    {
+        throw std::runtime_error("Cannot open texture " + path);
+    }
+
+    auto found = m_index.find(path);
+
+    if (found != m_index.end() && found->second.fileSize == fileSize && found->second.modifiedTime == modifiedTime)
+    {
+        m_stats.indexHits++;
+        return found->second;
+    }
+
+    DDSFile texture;
+    std::vector<uint8_t> payload;
+
+    if (CompressedTextureFile::IsCompressedTexturePath(path))
+    {
+        // Hash the decoded payload, so a .ctex matches the DDS file it was made from
+        CompressedTextureFile compressed;
+        compressed.Open(path);
+        compressed.Load(texture);
+        payload.swap(texture.data);
+    }
+    else
+    {
+        texture.LoadHeader(path);
+        payload.resize(texture.GetPayloadSize());
+
+        std::ifstream file(path, std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(texture.payloadOffset));
+        file.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+
+        if (!file.good())
+        {
+            throw std::runtime_error("Truncated texture " + path);
+        }
+    }
+
+    // The description seeds the payload hash, so equal bytes in different formats or
+    // layouts do not collide
+    const uint32_t description[] = {
+        static_cast<uint32_t>(texture.format), texture.width, texture.height,
+        texture.arraySize, texture.mipLevels, texture.isCubeMap ? 1u : 0u };
+
+    IndexEntry& entry = m_index[path];
+    entry.fileSize = fileSize;
+    entry.modifiedTime = modifiedTime;
+    entry.hash = HashContent(payload.data(), payload.size(), HashContent(description, sizeof(description)));
+    entry.payloadSize = payload.size();
+    m_indexChanged = true;
+
+    m_stats.filesHashed++;
+    m_stats.bytesHashed += payload.size();
+
+    return entry;
+}
+
+uint64_t TextureCache::GetContentHash(const std::string& path)
+{
+    return Lookup(path).hash;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Handles
+//
+uint32_t TextureCache::Acquire(const std::string& path, bool& created)
+{
+    const IndexEntry& entry = Lookup(path);
+    m_stats.requests++;
+
+    auto found = m_handles.find(entry.hash);
+
+    if (found != m_handles.end())
+    {
+        CachedTexture& texture = m_textures[found->second];
+        texture.refCount++;
+
+        m_stats.duplicates++;
+        m_stats.savedBytes += texture.payloadSize;
+
+        created = false;
+        return found->second;
+    }
+
+    uint32_t handle;
+
+    if (!m_freeHandles.empty())
+    {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+    }
+    else
+    {
+        handle = static_cast<uint32_t>(m_textures.size());
+        m_textures.emplace_back();
+    }
+
+    CachedTexture& texture = m_textures[handle];
+    texture.hash = entry.hash;
+    texture.payloadSize = entry.payloadSize;
+    texture.refCount = 1;
+    m_handles[entry.hash] = handle;
+
+    m_stats.uniqueTextures++;
+    m_stats.uniqueBytes += entry.payloadSize;
+
+    created = true;
+    return handle;
+}
+
+bool TextureCache::Release(uint32_t handle)
+{
+    CachedTexture& texture = m_textures.at(handle);
+
+    if (texture.refCount == 0)
+    {
+        throw std::logic_error("Texture cache handle released more often than acquired");
+    }
+
+    if (--texture.refCount > 0)
+    {
+        return false;
+    }
+
+    m_handles.erase(texture.hash);
+    m_freeHandles.push_back(handle);
+
+    m_stats.uniqueTextures--;
+    m_stats.uniqueBytes -= texture.payloadSize;
+
+    return true;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Counters of a TextureCache, reported after loading a scene
+struct TextureCacheStats
+{
+    /// Acquire calls
+    uint32_t requests = 0;
+    /// Textures with distinct content currently referenced
+    uint32_t uniqueTextures = 0;
+    /// Acquire calls that were served by an already cached texture
+    uint32_t duplicates = 0;
+    /// Files whose hash came from the index, without reading them
+    uint32_t indexHits = 0;
+    uint32_t filesHashed = 0;
+    uint64_t bytesHashed = 0;
+    /// Texel bytes of the unique textures
+    uint64_t uniqueBytes = 0;
+    /// Texel bytes that would have been allocated again for the duplicates
+    uint64_t savedBytes = 0;
+};
+
+/// Deduplicates textures by content: DDS or .ctex files with the same description and
+/// texel payload share one handle, whatever their path and container. Handles are
+/// reference counted; the cache only tracks them, the application keeps the resource of
+/// each handle (e.g. in a vector indexed by handle) and releases it when Release reports
+/// the last reference.
+///
+/// Hashing reads the whole payload, so the hashes are also kept in a small index keyed by
+/// path, file size and modification time. An index persisted with SaveIndex lets later
+/// runs skip reading unchanged files.
+class TextureCache
+{
+public:
+    static const uint32_t InvalidHandle = UINT32_MAX;
+
+    /// Read an index written by SaveIndex. A missing or malformed index is not an error,
+    /// the files are simply hashed again.
+    void LoadIndex(const std::string& path);
+
+    /// Write the index if it changed since LoadIndex. Throws std::runtime_error when the
+    /// file cannot be created.
+    void SaveIndex(const std::string& path) const;
+
+    /// Content hash of a DDS or .ctex file, covering its description and texel payload.
+    /// Throws std::runtime_error if the file cannot be read.
+    uint64_t GetContentHash(const std::string& path);
+
+    /// Reference the texture with the content of the given file. created is set when no
+    /// texture with this content is cached, the caller must then create the resource of
+    /// the returned handle.
+    uint32_t Acquire(const std::string& path, bool& created);
+
+    /// Drop a reference. Returns true when it was the last one: the handle becomes free
+    /// and the caller should release its resource.
+    bool Release(uint32_t handle);
+
+    uint32_t GetRefCount(uint32_t handle) const { return m_textures[handle].refCount; }
+    uint64_t GetHash(uint32_t handle) const { return m_textures[handle].hash; }
+
+    /// Number of handles ever allocated; sizes the application's resource table
+    uint32_t GetHandleCount() const { return static_cast<uint32_t>(m_textures.size()); }
+
+    TextureCacheStats GetStats() const { return m_stats; }
+
+private:
+    struct IndexEntry
+    {
+        uint64_t fileSize = 0;
+        int64_t modifiedTime = 0;
+        uint64_t hash = 0;
+        uint64_t payloadSize = 0;
+    };
+
+    struct CachedTexture
+    {
+        uint64_t hash = 0;
+        uint64_t payloadSize = 0;
+        uint32_t refCount = 0;
+    };
+
+    const IndexEntry& Lookup(const std::string& path);
+
+    std::unordered_map<std::string, IndexEntry> m_index;
+    bool m_indexChanged = false;
+
+    std::vector<CachedTexture> m_textures;
+    std::vector<uint32_t> m_freeHandles;
+    std::unordered_map<uint64_t, uint32_t> m_handles;
+
+    TextureCacheStats m_stats;
+};
@@ -0,0 +1,568 @@
+#include "TextureSampler.h"
+
+#include "CubeMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    const float* GetSRGBTable()
+    {
+        static const struct Table
+        {
+            float values[256];
+
+            Table()
+            {
+                for (uint32_t i = 0; i < 256; i++)
+                {
+                    values[i] = SRGBToLinear(i / 255.0f);
+                }
+            }
+        } table;
+
+        return table.values;
+    }
+
+    Texel Lerp(const Texel& a, const Texel& b, float t)
+    {
+        Texel result;
+        result.r = a.r + (b.r - a.r) * t;
+        result.g = a.g + (b.g - a.g) * t;
+        result.b = a.b + (b.b - a.b) * t;
+        result.a = a.a + (b.a - a.a) * t;
+        return result;
+    }
+
+    // Integer texel coordinate, kept in float like the SIMD path
+    float AddressCoordinate(float coordinate, float size, SamplerAddressMode addressMode)
+    {
+        if (addressMode == SamplerAddressMode::Wrap)
+        {
+            return coordinate - size * std::floor(coordinate / size);
+        }
+
+        return (std::min)((std::max)(coordinate, 0.0f), size - 1.0f);
+    }
+
+#if defined(__AVX2__)
+    // What the lanes need from the sampler
+    struct GatherLayout
+    {
+        const uint8_t* data;
+        const int32_t* offsets;
+        const int32_t* rowPitches;
+        const int32_t* widths;
+        const int32_t* heights;
+        const int32_t* mortonBits;
+        TextureFormat format;
+        int32_t bytesPerTexel;
+        bool srgb;
+        bool bgra;
+        bool morton;
+    };
+
+    struct TexelLanes
+    {
+        __m256 r, g, b, a;
+    };
+
+    __m256 LerpLanes(__m256 a, __m256 b, __m256 t)
+    {
+        return _mm256_fmadd_ps(_mm256_sub_ps(b, a), t, a);
+    }
+
+    TexelLanes LerpLanes(const TexelLanes& a, const TexelLanes& b, __m256 t)
+    {
+        return { LerpLanes(a.r, b.r, t), LerpLanes(a.g, b.g, t), LerpLanes(a.b, b.b, t), LerpLanes(a.a, b.a, t) };
+    }
+
+    __m256 AddressLanes(__m256 coordinate, __m256 size, SamplerAddressMode addressMode)
+    {
+        if (addressMode == SamplerAddressMode::Wrap)
+        {
+            return _mm256_sub_ps(coordinate, _mm256_mul_ps(size, _mm256_floor_ps(_mm256_div_ps(coordinate, size))));
+        }
+
+        return _mm256_min_ps(_mm256_max_ps(coordinate, _mm256_setzero_ps()), _mm256_sub_ps(size, _mm256_set1_ps(1.0f)));
+    }
+
+    // SpreadMortonBits on each lane
+    __m256i SpreadMortonBitsLanes(__m256i value)
+    {
+        value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 8)), _mm256_set1_epi32(0x00FF00FF));
+        value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+        value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 2)), _mm256_set1_epi32(0x33333333));
+        value = _mm256_and_si256(_mm256_or_si256(value, _mm256_slli_epi32(value, 1)), _mm256_set1_epi32(0x55555555));
+        return value;
+    }
+
+    // Halves in the low 16 bits of each lane
+    __m256 HalfToFloatLanes(__m256i halves)
+    {
+        const __m256i packed = _mm256_packus_epi32(halves, halves);
+        const __m256i ordered = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        return _mm256_cvtph_ps(_mm256_castsi256_si128(ordered));
+    }
+
+    __m256 UNorm8Lanes(__m256i texels, int shift, bool srgb)
+    {
+        const __m256i value = _mm256_and_si256(_mm256_srli_epi32(texels, shift), _mm256_set1_epi32(0xFF));
+
+        if (srgb)
+        {
+            return _mm256_i32gather_ps(GetSRGBTable(), value, 4);
+        }
+
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(value), _mm256_set1_ps(1.0f / 255.0f));
+    }
+
+    TexelLanes FetchLanes(const GatherLayout& layout, __m256i address)
+    {
+        const int* base = reinterpret_cast<const int*>(layout.data);
+        TexelLanes texel;
+
+        switch (layout.format)
+        {
+        case TextureFormat::R32G32B32A32_Float:
+        {
+            const float* floats = reinterpret_cast<const float*>(layout.data);
+            texel.r = _mm256_i32gather_ps(floats, address, 1);
+            texel.g = _mm256_i32gather_ps(floats + 1, address, 1);
+            texel.b = _mm256_i32gather_ps(floats + 2, address, 1);
+            texel.a = _mm256_i32gather_ps(floats + 3, address, 1);
+            break;
+        }
+        case TextureFormat::R16G16B16A16_Float:
+        {
+            const __m256i low = _mm256_i32gather_epi32(base, address, 1);
+            const __m256i high = _mm256_i32gather_epi32(base + 1, address, 1);
+            const __m256i mask = _mm256_set1_epi32(0xFFFF);
+            texel.r = HalfToFloatLanes(_mm256_and_si256(low, mask));
+            texel.g = HalfToFloatLanes(_mm256_srli_epi32(low, 16));
+            texel.b = HalfToFloatLanes(_mm256_and_si256(high, mask));
+            texel.a = HalfToFloatLanes(_mm256_srli_epi32(high, 16));
+            break;
+        }
+        default:
+        {
+            // One gather reads a whole 8-bit texel
+            const __m256i texels = _mm256_i32gather_epi32(base, address, 1);
+            texel.r = UNorm8Lanes(texels, layout.bgra ? 16 : 0, layout.srgb);
+            texel.g = UNorm8Lanes(texels, 8, layout.srgb);
+            texel.b = UNorm8Lanes(texels, layout.bgra ? 0 : 16, layout.srgb);
+            texel.a = UNorm8Lanes(texels, 24, false);
+            break;
+        }
+        }
+
+        return texel;
+    }
+
+    TexelLanes SampleLevelLanes(const GatherLayout& layout, __m256i subresource, __m256 u, __m256 v, bool linear,
+                                SamplerAddressMode addressMode)
+    {
+        const __m256 width = _mm256_cvtepi32_ps(_mm256_i32gather_epi32(layout.widths, subresource, 4));
+        const __m256 height = _mm256_cvtepi32_ps(_mm256_i32gather_epi32(layout.heights, subresource, 4));
+        const __m256i offset = _mm256_i32gather_epi32(layout.offsets, subresource, 4);
+        const __m256i rowPitch = _mm256_i32gather_epi32(layout.rowPitches, subresource, 4);
+        const __m256i bytesPerTexel = _mm256_set1_epi32(layout.bytesPerTexel);
+
+        // Morton indices are the OR of disjoint x and y bits, so they split into a row and a
+        // column term like linear addresses do
+        const __m256i mortonBits = layout.morton ? _mm256_i32gather_epi32(layout.mortonBits, subresource, 4) : _mm256_setzero_si256();
+        const __m256i mortonMask = _mm256_sub_epi32(_mm256_sllv_epi32(_mm256_set1_epi32(1), mortonBits), _mm256_set1_epi32(1));
+        const __m256i highShift = _mm256_add_epi32(mortonBits, mortonBits);
+
+        auto mortonTerm = [&](__m256i coordinate, int shift)
+        {
+            const __m256i low = SpreadMortonBitsLanes(_mm256_and_si256(coordinate, mortonMask));
+            const __m256i high = _mm256_sllv_epi32(_mm256_srlv_epi32(coordinate, mortonBits), highShift);
+            return _mm256_mullo_epi32(_mm256_or_si256(_mm256_slli_epi32(low, shift), high), bytesPerTexel);
+        };
+
+        auto rowAddress = [&](__m256 y)
+        {
+            const __m256i row = _mm256_cvttps_epi32(AddressLanes(y, height, addressMode));
+            return _mm256_add_epi32(offset, layout.morton ? mortonTerm(row, 1) : _mm256_mullo_epi32(row, rowPitch));
+        };
+
+        auto columnOffset = [&](__m256 x)
+        {
+            const __m256i column = _mm256_cvttps_epi32(AddressLanes(x, width, addressMode));
+            return layout.morton ? mortonTerm(column, 0) : _mm256_mullo_epi32(column, bytesPerTexel);
+        };
+
+        if (!linear)
+        {
+            const __m256 x = _mm256_floor_ps(_mm256_mul_ps(u, width));
+            const __m256 y = _mm256_floor_ps(_mm256_mul_ps(v, height));
+
+            return FetchLanes(layout, _mm256_add_epi32(rowAddress(y), columnOffset(x)));
+        }
+
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 x = _mm256_sub_ps(_mm256_mul_ps(u, width), half);
+        const __m256 y = _mm256_sub_ps(_mm256_mul_ps(v, height), half);
+        const __m256 x0 = _mm256_floor_ps(x);
+        const __m256 y0 = _mm256_floor_ps(y);
+        const __m256 fx = _mm256_sub_ps(x, x0);
+        const __m256 fy = _mm256_sub_ps(y, y0);
+
+        const __m256i row0 = rowAddress(y0);
+        const __m256i row1 = rowAddress(_mm256_add_ps(y0, one));
+        const __m256i column0 = columnOffset(x0);
+        const __m256i column1 = columnOffset(_mm256_add_ps(x0, one));
+
+        const TexelLanes top = LerpLanes(FetchLanes(layout, _mm256_add_epi32(row0, column0)),
+                                         FetchLanes(layout, _mm256_add_epi32(row0, column1)), fx);
+        const TexelLanes bottom = LerpLanes(FetchLanes(layout, _mm256_add_epi32(row1, column0)),
+                                            FetchLanes(layout, _mm256_add_epi32(row1, column1)), fx);
+
+        return LerpLanes(top, bottom, fy);
+    }
+
+    TexelLanes SampleMipsLanes(const GatherLayout& layout, uint32_t mipLevels, SamplerFilter filter, __m256i slice,
+                               __m256 u, __m256 v, __m256 lod, SamplerAddressMode addressMode)
+    {
+        const __m256 maxLod = _mm256_set1_ps(static_cast<float>(mipLevels - 1));
+        const __m256i mips = _mm256_set1_epi32(static_cast<int>(mipLevels));
+        const __m256i firstSubresource = _mm256_mullo_epi32(slice, mips);
+
+        lod = _mm256_min_ps(_mm256_max_ps(lod, _mm256_setzero_ps()), maxLod);
+
+        if (filter != SamplerFilter::Trilinear)
+        {
+            const __m256i mip = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(lod, _mm256_set1_ps(0.5f))));
+
+            return SampleLevelLanes(layout, _mm256_add_epi32(firstSubresource, mip), u, v,
+                                    filter == SamplerFilter::Bilinear, addressMode);
+        }
+
+        const __m256 mip0 = _mm256_floor_ps(lod);
+        const __m256 mip1 = _mm256_min_ps(_mm256_add_ps(mip0, _mm256_set1_ps(1.0f)), maxLod);
+        const __m256 t = _mm256_sub_ps(lod, mip0);
+
+        const TexelLanes sample0 = SampleLevelLanes(layout, _mm256_add_epi32(firstSubresource, _mm256_cvttps_epi32(mip0)),
+                                                    u, v, true, addressMode);
+        const TexelLanes sample1 = SampleLevelLanes(layout, _mm256_add_epi32(firstSubresource, _mm256_cvttps_epi32(mip1)),
+                                                    u, v, true, addressMode);
+
+        return LerpLanes(sample0, sample1, t);
+    }
+
+    void StoreLanes(const TexelLanes& texel, TexelBlock8& result)
+    {
+        _mm256_store_ps(result.r, texel.r);
+        _mm256_store_ps(result.g, texel.g);
+        _mm256_store_ps(result.b, texel.b);
+        _mm256_store_ps(result.a, texel.a);
+    }
+#endif
+}
+
+bool TextureSampler::CanSampleDirectly(TextureFormat format)
+{
+    switch (format)
+    {
+    case TextureFormat::R8G8B8A8_UNorm:
+    case TextureFormat::R8G8B8A8_UNorm_sRGB:
+    case TextureFormat::B8G8R8A8_UNorm:
+    case TextureFormat::B8G8R8A8_UNorm_sRGB:
+    case TextureFormat::R16G16B16A16_Float:
+    case TextureFormat::R32G32B32A32_Float:
+        return true;
+    default:
+        return false;
+    }
+}
+
+TextureSampler::TextureSampler(const DDSFile& texture, const SamplerDesc& desc) : m_desc(desc)
+{
+    const DDSFile* source = &texture;
+
+    if (!CanSampleDirectly(texture.format))
+    {
+        if (!CanDecodeTexels(texture.format))
+        {
+            throw std::runtime_error(std::string("Cannot sample ") + GetTextureFormatName(texture.format) + " textures");
+        }
+
+        m_decoded.Initialize(TextureFormat::R32G32B32A32_Float, texture.width, texture.height, texture.arraySize,
+                             texture.mipLevels, texture.isCubeMap);
+
+        for (uint32_t i = 0; i < texture.GetSubresourceCount(); i++)
+        {
+            const DDSSubresource& subresource = texture.GetSubresource(i);
+
+            // RGBA32F rows are exactly width texels, so the surface is a Texel array
+            DecodeSurface(texture.format, texture.GetSubresourceData(i), subresource.rowPitch, subresource.width,
+                          subresource.height, reinterpret_cast<Texel*>(m_decoded.GetSubresourceData(i)));
+        }
+
+        source = &m_decoded;
+    }
+
+    m_data = source->data.data();
+    m_format = source->format;
+    m_bytesPerTexel = GetBytesPerBlock(m_format);
+    m_mipLevels = source->mipLevels;
+    m_arraySize = source->arraySize;
+    m_srgb = m_format == TextureFormat::R8G8B8A8_UNorm_sRGB || m_format == TextureFormat::B8G8R8A8_UNorm_sRGB;
+    m_bgra = m_format == TextureFormat::B8G8R8A8_UNorm || m_format == TextureFormat::B8G8R8A8_UNorm_sRGB;
+
+    size_t storageSize = source->data.size();
+
+    if (m_desc.layout == TexelLayout::Morton)
+    {
+        // Each surface starts on a cache line
+        storageSize = 0;
+
+        for (const auto& subresource : source->subresources)
+        {
+            storageSize += (GetMortonSurfaceTexels(subresource.width, subresource.height) * m_bytesPerTexel + 63) & ~static_cast<size_t>(63);
+        }
+
+        m_swizzled.resize(storageSize);
+    }
+
+    if (storageSize > static_cast<size_t>((std::numeric_limits<int32_t>::max)()))
+    {
+        throw std::runtime_error("Texture too large for 32-bit gather offsets");
+    }
+
+    size_t swizzledOffset = 0;
+
+    for (const auto& subresource : source->subresources)
+    {
+        m_widths.push_back(static_cast<int32_t>(subresource.width));
+        m_heights.push_back(static_cast<int32_t>(subresource.height));
+        m_mortonBits.push_back(static_cast<int32_t>(GetMortonBits(subresource.width, subresource.height)));
+
+        if (m_desc.layout == TexelLayout::Morton)
+        {
+            SwizzleSurface(m_data + subresource.offset, subresource.rowPitch, subresource.width, subresource.height,
+                           m_bytesPerTexel, m_swizzled.data() + swizzledOffset);
+
+            m_offsets.push_back(static_cast<int32_t>(swizzledOffset));
+            m_rowPitches.push_back(0);
+
+            swizzledOffset += (GetMortonSurfaceTexels(subresource.width, subresource.height) * m_bytesPerTexel + 63) & ~static_cast<size_t>(63);
+        }
+        else
+        {
+            m_offsets.push_back(static_cast<int32_t>(subresource.offset));
+            m_rowPitches.push_back(static_cast<int32_t>(subresource.rowPitch));
+        }
+    }
+
+    if (m_desc.layout == TexelLayout::Morton)
+    {
+        m_data = m_swizzled.data();
+    }
+}
+
+size_t TextureSampler::GetTexelOffset(uint32_t subresource, uint32_t x, uint32_t y) const
+{
+    if (m_desc.layout == TexelLayout::Morton)
+    {
+        return m_offsets[subresource] + static_cast<size_t>(GetMortonIndex(x, y, m_mortonBits[subresource])) * m_bytesPerTexel;
+    }
+
+    return m_offsets[subresource] + static_cast<size_t>(y) * m_rowPitches[subresource] + static_cast<size_t>(x) * m_bytesPerTexel;
+}
+
+Texel TextureSampler::FetchTexel(uint32_t subresource, uint32_t x, uint32_t y) const
+{
+    const uint8_t* bytes = m_data + GetTexelOffset(subresource, x, y);
+    Texel texel;
+
+    switch (m_format)
+    {
+    case TextureFormat::R32G32B32A32_Float:
+        memcpy(&texel, bytes, sizeof(texel));
+        break;
+    case TextureFormat::R16G16B16A16_Float:
+    {
+        uint16_t halves[4];
+        memcpy(halves, bytes, sizeof(halves));
+        texel.r = HalfToFloat(halves[0]);
+        texel.g = HalfToFloat(halves[1]);
+        texel.b = HalfToFloat(halves[2]);
+        texel.a = HalfToFloat(halves[3]);
+        break;
+    }
+    default:
+    {
+        const float* table = GetSRGBTable();
+        const uint8_t r = bytes[m_bgra ? 2 : 0];
+        const uint8_t b = bytes[m_bgra ? 0 : 2];
+        texel.r = m_srgb ? table[r] : r / 255.0f;
+        texel.g = m_srgb ? table[bytes[1]] : bytes[1] / 255.0f;
+        texel.b = m_srgb ? table[b] : b / 255.0f;
+        texel.a = bytes[3] / 255.0f;
+        break;
+    }
+    }
+
+    return texel;
+}
+
+Texel TextureSampler::SampleLevel(uint32_t subresource, float u, float v, bool linear, SamplerAddressMode addressMode) const
+{
+    const float width = static_cast<float>(m_widths[subresource]);
+    const float height = static_cast<float>(m_heights[subresource]);
+
+    if (!linear)
+    {
+        const float x = AddressCoordinate(std::floor(u * width), width, addressMode);
+        const float y = AddressCoordinate(std::floor(v * height), height, addressMode);
+
+        return FetchTexel(subresource, static_cast<uint32_t>(x), static_cast<uint32_t>(y));
+    }
+
+    const float x = u * width - 0.5f;
+    const float y = v * height - 0.5f;
+    const float x0 = std::floor(x);
+    const float y0 = std::floor(y);
+
+    const uint32_t column0 = static_cast<uint32_t>(AddressCoordinate(x0, width, addressMode));
+    const uint32_t column1 = static_cast<uint32_t>(AddressCoordinate(x0 + 1.0f, width, addressMode));
+    const uint32_t row0 = static_cast<uint32_t>(AddressCoordinate(y0, height, addressMode));
+    const uint32_t row1 = static_cast<uint32_t>(AddressCoordinate(y0 + 1.0f, height, addressMode));
+
+    const Texel top = Lerp(FetchTexel(subresource, column0, row0), FetchTexel(subresource, column1, row0), x - x0);
+    const Texel bottom = Lerp(FetchTexel(subresource, column0, row1), FetchTexel(subresource, column1, row1), x - x0);
+
+    return Lerp(top, bottom, y - y0);
+}
+
+Texel TextureSampler::SampleMips(uint32_t slice, float u, float v, float lod, SamplerAddressMode addressMode) const
+{
+    const float maxLod = static_cast<float>(m_mipLevels - 1);
+    const uint32_t firstSubresource = slice * m_mipLevels;
+
+    lod = (std::min)((std::max)(lod, 0.0f), maxLod);
+
+    if (m_desc.filter != SamplerFilter::Trilinear)
+    {
+        const uint32_t mip = static_cast<uint32_t>(std::floor(lod + 0.5f));
+
+        return SampleLevel(firstSubresource + mip, u, v, m_desc.filter == SamplerFilter::Bilinear, addressMode);
+    }
+
+    const float mip0 = std::floor(lod);
+    const float mip1 = (std::min)(mip0 + 1.0f, maxLod);
+
+    return Lerp(SampleLevel(firstSubresource + static_cast<uint32_t>(mip0), u, v, true, addressMode),
+                SampleLevel(firstSubresource + static_cast<uint32_t>(mip1), u, v, true, addressMode), lod - mip0);
+}
+
+Texel TextureSampler::Sample(float u, float v, float lod, uint32_t slice) const
+{
+    return SampleMips(slice, u, v, lod, m_desc.addressMode);
+}
+
+Texel TextureSampler::SampleCube(const float direction[3], float lod, uint32_t cube) const
+{
+    uint32_t face;
+    float u, v;
+    CubeMapImage::GetFaceCoordinates(direction, face, u, v);
+
+    return SampleMips(cube * CubeMapImage::FaceCount + face, u, v, lod, SamplerAddressMode::Clamp);
+}
+
+void TextureSampler::Sample(const float u[8], const float v[8], const float lod[8], TexelBlock8& result, uint32_t slice) const
+{
+#if defined(__AVX2__)
+    const GatherLayout layout = { m_data, m_offsets.data(), m_rowPitches.data(), m_widths.data(), m_heights.data(),
+                                  m_mortonBits.data(), m_format, static_cast<int32_t>(m_bytesPerTexel), m_srgb, m_bgra,
+                                  m_desc.layout == TexelLayout::Morton };
+
+    StoreLanes(SampleMipsLanes(layout, m_mipLevels, m_desc.filter, _mm256_set1_epi32(static_cast<int>(slice)),
+                               _mm256_loadu_ps(u), _mm256_loadu_ps(v), _mm256_loadu_ps(lod), m_desc.addressMode), result);
+#else
+    for (uint32_t i = 0; i < BatchSize; i++)
+    {
+        const Texel texel = Sample(u[i], v[i], lod[i], slice);
+        result.r[i] = texel.r;
+        result.g[i] = texel.g;
+        result.b[i] = texel.b;
+        result.a[i] = texel.a;
+    }
+#endif
+}
+
+void TextureSampler::SampleCube(const float x[8], const float y[8], const float z[8], const float lod[8],
+                                TexelBlock8& result, uint32_t cube) const
+{
+#if defined(__AVX2__)
+    const GatherLayout layout = { m_data, m_offsets.data(), m_rowPitches.data(), m_widths.data(), m_heights.data(),
+                                  m_mortonBits.data(), m_format, static_cast<int32_t>(m_bytesPerTexel), m_srgb, m_bgra,
+                                  m_desc.layout == TexelLayout::Morton };
+
+    const __m256 dx = _mm256_loadu_ps(x);
+    const __m256 dy = _mm256_loadu_ps(y);
+    const __m256 dz = _mm256_loadu_ps(z);
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    const __m256 ax = _mm256_andnot_ps(signMask, dx);
+    const __m256 ay = _mm256_andnot_ps(signMask, dy);
+    const __m256 az = _mm256_andnot_ps(signMask, dz);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    // Same face selection and orientation as CubeMapImage::GetFaceCoordinates
+    const __m256 xMajor = _mm256_and_ps(_mm256_cmp_ps(ax, ay, _CMP_GE_OQ), _mm256_cmp_ps(ax, az, _CMP_GE_OQ));
+    const __m256 yMajor = _mm256_andnot_ps(xMajor, _mm256_cmp_ps(ay, az, _CMP_GE_OQ));
+    const __m256 xPositive = _mm256_cmp_ps(dx, zero, _CMP_GE_OQ);
+    const __m256 yPositive = _mm256_cmp_ps(dy, zero, _CMP_GE_OQ);
+    const __m256 zPositive = _mm256_cmp_ps(dz, zero, _CMP_GE_OQ);
+    const __m256 negativeX = _mm256_xor_ps(dx, signMask);
+    const __m256 negativeY = _mm256_xor_ps(dy, signMask);
+    const __m256 negativeZ = _mm256_xor_ps(dz, signMask);
+
+    __m256 face = _mm256_blendv_ps(_mm256_set1_ps(5.0f), _mm256_set1_ps(4.0f), zPositive);
+    __m256 sc = _mm256_blendv_ps(negativeX, dx, zPositive);
+    __m256 tc = negativeY;
+    __m256 ma = az;
+
+    face = _mm256_blendv_ps(face, _mm256_blendv_ps(_mm256_set1_ps(3.0f), _mm256_set1_ps(2.0f), yPositive), yMajor);
+    sc = _mm256_blendv_ps(sc, dx, yMajor);
+    tc = _mm256_blendv_ps(tc, _mm256_blendv_ps(negativeZ, dz, yPositive), yMajor);
+    ma = _mm256_blendv_ps(ma, ay, yMajor);
+
+    face = _mm256_blendv_ps(face, _mm256_blendv_ps(one, zero, xPositive), xMajor);
+    sc = _mm256_blendv_ps(sc, _mm256_blendv_ps(dz, negativeZ, xPositive), xMajor);
+    ma = _mm256_blendv_ps(ma, ax, xMajor);
+
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 u = _mm256_mul_ps(half, _mm256_add_ps(_mm256_div_ps(sc, ma), one));
+    const __m256 v = _mm256_mul_ps(half, _mm256_add_ps(_mm256_div_ps(tc, ma), one));
+
+    const __m256i slice = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(cube * CubeMapImage::FaceCount)),
+                                           _mm256_cvttps_epi32(face));
+
+    StoreLanes(SampleMipsLanes(layout, m_mipLevels, m_desc.filter, slice, u, v, _mm256_loadu_ps(lod),
+                               SamplerAddressMode::Clamp), result);
+#else
+    for (uint32_t i = 0; i < BatchSize; i++)
+    {
+        const float direction[3] = { x[i], y[i], z[i] };
+        const Texel texel = SampleCube(direction, lod[i], cube);
+        result.r[i] = texel.r;
+        result.g[i] = texel.g;
+        result.b[i] = texel.b;
+        result.a[i] = texel.a;
+    }
+#endif
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "DDSFile.h"
+#include "TexelCodec.h"
+#include "TextureSwizzle.h"
+
+#include <cstdint>
+#include <vector>
+
+enum class SamplerFilter
+{
+    /// MIN_MAG_MIP_POINT
+    Point,
+    /// MIN_MAG_LINEAR_MIP_POINT
+    Bilinear,
+    /// MIN_MAG_MIP_LINEAR
+    Trilinear,
+};
+
+enum class SamplerAddressMode
+{
+    Wrap,
+    Clamp,
+};
+
+struct SamplerDesc
+{
+    SamplerFilter filter = SamplerFilter::Trilinear;
+    /// Used for both U and V of 2D lookups. Cube lookups clamp to the face they hit.
+    SamplerAddressMode addressMode = SamplerAddressMode::Wrap;
+    /// Storage the sampler reads. Morton copies the texels into Z-order at construction,
+    /// which keeps 2D-local lookups in fewer cache lines.
+    TexelLayout layout = TexelLayout::Linear;
+};
+
+/// Eight results of a batched lookup, structure of arrays
+struct TexelBlock8
+{
+    alignas(32) float r[8];
+    alignas(32) float g[8];
+    alignas(32) float b[8];
+    alignas(32) float a[8];
+};
+
+/// CPU equivalent of Texture2D(Array)::SampleLevel and TextureCube::SampleLevel, so
+/// tools can read textures the way the shaders do. Filtering follows the D3D rules
+/// (texel centers at half integers, the nearest mip for point mip filtering) and sRGB
+/// formats are returned linear.
+///
+/// 8-bit RGBA/BGRA, RGBA16F and RGBA32F are read in place from the subresource layout
+/// of DDSFile, which is the layout DDSTextureLoader12 uploads. Other formats
+/// DecodeSurface reads (BC1-BC3) are decoded to RGBA32F once, at construction.
+///
+/// The batched overloads take eight coordinates and compute them in AVX2 lanes: texel
+/// addresses come from gathered per-subresource tables, so every lane may use its own
+/// mip, and texels are fetched with gathers. Builds without AVX2 run the scalar path
+/// per lane. Cube lookups do not filter across face edges. With TexelLayout::Morton the
+/// row and column terms of an address become interleaved bits instead of y * rowPitch
+/// and x * bytesPerTexel, on both paths.
+class TextureSampler
+{
+public:
+    static const uint32_t BatchSize = 8;
+
+    /// Sample a texture that outlives the sampler. Throws std::runtime_error if the format
+    /// cannot be read or the payload does not fit 32-bit gather offsets.
+    TextureSampler(const DDSFile& texture, const SamplerDesc& desc);
+
+    /// Not copyable: decoded textures are read through a pointer into m_decoded
+    TextureSampler(const TextureSampler&) = delete;
+    TextureSampler& operator=(const TextureSampler&) = delete;
+
+    /// Lookup at (u, v) of an array slice, with an explicit mip level like SampleLevel
+    Texel Sample(float u, float v, float lod, uint32_t slice = 0) const;
+
+    /// Lookup in a direction (need not be normalized) of cube `cube` of a cube array
+    Texel SampleCube(const float direction[3], float lod, uint32_t cube = 0) const;
+
+    void Sample(const float u[8], const float v[8], const float lod[8], TexelBlock8& result, uint32_t slice = 0) const;
+
+    void SampleCube(const float x[8], const float y[8], const float z[8], const float lod[8], TexelBlock8& result,
+                    uint32_t cube = 0) const;
+
+    /// True for the formats read in place, without decoding at construction
+    static bool CanSampleDirectly(TextureFormat format);
+
+    uint32_t GetMipLevels() const { return m_mipLevels; }
+
+    /// Byte offset of texel (x, y) of a subresource in the storage the sampler reads, for
+    /// memory access studies
+    size_t GetTexelOffset(uint32_t subresource, uint32_t x, uint32_t y) const;
+
+private:
+    Texel FetchTexel(uint32_t subresource, uint32_t x, uint32_t y) const;
+    Texel SampleLevel(uint32_t subresource, float u, float v, bool linear, SamplerAddressMode addressMode) const;
+    Texel SampleMips(uint32_t slice, float u, float v, float lod, SamplerAddressMode addressMode) const;
+
+    SamplerDesc m_desc;
+    /// Copy in RGBA32F of textures that cannot be read in place
+    DDSFile m_decoded;
+    /// Copy in Morton order, for TexelLayout::Morton
+    std::vector<uint8_t> m_swizzled;
+    const uint8_t* m_data = nullptr;
+    TextureFormat m_format = TextureFormat::Unknown;
+    uint32_t m_bytesPerTexel = 0;
+    uint32_t m_mipLevels = 0;
+    uint32_t m_arraySize = 0;
+    bool m_srgb = false;
+    bool m_bgra = false;
+
+    /// Per subresource, as 32-bit integers for the gathers
+    std::vector<int32_t> m_offsets;
+    std::vector<int32_t> m_rowPitches;
+    std::vector<int32_t> m_widths;
+    std::vector<int32_t> m_heights;
+    std::vector<int32_t> m_mortonBits;
+};
@@ -0,0 +1,459 @@
+#include "TextureStreamer.h"
+
+#include "CompressedTexture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+TextureStreamer::TextureStreamer(const Settings& settings) : m_settings(settings)
+{
+    for (uint32_t i = 0; i < std::max(1u, settings.ioThreads); i++)
+    {
+        m_threads.emplace_back(&TextureStreamer::IoThread, this);
+    }
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+
+    m_requestAvailable.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+uint64_t TextureStreamer::GetResidentSize(const DDSFile& info, uint32_t topMip)
+{
+    uint64_t size = 0;
+
+    for (uint32_t mip = topMip; mip < info.mipLevels; mip++)
+    {
+        size += info.GetSubresource(info.GetSubresourceIndex(mip, 0)).slicePitch;
+    }
+
+    return size * info.arraySize;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Read the mips [firstMip, endMip) of every slice. In a DDS file they are contiguous
+// within a slice, so this is one read per slice.
+//
+TextureResidencyChange TextureStreamer::ReadMips(const std::string& path, const DDSFile& info, uint32_t firstMip, uint32_t endMip)
+{
+    TextureResidencyChange change;
+    change.topMip = firstMip;
+    change.previousTopMip = endMip;
+
+    // The mips of one slice are contiguous in the payload, and so are they in the change
+    std::vector<size_t> sliceOffsets;
+
+    for (uint32_t slice = 0; slice < info.arraySize; slice++)
+    {
+        const DDSSubresource& first = info.GetSubresource(info.GetSubresourceIndex(firstMip, slice));
+        const DDSSubresource& last = info.GetSubresource(info.GetSubresourceIndex(endMip - 1, slice));
+        const size_t sliceBytes = last.offset + last.slicePitch - first.offset;
+
+        for (uint32_t mip = firstMip; mip < endMip; mip++)
+        {
+            DDSSubresource subresource = info.GetSubresource(info.GetSubresourceIndex(mip, slice));
+            subresource.offset = subresource.offset - first.offset + change.data.size();
+            change.subresources.push_back(subresource);
+        }
+
+        sliceOffsets.push_back(change.data.size());
+        change.data.resize(change.data.size() + sliceBytes);
+    }
+
+    if (CompressedTextureFile::IsCompressedTexturePath(path))
+    {
+        // Only the chunks of the requested mips are decoded
+        CompressedTextureFile file;
+        file.Open(path);
+
+        for (uint32_t slice = 0; slice < info.arraySize; slice++)
+        {
+            file.ReadSubresources(info.GetSubresourceIndex(firstMip, slice), endMip - firstMip, change.data.data() + sliceOffsets[slice]);
+        }
+
+        return change;
+    }
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.good())
+    {
+        throw std::runtime_error("Cannot open DDS file " + path);
+    }
+
+    for (uint32_t slice = 0; slice < info.arraySize; slice++)
+    {
+        const size_t sliceEnd = slice + 1 < info.arraySize ? sliceOffsets[slice + 1] : change.data.size();
+
+        file.seekg(static_cast<std::streamoff>(info.payloadOffset + info.GetSubresource(info.GetSubresourceIndex(firstMip, slice)).offset));
+        file.read(reinterpret_cast<char*>(change.data.data() + sliceOffsets[slice]), static_cast<std::streamsize>(sliceEnd - sliceOffsets[slice]));
+
+        if (!file.good())
+        {
+            throw std::runtime_error("DDS file is truncated: " + path);
+        }
+    }
+
+    return change;
+}
+
+TextureResidencyChange TextureStreamer::AddTexture(const std::string& path)
+{
+    StreamedTexture texture;
+    texture.path = path;
+
+    if (CompressedTextureFile::IsCompressedTexturePath(path))
+    {
+        CompressedTextureFile file;
+        file.Open(path);
+        texture.info = file.GetInfo();
+    }
+    else
+    {
+        texture.info.LoadHeader(path);
+    }
+
+    // The tail starts at the first mip that fits in mipTailSize, or is the last mip
+    texture.tailMip = texture.info.mipLevels - 1;
+
+    for (uint32_t mip = 0; mip < texture.info.mipLevels; mip++)
+    {
+        const DDSSubresource& subresource = texture.info.GetSubresource(mip);
+
+        if (subresource.width <= m_settings.mipTailSize && subresource.height <= m_settings.mipTailSize)
+        {
+            texture.tailMip = mip;
+            break;
+        }
+    }
+
+    texture.residentTopMip = texture.tailMip;
+    texture.targetTopMip = texture.tailMip;
+    texture.desiredTopMip = texture.tailMip;
+
+    TextureResidencyChange change = ReadMips(path, texture.info, texture.tailMip, texture.info.mipLevels);
+    change.texture = static_cast<uint32_t>(m_textures.size());
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytesRead += change.data.size();
+    }
+
+    m_textures.push_back(std::move(texture));
+
+    return change;
+}
+
+void TextureStreamer::BeginFrame(const TextureStreamingView& view)
+{
+    m_view = view;
+
+    for (auto& texture : m_textures)
+    {
+        texture.desiredTopMip = texture.tailMip;
+        texture.priority = 0.0f;
+        texture.trimmed = false;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//
+// The object covers about radius * screenHeight / (distance * tan(fov / 2)) pixels on
+// screen, and uvScale * width texels of the texture are spread across it. The desired mip
+// is the one with about one texel per pixel.
+//
+void TextureStreamer::AddUsage(uint32_t texture, const float center[3], float radius, float uvScale)
+{
+    StreamedTexture& streamedTexture = m_textures[texture];
+
+    const float dx = center[0] - m_view.cameraPosition[0];
+    const float dy = center[1] - m_view.cameraPosition[1];
+    const float dz = center[2] - m_view.cameraPosition[2];
+    const float distance = std::max(std::sqrt(dx * dx + dy * dy + dz * dz) - radius, 0.01f);
+
+    const float projectedPixels = radius * m_view.screenHeight / (distance * std::tan(m_view.verticalFov * 0.5f));
+    const float texels = uvScale * std::max(streamedTexture.info.width, streamedTexture.info.height);
+
+    const float mip = std::floor(std::log2(std::max(texels / std::max(projectedPixels, 1.0f), 1.0f)) + m_settings.mipBias);
+    const uint32_t desiredTopMip = std::min(static_cast<uint32_t>(std::max(mip, 0.0f)), streamedTexture.tailMip);
+
+    streamedTexture.desiredTopMip = std::min(streamedTexture.desiredTopMip, desiredTopMip);
+    streamedTexture.priority = std::max(streamedTexture.priority, projectedPixels);
+}
+
+uint64_t TextureStreamer::GetCommittedBytes() const
+{
+    uint64_t bytes = 0;
+
+    for (const auto& texture : m_textures)
+    {
+        bytes += GetResidentSize(texture.info, texture.targetTopMip);
+    }
+
+    return bytes;
+}
+
+//-----------------------------------------------------------------------------
+//
+// Free memory for a load of the given priority. Textures more detailed than they need to
+// be go first, then the least visible ones. Textures with a load in flight are skipped.
+//
+bool TextureStreamer::TrimForBytes(uint64_t bytesNeeded, float priority)
+{
+    auto canTrim = [priority](const StreamedTexture& texture)
+    {
+        if (texture.targetTopMip != texture.residentTopMip || texture.residentTopMip >= texture.tailMip)
+        {
+            return false;
+        }
+
+        return texture.residentTopMip < texture.desiredTopMip || texture.priority < priority;
+    };
+
+    uint64_t committed = GetCommittedBytes();
+
+    if (committed + bytesNeeded <= m_settings.budgetBytes)
+    {
+        return true;
+    }
+
+    // Do not trim anything if the load cannot fit anyway
+    uint64_t trimmable = 0;
+
+    for (const auto& texture : m_textures)
+    {
+        if (canTrim(texture))
+        {
+            trimmable += GetResidentSize(texture.info, texture.residentTopMip) - GetResidentSize(texture.info, texture.tailMip);
+        }
+    }
+
+    if (committed + bytesNeeded > m_settings.budgetBytes + trimmable)
+    {
+        return false;
+    }
+
+    while (committed + bytesNeeded > m_settings.budgetBytes)
+    {
+        StreamedTexture* victim = nullptr;
+        bool victimOverDetailed = false;
+
+        for (auto& texture : m_textures)
+        {
+            if (!canTrim(texture))
+            {
+                continue;
+            }
+
+            const bool overDetailed = texture.residentTopMip < texture.desiredTopMip;
+
+            if (victim == nullptr || (overDetailed && !victimOverDetailed) ||
+                (overDetailed == victimOverDetailed && texture.priority < victim->priority))
+            {
+                victim = &texture;
+                victimOverDetailed = overDetailed;
+            }
+        }
+
+        if (victim == nullptr)
+        {
+            return false;
+        }
+
+        const uint32_t texture = static_cast<uint32_t>(victim - m_textures.data());
+        const uint32_t previousTopMip = victim->residentTopMip;
+        committed -= GetResidentSize(victim->info, previousTopMip) - GetResidentSize(victim->info, previousTopMip + 1);
+
+        victim->residentTopMip++;
+        victim->targetTopMip = victim->residentTopMip;
+        victim->trimmed = true;
+        m_evictionCount++;
+
+        // Merge with an eviction of the same texture decided earlier this frame
+        auto eviction = std::find_if(m_evictions.begin(), m_evictions.end(),
+                                     [texture](const TextureResidencyChange& change) { return change.texture == texture; });
+
+        if (eviction == m_evictions.end())
+        {
+            TextureResidencyChange change;
+            change.texture = texture;
+            change.previousTopMip = previousTopMip;
+            change.topMip = victim->residentTopMip;
+            m_evictions.push_back(std::move(change));
+        }
+        else
+        {
+            eviction->topMip = victim->residentTopMip;
+        }
+    }
+
+    return true;
+}
+
+void TextureStreamer::Update()
+{
+    std::vector<uint32_t> candidates;
+
+    for (uint32_t i = 0; i < m_textures.size(); i++)
+    {
+        const StreamedTexture& texture = m_textures[i];
+
+        if (texture.desiredTopMip < texture.residentTopMip && texture.targetTopMip == texture.residentTopMip)
+        {
+            candidates.push_back(i);
+        }
+    }
+
+    std::sort(candidates.begin(), candidates.end(),
+              [this](uint32_t a, uint32_t b) { return m_textures[a].priority > m_textures[b].priority; });
+
+    std::vector<LoadRequest> requests;
+
+    for (uint32_t index : candidates)
+    {
+        StreamedTexture& texture = m_textures[index];
+
+        if (texture.trimmed)
+        {
+            continue;
+        }
+
+        // Try the desired mip first, then settle for less detail if the budget is short
+        for (uint32_t topMip = texture.desiredTopMip; topMip < texture.residentTopMip; topMip++)
+        {
+            const uint64_t bytesNeeded = GetResidentSize(texture.info, topMip) - GetResidentSize(texture.info, texture.residentTopMip);
+
+            if (TrimForBytes(bytesNeeded, texture.priority))
+            {
+                texture.targetTopMip = topMip;
+                requests.push_back({ index, topMip, texture.residentTopMip, texture.path, texture.info });
+                break;
+            }
+        }
+    }
+
+    if (!requests.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto& request : requests)
+        {
+            m_requests.push_back(std::move(request));
+            m_loadsInFlight++;
+        }
+    }
+
+    m_requestAvailable.notify_all();
+}
+
+void TextureStreamer::IoThread()
+{
+    for (;;)
+    {
+        LoadRequest request;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_requestAvailable.wait(lock, [this] { return m_exit || !m_requests.empty(); });
+
+            if (m_exit)
+            {
+                return;
+            }
+
+            request = std::move(m_requests.front());
+            m_requests.pop_front();
+        }
+
+        LoadResult result;
+
+        try
+        {
+            result.change = ReadMips(request.path, request.info, request.firstMip, request.endMip);
+        }
+        catch (const std::exception&)
+        {
+            // Leave the data empty; the texture keeps its current mips and may be retried
+            result.change.data.clear();
+        }
+
+        result.change.texture = request.texture;
+        result.request = std::move(request);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bytesRead += result.change.data.size();
+        m_results.push_back(std::move(result));
+    }
+}
+
+std::vector<TextureResidencyChange> TextureStreamer::TakeResidencyChanges()
+{
+    std::vector<TextureResidencyChange> changes = std::move(m_evictions);
+    m_evictions.clear();
+
+    std::vector<LoadResult> results;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        results.swap(m_results);
+        m_loadsInFlight -= static_cast<uint32_t>(results.size());
+        m_loadsCompleted += results.size();
+    }
+
+    for (auto& result : results)
+    {
+        StreamedTexture& texture = m_textures[result.request.texture];
+
+        if (result.change.data.empty())
+        {
+            texture.targetTopMip = texture.residentTopMip;
+            continue;
+        }
+
+        texture.residentTopMip = result.request.firstMip;
+        changes.push_back(std::move(result.change));
+    }
+
+    return changes;
+}
+
+TextureStreamerStats TextureStreamer::GetStats() const
+{
+    TextureStreamerStats stats;
+    stats.budgetBytes = m_settings.budgetBytes;
+    stats.textureCount = static_cast<uint32_t>(m_textures.size());
+    stats.evictions = m_evictionCount;
+
+    for (const auto& texture : m_textures)
+    {
+        const uint64_t residentBytes = GetResidentSize(texture.info, texture.residentTopMip);
+        stats.residentBytes += residentBytes;
+        stats.pendingBytes += GetResidentSize(texture.info, texture.targetTopMip) - residentBytes;
+        stats.desiredBytes += GetResidentSize(texture.info, texture.desiredTopMip);
+
+        if (texture.residentTopMip <= texture.desiredTopMip)
+        {
+            stats.texturesAtDesiredMip++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats.bytesRead = m_bytesRead;
+    stats.loadsInFlight = m_loadsInFlight;
+    stats.loadsCompleted = m_loadsCompleted;
+
+    return stats;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "DDSFile.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Camera parameters used to turn instance distances into projected texel densities
+struct TextureStreamingView
+{
+    float cameraPosition[3] = {};
+    /// Vertical field of view, in radians
+    float verticalFov = 0.785398f;
+    uint32_t screenHeight = 720;
+};
+
+/// Change of the resident mip range of a texture, returned by TakeResidencyChanges.
+/// Mips [topMip, mipLevels) are resident after the change. When mips were loaded, data
+/// holds the mips [topMip, previousTopMip) of every slice, laid out as in a DDS file
+/// (all loaded mips of slice 0, then slice 1...); evictions carry no data.
+struct TextureResidencyChange
+{
+    uint32_t texture = 0;
+    uint32_t previousTopMip = 0;
+    uint32_t topMip = 0;
+
+    std::vector<uint8_t> data;
+    /// Layout of data, indexed by (mip - topMip) + slice * (previousTopMip - topMip)
+    std::vector<DDSSubresource> subresources;
+};
+
+/// Counters exposed to size the budget per deployment
+struct TextureStreamerStats
+{
+    uint64_t budgetBytes = 0;
+    uint64_t residentBytes = 0;
+    /// Bytes of loads issued but not yet returned by TakeResidencyChanges
+    uint64_t pendingBytes = 0;
+    /// Bytes that would be resident if every texture was at its desired mip
+    uint64_t desiredBytes = 0;
+    uint64_t bytesRead = 0;
+    uint32_t textureCount = 0;
+    uint32_t texturesAtDesiredMip = 0;
+    uint32_t loadsInFlight = 0;
+    uint64_t loadsCompleted = 0;
+    uint64_t evictions = 0;
+};
+
+/// Mip-level texture streaming with a residency budget.
+///
+/// Textures start with only their mip tail resident (the mips no larger than
+/// Settings::mipTailSize). Every frame the application reports where each texture is
+/// used, as a bounding sphere and a UV density. From these the streamer derives the
+/// desired mip of each texture, and requests the missing mips by priority, largest screen
+/// coverage first. Reads are done by background threads straight from the DDS files, or
+/// from .ctex files (CompressedTexture) with one chunk decoded per requested mip.
+/// When the resident and pending bytes would exceed the budget, the least important
+/// textures are trimmed, one mip at a time, never below their mip tail.
+///
+/// The streamer only tracks residency; the application owns the GPU resources and
+/// applies the changes returned by TakeResidencyChanges.
+class TextureStreamer
+{
+public:
+    struct Settings
+    {
+        uint64_t budgetBytes = 64ull * 1024 * 1024;
+        /// Mips whose width and height are both at most this size form the mip tail
+        uint32_t mipTailSize = 128;
+        /// Added to the desired mip, positive values trade sharpness for memory
+        float mipBias = 0.0f;
+        uint32_t ioThreads = 2;
+    };
+
+    explicit TextureStreamer(const Settings& settings);
+    ~TextureStreamer();
+
+    TextureStreamer(const TextureStreamer&) = delete;
+    TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+    /// Register a DDS or .ctex file and read its mip tail synchronously. The returned change holds
+    /// the tail (previousTopMip is mipLevels), so the texture can be created right away.
+    TextureResidencyChange AddTexture(const std::string& path);
+
+    /// Description of a registered texture, without data
+    const DDSFile& GetTextureInfo(uint32_t texture) const { return m_textures[texture].info; }
+    uint32_t GetResidentTopMip(uint32_t texture) const { return m_textures[texture].residentTopMip; }
+
+    /// Start collecting usages for a new frame
+    void BeginFrame(const TextureStreamingView& view);
+
+    /// Report that a texture is visible on an object bounded by the given sphere. uvScale
+    /// is the number of times the texture repeats across the object.
+    void AddUsage(uint32_t texture, const float center[3], float radius, float uvScale);
+
+    /// Compute desired mips, trim textures to fit the budget and issue new loads
+    void Update();
+
+    /// Collect the evictions decided by Update and the loads completed by the IO threads,
+    /// in the order they must be applied
+    std::vector<TextureResidencyChange> TakeResidencyChanges();
+
+    TextureStreamerStats GetStats() const;
+
+    /// Bytes of the mips [topMip, mipLevels) of a texture, all slices
+    static uint64_t GetResidentSize(const DDSFile& info, uint32_t topMip);
+
+private:
+    struct StreamedTexture
+    {
+        std::string path;
+        DDSFile info;
+        uint32_t tailMip = 0;
+        /// Most detailed mip the application has been told about
+        uint32_t residentTopMip = 0;
+        /// Most detailed mip once the in-flight load completes, equal to residentTopMip
+        /// when nothing is in flight
+        uint32_t targetTopMip = 0;
+        uint32_t desiredTopMip = 0;
+        /// Largest projected size of the texture this frame, in pixels
+        float priority = 0.0f;
+        /// Set when Update trimmed the texture, so it is not reloaded in the same frame
+        bool trimmed = false;
+    };
+
+    // Requests carry their own copy of the texture description, so IO threads never
+    // touch m_textures while AddTexture may grow it
+    struct LoadRequest
+    {
+        uint32_t texture;
+        uint32_t firstMip;
+        uint32_t endMip;
+        std::string path;
+        DDSFile info;
+    };
+
+    struct LoadResult
+    {
+        LoadRequest request;
+        TextureResidencyChange change;
+    };
+
+    void IoThread();
+    static TextureResidencyChange ReadMips(const std::string& path, const DDSFile& info, uint32_t firstMip, uint32_t endMip);
+    uint64_t GetCommittedBytes() const;
+    bool TrimForBytes(uint64_t bytesNeeded, float priority);
+
+    Settings m_settings;
+    std::vector<StreamedTexture> m_textures;
+    TextureStreamingView m_view;
+
+    std::vector<TextureResidencyChange> m_evictions;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_requestAvailable;
+    std::deque<LoadRequest> m_requests;
+    std::vector<LoadResult> m_results;
+    std::vector<std::thread> m_threads;
+    bool m_exit = false;
+
+    uint64_t m_bytesRead = 0;
+    uint32_t m_loadsInFlight = 0;
+    uint64_t m_loadsCompleted = 0;
+    uint64_t m_evictionCount = 0;
+};
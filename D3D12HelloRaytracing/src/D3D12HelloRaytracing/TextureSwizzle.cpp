@@ -0,0 +1,63 @@
+#include "TextureSwizzle.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    uint32_t CeilLog2(uint32_t value)
+    {
+        uint32_t bits = 0;
+
+        while ((1u << bits) < value)
+        {
+            bits++;
+        }
+
+        return bits;
+    }
+}
+
+uint32_t GetMortonBits(uint32_t width, uint32_t height)
+{
+    return (std::min)(CeilLog2(width), CeilLog2(height));
+}
+
+size_t GetMortonSurfaceTexels(uint32_t width, uint32_t height)
+{
+    return (static_cast<size_t>(1) << CeilLog2(width)) << CeilLog2(height);
+}
+
+void SwizzleSurface(const uint8_t* source, size_t rowPitch, uint32_t width, uint32_t height,
+                    uint32_t bytesPerTexel, uint8_t* destination)
+{
+    const uint32_t mortonBits = GetMortonBits(width, height);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t* row = source + y * rowPitch;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            memcpy(destination + static_cast<size_t>(GetMortonIndex(x, y, mortonBits)) * bytesPerTexel,
+                   row + static_cast<size_t>(x) * bytesPerTexel, bytesPerTexel);
+        }
+    }
+}
+
+void UnswizzleSurface(const uint8_t* source, uint32_t width, uint32_t height, uint32_t bytesPerTexel,
+                      uint8_t* destination, size_t rowPitch)
+{
+    const uint32_t mortonBits = GetMortonBits(width, height);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint8_t* row = destination + y * rowPitch;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            memcpy(row + static_cast<size_t>(x) * bytesPerTexel,
+                   source + static_cast<size_t>(GetMortonIndex(x, y, mortonBits)) * bytesPerTexel, bytesPerTexel);
+        }
+    }
+}
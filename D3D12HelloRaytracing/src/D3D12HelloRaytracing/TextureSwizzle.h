@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Order of the texels of a surface in CPU memory
+enum class TexelLayout
+{
+    /// Row after row with a row pitch, as FillInitData and DDSFile store them
+    Linear,
+    /// Z-order: the bits of x and y interleaved, so the texels of any aligned 2^n x 2^n
+    /// square are contiguous and a bilinear footprint usually sits in one cache line
+    Morton,
+};
+
+/// Morton surfaces are padded to power-of-two width and height. The low GetMortonBits
+/// bits of x and y are interleaved; the remaining high bits of the longer side select
+/// square blocks laid out one after another.
+uint32_t GetMortonBits(uint32_t width, uint32_t height);
+
+/// Texels in the padded Morton surface
+size_t GetMortonSurfaceTexels(uint32_t width, uint32_t height);
+
+inline uint32_t SpreadMortonBits(uint32_t value)
+{
+    value &= 0x0000FFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+inline uint32_t GetMortonIndex(uint32_t x, uint32_t y, uint32_t mortonBits)
+{
+    const uint32_t mask = (1u << mortonBits) - 1;
+
+    return SpreadMortonBits(x & mask) | (SpreadMortonBits(y & mask) << 1) | (((x | y) >> mortonBits) << (mortonBits * 2));
+}
+
+/// Copy a linear surface to Morton order. destination holds GetMortonSurfaceTexels texels;
+/// the padding is left untouched.
+void SwizzleSurface(const uint8_t* source, size_t rowPitch, uint32_t width, uint32_t height,
+                    uint32_t bytesPerTexel, uint8_t* destination);
+
+/// Copy a Morton surface back to linear rows
+void UnswizzleSurface(const uint8_t* source, uint32_t width, uint32_t height, uint32_t bytesPerTexel,
+                      uint8_t* destination, size_t rowPitch);
@@ -0,0 +1,149 @@
+#include "TextureUploadPlanner.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    uint64_t AlignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+uint32_t TextureUploadPlanner::AddTexture(const TextureUploadDesc& desc, uint32_t firstMip, uint32_t mipCount)
+{
+    if (desc.width == 0 || desc.height == 0 || desc.arraySize == 0 || desc.mipLevels == 0)
+    {
+        throw std::logic_error("Empty texture upload");
+    }
+
+    const uint32_t textureIndex = static_cast<uint32_t>(m_textures.size());
+    m_textures.push_back(desc);
+
+    const uint32_t endMip = firstMip + std::min(mipCount, desc.mipLevels - std::min(firstMip, desc.mipLevels));
+
+    for (uint32_t slice = 0; slice < desc.arraySize; slice++)
+    {
+        uint32_t width = desc.width;
+        uint32_t height = desc.height;
+
+        for (uint32_t mip = 0; mip < endMip; mip++)
+        {
+            if (mip < firstMip)
+            {
+                width = std::max(1u, width >> 1);
+                height = std::max(1u, height >> 1);
+                continue;
+            }
+
+            size_t rowBytes = 0;
+            uint32_t numRows = 0;
+            GetSurfaceInfo(desc.format, width, height, &rowBytes, &numRows, nullptr);
+
+            TextureUploadCopy copy;
+            copy.texture = textureIndex;
+            copy.subresource = mip + slice * desc.mipLevels;
+            copy.offset = AlignUp(m_arenaSize, PlacementAlignment);
+            copy.rowPitch = static_cast<uint32_t>(AlignUp(rowBytes, RowPitchAlignment));
+            copy.width = width;
+            copy.height = height;
+            copy.numRows = numRows;
+            copy.rowBytes = rowBytes;
+
+            m_arenaSize = GetFootprintEnd(copy);
+            m_copies.push_back(copy);
+
+            width = std::max(1u, width >> 1);
+            height = std::max(1u, height >> 1);
+        }
+    }
+
+    return textureIndex;
+}
+
+uint32_t TextureUploadPlanner::AddTexture(const TextureUploadDesc& desc, const std::vector<TextureUploadCopy>& footprints)
+{
+    const uint32_t textureIndex = static_cast<uint32_t>(m_textures.size());
+    m_textures.push_back(desc);
+
+    // The footprints keep their relative placement, so only the base needs aligning
+    const uint64_t base = AlignUp(m_arenaSize, PlacementAlignment);
+
+    for (const auto& footprint : footprints)
+    {
+        TextureUploadCopy copy = footprint;
+        copy.texture = textureIndex;
+        copy.offset += base;
+
+        m_arenaSize = std::max(m_arenaSize, GetFootprintEnd(copy));
+        m_copies.push_back(copy);
+    }
+
+    return textureIndex;
+}
+
+void TextureUploadPlanner::WriteSubresource(uint8_t* arena, const TextureUploadCopy& copy,
+                                            const uint8_t* source, size_t sourceRowPitch, size_t sourceSlicePitch)
+{
+    uint8_t* destination = arena + copy.offset;
+
+    for (uint32_t slice = 0; slice < copy.depth; slice++)
+    {
+        const uint8_t* sourceSlice = source + slice * sourceSlicePitch;
+        uint8_t* destinationSlice = destination + static_cast<size_t>(slice) * copy.numRows * copy.rowPitch;
+
+        for (uint32_t row = 0; row < copy.numRows; row++)
+        {
+            memcpy(destinationSlice + static_cast<size_t>(row) * copy.rowPitch, sourceSlice + row * sourceRowPitch, static_cast<size_t>(copy.rowBytes));
+        }
+    }
+}
+
+void TextureUploadPlanner::Validate() const
+{
+    uint64_t previousEnd = 0;
+
+    for (const auto& copy : m_copies)
+    {
+        const std::string name = "texture " + std::to_string(copy.texture) + " subresource " + std::to_string(copy.subresource);
+
+        if (copy.offset % PlacementAlignment != 0)
+        {
+            throw std::logic_error(name + ": footprint offset is not 512-byte aligned");
+        }
+
+        if (copy.rowPitch % RowPitchAlignment != 0 || copy.rowPitch < copy.rowBytes)
+        {
+            throw std::logic_error(name + ": invalid row pitch");
+        }
+
+        if (copy.offset < previousEnd)
+        {
+            throw std::logic_error(name + ": footprint overlaps the previous one");
+        }
+
+        previousEnd = GetFootprintEnd(copy);
+
+        if (previousEnd > m_arenaSize)
+        {
+            throw std::logic_error(name + ": footprint exceeds the arena");
+        }
+    }
+}
+
+uint64_t TextureUploadPlanner::GetFootprintEnd(const TextureUploadCopy& copy)
+{
+    // Like GetCopyableFootprints, the last row only needs its texel bytes
+    const uint64_t rowCount = static_cast<uint64_t>(copy.numRows) * copy.depth;
+    return copy.offset + copy.rowPitch * (rowCount - 1) + copy.rowBytes;
+}
+
+void TextureUploadPlanner::Reset()
+{
+    m_textures.clear();
+    m_copies.clear();
+    m_arenaSize = 0;
+}
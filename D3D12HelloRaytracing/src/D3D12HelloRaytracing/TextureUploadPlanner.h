@@ -0,0 +1,95 @@
+#pragma once
+
+#include "DDSFile.h"
+
+#include <cstdint>
+#include <vector>
+
+/// Description of a texture to upload; mirrors the fields of D3D12_RESOURCE_DESC the
+/// copyable footprint depends on
+struct TextureUploadDesc
+{
+    TextureFormat format = TextureFormat::Unknown;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t arraySize = 1;
+    uint32_t mipLevels = 1;
+};
+
+/// One buffer-to-texture copy, equivalent to a D3D12_PLACED_SUBRESOURCE_FOOTPRINT in the
+/// staging arena plus the subresource it targets
+struct TextureUploadCopy
+{
+    /// Index returned by TextureUploadPlanner::AddTexture
+    uint32_t texture = 0;
+    /// D3D12 subresource index, mip + slice * mipLevels
+    uint32_t subresource = 0;
+
+    /// Offset of the footprint in the arena, a multiple of PlacementAlignment
+    uint64_t offset = 0;
+    /// Row pitch of the footprint, a multiple of RowPitchAlignment
+    uint32_t rowPitch = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// Number of depth slices, above 1 only for volume textures
+    uint32_t depth = 1;
+    /// Number of rows to copy per depth slice: texel rows, or rows of 4x4 blocks for BC formats
+    uint32_t numRows = 0;
+    /// Bytes of texel data in one row, without the pitch padding
+    uint64_t rowBytes = 0;
+};
+
+/// Packs the subresources of any number of textures into a single linear staging arena,
+/// following the rules of ID3D12Device::GetCopyableFootprints: every footprint starts at
+/// a 512-byte boundary and every row at a 256-byte boundary, and the last row of a
+/// footprint is not padded. The resulting copy list can be recorded as
+/// CopyTextureRegion calls and submitted at once, instead of one round trip per texture.
+///
+/// The planner does not depend on D3D12 so that the layout can be checked on the CPU.
+class TextureUploadPlanner
+{
+public:
+    /// D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+    static const uint32_t RowPitchAlignment = 256;
+    /// D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+    static const uint32_t PlacementAlignment = 512;
+
+    /// Append the footprints of the subresources of a texture to the arena and return the
+    /// index of the texture in the copy list. Only the mips [firstMip, firstMip + mipCount)
+    /// of each slice are planned, so partially updated textures can share the arena; a
+    /// mipCount of 0 registers the texture without any copy.
+    uint32_t AddTexture(const TextureUploadDesc& desc, uint32_t firstMip = 0, uint32_t mipCount = UINT32_MAX);
+
+    /// Append footprints computed elsewhere, e.g. by GetCopyableFootprints for a format
+    /// the planner has no size rules for. Offsets are relative to the first footprint and
+    /// are moved into the arena; the texture index of each copy is filled in.
+    uint32_t AddTexture(const TextureUploadDesc& desc, const std::vector<TextureUploadCopy>& footprints);
+
+    /// Total size of the staging buffer, including alignment padding
+    uint64_t GetArenaSize() const { return m_arenaSize; }
+
+    /// Copies in submission order, grouped by texture and sorted by subresource index
+    const std::vector<TextureUploadCopy>& GetCopies() const { return m_copies; }
+
+    uint32_t GetTextureCount() const { return static_cast<uint32_t>(m_textures.size()); }
+    const TextureUploadDesc& GetTexture(uint32_t index) const { return m_textures[index]; }
+
+    /// Copy the rows of one subresource into its footprint in the mapped arena.
+    /// sourceSlicePitch is only read for footprints with a depth above 1.
+    static void WriteSubresource(uint8_t* arena, const TextureUploadCopy& copy,
+                                 const uint8_t* source, size_t sourceRowPitch, size_t sourceSlicePitch = 0);
+
+    /// Check every footprint against the alignment rules and for overlaps. Throws
+    /// std::logic_error describing the first violation.
+    void Validate() const;
+
+    /// Forget all textures, so the planner can be reused for the next batch
+    void Reset();
+
+private:
+    static uint64_t GetFootprintEnd(const TextureUploadCopy& copy);
+
+    std::vector<TextureUploadDesc> m_textures;
+    std::vector<TextureUploadCopy> m_copies;
+    uint64_t m_arenaSize = 0;
+};
@@ -185,9 +185,15 @@ void BottomLevelASGenerator::Generate(
         *resultBuffer, // Result buffer storing the acceleration structure
     bool updateOnly,   // If true, simply refit the existing
                        // acceleration structure
-    ID3D12Resource *previousResult // Optional previous acceleration
-                                   // structure, used if an iterative update
-                                   // is requested
+    ID3D12Resource *previousResult, // Optional previous acceleration
+                                    // structure, used if an iterative update
+                                    // is requested
+    UINT64 scratchOffsetInBytes,    // Offset of the scratch space in
+                                    // scratchBuffer
+    bool barrierOnResult,           // If false, the caller records the
+                                    // barriers
+    UINT64 resultOffsetInBytes      // Offset of the structure in
+                                    // resultBuffer
 ) {
 
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = m_flags;
@@ -225,11 +231,15 @@ void BottomLevelASGenerator::Generate(
   buildDesc.Inputs.NumDescs = static_cast<UINT>(m_vertexBuffers.size());
   buildDesc.Inputs.pGeometryDescs = m_vertexBuffers.data();
   buildDesc.DestAccelerationStructureData = {
-      resultBuffer->GetGPUVirtualAddress()};
+      resultBuffer->GetGPUVirtualAddress() + resultOffsetInBytes};
   buildDesc.ScratchAccelerationStructureData = {
-      scratchBuffer->GetGPUVirtualAddress()};
+      scratchBuffer->GetGPUVirtualAddress() + scratchOffsetInBytes};
   buildDesc.SourceAccelerationStructureData =
       previousResult ? previousResult->GetGPUVirtualAddress() : 0;
+  // In-place updates of a suballocated structure
+  if (previousResult == resultBuffer) {
+    buildDesc.SourceAccelerationStructureData += resultOffsetInBytes;
+  }
   buildDesc.Inputs.Flags = flags;
 
   // Build the AS
@@ -239,6 +249,9 @@ void BottomLevelASGenerator::Generate(
   // buffer. This is particularly important as the construction of the top-level
   // hierarchy may be called right afterwards, before executing the command
   // list.
+  if (!barrierOnResult) {
+    return;
+  }
   D3D12_RESOURCE_BARRIER uavBarrier;
   uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
   uavBarrier.UAV.pResource = resultBuffer;
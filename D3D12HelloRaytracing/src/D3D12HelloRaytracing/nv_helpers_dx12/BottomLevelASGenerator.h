@@ -150,8 +150,17 @@ public:
                                      /// store temporary data
       ID3D12Resource* resultBuffer,  /// Result buffer storing the acceleration structure
       bool updateOnly = false,       /// If true, simply refit the existing acceleration structure
-      ID3D12Resource* previousResult = nullptr /// Optional previous acceleration structure, used
-                                               /// if an iterative update is requested
+      ID3D12Resource* previousResult = nullptr, /// Optional previous acceleration structure, used
+                                                /// if an iterative update is requested
+      UINT64 scratchOffsetInBytes = 0, /// Offset of the scratch space in scratchBuffer, when
+                                       /// several builds share one buffer. Must be a multiple
+                                       /// of 256
+      bool barrierOnResult = true, /// If false, no UAV barrier is recorded after the build,
+                                   /// so that independent builds can overlap; the caller
+                                   /// then records the barriers itself
+      UINT64 resultOffsetInBytes = 0 /// Offset of the structure in resultBuffer, when it is
+                                     /// suballocated from a pool. Must be a multiple of 256.
+                                     /// Also applies to previousResult if it is resultBuffer
   );
 
 private:
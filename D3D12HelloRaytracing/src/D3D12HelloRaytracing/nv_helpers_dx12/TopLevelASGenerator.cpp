@@ -70,12 +70,15 @@ void TopLevelASGenerator::AddInstance(
                                         // positions
     UINT instanceID,                    // Instance ID, which can be used in the shaders to
                                         // identify this specific instance
-    UINT hitGroupIndex                  // Hit group index, corresponding the the index of the
+    UINT hitGroupIndex,                 // Hit group index, corresponding the the index of the
                                         // hit group in the Shader Binding Table that will be
                                         // invocated upon hitting the geometry
+    UINT64 bottomLevelASOffsetInBytes /*= 0*/ // Offset of the bottom-level AS in its buffer,
+                                              // when it is suballocated from a pool
 )
 {
-  m_instances.emplace_back(Instance(bottomLevelAS, transform, instanceID, hitGroupIndex));
+  m_instances.emplace_back(
+      Instance(bottomLevelAS, transform, instanceID, hitGroupIndex, bottomLevelASOffsetInBytes));
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -155,65 +158,82 @@ void TopLevelASGenerator::Generate(
                                        // descriptors, has to be in upload heap
     bool updateOnly /*= false*/,       // If true, simply refit the existing
                                        // acceleration structure
-    ID3D12Resource* previousResult /*= nullptr*/ // Optional previous acceleration
-                                                 // structure, used if an iterative update
-                                                 // is requested
+    ID3D12Resource* previousResult /*= nullptr*/, // Optional previous acceleration
+                                                  // structure, used if an iterative update
+                                                  // is requested
+    InstanceDescWriter* descWriter /*= nullptr*/  // Optional writer of the instance descriptors
 )
 {
-  // Copy the descriptors in the target descriptor buffer
-  D3D12_RAYTRACING_INSTANCE_DESC* instanceDescs;
-  descriptorsBuffer->Map(0, nullptr, reinterpret_cast<void**>(&instanceDescs));
-  if (!instanceDescs)
+  // Map the descriptors buffer once and keep it mapped, which upload heaps allow. A
+  // new buffer holds none of the previous descriptors, so all of them are written
+  bool writeAll = false;
+  if (descriptorsBuffer != m_descriptorsBuffer.Get())
   {
-    throw std::logic_error("Cannot map the instance descriptor buffer - is it "
-                           "in the upload heap?");
+    if (m_descriptorsBuffer)
+    {
+      m_descriptorsBuffer->Unmap(0, nullptr);
+      m_descriptorsBuffer.Reset();
+      m_mappedDescriptors = nullptr;
+    }
+
+    descriptorsBuffer->Map(0, nullptr, reinterpret_cast<void**>(&m_mappedDescriptors));
+    if (!m_mappedDescriptors)
+    {
+      throw std::logic_error("Cannot map the instance descriptor buffer - is it "
+                             "in the upload heap?");
+    }
+
+    m_descriptorsBuffer = descriptorsBuffer;
+    writeAll = true;
   }
 
   auto instanceCount = static_cast<UINT>(m_instances.size());
 
-  // Initialize the memory to zero on the first time only
-  if (!updateOnly)
+  if (descWriter)
   {
-    ZeroMemory(instanceDescs, m_instanceDescsSizeInBytes);
+    descWriter->Write(m_instances, m_mappedDescriptors, writeAll);
   }
-
-  // Create the description for each instance
-  for (uint32_t i = 0; i < instanceCount; i++)
+  else
   {
-    // Instance ID visible in the shader in InstanceID()
-    instanceDescs[i].InstanceID = m_instances[i].instanceID;
-    // Index of the hit group invoked upon intersection
-    instanceDescs[i].InstanceContributionToHitGroupIndex = m_instances[i].hitGroupIndex;
-    // Instance flags, including backface culling, winding, etc - TODO: should
-    // be accessible from outside
-    instanceDescs[i].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
-    // Instance transform matrix
-    DirectX::XMMATRIX m = XMMatrixTranspose(
-        m_instances[i].transform); // GLM is column major, the INSTANCE_DESC is row major
-    memcpy(instanceDescs[i].Transform, &m, sizeof(instanceDescs[i].Transform));
-    // Get access to the bottom level
-    instanceDescs[i].AccelerationStructure = m_instances[i].bottomLevelAS->GetGPUVirtualAddress();
-    // Visibility mask, always visible here - TODO: should be accessible from
-    // outside
-    instanceDescs[i].InstanceMask = 0xFF;
+    // Create the description for each instance. Every field is written, so the
+    // buffer does not need to be zeroed first
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+      // Instance ID visible in the shader in InstanceID()
+      m_mappedDescriptors[i].InstanceID = m_instances[i].instanceID;
+      // Index of the hit group invoked upon intersection
+      m_mappedDescriptors[i].InstanceContributionToHitGroupIndex = m_instances[i].hitGroupIndex;
+      // Instance flags, including backface culling, winding, etc - TODO: should
+      // be accessible from outside
+      m_mappedDescriptors[i].Flags = D3D12_RAYTRACING_INSTANCE_FLAG_NONE;
+      // Instance transform matrix
+      DirectX::XMMATRIX m = XMMatrixTranspose(
+          m_instances[i].transform); // GLM is column major, the INSTANCE_DESC is row major
+      memcpy(m_mappedDescriptors[i].Transform, &m, sizeof(m_mappedDescriptors[i].Transform));
+      // Get access to the bottom level
+      m_mappedDescriptors[i].AccelerationStructure =
+          m_instances[i].bottomLevelAS->GetGPUVirtualAddress() + m_instances[i].bottomLevelASOffset;
+      // Visibility mask, always visible here - TODO: should be accessible from
+      // outside
+      m_mappedDescriptors[i].InstanceMask = 0xFF;
+    }
   }
 
-  descriptorsBuffer->Unmap(0, nullptr);
-
   // If this in an update operation we need to provide the source buffer
   D3D12_GPU_VIRTUAL_ADDRESS pSourceAS = updateOnly ? previousResult->GetGPUVirtualAddress() : 0;
 
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS flags = m_flags;
   // The stored flags represent whether the AS has been built for updates or
   // not. If yes and an update is requested, the builder is told to only update
-  // the AS instead of fully rebuilding it
-  if (flags == D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE && updateOnly)
+  // the AS instead of fully rebuilding it. An update has to keep the flags of the
+  // original build, ALLOW_UPDATE included, so that later updates can start from it
+  if ((flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) && updateOnly)
   {
-    flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+    flags = m_flags | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
   }
 
   // Sanity checks
-  if (m_flags != D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE && updateOnly)
+  if (!(m_flags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE) && updateOnly)
   {
     throw std::logic_error("Cannot update a top-level AS not originally built for updates");
   }
@@ -253,8 +273,9 @@ void TopLevelASGenerator::Generate(
 //
 //
 TopLevelASGenerator::Instance::Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID,
-                                        UINT hgId)
-    : bottomLevelAS(blAS), transform(tr), instanceID(iID), hitGroupIndex(hgId)
+                                        UINT hgId, UINT64 blASOffset)
+    : bottomLevelAS(blAS), bottomLevelASOffset(blASOffset), transform(tr), instanceID(iID),
+      hitGroupIndex(hgId)
 {
 }
 } // namespace nv_helpers_dx12
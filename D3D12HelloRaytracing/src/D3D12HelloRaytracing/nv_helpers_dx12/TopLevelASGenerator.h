@@ -73,6 +73,7 @@ return buffers;
 #include <DirectXMath.h>
 
 #include <vector>
+#include <wrl/client.h>
 
 namespace nv_helpers_dx12
 {
@@ -81,6 +82,38 @@ namespace nv_helpers_dx12
 class TopLevelASGenerator
 {
 public:
+  /// Helper struct storing the instance data
+  struct Instance
+  {
+    Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID, UINT hgId, UINT64 blASOffset);
+    /// Bottom-level AS
+    ID3D12Resource* bottomLevelAS;
+    /// Offset of the bottom-level AS in its buffer
+    UINT64 bottomLevelASOffset;
+    /// Transform matrix
+    const DirectX::XMMATRIX& transform;
+    /// Instance ID visible in the shader
+    UINT instanceID;
+    /// Hit group index used to fetch the shaders from the SBT
+    UINT hitGroupIndex;
+  };
+
+  /// Application-provided writer of the instance descriptors, letting Generate skip the
+  /// instances that did not change and use a faster way to write them
+  class InstanceDescWriter
+  {
+  public:
+    virtual ~InstanceDescWriter() = default;
+
+    /// Write the descriptors of the instances into the mapped descriptors buffer, one per
+    /// instance. If writeAll is false the buffer still holds what the previous call
+    /// wrote, and only the descriptors that changed need to be written
+    virtual void Write(const std::vector<Instance>& instances, /// Instances of the top-level AS
+                       D3D12_RAYTRACING_INSTANCE_DESC* descs, /// Mapped descriptors buffer
+                       bool writeAll /// True if the buffer holds none of the previous descriptors
+                       ) = 0;
+  };
+
   /// Add an instance to the top-level acceleration structure. The instance is
   /// represented by a bottom-level AS, a transform, an instance ID and the
   /// index of the hit group indicating which shaders are executed upon hitting
@@ -93,9 +126,12 @@ public:
                                                   /// at several world-space positions
               UINT instanceID,   /// Instance ID, which can be used in the shaders to
                                  /// identify this specific instance
-              UINT hitGroupIndex /// Hit group index, corresponding the the index of the
-                                 /// hit group in the Shader Binding Table that will be
-                                 /// invocated upon hitting the geometry
+              UINT hitGroupIndex, /// Hit group index, corresponding the the index of the
+                                  /// hit group in the Shader Binding Table that will be
+                                  /// invocated upon hitting the geometry
+              UINT64 bottomLevelASOffsetInBytes = 0 /// Offset of the bottom-level AS in its
+                                                    /// buffer, when it is suballocated from a
+                                                    /// pool. Must be a multiple of 256
   );
 
   /// Compute the size of the scratch space required to build the acceleration
@@ -119,6 +155,9 @@ public:
   /// acceleration structure in case of iterative updates. Note that the update
   /// can be done in place: the result and previousResult pointers can be the
   /// same.
+  /// The descriptors buffer stays mapped between calls. Every descriptor is written,
+  /// unless a descriptor writer is given, which can then skip the instances that did
+  /// not change since the previous call.
   void Generate(
       ID3D12GraphicsCommandList4* commandList, /// Command list on which the build will be enqueued
       ID3D12Resource* scratchBuffer,     /// Scratch buffer used by the builder to
@@ -127,25 +166,12 @@ public:
       ID3D12Resource* descriptorsBuffer, /// Auxiliary result buffer containing the instance
                                          /// descriptors, has to be in upload heap
       bool updateOnly = false, /// If true, simply refit the existing acceleration structure
-      ID3D12Resource* previousResult = nullptr /// Optional previous acceleration structure, used
-                                               /// if an iterative update is requested
+      ID3D12Resource* previousResult = nullptr, /// Optional previous acceleration structure, used
+                                                /// if an iterative update is requested
+      InstanceDescWriter* descWriter = nullptr  /// Optional writer of the instance descriptors
   );
 
 private:
-  /// Helper struct storing the instance data
-  struct Instance
-  {
-    Instance(ID3D12Resource* blAS, const DirectX::XMMATRIX& tr, UINT iID, UINT hgId);
-    /// Bottom-level AS
-    ID3D12Resource* bottomLevelAS;
-    /// Transform matrix
-    const DirectX::XMMATRIX& transform;
-    /// Instance ID visible in the shader
-    UINT instanceID;
-    /// Hit group index used to fetch the shaders from the SBT
-    UINT hitGroupIndex;
-  };
-
   /// Construction flags, indicating whether the AS supports iterative updates
   D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS m_flags;
   /// Instances contained in the top-level AS
@@ -157,5 +183,9 @@ private:
   UINT64 m_instanceDescsSizeInBytes;
   /// Size of the buffer containing the TLAS
   UINT64 m_resultSizeInBytes;
+
+  /// Descriptors buffer the last Generate wrote, kept mapped
+  Microsoft::WRL::ComPtr<ID3D12Resource> m_descriptorsBuffer;
+  D3D12_RAYTRACING_INSTANCE_DESC* m_mappedDescriptors = nullptr;
 };
 } // namespace nv_helpers_dx12